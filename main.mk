@@ -164,6 +164,10 @@ website:
 test: hwish
 	./hwish $(TOP)/tests/all.tcl
 
+bench: hwish
+	`test -n "$$DISPLAY" || echo xvfb-run -a` ./hwish \
+	    $(TOP)/tests/bench.tcl -output bench.json $(BENCHFLAGS)
+
 #-----------------------------------------------------------------------
 # Target to build the groff version of the widget manpage.
 #
@@ -83,6 +83,25 @@ static const char rcsid[] = "$Id: css.c,v 1.139 2007/12/16 11:57:43 danielk1977
 #define TRACE_PARSER_CALLS 0
 
 static int cssParse(HtmlTree*,int,CONST char*,int,int,Tcl_Obj*,Tcl_Obj*,Tcl_Obj*,Tcl_Obj*,CssStyleSheet**);
+static void selectorCompile(HtmlTree *, CssSelector *);
+static void parseSortRules(CssParse *);
+
+/*
+ * Return layer iLayer of stylesheet configuration pStyle. Layer 0 is 
+ * pStyle itself. Layers 1 to pStyle->nLayer are the shared stylesheets
+ * stored in pStyle->apLayer[].
+ *
+ * Each stylesheet document added to a configuration is assigned a
+ * sequence number (from CssStyleSheet.iNextSeq). For a shared layer it
+ * is stored in CssStyleSheet.aLayerSeq[], and for rules parsed into 
+ * layer 0 in CssRule.iSeq. If two rules from different layers have the
+ * same priority, the one added later wins (see ruleMergeBefore()).
+ * styleSheetLayerSeq() returns -1 for layer 0.
+ */
+#define styleSheetLayer(pStyle, iLayer) \
+    ((iLayer) == 0 ? (pStyle) : (pStyle)->apLayer[(iLayer) - 1])
+#define styleSheetLayerSeq(pStyle, iLayer) \
+    ((iLayer) == 0 ? -1 : (pStyle)->aLayerSeq[(iLayer) - 1])
 
 /*
  *---------------------------------------------------------------------------
@@ -1996,6 +2015,7 @@ static void selectorFree(pSelector)
 {
     if( !pSelector ) return;
     selectorFree(pSelector->pNext);
+    HtmlFree(pSelector->pProgram);
     HtmlFree(pSelector->zValue);
     HtmlFree(pSelector->zAttr);
     HtmlFree(pSelector);
@@ -2205,6 +2225,7 @@ pTree, n, z, isStyle, origin, pStyleId, pImportCmd, pUrlCmd, pErrorVar, ppStyle)
     } else {
         sParse.pStyle = *ppStyle;
     }
+    sParse.iSeq = sParse.pStyle->iNextSeq++;
 
     /* If this is a stylesheet, not a style attribute, add the priority
      * entries for both regular and "!important" properties for this
@@ -2225,6 +2246,8 @@ pTree, n, z, isStyle, origin, pStyleId, pImportCmd, pUrlCmd, pErrorVar, ppStyle)
         HtmlCssRunParser(z, n, &sParse);
     }
 
+    /* Sort the rule lists modified by the parse into priority order */
+    parseSortRules(&sParse);
     *ppStyle = sParse.pStyle;
 
     /* Clean up anything left in sParse */
@@ -2253,6 +2276,368 @@ HtmlCssSelectorParse(pTree, n, z, ppStyle)
     return cssParse(pTree, n, z, 0, 0, 0, 0, 0, 0, ppStyle);
 }
 
+/*
+ * Maximum number of unused agent stylesheets retained per interpreter.
+ * See "Shared stylesheets" below.
+ */
+#define CSS_MAX_RETAINED_STYLE 4
+
+/*
+ * Shared stylesheets.
+ *
+ * Parsing a stylesheet depends on nothing but the stylesheet text and id,
+ * the -mode option of the widget and the set of available font families
+ * (the same for all widgets in an interpreter), unless an -importcmd or
+ * -urlcmd script is supplied to transform @import directives and url()
+ * values, or an -errorvar variable to report syntax errors to. 
+ *
+ * Stylesheets added without any of these options (including the default
+ * stylesheet loaded from the -defaultstyle option each time a widget is
+ * created or reset) are parsed once per interpreter and shared by every
+ * widget that loads them. Each is stored in the 
+ * HtmlInterpData.aSharedStyle hash table, keyed by a hash of its text, 
+ * id and mode, and is reference counted. A widget's configuration 
+ * (HtmlTree.pStyle) stores pointers to the shared stylesheets it uses in
+ * CssStyleSheet.apLayer[], and contains the rules of any other 
+ * stylesheets itself. Shared stylesheets are never modified once they
+ * have been parsed.
+ *
+ * Up to CSS_MAX_RETAINED_STYLE default stylesheets (those loaded from
+ * the -defaultstyle option by doLoadDefaultStyle(), not other sheets 
+ * with origin "agent") are retained by the interpreter even when no 
+ * widget is using them, until the interpreter is deleted. So 
+ * applications that create and destroy widgets frequently only pay to 
+ * parse the default stylesheet when the first widget is created. Other
+ * shared stylesheets are freed from an idle callback once they are no
+ * longer in use.
+ *
+ * Since the priority of a rule depends only on its own stylesheet id, 
+ * specificity and position (see ruleCompare()), the cascade treats the
+ * rules of all layers as if they belonged to a single stylesheet.
+ */
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * styleSheetHash --
+ *
+ *     Return the hash used to identify the shared stylesheet parsed from
+ *     text zText (nText bytes) with stylesheet-id zId and mode eMode.
+ *
+ * Results:
+ *     Hash value.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static unsigned int
+styleSheetHash(zText, nText, zId, eMode)
+    const char *zText;
+    int nText;
+    const char *zId;
+    int eMode;
+{
+    /* FNV-1a */
+    unsigned int h = 2166136261U ^ (unsigned int)eMode;
+    const unsigned char *z;
+    int ii;
+    for (z = (const unsigned char *)zId; *z; z++) {
+        h = (h ^ *z) * 16777619U;
+    }
+    z = (const unsigned char *)zText;
+    for (ii = 0; ii < nText; ii++) {
+        h = (h ^ z[ii]) * 16777619U;
+    }
+    return h;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlCssSharedStyleSweep --
+ *
+ *     Free all shared stylesheets in the HtmlInterpData.aSharedStyle 
+ *     table of p that are not currently in use by any widget. Unless
+ *     isAll is true, retained stylesheets (see above) are not freed.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     Cancels any pending sharedStyleSweepCb() idle callback.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+sharedStyleSweepCb(clientData)
+    ClientData clientData;
+{
+    HtmlInterpData *p = (HtmlInterpData *)clientData;
+    p->isStyleSweep = 0;
+    HtmlCssSharedStyleSweep(p, 0);
+}
+
+void
+HtmlCssSharedStyleSweep(p, isAll)
+    HtmlInterpData *p;
+    int isAll;
+{
+    Tcl_HashSearch search;
+    Tcl_HashEntry *pEntry;
+
+    if (p->isStyleSweep) {
+        Tcl_CancelIdleCall(sharedStyleSweepCb, (ClientData)p);
+        p->isStyleSweep = 0;
+    }
+
+    for (
+        pEntry = Tcl_FirstHashEntry(&p->aSharedStyle, &search); 
+        pEntry; 
+        pEntry = Tcl_NextHashEntry(&search)
+    ) {
+        CssStyleSheet *pHead = (CssStyleSheet *)Tcl_GetHashValue(pEntry);
+        CssStyleSheet **pp = &pHead;
+        while (*pp) {
+            CssStyleSheet *pShared = *pp;
+            if (pShared->nRef == 0 && (isAll || !pShared->isRetained)) {
+                *pp = pShared->pNextShared;
+                if (pShared->isRetained) {
+                    p->nRetainedStyle--;
+                }
+                HtmlCssStyleSheetFree(pShared);
+            } else {
+                pp = &pShared->pNextShared;
+            }
+        }
+        if (pHead) {
+            Tcl_SetHashValue(pEntry, pHead);
+        } else {
+            Tcl_DeleteHashEntry(pEntry);
+        }
+    }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlCssSharedStyleStats --
+ *
+ *         widget _stylestats
+ *
+ *     Return a list of the form {parsed N shared N retained N}. The
+ *     "parsed" value is the total number of shared stylesheets parsed
+ *     by the interpreter so far. "shared" and "retained" are the number
+ *     of shared stylesheets currently in the HtmlInterpData.aSharedStyle
+ *     table, and the number of those that are retained. This is used by
+ *     the regression tests to check that stylesheets are really shared.
+ *
+ * Results:
+ *     TCL_OK.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+int
+HtmlCssSharedStyleStats(clientData, interp, objc, objv)
+    ClientData clientData;             /* The HTML widget data structure */
+    Tcl_Interp *interp;                /* Current interpreter. */
+    int objc;                          /* Number of arguments. */
+    Tcl_Obj *CONST objv[];             /* Argument strings. */
+{
+    HtmlTree *pTree = (HtmlTree *)clientData;
+    HtmlInterpData *p = pTree->pInterpData;
+    Tcl_HashSearch search;
+    Tcl_HashEntry *pEntry;
+    int nShared = 0;
+    char zRes[128];
+
+    for (
+        pEntry = Tcl_FirstHashEntry(&p->aSharedStyle, &search); 
+        pEntry; 
+        pEntry = Tcl_NextHashEntry(&search)
+    ) {
+        CssStyleSheet *pShared = (CssStyleSheet *)Tcl_GetHashValue(pEntry);
+        for ( ; pShared; pShared = pShared->pNextShared) {
+            nShared++;
+        }
+    }
+
+    sprintf(zRes, "parsed %d shared %d retained %d", 
+        p->nStyleParse, nShared, p->nRetainedStyle
+    );
+    Tcl_SetResult(interp, zRes, TCL_VOLATILE);
+    return TCL_OK;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * styleSheetRelease --
+ *
+ *     Decrement the reference count of shared stylesheet pShared. If it
+ *     drops to zero and the stylesheet is not retained, schedule an idle 
+ *     callback to free it. The stylesheet is not freed immediately, so 
+ *     that a stylesheet reloaded after [$html reset] (which releases the
+ *     old stylesheet configuration before the new one is loaded) does 
+ *     not need to be parsed again.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     May schedule a call to HtmlCssSharedStyleSweep().
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+styleSheetRelease(pShared)
+    CssStyleSheet *pShared;
+{
+    pShared->nRef--;
+    assert(pShared->nRef >= 0);
+    if (pShared->nRef == 0 && !pShared->isRetained && 
+        !pShared->pInterpData->isStyleSweep
+    ) {
+        HtmlInterpData *p = pShared->pInterpData;
+        p->isStyleSweep = 1;
+        Tcl_DoWhenIdle(sharedStyleSweepCb, (ClientData)p);
+    }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * styleSheetShared --
+ *
+ *     Return the shared stylesheet for text pStyleText and id pId, 
+ *     parsing it if it is not already present in the 
+ *     HtmlInterpData.aSharedStyle table of pTree.
+ *
+ *     Arguments origin and pStyleId are the parsed form of pId (see
+ *     HtmlStyleParse()).
+ *
+ * Results:
+ *     Pointer to shared stylesheet. The caller must increment
+ *     CssStyleSheet.nRef.
+ *
+ * Side effects:
+ *     May parse a new stylesheet and add it to the table.
+ *
+ *---------------------------------------------------------------------------
+ */
+static CssStyleSheet *
+styleSheetShared(pTree, pStyleText, pId, origin, pStyleId)
+    HtmlTree *pTree;
+    Tcl_Obj *pStyleText;
+    Tcl_Obj *pId;
+    int origin;
+    Tcl_Obj *pStyleId;
+{
+    Tcl_HashTable *pCache = &pTree->pInterpData->aSharedStyle;
+    int eMode = pTree->options.mode;
+    const char *zId = Tcl_GetString(pId);
+    const char *zText;
+    int nText;
+
+    unsigned int iHash;
+    Tcl_HashEntry *pEntry;
+    CssStyleSheet *pShared;
+    int isNew;
+
+    zText = Tcl_GetStringFromObj(pStyleText, &nText);
+    iHash = styleSheetHash(zText, nText, zId, eMode);
+    pEntry = Tcl_CreateHashEntry(pCache, (char *)((size_t) iHash), &isNew);
+
+    pShared = (isNew ? 0 : (CssStyleSheet *)Tcl_GetHashValue(pEntry));
+    for ( ; pShared; pShared = pShared->pNextShared) {
+        int n;
+        const char *z = Tcl_GetStringFromObj(pShared->pText, &n);
+        if (pShared->eMode == eMode && n == nText && 
+            0 == strcmp(zId, Tcl_GetString(pShared->pId)) &&
+            0 == memcmp(z, zText, n)
+        ) {
+            return pShared;
+        }
+    }
+
+    cssParse(pTree, nText, zText, 0, origin, pStyleId, 0, 0, 0, &pShared);
+    pTree->pInterpData->nStyleParse++;
+    pShared->iHash = iHash;
+    pShared->eMode = eMode;
+    pShared->pText = pStyleText;
+    Tcl_IncrRefCount(pStyleText);
+    pShared->pId = pId;
+    Tcl_IncrRefCount(pId);
+    pShared->pInterpData = pTree->pInterpData;
+    if (pStyleText == pTree->options.defaultstyle && 
+        pTree->pInterpData->nRetainedStyle < CSS_MAX_RETAINED_STYLE
+    ) {
+        pShared->isRetained = 1;
+        pTree->pInterpData->nRetainedStyle++;
+    }
+    pShared->pNextShared = 
+        (isNew ? 0 : (CssStyleSheet *)Tcl_GetHashValue(pEntry));
+    Tcl_SetHashValue(pEntry, pShared);
+
+    return pShared;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * styleSheetAddLayer --
+ *
+ *     Add shared stylesheet pShared to the stylesheet configuration of
+ *     widget pTree, if it is not already part of it. Either way, it is
+ *     assigned a new sequence number, so that its rules take precedence
+ *     over those of stylesheets added earlier.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     May create pTree->pStyle. Increments pShared->nRef.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+styleSheetAddLayer(pTree, pShared)
+    HtmlTree *pTree;
+    CssStyleSheet *pShared;
+{
+    CssStyleSheet *pStyle = pTree->pStyle;
+    int ii;
+
+    if (!pStyle) {
+        pStyle = HtmlNew(CssStyleSheet);
+        Tcl_InitHashTable(&pStyle->aByTag, TCL_STRING_KEYS);
+        Tcl_InitHashTable(&pStyle->aByClass, TCL_STRING_KEYS);
+        Tcl_InitHashTable(&pStyle->aById, TCL_STRING_KEYS);
+        pTree->pStyle = pStyle;
+    }
+
+    for (ii = 0; ii < pStyle->nLayer; ii++) {
+        if (pStyle->apLayer[ii] == pShared) {
+            pStyle->aLayerSeq[ii] = pStyle->iNextSeq++;
+            return;
+        }
+    }
+
+    pStyle->apLayer = (CssStyleSheet **)HtmlRealloc("CssStyleSheet.apLayer",
+        pStyle->apLayer, (pStyle->nLayer + 1) * sizeof(CssStyleSheet *)
+    );
+    pStyle->aLayerSeq = (int *)HtmlRealloc("CssStyleSheet.aLayerSeq",
+        pStyle->aLayerSeq, (pStyle->nLayer + 1) * sizeof(int)
+    );
+    pStyle->aLayerSeq[pStyle->nLayer] = pStyle->iNextSeq++;
+    pStyle->apLayer[pStyle->nLayer++] = pShared;
+    pShared->nRef++;
+}
+
 /*
  *---------------------------------------------------------------------------
  *
@@ -2305,12 +2690,23 @@ HtmlStyleParse(pTree, pStyleText, pId, pImportCmd, pUrlCmd, pErrorVar)
     }
     Tcl_IncrRefCount(pStyleId);
 
+    /* If the stylesheet does not depend on any script callbacks, use a
+     * shared copy (see "Shared stylesheets" above).
+     */
+    if (!pImportCmd && !pUrlCmd && !pErrorVar) {
+        CssStyleSheet *pShared;
+        pShared = styleSheetShared(pTree, pStyleText, pId, origin, pStyleId);
+        styleSheetAddLayer(pTree, pShared);
+        Tcl_DecrRefCount(pStyleId);
+        return TCL_OK;
+    }
+
     /* If there is already a stylesheet in pTree->pStyle, then this call will
      * parse the stylesheet text in pStyleText and append rules to the
      * existing stylesheet. If pTree->pStyle is NULL, then a new stylesheet is
      * created. Within Tkhtml, each document only ever has a single stylesheet
-     * object, possibly created by combining text from multiple stylesheet
-     * documents.
+     * configuration object, containing the rules of the stylesheet
+     * documents that are not shared.
      */
     zStyleText = Tcl_GetStringFromObj(pStyleText, &nStyleText);
     cssParse(
@@ -2449,6 +2845,16 @@ HtmlCssStyleSheetFree(pStyle)
 {
     if (pStyle) {
         CssPriority *pPriority;
+        int ii;
+
+        /* Release the shared stylesheet layers */
+        for (ii = 0; ii < pStyle->nLayer; ii++) {
+            styleSheetRelease(pStyle->apLayer[ii]);
+        }
+        HtmlFree(pStyle->apLayer);
+        HtmlFree(pStyle->aLayerSeq);
+        if (pStyle->pText) Tcl_DecrRefCount(pStyle->pText);
+        if (pStyle->pId) Tcl_DecrRefCount(pStyle->pId);
 
         /* Free the universal rules list */
         freeRulesList(&pStyle->pUniversalRules); 
@@ -2473,10 +2879,15 @@ HtmlCssStyleSheetFree(pStyle)
 
 /*
 ** Return the number of syntax errors that occured while parsing the
-** style-sheet.
+** style-sheet (including any shared stylesheet layers).
 */
 int HtmlCssStyleSheetSyntaxErrs(CssStyleSheet *pStyle){
-    return pStyle->nSyntaxErr;
+    int nErr = 0;
+    int ii;
+    for (ii = 0; ii <= pStyle->nLayer; ii++) {
+        nErr += styleSheetLayer(pStyle, ii)->nSyntaxErr;
+    }
+    return nErr;
 }
 
 /*--------------------------------------------------------------------------
@@ -2642,6 +3053,20 @@ void HtmlCssSelector(pParse, stype, pAttr, pValue)
         (stype == CSS_PSEUDOCLASS_FOCUS)                  ||
         (stype == CSS_PSEUDOCLASS_ACTIVE)
     ) ? 1 : 0;
+
+    /* A selector that can distinguish between two elements with the same
+     * tag, attributes and (equivalent) parent prevents an element it
+     * is tested against from sharing its computed style with other
+     * elements. See HtmlCssStyleSheetApply().
+     */
+    pSelector->isNoShare = (
+        (pSelector->pNext && pSelector->pNext->isNoShare) ||
+        (stype == CSS_PSEUDOCLASS_FIRSTCHILD)             ||
+        (stype == CSS_PSEUDOCLASS_LASTCHILD)              ||
+        (stype == CSS_PSEUDOCLASS_LINK)                   ||
+        (stype == CSS_PSEUDOCLASS_VISITED)                ||
+        (stype == CSS_SELECTORCHAIN_ADJACENT)
+    ) ? 1 : 0;
     pParse->pSelector = pSelector;
     dequote(pSelector->zValue);
 
@@ -2711,82 +3136,626 @@ ruleCompare(CssRule *pLeft, CssRule *pRight) {
     return res;
 }
 
+/*
+ * Rules are added to the lists of a stylesheet in two steps. As each rule
+ * is parsed, insertRule() prepends it to the list it belongs in. Once the
+ * whole document has been parsed, parseSortRules() sorts each list that
+ * was modified using a merge-sort. This is O(N*log(N)) in the number of
+ * rules, where inserting each rule into the sorted list as it was parsed
+ * was O(N*N).
+ *
+ * If two rules have the same priority, the one that was added later 
+ * must occur first in the list. Since new rules are prepended to the 
+ * list and the sort is stable, this is always the case.
+ */
 static void
 insertRule(ppList, pRule) 
     CssRule **ppList;
     CssRule *pRule;
 {
-    if (!*ppList || ruleCompare(*ppList, pRule) <= 0) {
-        /* If the default list is currently empty, or the rule being
-         * added has higher priority than the first rule in the list,
-         * our rule becomes the new head of the list.
-         */
-        pRule->pNext = *ppList;
-        *ppList = pRule;
-    } else {
-        /* Otherwise insert the new rule into the list, ordered by
-         * priority. If there exists another rule with the same
-         * priority, then this rule is inserted into the list *before*
-         * it. This is because when rules are of equal priority, the
-         * latter specified wins.
-         */
-        CssRule *pR = *ppList;
-        while (pR->pNext && ruleCompare(pR->pNext, pRule)>0 ) {
-            pR = pR->pNext;
+    pRule->pNext = *ppList;
+    *ppList = pRule;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * ruleListMerge --
+ *
+ *     Merge the two sorted rule lists pLeft and pRight. If a rule from
+ *     pLeft has the same priority as a rule from pRight, the rule from 
+ *     pLeft is placed first in the output.
+ *
+ * Results:
+ *     Pointer to the merged list.
+ *
+ * Side effects:
+ *     Modifies CssRule.pNext pointers.
+ *
+ *---------------------------------------------------------------------------
+ */
+static CssRule *
+ruleListMerge(pLeft, pRight)
+    CssRule *pLeft;
+    CssRule *pRight;
+{
+    CssRule *pRet = 0;
+    CssRule **ppTail = &pRet;
+
+    while (pLeft && pRight) {
+        if (ruleCompare(pLeft, pRight) >= 0) {
+            *ppTail = pLeft;
+            ppTail = &pLeft->pNext;
+            pLeft = pLeft->pNext;
+        } else {
+            *ppTail = pRight;
+            ppTail = &pRight->pNext;
+            pRight = pRight->pNext;
         }
-        pRule->pNext = pR->pNext;
-        pR->pNext = pRule;
     }
+    *ppTail = (pLeft ? pLeft : pRight);
+
+    return pRet;
 }
 
 /*
  *---------------------------------------------------------------------------
  *
- * cssSelectorPropertySetPair --
- *
- *     A rule has just been parsed with selector pSelector and properties
- *     pPropertySet. This function creates a CssRule object to link the two
- *     together and inserts the new rule into the CssStyleSheet structure.
+ * ruleListSort --
  *
- *     The caller should not free resources associated with pSelector or
- *     pPropertySet after this function returns, they are now linked into
- *     the stylesheet object.
+ *     Sort the rule list pList in order of priority, highest first. The
+ *     sort is stable.
  *
  * Results:
- *     None.
+ *     Pointer to the sorted list.
  *
  * Side effects:
- *     None.
+ *     Modifies CssRule.pNext pointers.
  *
  *---------------------------------------------------------------------------
  */
-#define FREE_SELECTOR    0x00000001
-#define FREE_PROPERTYSET 0x00000002
-#define FREE_BOTH        0x00000003
-static void 
-cssSelectorPropertySetPair(pParse, pSelector, pPropertySet, freeWhat)
-    CssParse *pParse;
-    CssSelector *pSelector;
-    CssPropertySet *pPropertySet;
-    unsigned int freeWhat;
+static CssRule *
+ruleListSort(pList)
+    CssRule *pList;
 {
-    int spec = 0;
-    CssSelector *pS = 0;
-    CssStyleSheet *pStyle = pParse->pStyle;
-    CssRule *pRule = HtmlNew(CssRule);
-
-    assert(pPropertySet && pPropertySet->n > 0);
+    /* Each non-NULL entry aSub[ii] is a sorted list of 2^ii rules. All 
+     * rules in aSub[ii] occur in pList before those in aSub[ii-1].
+     */
+    CssRule *aSub[32];
+    CssRule *pRet = 0;
+    int ii;
 
-    if (freeWhat & FREE_PROPERTYSET) {
-        pRule->freePropertySets = 1;
+    memset(aSub, 0, sizeof(aSub));
+    while (pList) {
+        CssRule *p = pList;
+        pList = p->pNext;
+        p->pNext = 0;
+        for (ii = 0; ii < 31 && aSub[ii]; ii++) {
+            p = ruleListMerge(aSub[ii], p);
+            aSub[ii] = 0;
+        }
+        aSub[ii] = ruleListMerge(aSub[ii], p);
     }
-    if (freeWhat & FREE_SELECTOR) {
-        pRule->freeSelector = 1;
+
+    for (ii = 0; ii < 32; ii++) {
+        pRet = ruleListMerge(aSub[ii], pRet);
     }
+    return pRet;
+}
 
-    /* Calculate the specificity of the rules. We use the following
-     * formala:
-     *
+/*
+ *---------------------------------------------------------------------------
+ *
+ * parseMarkDirty --
+ *
+ *     Hash entry pEntry of one of the aByTag, aByClass or aById tables
+ *     is about to have a rule from the stylesheet being parsed prepended 
+ *     to its list. Add it to the CssParse.apDirty[] array, if it is not
+ *     already present. Argument pList is the current value of the entry,
+ *     or NULL for a new entry.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     May grow CssParse.apDirty[].
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+parseMarkDirty(pParse, pEntry, pList)
+    CssParse *pParse;
+    Tcl_HashEntry *pEntry;
+    CssRule *pList;
+{
+    /* If the rule at the head of the list is from this stylesheet, the 
+     * entry is already in apDirty[].
+     */
+    if (pList && pList->pPriority && (
+        pList->pPriority == pParse->pPriority1 || 
+        pList->pPriority == pParse->pPriority2
+    )) {
+        return;
+    }
+
+    if (pParse->nDirty == pParse->nDirtyAlloc) {
+        pParse->nDirtyAlloc = pParse->nDirtyAlloc * 2 + 16;
+        pParse->apDirty = (Tcl_HashEntry **)HtmlRealloc("CssParse.apDirty",
+            pParse->apDirty, pParse->nDirtyAlloc * sizeof(Tcl_HashEntry *)
+        );
+    }
+    pParse->apDirty[pParse->nDirty++] = pEntry;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * parseSortRules --
+ *
+ *     Sort each rule list of stylesheet pParse->pStyle that was modified
+ *     while parsing the current stylesheet document. See insertRule().
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     Frees CssParse.apDirty[].
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+parseSortRules(pParse)
+    CssParse *pParse;
+{
+    CssStyleSheet *pStyle = pParse->pStyle;
+    int ii;
+
+    for (ii = 0; ii < pParse->nDirty; ii++) {
+        Tcl_HashEntry *pEntry = pParse->apDirty[ii];
+        CssRule *pList = (CssRule *)Tcl_GetHashValue(pEntry);
+        Tcl_SetHashValue(pEntry, ruleListSort(pList));
+    }
+    if (pParse->isDirty) {
+        pStyle->pUniversalRules = ruleListSort(pStyle->pUniversalRules);
+        pStyle->pBeforeRules = ruleListSort(pStyle->pBeforeRules);
+        pStyle->pAfterRules = ruleListSort(pStyle->pAfterRules);
+    }
+
+    HtmlFree(pParse->apDirty);
+    pParse->apDirty = 0;
+    pParse->nDirty = 0;
+    pParse->nDirtyAlloc = 0;
+    pParse->isDirty = 0;
+}
+
+/*
+ * Ancestor filter.
+ *
+ * While HtmlStyleApply() walks the document tree, a counting Bloom filter
+ * containing hashes of the tag name, id and classes of each ancestor of
+ * the node currently being styled is maintained. Each CssRule stores
+ * the hashes of up to CSS_MAX_ANCESTOR_HASH tags, ids and classes that
+ * must be present on some ancestor of a node for the rule's selector to 
+ * match (i.e. those that appear to the left of a descendant or child
+ * combinator). If any of these is definitely not present in the filter,
+ * the rule cannot match and HtmlCssSelectorTest() is not called.
+ *
+ * Each hash sets two counters in CssAncestorFilter.aCount[] - one selected
+ * by the low 12 bits of the hash, and the other by the next 12. Counters
+ * that reach 255 are never decremented, so the filter may become less 
+ * selective but never reports a false negative.
+ *
+ * The hashes added for each ancestor are also pushed onto the aHash[]
+ * stack, so that exactly the same values are removed when the ancestor
+ * is popped, regardless of any changes made to the node in the meantime.
+ */
+#define CSS_ANCESTOR_FILTER_BITS 12
+#define CSS_ANCESTOR_FILTER_SIZE (1 << CSS_ANCESTOR_FILTER_BITS)
+#define CSS_ANCESTOR_FILTER_MASK (CSS_ANCESTOR_FILTER_SIZE - 1)
+
+#define ANCESTOR_SALT_TAG   0x9E3779B9
+#define ANCESTOR_SALT_ID    0x85EBCA6B
+#define ANCESTOR_SALT_CLASS 0xC2B2AE35
+
+typedef struct CssAncestorFilter CssAncestorFilter;
+struct CssAncestorFilter {
+    unsigned char aCount[CSS_ANCESTOR_FILTER_SIZE];
+
+    unsigned int *aHash;          /* Stack of hashes added to aCount[] */
+    int nHash;                    /* Number of entries in aHash[] */
+    int nHashAlloc;               /* Allocated size of aHash[] */
+
+    struct CssAncestorLevel {
+        HtmlNode *pNode;          /* Ancestor node */
+        int iFirstHash;           /* Index of first aHash[] entry for pNode */
+    } *aLevel;
+    int nLevel;                   /* Number of entries in aLevel[] */
+    int nLevelAlloc;              /* Allocated size of aLevel[] */
+};
+
+/*--------------------------------------------------------------------------
+ *
+ * ancestorFilterHash --
+ *
+ *     Return the filter hash of the n bytes of string z (or of the entire
+ *     nul-terminated string if n is less than zero). Argument salt should
+ *     be one of the ANCESTOR_SALT_XXX values, depending on whether z is a
+ *     tag name, id or class. Since id and class selectors are matched 
+ *     case-insensitively, the hash folds ASCII case.
+ *
+ * Results:
+ *     Non-zero hash value.
+ *
+ * Side effects:
+ *     None.
+ *
+ *--------------------------------------------------------------------------
+ */
+static unsigned int
+ancestorFilterHash(salt, z, n)
+    unsigned int salt;
+    const char *z;
+    int n;
+{
+    unsigned int h = salt;
+    const unsigned char *zIter = (const unsigned char *)z;
+    const unsigned char *zEnd = n < 0 ? 0 : &zIter[n];
+
+    for ( ; (zEnd ? zIter < zEnd : *zIter != '\0'); zIter++) {
+        h = (h ^ tolower(*zIter)) * 0x01000193;
+    }
+    h ^= (h >> 16);
+    return (h ? h : 1);
+}
+
+/*--------------------------------------------------------------------------
+ *
+ * ancestorFilterRuleHashes --
+ *
+ *     Populate the CssRule.aAncestorHash[] array of rule pRule, based on
+ *     selector chain pSelector.
+ *
+ *     A simple selector refers to an ancestor of the matched node if the
+ *     nearest combinator to it's right is a descendant or child
+ *     combinator. The hashes of the type, id and class simple selectors
+ *     that meet this condition are added to the array, until it is full.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *--------------------------------------------------------------------------
+ */
+static void
+ancestorFilterRuleHashes(pRule, pSelector)
+    CssRule *pRule;
+    CssSelector *pSelector;
+{
+    CssSelector *pS;
+    int eCombinator = 0;
+    int nHash = 0;
+
+    memset(pRule->aAncestorHash, 0, sizeof(pRule->aAncestorHash));
+    for (pS = pSelector; pS && nHash < CSS_MAX_ANCESTOR_HASH; pS = pS->pNext) {
+        unsigned int salt = 0;
+        switch (pS->eSelector) {
+            case CSS_SELECTORCHAIN_DESCENDANT:
+            case CSS_SELECTORCHAIN_CHILD:
+            case CSS_SELECTORCHAIN_ADJACENT:
+                eCombinator = pS->eSelector;
+                break;
+            case CSS_SELECTOR_TYPE:
+                salt = ANCESTOR_SALT_TAG;
+                break;
+            case CSS_SELECTOR_ID:
+                salt = ANCESTOR_SALT_ID;
+                break;
+            case CSS_SELECTOR_CLASS:
+                salt = ANCESTOR_SALT_CLASS;
+                break;
+        }
+        if (salt && pS->zValue && (
+                eCombinator == CSS_SELECTORCHAIN_DESCENDANT ||
+                eCombinator == CSS_SELECTORCHAIN_CHILD
+        )) {
+            pRule->aAncestorHash[nHash++] = 
+                ancestorFilterHash(salt, pS->zValue, -1);
+        }
+    }
+}
+
+/*--------------------------------------------------------------------------
+ *
+ * ancestorFilterAdd --
+ *
+ *     Add hash h to the ancestor filter p.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *--------------------------------------------------------------------------
+ */
+static void
+ancestorFilterAdd(p, h)
+    CssAncestorFilter *p;
+    unsigned int h;
+{
+    unsigned char *p1 = &p->aCount[h & CSS_ANCESTOR_FILTER_MASK];
+    unsigned char *p2 = 
+        &p->aCount[(h >> CSS_ANCESTOR_FILTER_BITS) & CSS_ANCESTOR_FILTER_MASK];
+
+    if (p->nHash == p->nHashAlloc) {
+        p->nHashAlloc = p->nHashAlloc * 2 + 32;
+        p->aHash = (unsigned int *)HtmlRealloc("CssAncestorFilter.aHash",
+            p->aHash, sizeof(unsigned int) * p->nHashAlloc
+        );
+    }
+    p->aHash[p->nHash++] = h;
+
+    if (*p1 < 255) (*p1)++;
+    if (*p2 < 255) (*p2)++;
+}
+
+/*--------------------------------------------------------------------------
+ *
+ * ancestorFilterRemove --
+ *
+ *     Remove hash h from the ancestor filter p. The hash must have been
+ *     added using ancestorFilterAdd() and not yet removed.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *--------------------------------------------------------------------------
+ */
+static void
+ancestorFilterRemove(p, h)
+    CssAncestorFilter *p;
+    unsigned int h;
+{
+    unsigned char *p1 = &p->aCount[h & CSS_ANCESTOR_FILTER_MASK];
+    unsigned char *p2 = 
+        &p->aCount[(h >> CSS_ANCESTOR_FILTER_BITS) & CSS_ANCESTOR_FILTER_MASK];
+
+    assert(*p1 > 0 && *p2 > 0);
+    if (*p1 < 255) (*p1)--;
+    if (*p2 < 255) (*p2)--;
+}
+
+/*--------------------------------------------------------------------------
+ *
+ * ancestorFilterReject --
+ *
+ *     Return true if the ancestor filter p proves that the selector of 
+ *     rule pRule cannot match a child of the node at the top of the 
+ *     filter stack.
+ *
+ * Results:
+ *     See above.
+ *
+ * Side effects:
+ *     None.
+ *
+ *--------------------------------------------------------------------------
+ */
+static int
+ancestorFilterReject(p, pRule)
+    CssAncestorFilter *p;
+    CssRule *pRule;
+{
+    int ii;
+    for (ii = 0; ii < CSS_MAX_ANCESTOR_HASH; ii++) {
+        unsigned int h = pRule->aAncestorHash[ii];
+        if (h == 0) break;
+        if (
+            0 == p->aCount[h & CSS_ANCESTOR_FILTER_MASK] ||
+            0 == p->aCount[(h>>CSS_ANCESTOR_FILTER_BITS) & CSS_ANCESTOR_FILTER_MASK]
+        ) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*--------------------------------------------------------------------------
+ *
+ * HtmlCssAncestorFilterInit --
+ *
+ *     Called by HtmlStyleApply() before walking the document tree to
+ *     create an empty ancestor filter.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     Sets HtmlTree.pAncestorFilter.
+ *
+ *--------------------------------------------------------------------------
+ */
+void
+HtmlCssAncestorFilterInit(pTree)
+    HtmlTree *pTree;
+{
+    assert(!pTree->pAncestorFilter);
+    pTree->pAncestorFilter = (void *)HtmlNew(CssAncestorFilter);
+}
+
+/*--------------------------------------------------------------------------
+ *
+ * HtmlCssAncestorFilterFinish --
+ *
+ *     Delete the ancestor filter created by HtmlCssAncestorFilterInit().
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     Clears HtmlTree.pAncestorFilter.
+ *
+ *--------------------------------------------------------------------------
+ */
+void
+HtmlCssAncestorFilterFinish(pTree)
+    HtmlTree *pTree;
+{
+    CssAncestorFilter *p = (CssAncestorFilter *)pTree->pAncestorFilter;
+    if (p) {
+        assert(p->nLevel == 0 && p->nHash == 0);
+        HtmlFree(p->aHash);
+        HtmlFree(p->aLevel);
+        HtmlFree(p);
+        pTree->pAncestorFilter = 0;
+    }
+}
+
+/*--------------------------------------------------------------------------
+ *
+ * HtmlCssAncestorFilterPush --
+ *
+ *     Add the tag name, id and classes of element pNode to the ancestor 
+ *     filter. This is called by the style walk before visiting the 
+ *     children of pNode.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *--------------------------------------------------------------------------
+ */
+void
+HtmlCssAncestorFilterPush(pTree, pNode)
+    HtmlTree *pTree;
+    HtmlNode *pNode;
+{
+    CssAncestorFilter *p = (CssAncestorFilter *)pTree->pAncestorFilter;
+    const char *zId;
+    const char *zClass;
+
+    if (!p) return;
+    assert(HtmlNodeAsElement(pNode));
+
+    if (p->nLevel == p->nLevelAlloc) {
+        p->nLevelAlloc = p->nLevelAlloc * 2 + 16;
+        p->aLevel = (struct CssAncestorLevel *)HtmlRealloc(
+            "CssAncestorFilter.aLevel", p->aLevel, 
+            sizeof(struct CssAncestorLevel) * p->nLevelAlloc
+        );
+    }
+    p->aLevel[p->nLevel].pNode = pNode;
+    p->aLevel[p->nLevel].iFirstHash = p->nHash;
+    p->nLevel++;
+
+    if (pNode->zTag) {
+        ancestorFilterAdd(p, ancestorFilterHash(ANCESTOR_SALT_TAG,pNode->zTag,-1));
+    }
+    zId = HtmlAttrId(((HtmlElementNode *)pNode)->pAttributes);
+    if (zId) {
+        ancestorFilterAdd(p, ancestorFilterHash(ANCESTOR_SALT_ID, zId, -1));
+    }
+    zClass = HtmlAttrClass(((HtmlElementNode *)pNode)->pAttributes);
+    if (zClass) {
+        int nClass;
+        while ((zClass = HtmlCssGetNextListItem(zClass,strlen(zClass),&nClass))){
+            ancestorFilterAdd(p, 
+                ancestorFilterHash(ANCESTOR_SALT_CLASS, zClass, nClass)
+            );
+            zClass += nClass;
+        }
+    }
+}
+
+/*--------------------------------------------------------------------------
+ *
+ * HtmlCssAncestorFilterPop --
+ *
+ *     Remove element pNode from the ancestor filter. pNode must be the 
+ *     node most recently added by HtmlCssAncestorFilterPush().
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *--------------------------------------------------------------------------
+ */
+void
+HtmlCssAncestorFilterPop(pTree, pNode)
+    HtmlTree *pTree;
+    HtmlNode *pNode;
+{
+    CssAncestorFilter *p = (CssAncestorFilter *)pTree->pAncestorFilter;
+    int iFirst;
+
+    if (!p) return;
+    assert(p->nLevel > 0 && p->aLevel[p->nLevel - 1].pNode == pNode);
+
+    p->nLevel--;
+    iFirst = p->aLevel[p->nLevel].iFirstHash;
+    while (p->nHash > iFirst) {
+        p->nHash--;
+        ancestorFilterRemove(p, p->aHash[p->nHash]);
+    }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * cssSelectorPropertySetPair --
+ *
+ *     A rule has just been parsed with selector pSelector and properties
+ *     pPropertySet. This function creates a CssRule object to link the two
+ *     together and inserts the new rule into the CssStyleSheet structure.
+ *
+ *     The caller should not free resources associated with pSelector or
+ *     pPropertySet after this function returns, they are now linked into
+ *     the stylesheet object.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+#define FREE_SELECTOR    0x00000001
+#define FREE_PROPERTYSET 0x00000002
+#define FREE_BOTH        0x00000003
+static void 
+cssSelectorPropertySetPair(pParse, pSelector, pPropertySet, freeWhat)
+    CssParse *pParse;
+    CssSelector *pSelector;
+    CssPropertySet *pPropertySet;
+    unsigned int freeWhat;
+{
+    int spec = 0;
+    CssSelector *pS = 0;
+    CssStyleSheet *pStyle = pParse->pStyle;
+    CssRule *pRule = HtmlNew(CssRule);
+
+    assert(pPropertySet && pPropertySet->n > 0);
+
+    if (freeWhat & FREE_PROPERTYSET) {
+        pRule->freePropertySets = 1;
+    }
+    if (freeWhat & FREE_SELECTOR) {
+        pRule->freeSelector = 1;
+    }
+
+    /* Calculate the specificity of the rules. We use the following
+     * formala:
+     *
      *     Specificity = (number of id selectors)        * 10000 +
      *                   (number of attribute selectors) * 100   +
      *                   (number of pseudo classes)      * 100   +
@@ -2835,6 +3804,7 @@ cssSelectorPropertySetPair(pParse, pSelector, pPropertySet, freeWhat)
          }
     }
     pRule->specificity = spec;
+    ancestorFilterRuleHashes(pRule, pSelector);
     assert(
         pPropertySet == pParse->pPropertySet || 
         pPropertySet == pParse->pImportant
@@ -2845,6 +3815,7 @@ cssSelectorPropertySetPair(pParse, pSelector, pPropertySet, freeWhat)
         pRule->pPriority = pParse->pPriority2;
     }
     pRule->iRule = pParse->iNextRule++;
+    pRule->iSeq = pParse->iSeq;
 
     /* Insert the rule into it's list. */
     if (pParse->pStyleId) {
@@ -2874,10 +3845,12 @@ cssSelectorPropertySetPair(pParse, pSelector, pPropertySet, freeWhat)
 
             case CSS_PSEUDOELEMENT_AFTER:
                 insertRule(&pStyle->pAfterRules, pRule);
+                pParse->isDirty = 1;
                 break;
 
             case CSS_PSEUDOELEMENT_BEFORE:
                 insertRule(&pStyle->pBeforeRules, pRule);
+                pParse->isDirty = 1;
                 break;
     
             case CSS_SELECTOR_ID:
@@ -2899,6 +3872,7 @@ cssSelectorPropertySetPair(pParse, pSelector, pPropertySet, freeWhat)
                 if (!newentry) { 
                     pList = (CssRule *)Tcl_GetHashValue(p); 
                 }
+                parseMarkDirty(pParse, p, pList);
                 insertRule(&pList, pRule);
                 Tcl_SetHashValue(p, pList);
                 break;
@@ -2906,10 +3880,12 @@ cssSelectorPropertySetPair(pParse, pSelector, pPropertySet, freeWhat)
     
             default:
                 insertRule(&pStyle->pUniversalRules, pRule);
+                pParse->isDirty = 1;
                 break;
         }
     } else {
         insertRule(&pStyle->pUniversalRules, pRule);
+        pParse->isDirty = 1;
     }
 
     pRule->pSelector = pSelector;
@@ -2964,6 +3940,11 @@ void HtmlCssRule(pParse, success)
         (pPropertySet || pImportant)
     ) {
 
+        selectorCompile(pParse->pTree, pSelector);
+        for (i = 0; i < nXtra; i++){
+            selectorCompile(pParse->pTree, apXtraSelector[i]);
+        }
+
         if (pPropertySet) {
             unsigned int flags = FREE_BOTH;
             cssSelectorPropertySetPair(pParse, pSelector, pPropertySet, flags);
@@ -3093,16 +4074,263 @@ static int attrTest(eType, zString, zAttr)
 
 /*--------------------------------------------------------------------------
  *
- * HtmlCssSelectorTest --
+ * classAtom --
  *
- *     Test if a selector matches a document node.
+ *     Return the class-name atom for the nul-terminated string zClass.
+ *     Class names are compared case-insensitively, so two strings that
+ *     differ only in case map to the same atom.
  *
  * Results:
- *     Non-zero is returned if the Selector does match the node.
+ *     Pointer to the atom.
  *
  * Side effects:
+ *     May add an entry to HtmlInterpData.aClassAtom.
+ *
+ *--------------------------------------------------------------------------
+ */
+static const char *
+classAtom(pAtoms, zClass)
+    HtmlInterpData *pAtoms;
+    const char *zClass;
+{
+    int isNew;
+    Tcl_HashEntry *pEntry;
+    pEntry = Tcl_CreateHashEntry(&pAtoms->aClassAtom, zClass, &isNew);
+    return (const char *)Tcl_GetHashKey(&pAtoms->aClassAtom, pEntry);
+}
+
+/*
+ * Value of HtmlElementNode.apClass for elements with no "class" attribute.
+ */
+static const char *aNoClass[1] = {0};
+
+/*--------------------------------------------------------------------------
+ *
+ * nodeClassList --
+ *
+ *     Return the list of class-name atoms for element pElem. The first
+ *     time this is called for an element (or the first time after its
+ *     attributes are modified) the "class" attribute is split into 
+ *     atoms and the result stored in HtmlElementNode.apClass.
+ *
+ * Results:
+ *     Pointer to a NULL-terminated array of atoms.
+ *
+ * Side effects:
+ *     May set HtmlElementNode.apClass.
+ *
+ *--------------------------------------------------------------------------
+ */
+static const char **
+nodeClassList(pAtoms, pElem)
+    HtmlInterpData *pAtoms;
+    HtmlElementNode *pElem;
+{
+    if (!pElem->apClass) {
+        const char *zAttr = HtmlAttrClass(pElem->pAttributes);
+        const char **apClass = aNoClass;
+        const char *z;
+        int nClass = 0;
+        int n;
+
+        for (z = zAttr; z && (z = HtmlCssGetNextListItem(z, strlen(z), &n)); ){
+            nClass++;
+            z += n;
+        }
+
+        if (nClass > 0) {
+            int ii = 0;
+            char zBuf[128];
+            apClass = (const char **)HtmlArenaAlloc(HtmlArenaOf(pElem),
+                "HtmlElementNode.apClass", (nClass + 1) * sizeof(char *)
+            );
+            for (z = zAttr; (z = HtmlCssGetNextListItem(z, strlen(z), &n)); ){
+                char *zItem = zBuf;
+                if (n >= sizeof(zBuf)) {
+                    zItem = HtmlAlloc("temp", n + 1);
+                }
+                memcpy(zItem, z, n);
+                zItem[n] = '\0';
+                apClass[ii++] = classAtom(pAtoms, zItem);
+                if (zItem != zBuf) {
+                    HtmlFree(zItem);
+                }
+                z += n;
+            }
+            assert(ii == nClass);
+            apClass[ii] = 0;
+        }
+        pElem->apClass = apClass;
+    }
+    return pElem->apClass;
+}
+
+/*--------------------------------------------------------------------------
+ *
+ * HtmlCssClassListFree --
+ *
+ *     Discard the list of class-name atoms cached by nodeClassList(). 
+ *     This is called when an element is deleted or its attributes are
+ *     modified.
+ *
+ * Results:
  *     None.
  *
+ * Side effects:
+ *     Clears HtmlElementNode.apClass.
+ *
+ *--------------------------------------------------------------------------
+ */
+void
+HtmlCssClassListFree(pElem)
+    HtmlElementNode *pElem;
+{
+    if (pElem->apClass && pElem->apClass != aNoClass) {
+        HtmlArenaFree((void *)pElem->apClass);
+    }
+    pElem->apClass = 0;
+}
+
+/*--------------------------------------------------------------------------
+ *
+ * selectorCompile --
+ *
+ *     Compile the selector chain that begins with pSelector into a
+ *     CssProgram and attach it to the head of the chain. Type selectors
+ *     that name a known HTML tag are resolved to the tag-name atom
+ *     (the same pointer as HtmlNode.zTag). If pTree is not NULL, class
+ *     selectors are resolved to class-name atoms and the attribute names
+ *     in attribute selectors to attribute-name atoms. The atoms belong
+ *     to the HtmlInterpData shared by all widgets in the interpreter, so
+ *     the compiled program may be used with any of them.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     Sets pSelector->pProgram. May add entries to the atom tables.
+ *
+ *--------------------------------------------------------------------------
+ */
+static void
+selectorCompile(pTree, pSelector)
+    HtmlTree *pTree;
+    CssSelector *pSelector;
+{
+    CssProgram *pProgram;
+    CssSelector *p;
+    int nOp = 0;
+    int ii;
+
+    if (!pSelector || pSelector->pProgram) return;
+
+    for (p = pSelector; p; p = p->pNext) nOp++;
+    pProgram = (CssProgram *)HtmlClearAlloc("CssProgram", 
+        sizeof(CssProgram) + (nOp - 1) * sizeof(CssProgramOp)
+    );
+    pProgram->pAtoms = (pTree ? pTree->pInterpData : 0);
+    pProgram->nOp = nOp;
+
+    for (ii = 0, p = pSelector; p; ii++, p = p->pNext) {
+        CssProgramOp *pOp = &pProgram->aOp[ii];
+        pOp->eOp = p->eSelector;
+        pOp->zValue = p->zValue;
+        pOp->zAttr = p->zAttr;
+
+        switch (p->eSelector) {
+            case CSS_SELECTOR_TYPE: {
+                /* Elements of unknown type (XML mode only) use atoms
+                 * from HtmlTree.aAtom, which preserve the case of the
+                 * document. Those are still tested with strcmp().
+                 */
+                HtmlTokenMap *pMap = HtmlHashLookup(0, p->zValue);
+                if (pMap && 0 == strcmp(pMap->zName, p->zValue)) {
+                    pOp->eOp = CSS_OP_TAG;
+                    pOp->zValue = pMap->zName;
+                }
+                break;
+            }
+            case CSS_SELECTOR_CLASS:
+                if (pTree) {
+                    pOp->eOp = CSS_OP_CLASS;
+                    pOp->zValue = classAtom(pTree->pInterpData, p->zValue);
+                }
+                break;
+
+            case CSS_SELECTOR_ATTR:
+            case CSS_SELECTOR_ATTRVALUE:
+            case CSS_SELECTOR_ATTRLISTVALUE:
+            case CSS_SELECTOR_ATTRHYPHEN:
+            case CSS_SELECTOR_ATTRSTAR:
+            case CSS_SELECTOR_ATTRHAT:
+                if (pTree) {
+                    pOp->zAttr = HtmlAttributeAtom(pTree, p->zAttr);
+                }
+                break;
+        }
+    }
+
+    pSelector->pProgram = pProgram;
+}
+
+/*
+ * An instance of the following structure is passed to programTest() by
+ * HtmlCssSelectorSources() to collect the set of nodes whose dynamic 
+ * flags (:hover, :focus and :active) the result of a test depends on.
+ */
+typedef struct CssSourceList CssSourceList;
+struct CssSourceList {
+    int nStep;               /* Number of ops executed so far */
+    int nSource;             /* Number of entries in apSource[] */
+    int nAlloc;              /* Allocated size of apSource[] */
+    HtmlNode **apSource;     /* Nodes tested by a dynamic pseudo-class */
+};
+
+/*
+ * Maximum number of ops HtmlCssSelectorSources() will execute for a
+ * single selector. Selectors with many descendant combinators tested 
+ * against deep documents can exceed this.
+ */
+#define CSS_SOURCES_MAX_STEP 2000
+
+static void
+sourceListAdd(pList, pNode)
+    CssSourceList *pList;
+    HtmlNode *pNode;
+{
+    int ii;
+    for (ii = 0; ii < pList->nSource; ii++) {
+        if (pList->apSource[ii] == pNode) return;
+    }
+    if (pList->nSource == pList->nAlloc) {
+        pList->nAlloc = pList->nAlloc * 2 + 4;
+        pList->apSource = (HtmlNode **)HtmlRealloc("CssSourceList.apSource",
+            pList->apSource, pList->nAlloc * sizeof(HtmlNode *)
+        );
+    }
+    pList->apSource[pList->nSource++] = pNode;
+}
+
+/*--------------------------------------------------------------------------
+ *
+ * programTest --
+ *
+ *     Test if the compiled selector program pProgram, starting at 
+ *     op iOp, matches document node pNode.
+ *
+ *     If pList is not NULL, every node that a dynamic pseudo-class op
+ *     is tested against is added to it. In this case the descendant
+ *     combinator tries all ancestors of a node instead of stopping at
+ *     the first that matches, so that pList contains every node that
+ *     might be tested for any combination of dynamic flags. pList is
+ *     only ever non-NULL when dynamic_true is also true.
+ *
+ * Results:
+ *     Non-zero is returned if the program does match the node.
+ *
+ * Side effects:
+ *     May set HtmlElementNode.apClass for pNode or its relatives.
+ *
  *--------------------------------------------------------------------------
  */
 #define N_TYPE(x)        HtmlNodeTagName(x)
@@ -3110,33 +4338,54 @@ static int attrTest(eType, zString, zAttr)
 #define N_PARENT(x)      HtmlNodeParent(x)
 #define N_NUMCHILDREN(x) HtmlNodeNumChildren(x)
 #define N_CHILD(x,y)     HtmlNodeChild(x,y)
-int 
-HtmlCssSelectorTest(pSelector, pNode, dynamic_true)
-    CssSelector *pSelector;
+static int 
+programTest(pProgram, iOp, pNode, dynamic_true, pList)
+    CssProgram *pProgram;
+    int iOp;
     HtmlNode *pNode;
     int dynamic_true;
+    CssSourceList *pList;
 {
-    CssSelector *p = pSelector;
+    CssProgramOp *pOp = &pProgram->aOp[iOp];
+    CssProgramOp *pEnd = &pProgram->aOp[pProgram->nOp];
     HtmlNode *x = pNode;
 
-    HtmlElementNode *pElem = HtmlNodeAsElement(pNode);
-    assert(pElem);
+    assert(!pList || dynamic_true);
+
+    while( pOp < pEnd && x ){
+        HtmlElementNode *pElem = HtmlNodeAsElement(x);
 
-    while( p && x ){
-        pElem = HtmlNodeAsElement(x);
+        if( pList && ++pList->nStep > CSS_SOURCES_MAX_STEP ) return 0;
 
-        switch( p->eSelector ){
+        switch( pOp->eOp ){
             case CSS_SELECTOR_UNIVERSAL:
                 break;
 
+            case CSS_OP_TAG:
+                if( HtmlNodeIsText(x) || x->zTag != pOp->zValue ) return 0;
+                break;
+
             case CSS_SELECTOR_TYPE:
                 assert(x->zTag || HtmlNodeIsText(x));
-                if( HtmlNodeIsText(x) || strcmp(x->zTag, p->zValue) ) return 0;
+                if( HtmlNodeIsText(x) || strcmp(x->zTag, pOp->zValue) ) return 0;
+                break;
+
+            case CSS_OP_CLASS: {
+                const char **apClass;
+                if( !pElem ) return 0;
+                apClass = pElem->apClass;
+                if( !apClass ){
+                    apClass = nodeClassList(pProgram->pAtoms, pElem);
+                }
+                while( *apClass && *apClass != pOp->zValue ) apClass++;
+                if( !*apClass ) return 0;
                 break;
+            }
 
             case CSS_SELECTOR_CLASS: {
-                const char *zClass = p->zValue;
-                const char *zAttr = N_ATTR(x, "class");
+                const char *zClass = pOp->zValue;
+                const char *zAttr = 0;
+                if( pElem ) zAttr = HtmlAttrClass(pElem->pAttributes);
                 if( !attrTest(CSS_SELECTOR_ATTRLISTVALUE, zClass, zAttr) ){
                     return 0;
                 }
@@ -3144,8 +4393,9 @@ HtmlCssSelectorTest(pSelector, pNode, dynamic_true)
             }
 
             case CSS_SELECTOR_ID: {
-                const char *zId = p->zValue;
-                const char *zAttr = N_ATTR(x, "id");
+                const char *zId = pOp->zValue;
+                const char *zAttr = 0;
+                if( pElem ) zAttr = HtmlAttrId(pElem->pAttributes);
                 if( !attrTest(CSS_SELECTOR_ATTRVALUE, zId, zAttr) ){
                     return 0;
                 }
@@ -3157,22 +4407,33 @@ HtmlCssSelectorTest(pSelector, pNode, dynamic_true)
             case CSS_SELECTOR_ATTRLISTVALUE:
             case CSS_SELECTOR_ATTRHYPHEN:
             case CSS_SELECTOR_ATTRSTAR:
-            case CSS_SELECTOR_ATTRHAT:
-                if( !attrTest(p->eSelector, p->zValue, N_ATTR(x,p->zAttr)) ){
+            case CSS_SELECTOR_ATTRHAT: {
+                /* If the program was compiled with a tree, pOp->zAttr
+                 * is an attribute-name atom. */
+                const char *zAttr = 0;
+                if( !pProgram->pAtoms ){
+                    zAttr = N_ATTR(x, pOp->zAttr);
+                }else if( pElem ){
+                    zAttr = HtmlAttributesFind(pElem->pAttributes, pOp->zAttr);
+                }
+                if( !attrTest(pOp->eOp, pOp->zValue, zAttr) ){
                     return 0;
                 }
                 break;
+            }
 
             case CSS_SELECTORCHAIN_DESCENDANT: {
                 HtmlNode *pParent = N_PARENT(x);
-                CssSelector *pNext = p->pNext;
+                int iNext = (pOp - pProgram->aOp) + 1;
+                int isMatch = 0;
                 while (pParent) {
-                    if (HtmlCssSelectorTest(pNext, pParent, dynamic_true)) {
-                        return 1;
+                    if (programTest(pProgram,iNext,pParent,dynamic_true,pList)){
+                        if (!pList) return 1;
+                        isMatch = 1;
                     }
                     pParent = N_PARENT(pParent);
                 }
-                return 0;
+                return isMatch;
             }
             case CSS_SELECTORCHAIN_CHILD:
                 x = N_PARENT(x);
@@ -3247,12 +4508,15 @@ HtmlCssSelectorTest(pSelector, pNode, dynamic_true)
                 break;
 
             case CSS_PSEUDOCLASS_ACTIVE:
+                if (pList) sourceListAdd(pList, x);
                 if (dynamic_true || (pElem->flags & HTML_DYNAMIC_ACTIVE)) break;
                 return 0;
             case CSS_PSEUDOCLASS_HOVER:
+                if (pList) sourceListAdd(pList, x);
                 if (dynamic_true || (pElem->flags & HTML_DYNAMIC_HOVER)) break;
                 return 0;
             case CSS_PSEUDOCLASS_FOCUS:
+                if (pList) sourceListAdd(pList, x);
                 if (dynamic_true || (pElem->flags & HTML_DYNAMIC_FOCUS)) break;
                 return 0;
             case CSS_PSEUDOCLASS_LINK:
@@ -3262,16 +4526,93 @@ HtmlCssSelectorTest(pSelector, pNode, dynamic_true)
                 if (pElem->flags & HTML_DYNAMIC_VISITED) break;
                 return 0;
 
-            case CSS_SELECTOR_NEVERMATCH:
-                return 0;
+            case CSS_SELECTOR_NEVERMATCH:
+                return 0;
+
+            default:
+                assert(!"Impossible");
+        }
+        pOp++;
+    }
+
+    return (x && pOp == pEnd)?1:0;
+}
+
+/*--------------------------------------------------------------------------
+ *
+ * HtmlCssSelectorTest --
+ *
+ *     Test if a selector matches a document node. The selector is
+ *     compiled by selectorCompile() the first time it is tested, if 
+ *     this was not already done when the rule was parsed.
+ *
+ * Results:
+ *     Non-zero is returned if the Selector does match the node.
+ *
+ * Side effects:
+ *     None.
+ *
+ *--------------------------------------------------------------------------
+ */
+int 
+HtmlCssSelectorTest(pSelector, pNode, dynamic_true)
+    CssSelector *pSelector;
+    HtmlNode *pNode;
+    int dynamic_true;
+{
+    assert(HtmlNodeAsElement(pNode));
+    if (!pSelector->pProgram) {
+        selectorCompile(0, pSelector);
+    }
+    return programTest(pSelector->pProgram, 0, pNode, dynamic_true, 0);
+}
+
+/*--------------------------------------------------------------------------
+ *
+ * HtmlCssSelectorSources --
+ *
+ *     Determine the set of nodes whose dynamic flags (HTML_DYNAMIC_HOVER,
+ *     HTML_DYNAMIC_FOCUS and HTML_DYNAMIC_ACTIVE) may affect the result
+ *     of testing pSelector against pNode. This is used to index dynamic
+ *     conditions by the nodes they depend on (see cssdynamic.c).
+ *
+ * Results:
+ *     If successful, non-zero is returned and *papSource is set to point
+ *     to an array of *pnSource nodes allocated with HtmlAlloc(). The
+ *     caller is responsible for freeing it. 
+ *
+ *     If the set cannot be determined cheaply, zero is returned and
+ *     *papSource and *pnSource are set to 0.
+ *
+ * Side effects:
+ *     None.
+ *
+ *--------------------------------------------------------------------------
+ */
+int
+HtmlCssSelectorSources(pSelector, pNode, papSource, pnSource)
+    CssSelector *pSelector;
+    HtmlNode *pNode;
+    HtmlNode ***papSource;
+    int *pnSource;
+{
+    CssSourceList sList;
 
-            default:
-                assert(!"Impossible");
-        }
-        p = p->pNext;
+    memset(&sList, 0, sizeof(CssSourceList));
+    if (!pSelector->pProgram) {
+        selectorCompile(0, pSelector);
     }
+    programTest(pSelector->pProgram, 0, pNode, 1, &sList);
 
-    return (x && !p)?1:0;
+    if (sList.nStep > CSS_SOURCES_MAX_STEP) {
+        HtmlFree(sList.apSource);
+        *papSource = 0;
+        *pnSource = 0;
+        return 0;
+    }
+    *papSource = sList.apSource;
+    *pnSource = sList.nSource;
+    return 1;
 }
 
 /*
@@ -3350,150 +4691,501 @@ ruleToPropertyValues(p, aPropDone, pRule)
 /*
  *---------------------------------------------------------------------------
  *
- * ruleToPropertyValues --
+ * ruleToPropertyValues --
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void 
+overrideToPropertyValues(pTree, p, aPropDone, pOverride)
+    HtmlTree *pTree;
+    HtmlComputedValuesCreator *p;
+    int *aPropDone;
+    Tcl_Obj *pOverride;
+{
+    Tcl_Obj **apObj = 0;
+    int nObj = 0;
+    int ii;
+
+    if (!pOverride) return;
+    Tcl_ListObjGetElements(0, pOverride, &nObj, &apObj);
+
+    for (ii = 0; ii < (nObj - 1); ii += 2) { 
+        int eProp;
+        const char *zProp;
+        int nProp;
+
+        zProp = Tcl_GetStringFromObj(apObj[ii], &nProp);
+        eProp = HtmlCssPropertyLookup(nProp, zProp);
+
+        if (eProp < 0) {
+          LOG {
+            HtmlLog(pTree, "override: wrong css prop: %s", zProp);
+          }
+          continue;
+        }
+
+	if (eProp <= CSS_PROPERTY_MAX_PROPERTY && 0 == aPropDone[eProp]) {
+            const char *zVal = Tcl_GetString(apObj[ii + 1]);
+            CssProperty *pProp = HtmlCssStringToProperty(zVal, -1);
+            if (0 == HtmlComputedValuesSet(p, eProp, pProp)) {
+                aPropDone[eProp] = 1;
+            }
+            HtmlComputedValuesFreeProperty(p, pProp);
+        }
+    }
+}
+
+/*--------------------------------------------------------------------------
+ *
+ * applyRule --
+ *
+ *     Test the selector of pRule against node pNode. If there is a match,
+ *     add the rules properties to the computed values being accumulated in
+ *     pCreator.
+ *
+ * Results:
+ *
+ *     The value returned is true if the selector matched, or false otherwise.
+ *
+ * Side effects:
+ *
+ *--------------------------------------------------------------------------
+ */
+static int 
+applyRule(pTree, pNode, pRule, aPropDone, pzIfMatch, pCreator)
+    HtmlTree *pTree;
+    HtmlNode *pNode;
+    CssRule *pRule;
+    int *aPropDone;
+    char **pzIfMatch;
+    HtmlComputedValuesCreator *pCreator;
+{
+    /* Test if the selector matches the node. Variable isMatch is set to
+     * true if the selector matches, or false otherwise. 
+     */
+    CssSelector *pSelector = pRule->pSelector;
+    int isMatch = HtmlCssSelectorTest(pSelector, pNode, 0);
+
+    /* There is a match. Log some output for debugging. */
+    LOG {
+        CssPriority *pPriority = pRule->pPriority;
+        Tcl_Obj *pS = Tcl_NewObj();
+        Tcl_IncrRefCount(pS);
+        HtmlCssSelectorToString(pSelector, pS);
+        HtmlLog(pTree, "STYLEENGINE", "%s %s (%s)"
+            " from \"%s%s\"",
+            Tcl_GetString(HtmlNodeCommand(pTree, pNode)),
+            (isMatch ? "matches" : "nomatch"),
+            Tcl_GetString(pS),
+            pPriority->origin == CSS_ORIGIN_AUTHOR ? "author" :
+            pPriority->origin == CSS_ORIGIN_AGENT ? "agent" : "user",
+            Tcl_GetString(pPriority->pIdTail)
+        );
+        Tcl_DecrRefCount(pS);
+    }
+    if (isMatch) {
+
+        if (pzIfMatch) {
+            HtmlComputedValuesInit(pTree, pNode, pNode, pCreator);
+            pCreator->pzContent = pzIfMatch;
+        }
+  
+        /* Copy the properties from the rule into the computed values set. */
+        ruleToPropertyValues(pCreator, aPropDone, pRule);
+    }
+
+    assert(isMatch == 0 || isMatch == 1);
+    return isMatch;
+}
+
+/*
+ * A CssRuleMerge structure is used to merge the rule lists that apply to
+ * a node in priority order. The heads of the lists are stored in a 
+ * binary heap, so that retrieving each rule is O(log(N)) in the number
+ * of lists (which may be as large as (MAX_CLASSES+2) per stylesheet 
+ * layer), instead of O(N). If two lists have rules of the same priority
+ * at their heads, the rule with the larger sequence number (see
+ * styleSheetLayerSeq()) is returned first. If the sequence numbers are
+ * also the same, the rule from the list with the lower index in the 
+ * apRule[] array passed to ruleMergeInit() is returned first.
+ *
+ *     ruleMergeInit()
+ *     ruleMergeNext()
+ *     ruleMergeFinish()
+ */
+#define CSS_MERGE_STATIC 256
+typedef struct CssRuleMerge CssRuleMerge;
+struct CssRuleMerge {
+    CssRule **apRule;                  /* Heads of the lists being merged */
+    int *aSeq;                         /* Layer sequence number of each */
+    int nHeap;                         /* Number of entries in aHeap[] */
+    int *aHeap;                        /* Heap of indexes into apRule[] */
+    int aStatic[CSS_MERGE_STATIC];     /* Static space for aHeap[] */
+};
+
+/*
+ * Return the sequence number of the rule at the head of list iList. An
+ * entry of -1 in the CssRuleMerge.aSeq[] array means the list belongs
+ * to layer 0, so the number is read from the rule itself.
+ */
+#define ruleMergeSeq(p, iList) \
+    ((p)->aSeq[iList] < 0 ? (p)->apRule[iList]->iSeq : (p)->aSeq[iList])
+
+/*
+ * Return true if the rule at the head of list iLeft should be returned
+ * before the rule at the head of list iRight.
+ */
+static int
+ruleMergeBefore(p, iLeft, iRight)
+    CssRuleMerge *p;
+    int iLeft;
+    int iRight;
+{
+    int res = ruleCompare(p->apRule[iLeft], p->apRule[iRight]);
+    if (res == 0) {
+        res = ruleMergeSeq(p, iLeft) - ruleMergeSeq(p, iRight);
+    }
+    return (res > 0 || (res == 0 && iLeft < iRight));
+}
+
+static void
+ruleMergeSiftDown(p, iHeap)
+    CssRuleMerge *p;
+    int iHeap;
+{
+    int *aHeap = p->aHeap;
+    for (;;) {
+        int iChild = iHeap * 2 + 1;
+        int iTmp;
+        if (iChild >= p->nHeap) break;
+        if (iChild + 1 < p->nHeap && 
+            ruleMergeBefore(p, aHeap[iChild + 1], aHeap[iChild])
+        ) {
+            iChild++;
+        }
+        if (!ruleMergeBefore(p, aHeap[iChild], aHeap[iHeap])) break;
+        iTmp = aHeap[iChild];
+        aHeap[iChild] = aHeap[iHeap];
+        aHeap[iHeap] = iTmp;
+        iHeap = iChild;
+    }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * ruleMergeInit --
+ *
+ *     Initialise the CssRuleMerge structure p to merge the n rule lists
+ *     in array apRule[]. Entries of apRule[] may be NULL (empty lists).
+ *     Array aSeq[] contains the layer sequence number of each list (see
+ *     styleSheetLayerSeq()). ruleMergeFinish() must be called to clean 
+ *     up p.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     The entries of apRule[] are advanced as rules are returned by
+ *     ruleMergeNext().
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+ruleMergeInit(p, apRule, aSeq, n)
+    CssRuleMerge *p;
+    CssRule **apRule;
+    int *aSeq;
+    int n;
+{
+    int ii;
+
+    p->apRule = apRule;
+    p->aSeq = aSeq;
+    p->aHeap = p->aStatic;
+    if (n > CSS_MERGE_STATIC) {
+        p->aHeap = (int *)HtmlAlloc("CssRuleMerge.aHeap", n * sizeof(int));
+    }
+
+    p->nHeap = 0;
+    for (ii = 0; ii < n; ii++) {
+        if (apRule[ii]) {
+            p->aHeap[p->nHeap++] = ii;
+        }
+    }
+    for (ii = p->nHeap / 2 - 1; ii >= 0; ii--) {
+        ruleMergeSiftDown(p, ii);
+    }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * ruleMergeNext --
+ *
+ *     Remove the highest priority remaining rule from the lists being 
+ *     merged by p.
+ *
+ * Results:
+ *     The rule removed, or NULL if all lists are empty.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static CssRule *
+ruleMergeNext(p)
+    CssRuleMerge *p;
+{
+    CssRule *pRet = 0;
+    if (p->nHeap > 0) {
+        int iList = p->aHeap[0];
+        pRet = p->apRule[iList];
+        p->apRule[iList] = pRet->pNext;
+        if (!pRet->pNext) {
+            p->aHeap[0] = p->aHeap[--p->nHeap];
+        }
+        ruleMergeSiftDown(p, 0);
+    }
+    return pRet;
+}
+
+static void
+ruleMergeFinish(p)
+    CssRuleMerge *p;
+{
+    if (p->aHeap != p->aStatic) {
+        HtmlFree(p->aHeap);
+    }
+    p->aHeap = 0;
+}
+
+/*
+ * Style-sharing cache.
+ *
+ * Documents often contain long runs of elements that are certain to be
+ * assigned identical computed values - for example the cells of a large
+ * table, all with the same tag and "class" attribute. Instead of testing
+ * every candidate rule against each of them, HtmlCssStyleSheetApply() 
+ * reuses the HtmlComputedValues of a recently styled element if the two
+ * elements are provably equivalent:
+ *
+ *   * Both have the same tag, the same attributes (names, values and order)
+ *     and the same HTML_DYNAMIC_XXX flags.
+ *
+ *   * Neither has an inline "style" attribute or any property overrides.
+ *
+ *   * Their parents are the same node, or are themselves equivalent.
+ *
+ *   * None of the selectors tested against the earlier element were
+ *     dynamic or have the CssSelector.isNoShare flag set, and no tcl()
+ *     property value was evaluated while styling it.
+ *
+ * Equivalence is tracked using HtmlElementNode.iStyleShare. An element
+ * styled the slow way is assigned a new id (from HtmlTree.iStyleShareId).
+ * An element that shares the style of another is assigned the same id as
+ * the other. Ids assigned by earlier style passes (those less than
+ * CssStyleShare.iFirstId) are ignored.
+ *
+ * An instance of the following structure exists for the duration of each
+ * HtmlStyleApply() pass. It is pointed to by HtmlTree.pStyleShare.
+ */
+#define CSS_STYLESHARE_SLOTS 8
+typedef struct CssStyleShare CssStyleShare;
+struct CssStyleShare {
+    int iFirstId;                  /* First id assigned during this pass */
+    int iNextSlot;                 /* Index of aSlot[] entry to replace next */
+    HtmlElementNode *aSlot[CSS_STYLESHARE_SLOTS];   /* Candidate elements */
+    int nStyled;                   /* Number of elements styled */
+    int nShared;                   /* Number that reused another's style */
+};
+
+/*--------------------------------------------------------------------------
+ *
+ * HtmlCssStyleShareInit --
+ *
+ *     Called by HtmlStyleApply() before styling any nodes to create the
+ *     style-sharing cache for the pass.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     Sets HtmlTree.pStyleShare.
+ *
+ *--------------------------------------------------------------------------
+ */
+void
+HtmlCssStyleShareInit(pTree)
+    HtmlTree *pTree;
+{
+    CssStyleShare *pShare;
+    assert(!pTree->pStyleShare);
+    pShare = HtmlNew(CssStyleShare);
+    pShare->iFirstId = pTree->iStyleShareId + 1;
+    pTree->pStyleShare = (void *)pShare;
+}
+
+/*--------------------------------------------------------------------------
+ *
+ * HtmlCssStyleShareFinish --
+ *
+ *     Called by HtmlStyleApply() after a style pass to delete the 
+ *     style-sharing cache created by HtmlCssStyleShareInit().
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     Clears HtmlTree.pStyleShare.
+ *
+ *--------------------------------------------------------------------------
+ */
+void
+HtmlCssStyleShareFinish(pTree)
+    HtmlTree *pTree;
+{
+    CssStyleShare *pShare = (CssStyleShare *)pTree->pStyleShare;
+    if (pShare) {
+        LOG {
+            HtmlLog(pTree, "STYLEENGINE", 
+                "style sharing: %d/%d elements reused a computed style",
+                pShare->nShared, pShare->nStyled
+            );
+        }
+        HtmlFree(pShare);
+        pTree->pStyleShare = 0;
+    }
+}
+
+/*--------------------------------------------------------------------------
+ *
+ * styleShareEquivalent --
+ *
+ *     Return true if nodes pA and pB are known to be equivalent for the
+ *     purposes of the style-sharing cache. Either argument may be NULL.
  *
  * Results:
- *     None.
+ *     See above.
  *
  * Side effects:
  *     None.
  *
- *---------------------------------------------------------------------------
+ *--------------------------------------------------------------------------
  */
-static void 
-overrideToPropertyValues(pTree, p, aPropDone, pOverride)
-    HtmlTree *pTree;
-    HtmlComputedValuesCreator *p;
-    int *aPropDone;
-    Tcl_Obj *pOverride;
+static int
+styleShareEquivalent(pShare, pA, pB)
+    CssStyleShare *pShare;
+    HtmlNode *pA;
+    HtmlNode *pB;
 {
-    Tcl_Obj **apObj = 0;
-    int nObj = 0;
-    int ii;
-
-    if (!pOverride) return;
-    Tcl_ListObjGetElements(0, pOverride, &nObj, &apObj);
-
-    for (ii = 0; ii < (nObj - 1); ii += 2) { 
-        int eProp;
-        const char *zProp;
-        int nProp;
-
-        zProp = Tcl_GetStringFromObj(apObj[ii], &nProp);
-        eProp = HtmlCssPropertyLookup(nProp, zProp);
-
-        if (eProp < 0) {
-          LOG {
-            HtmlLog(pTree, "override: wrong css prop: %s", zProp);
-          }
-          continue;
-        }
-
-	if (eProp <= CSS_PROPERTY_MAX_PROPERTY && 0 == aPropDone[eProp]) {
-            const char *zVal = Tcl_GetString(apObj[ii + 1]);
-            CssProperty *pProp = HtmlCssStringToProperty(zVal, -1);
-            if (0 == HtmlComputedValuesSet(p, eProp, pProp)) {
-                aPropDone[eProp] = 1;
-            }
-            HtmlComputedValuesFreeProperty(p, pProp);
-        }
-    }
+    HtmlElementNode *pElemA;
+    HtmlElementNode *pElemB;
+
+    if (pA == pB) return 1;
+    if (!pA || !pB) return 0;
+
+    pElemA = HtmlNodeAsElement(pA);
+    pElemB = HtmlNodeAsElement(pB);
+    return (
+        pElemA && pElemB &&
+        pElemA->iStyleShare == pElemB->iStyleShare &&
+        pElemA->iStyleShare >= pShare->iFirstId
+    );
 }
 
 /*--------------------------------------------------------------------------
  *
- * applyRule --
+ * styleShareAttributesMatch --
  *
- *     Test the selector of pRule against node pNode. If there is a match,
- *     add the rules properties to the computed values being accumulated in
- *     pCreator.
+ *     Return true if element nodes pA and pB have identical tags and 
+ *     attribute lists.
  *
  * Results:
- *
- *     The value returned is true if the selector matched, or false otherwise.
+ *     See above.
  *
  * Side effects:
+ *     None.
  *
  *--------------------------------------------------------------------------
  */
-static int 
-applyRule(pTree, pNode, pRule, aPropDone, pzIfMatch, pCreator)
-    HtmlTree *pTree;
-    HtmlNode *pNode;
-    CssRule *pRule;
-    int *aPropDone;
-    char **pzIfMatch;
-    HtmlComputedValuesCreator *pCreator;
+static int
+styleShareAttributesMatch(pA, pB)
+    HtmlElementNode *pA;
+    HtmlElementNode *pB;
 {
-    /* Test if the selector matches the node. Variable isMatch is set to
-     * true if the selector matches, or false otherwise. 
-     */
-    CssSelector *pSelector = pRule->pSelector;
-    int isMatch = HtmlCssSelectorTest(pSelector, pNode, 0);
+    HtmlAttributes *pAttrA = pA->pAttributes;
+    HtmlAttributes *pAttrB = pB->pAttributes;
+    int nA = pAttrA ? pAttrA->nAttr : 0;
+    int nB = pAttrB ? pAttrB->nAttr : 0;
+    int ii;
 
-    /* There is a match. Log some output for debugging. */
-    LOG {
-        CssPriority *pPriority = pRule->pPriority;
-        Tcl_Obj *pS = Tcl_NewObj();
-        Tcl_IncrRefCount(pS);
-        HtmlCssSelectorToString(pSelector, pS);
-        HtmlLog(pTree, "STYLEENGINE", "%s %s (%s)"
-            " from \"%s%s\"",
-            Tcl_GetString(HtmlNodeCommand(pTree, pNode)),
-            (isMatch ? "matches" : "nomatch"),
-            Tcl_GetString(pS),
-            pPriority->origin == CSS_ORIGIN_AUTHOR ? "author" :
-            pPriority->origin == CSS_ORIGIN_AGENT ? "agent" : "user",
-            Tcl_GetString(pPriority->pIdTail)
-        );
-        Tcl_DecrRefCount(pS);
+    if (
+        pA->node.eTag != pB->node.eTag ||
+        (pA->node.zTag != pB->node.zTag && 
+            (!pA->node.zTag || !pB->node.zTag ||
+             strcmp(pA->node.zTag, pB->node.zTag))
+        ) ||
+        nA != nB
+    ) {
+        return 0;
     }
-    if (isMatch) {
 
-        if (pzIfMatch) {
-            HtmlComputedValuesInit(pTree, pNode, pNode, pCreator);
-            pCreator->pzContent = pzIfMatch;
+    for (ii = 0; ii < nA; ii++) {
+        const char *zA = pAttrA->a[ii].zValue;
+        const char *zB = pAttrB->a[ii].zValue;
+        if (
+            pAttrA->a[ii].zName != pAttrB->a[ii].zName ||
+            (zA != zB && (!zA || !zB || strcmp(zA, zB)))
+        ) {
+            return 0;
         }
-  
-        /* Copy the properties from the rule into the computed values set. */
-        ruleToPropertyValues(pCreator, aPropDone, pRule);
     }
-
-    assert(isMatch == 0 || isMatch == 1);
-    return isMatch;
+    return 1;
 }
 
 /*--------------------------------------------------------------------------
  *
- * nextRule --
+ * styleShareLookup --
+ *
+ *     Search the style-sharing cache for an element equivalent to pElem.
  *
  * Results:
+ *     Pointer to the equivalent element, or NULL if there is none.
  *
  * Side effects:
+ *     None.
  *
  *--------------------------------------------------------------------------
  */
-static CssRule *
-nextRule(apRule, n)
-    CssRule **apRule;
-    int n;
+static HtmlElementNode *
+styleShareLookup(pShare, pElem)
+    CssStyleShare *pShare;
+    HtmlElementNode *pElem;
 {
-    CssRule **ppRule = 0;
-    CssRule *pRet = 0;
-    int i;
+    HtmlNode *pParent = HtmlNodeParent(&pElem->node);
+    int ii;
 
-    for (i = 0; i < n; i++) {
-        if (apRule[i] && (ppRule == 0 || ruleCompare(apRule[i], *ppRule) > 0)) {
-            ppRule = &apRule[i];
+    for (ii = 0; ii < CSS_STYLESHARE_SLOTS; ii++) {
+        HtmlElementNode *p = pShare->aSlot[ii];
+        if (
+            p && p != pElem &&
+            p->pPropertyValues &&
+            p->flags == pElem->flags &&
+            styleShareEquivalent(pShare, HtmlNodeParent(&p->node), pParent) &&
+            styleShareAttributesMatch(p, pElem)
+        ) {
+            return p;
         }
     }
-
-    if (ppRule) {
-        pRet = *ppRule;
-        *ppRule = (*ppRule)->pNext;
-    }
-
-    return pRet;
+    return 0;
 }
 
 /*--------------------------------------------------------------------------
@@ -3546,52 +5238,126 @@ HtmlCssStyleSheetApply(pTree, pNode)
     char const *zClassAttr;            /* Value of node "class" attribute */
     char const *zIdAttr;               /* Value of node "id" attribute */
 
-    CssRule *apRule[MAX_CLASSES + 2];  /* Array of applicable rules lists. */
+    /* Array of applicable rules lists. Each layer of the stylesheet
+     * configuration may contribute up to (MAX_CLASSES + 2) lists. The
+     * static array is large enough for a configuration with one shared
+     * stylesheet layer, which is the usual case.
+     */
+    CssRule *aStaticRule[(MAX_CLASSES + 2) * 2];
+    int aStaticSeq[(MAX_CLASSES + 2) * 2];
+    CssRule **apRule = aStaticRule;
+    int *aSeq = aStaticSeq;                   /* Layer seq. of each list */
+    int nRuleAlloc = sizeof(aStaticRule) / sizeof(aStaticRule[0]);
     int npRule;
+    int nLayer = pStyle->nLayer + 1;
+    int iLayer;
+    CssRuleMerge sMerge;                      /* Merges lists in apRule */
 
     int nSelectorMatch = 0;
     int nSelectorTest = 0;
 
+    /* Style-sharing cache, if any. Variable isShareable is cleared if it
+     * is discovered that pNode may not share it's computed values.
+     */
+    CssStyleShare *pShare = (CssStyleShare *)pTree->pStyleShare;
+    int isShareable;
+
+    /* Ancestor filter, if it may be used for pNode. */
+    CssAncestorFilter *pFilter = (CssAncestorFilter *)pTree->pAncestorFilter;
+    int nFilterReject = 0;
+
     HtmlElementNode *pElem = HtmlNodeAsElement(pNode);
     assert(pElem);
 
-    /* The universal rules list applies to all nodes */
-    apRule[0] = pStyle->pUniversalRules;
-    npRule = 1;
+    /* The ancestor filter may only be used if it contains exactly the
+     * ancestors of pNode.
+     */
+    if (pFilter && (pFilter->nLevel == 0 ? 
+            HtmlNodeParent(pNode) != 0 :
+            pFilter->aLevel[pFilter->nLevel-1].pNode != HtmlNodeParent(pNode)
+    )) {
+        pFilter = 0;
+    }
+
+    isShareable = (pShare && !pElem->pStyle && !pElem->pOverride);
+    if (pShare) {
+        pShare->nStyled++;
+    }
+    if (isShareable) {
+        HtmlElementNode *pShared = styleShareLookup(pShare, pElem);
+        if (pShared) {
+            LOG {
+               HtmlLog(pTree, "STYLEENGINE", 
+                   "%s shares style with %s (matched 0/0 selectors)",
+                   Tcl_GetString(HtmlNodeCommand(pTree, pNode)),
+                   Tcl_GetString(HtmlNodeCommand(pTree, &pShared->node))
+               );
+            }
+            pShare->nShared++;
+            pElem->iStyleShare = pShared->iStyleShare;
+            pElem->pPropertyValues = pShared->pPropertyValues;
+            HtmlComputedValuesReference(pElem->pPropertyValues);
+            return;
+        }
+    }
 
-    /* Find the applicable "by-tag" rules list, if any. */
-    pEntry = Tcl_FindHashEntry(&pStyle->aByTag, pNode->zTag);
-    if (pEntry) {
-        apRule[npRule++] = Tcl_GetHashValue(pEntry);
+    if (nLayer * (MAX_CLASSES + 2) > nRuleAlloc) {
+        nRuleAlloc = nLayer * (MAX_CLASSES + 2);
+        apRule = (CssRule **)HtmlAlloc("temp", nRuleAlloc * sizeof(CssRule *));
+        aSeq = (int *)HtmlAlloc("temp", nRuleAlloc * sizeof(int));
     }
+    npRule = 0;
+    zIdAttr = HtmlAttrId(pElem->pAttributes);
+    zClassAttr = HtmlAttrClass(pElem->pAttributes);
+
+    for (iLayer = 0; iLayer < nLayer; iLayer++) {
+        CssStyleSheet *pSheet = styleSheetLayer(pStyle, iLayer);
+        int iSeq = styleSheetLayerSeq(pStyle, iLayer);
+
+        /* The universal rules list applies to all nodes */
+        if (pSheet->pUniversalRules) {
+            aSeq[npRule] = iSeq;
+            apRule[npRule++] = pSheet->pUniversalRules;
+        }
 
-    /* Find a rules list for the element id, if any */
-    zIdAttr = HtmlNodeAttr(pNode, "id");
-    if (zIdAttr) {
-        pEntry = Tcl_FindHashEntry(&pStyle->aById, zIdAttr);
+        /* Find the applicable "by-tag" rules list, if any. */
+        pEntry = Tcl_FindHashEntry(&pSheet->aByTag, pNode->zTag);
         if (pEntry) {
-            apRule[npRule++] = (CssRule *)Tcl_GetHashValue(pEntry);
+            aSeq[npRule] = iSeq;
+            apRule[npRule++] = Tcl_GetHashValue(pEntry);
+        }
+
+        /* Find a rules list for the element id, if any */
+        if (zIdAttr) {
+            pEntry = Tcl_FindHashEntry(&pSheet->aById, zIdAttr);
+            if (pEntry) {
+                aSeq[npRule] = iSeq;
+                apRule[npRule++] = (CssRule *)Tcl_GetHashValue(pEntry);
+            }
         }
     }
 
     /* Find a rules list for each class the element belongs to */
-    zClassAttr = HtmlNodeAttr(pNode, "class");
     if (zClassAttr) {
         int nClass;
         char const *zClass = zClassAttr;
         char zTerm[MAX_CLASS_NAME];
 
         while (
-            npRule < (MAX_CLASSES + 2) &&
+            npRule + nLayer <= nRuleAlloc &&
             (zClass = HtmlCssGetNextListItem(zClass, strlen(zClass), &nClass))
         ) {
             strncpy(zTerm, zClass, MIN(MAX_CLASS_NAME, nClass));
             zTerm[MIN(MAX_CLASS_NAME - 1, nClass)] = '\0';
             zClass += nClass;
 
-            pEntry = Tcl_FindHashEntry(&pStyle->aByClass, zTerm);
-            if (pEntry) {
-                apRule[npRule++] = (CssRule *)Tcl_GetHashValue(pEntry);
+            for (iLayer = 0; iLayer < nLayer; iLayer++) {
+                CssStyleSheet *pSheet = styleSheetLayer(pStyle, iLayer);
+                pEntry = Tcl_FindHashEntry(&pSheet->aByClass, zTerm);
+                if (pEntry) {
+                    aSeq[npRule] = styleSheetLayerSeq(pStyle, iLayer);
+                    apRule[npRule++] = (CssRule *)Tcl_GetHashValue(pEntry);
+                }
             }
         }
     }
@@ -3612,15 +5378,15 @@ HtmlCssStyleSheetApply(pTree, pNode)
     /* Loop through the list of CSS rules in the stylesheet. Rules that occur
      * earlier in the list have a higher priority than those that occur later.
      */
-    for (
-        pRule = nextRule(apRule, npRule); 
-        pRule; 
-        pRule = nextRule(apRule, npRule)
-    ) {
+    ruleMergeInit(&sMerge, apRule, aSeq, npRule);
+    while ((pRule = ruleMergeNext(&sMerge))) {
         CssPriority *pPriority = pRule->pPriority;
         CssSelector *pSelector = pRule->pSelector;
 
         nSelectorTest++;
+        if (pSelector->isDynamic || pSelector->isNoShare) {
+            isShareable = 0;
+        }
 
         /* The contents of the "style" attribute, if one exists, are handled
          * after the important rules but before anything else. This is because:
@@ -3638,6 +5404,16 @@ HtmlCssStyleSheetApply(pTree, pNode)
             }
         }
 
+        /* If the ancestor filter shows that the selector cannot match,
+         * skip the rule. Because the selector does not match regardless
+         * of the dynamic state of any node, there is no need to add a 
+         * dynamic condition either.
+         */
+        if (pFilter && ancestorFilterReject(pFilter, pRule)) {
+            nFilterReject++;
+            continue;
+        }
+
         /* If the selector is a match for our node, apply the rule properties */
         nSelectorMatch += 
                 applyRule(pTree, pNode, pRule, aPropDone, 0, &sCreator);
@@ -3646,25 +5422,45 @@ HtmlCssStyleSheetApply(pTree, pNode)
             pSelector->isDynamic &&
             HtmlCssSelectorTest(pSelector, pNode, 1)
         ) {
-            HtmlCssAddDynamic(pElem, pSelector, 0);
+            HtmlCssAddDynamic(pTree, pElem, pSelector, 0);
         }
     }
 
+    ruleMergeFinish(&sMerge);
+
     if (!isStyleDone && pElem->pStyle) {
         propertySetToPropertyValues(&sCreator, aPropDone, pElem->pStyle);
     }
 
     LOG {
-       HtmlLog(pTree, "STYLEENGINE", "%s matched %d/%d selectors",
+       HtmlLog(pTree, "STYLEENGINE", 
+           "%s matched %d/%d selectors (%d rejected by ancestor filter)",
            Tcl_GetString(HtmlNodeCommand(pTree, pNode)),
-           nSelectorMatch, nSelectorTest
+           nSelectorMatch, nSelectorTest, nFilterReject
        );
     }
 
     /* Call HtmlComputedValuesFinish() to finish creating the
      * HtmlComputedValues structure.
      */
+    if (sCreator.isTclScript) {
+        isShareable = 0;
+    }
     pElem->pPropertyValues = HtmlComputedValuesFinish(&sCreator);
+
+    /* Assign a new style-sharing id to the node. If it is shareable, add
+     * it to the style-sharing cache.
+     */
+    pElem->iStyleShare = ++pTree->iStyleShareId;
+    if (isShareable) {
+        pShare->aSlot[pShare->iNextSlot] = pElem;
+        pShare->iNextSlot = (pShare->iNextSlot + 1) % CSS_STYLESHARE_SLOTS;
+    }
+
+    if (apRule != aStaticRule) {
+        HtmlFree(apRule);
+        HtmlFree(aSeq);
+    }
 }
 
 /*--------------------------------------------------------------------------
@@ -3689,7 +5485,8 @@ generateContentText(pTree, zContent)
     HtmlTree *pTree;
     const char *zContent;
 {
-    HtmlTextNode *pTextNode = HtmlTextNew(strlen(zContent), zContent, 0, 0);
+    HtmlArena *pArena = HtmlTreeArena(pTree);
+    HtmlTextNode *pTextNode = HtmlTextNew(pArena, strlen(zContent), zContent, 0, 0);
     return pTextNode;
 }
 
@@ -3697,22 +5494,32 @@ generateContentText(pTree, zContent)
  *
  * generatedContent --
  *
+ *     Array apRule contains nRule lists of :after or :before rules (one
+ *     for each layer of the stylesheet configuration), and aSeq the
+ *     sequence number of each layer. The lists are merged in priority
+ *     order as they are applied.
+ *
  * Results:
  *
  *     None.
  *
  * Side effects:
  *
+ *     Modifies the entries of apRule.
+ *
  *--------------------------------------------------------------------------
  */
 static void 
-generatedContent(pTree, pNode, pCssRule, ppNode)
+generatedContent(pTree, pNode, apRule, aSeq, nRule, ppNode)
     HtmlTree *pTree;
     HtmlNode *pNode;
-    CssRule *pCssRule;        /* List of rules including :after or :before */
+    CssRule **apRule;         /* Lists of rules including :after or :before */
+    int *aSeq;                /* Layer sequence numbers (see ruleMergeInit) */
+    int nRule;                /* Number of entries in apRule[] */
     HtmlNode **ppNode;
 {
     CssRule *pRule;                                 /* Iterator variable */
+    CssRuleMerge sMerge;
     int have = 0;
 
     int aPropDone[CSS_PROPERTY_MAX_PROPERTY + 1];
@@ -3724,11 +5531,13 @@ generatedContent(pTree, pNode, pCssRule, ppNode)
     memset(aPropDone, 0, sizeof(aPropDone));
 
     sCreator.pzContent = &zContent;
-    for (pRule = pCssRule; pRule; pRule = pRule->pNext) {
+    ruleMergeInit(&sMerge, apRule, aSeq, nRule);
+    while ((pRule = ruleMergeNext(&sMerge))) {
         char **pz = (have ? 0 : (&zContent));
         int isMatch = applyRule(pTree, pNode, pRule, aPropDone, pz, &sCreator);
         if (isMatch) have = 1;
     }
+    ruleMergeFinish(&sMerge);
     if (have) {
         pValues = HtmlComputedValuesFinish(&sCreator);
     } else {
@@ -3736,7 +5545,7 @@ generatedContent(pTree, pNode, pCssRule, ppNode)
         return;
     }
 
-    *ppNode = (HtmlNode *)HtmlNew(HtmlElementNode);
+    *ppNode = (HtmlNode *)HtmlArenaNew(HtmlTreeArena(pTree), HtmlElementNode);
     ((HtmlElementNode *)(*ppNode))->pPropertyValues = pValues;
 
     if (zContent) {
@@ -3770,10 +5579,32 @@ void HtmlCssStyleGenerateContent(pTree, pElem, isBefore)
 {
     CssStyleSheet *pStyle = pTree->pStyle;    /* Stylesheet config */
     HtmlNode *pNode = (HtmlNode *)pElem;
+    CssRule *aStatic[8];
+    int aStaticSeq[8];
+    CssRule **apRule = aStatic;
+    int *aSeq = aStaticSeq;
+    int nRule = pStyle->nLayer + 1;
+    int ii;
+
+    if (nRule > sizeof(aStatic) / sizeof(aStatic[0])) {
+        apRule = (CssRule **)HtmlAlloc("temp", nRule * sizeof(CssRule *));
+        aSeq = (int *)HtmlAlloc("temp", nRule * sizeof(int));
+    }
+    for (ii = 0; ii < nRule; ii++) {
+        CssStyleSheet *pSheet = styleSheetLayer(pStyle, ii);
+        apRule[ii] = (isBefore ? pSheet->pBeforeRules : pSheet->pAfterRules);
+        aSeq[ii] = styleSheetLayerSeq(pStyle, ii);
+    }
+
     if (isBefore) {
-        generatedContent(pTree, pNode, pStyle->pBeforeRules, &pElem->pBefore);
+        generatedContent(pTree, pNode, apRule, aSeq, nRule, &pElem->pBefore);
     } else {
-        generatedContent(pTree, pNode, pStyle->pAfterRules, &pElem->pAfter);
+        generatedContent(pTree, pNode, apRule, aSeq, nRule, &pElem->pAfter);
+    }
+
+    if (apRule != aStatic) {
+        HtmlFree(apRule);
+        HtmlFree(aSeq);
     }
 }
 
@@ -4072,6 +5903,7 @@ HtmlCssStyleReport(clientData, interp, objc, objv)
     CssRule *pRule;
     Tcl_HashEntry *pEntry;
     Tcl_HashSearch search;
+    int iLayer;
 
     Tcl_Obj *pAfter;
     Tcl_Obj *pBefore;
@@ -4089,7 +5921,10 @@ HtmlCssStyleReport(clientData, interp, objc, objv)
         "<h1>Universal Rules</h1>",
         "<table border=1>", NULL
     );
-    rulelistReport(pStyle->pUniversalRules, pUniversal, &nUniversal);
+    for (iLayer = 0; iLayer <= pStyle->nLayer; iLayer++) {
+        CssStyleSheet *pSheet = styleSheetLayer(pStyle, iLayer);
+        rulelistReport(pSheet->pUniversalRules, pUniversal, &nUniversal);
+    }
     Tcl_AppendStringsToObj(pUniversal, "</table>", NULL);
 
     pAfter = Tcl_NewObj();
@@ -4098,7 +5933,10 @@ HtmlCssStyleReport(clientData, interp, objc, objv)
         "<h1>After Rules</h1>",
         "<table border=1>", NULL
     );
-    rulelistReport(pStyle->pAfterRules, pAfter, &nAfter);
+    for (iLayer = 0; iLayer <= pStyle->nLayer; iLayer++) {
+        CssStyleSheet *pSheet = styleSheetLayer(pStyle, iLayer);
+        rulelistReport(pSheet->pAfterRules, pAfter, &nAfter);
+    }
     Tcl_AppendStringsToObj(pAfter, "</table>", NULL);
 
     pBefore = Tcl_NewObj();
@@ -4107,7 +5945,10 @@ HtmlCssStyleReport(clientData, interp, objc, objv)
         "<h1>Before Rules</h1>",
         "<table border=1>", NULL
     );
-    rulelistReport(pStyle->pBeforeRules, pBefore, &nBefore);
+    for (iLayer = 0; iLayer <= pStyle->nLayer; iLayer++) {
+        CssStyleSheet *pSheet = styleSheetLayer(pStyle, iLayer);
+        rulelistReport(pSheet->pBeforeRules, pBefore, &nBefore);
+    }
     Tcl_AppendStringsToObj(pBefore, "</table>", NULL);
 
     pByTag = Tcl_NewObj();
@@ -4116,13 +5957,16 @@ HtmlCssStyleReport(clientData, interp, objc, objv)
         "<h1>By Tag Rules</h1>",
         "<table border=1>", NULL
     );
-    for (
-        pEntry = Tcl_FirstHashEntry(&pStyle->aByTag, &search);
-        pEntry;
-        pEntry = Tcl_NextHashEntry(&search)
-    ) {
-        pRule = (CssRule *)Tcl_GetHashValue(pEntry);
-        rulelistReport(pRule, pByTag, &nByTag);
+    for (iLayer = 0; iLayer <= pStyle->nLayer; iLayer++) {
+        CssStyleSheet *pSheet = styleSheetLayer(pStyle, iLayer);
+        for (
+            pEntry = Tcl_FirstHashEntry(&pSheet->aByTag, &search);
+            pEntry;
+            pEntry = Tcl_NextHashEntry(&search)
+        ) {
+            pRule = (CssRule *)Tcl_GetHashValue(pEntry);
+            rulelistReport(pRule, pByTag, &nByTag);
+        }
     }
     Tcl_AppendStringsToObj(pByTag, "</table>", NULL);
 
@@ -4132,13 +5976,16 @@ HtmlCssStyleReport(clientData, interp, objc, objv)
         "<h1>By Class Rules</h1>",
         "<table border=1>", NULL
     );
-    for (
-        pEntry = Tcl_FirstHashEntry(&pStyle->aByClass, &search);
-        pEntry;
-        pEntry = Tcl_NextHashEntry(&search)
-    ) {
-        pRule = (CssRule *)Tcl_GetHashValue(pEntry);
-        rulelistReport(pRule, pByClass, &nByClass);
+    for (iLayer = 0; iLayer <= pStyle->nLayer; iLayer++) {
+        CssStyleSheet *pSheet = styleSheetLayer(pStyle, iLayer);
+        for (
+            pEntry = Tcl_FirstHashEntry(&pSheet->aByClass, &search);
+            pEntry;
+            pEntry = Tcl_NextHashEntry(&search)
+        ) {
+            pRule = (CssRule *)Tcl_GetHashValue(pEntry);
+            rulelistReport(pRule, pByClass, &nByClass);
+        }
     }
     Tcl_AppendStringsToObj(pByClass, "</table>", NULL);
 
@@ -4148,13 +5995,16 @@ HtmlCssStyleReport(clientData, interp, objc, objv)
         "<h1>By Id Rules</h1>",
         "<table border=1>", NULL
     );
-    for (
-        pEntry = Tcl_FirstHashEntry(&pStyle->aById, &search);
-        pEntry;
-        pEntry = Tcl_NextHashEntry(&search)
-    ) {
-        pRule = (CssRule *)Tcl_GetHashValue(pEntry);
-        rulelistReport(pRule, pById, &nById);
+    for (iLayer = 0; iLayer <= pStyle->nLayer; iLayer++) {
+        CssStyleSheet *pSheet = styleSheetLayer(pStyle, iLayer);
+        for (
+            pEntry = Tcl_FirstHashEntry(&pSheet->aById, &search);
+            pEntry;
+            pEntry = Tcl_NextHashEntry(&search)
+        ) {
+            pRule = (CssRule *)Tcl_GetHashValue(pEntry);
+            rulelistReport(pRule, pById, &nById);
+        }
     }
     Tcl_AppendStringsToObj(pById, "</table>", NULL);
 
@@ -4200,6 +6050,172 @@ HtmlCssStyleReport(clientData, interp, objc, objv)
     return TCL_OK;
 }
 
+/*
+ * The following structure is used by HtmlCssSelectorBench() to collect
+ * the element nodes of the document and the rules of the stylesheet.
+ */
+typedef struct SelectorBench SelectorBench;
+struct SelectorBench {
+    int nNode;                 /* Number of entries in apNode[] */
+    int nNodeAlloc;            /* Allocated size of apNode[] */
+    HtmlNode **apNode;         /* Element nodes of the document */
+    int nRule;                 /* Number of entries in apRule[] */
+    int nRuleAlloc;            /* Allocated size of apRule[] */
+    CssRule **apRule;          /* Rules of the stylesheet */
+};
+
+static int
+benchNodeCb(pTree, pNode, clientData)
+    HtmlTree *pTree;
+    HtmlNode *pNode;
+    ClientData clientData;
+{
+    SelectorBench *p = (SelectorBench *)clientData;
+    if (!HtmlNodeIsText(pNode)) {
+        if (p->nNode == p->nNodeAlloc) {
+            p->nNodeAlloc = p->nNodeAlloc * 2 + 64;
+            p->apNode = (HtmlNode **)HtmlRealloc("SelectorBench.apNode",
+                p->apNode, p->nNodeAlloc * sizeof(HtmlNode *)
+            );
+        }
+        p->apNode[p->nNode++] = pNode;
+    }
+    return HTML_WALK_DESCEND;
+}
+
+static void
+benchAddRules(p, pRule)
+    SelectorBench *p;
+    CssRule *pRule;
+{
+    for ( ; pRule; pRule = pRule->pNext) {
+        if (p->nRule == p->nRuleAlloc) {
+            p->nRuleAlloc = p->nRuleAlloc * 2 + 64;
+            p->apRule = (CssRule **)HtmlRealloc("SelectorBench.apRule",
+                p->apRule, p->nRuleAlloc * sizeof(CssRule *)
+            );
+        }
+        p->apRule[p->nRule++] = pRule;
+    }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlCssSelectorBench --
+ *
+ *     html _selectorbench ?ITERATIONS?
+ *
+ *     Test the selector of every rule in the stylesheet against every
+ *     element node in the document, ITERATIONS times (default 1). The
+ *     result is a key-value list of the form:
+ *
+ *         rules R nodes N tests T matches M usec U rate S
+ *
+ *     where T is the number of selector tests performed, M the number 
+ *     that matched, U the total time taken in microseconds and S the
+ *     resulting throughput in selectors tested per second.
+ *
+ * Results:
+ *     Standard Tcl result.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+int
+HtmlCssSelectorBench(clientData, interp, objc, objv)
+    ClientData clientData;             /* The HTML widget data structure */
+    Tcl_Interp *interp;                /* Current interpreter. */
+    int objc;                          /* Number of arguments. */
+    Tcl_Obj *CONST objv[];             /* Argument strings. */
+{
+    HtmlTree *pTree = (HtmlTree *)clientData;
+    CssStyleSheet *pStyle = pTree->pStyle;
+    SelectorBench sBench;
+    int nIter = 1;
+    int nMatch = 0;
+    Tcl_WideInt nTest;
+    Tcl_WideInt iUsec;
+    double rate = 0.0;
+    Tcl_Time t1;
+    Tcl_Time t2;
+    Tcl_Obj *pRet;
+    int ii;
+    int iLayer;
+
+    if (objc != 2 && objc != 3) {
+        Tcl_WrongNumArgs(interp, 2, objv, "?ITERATIONS?");
+        return TCL_ERROR;
+    }
+    if (objc == 3 && Tcl_GetIntFromObj(interp, objv[2], &nIter)) {
+        return TCL_ERROR;
+    }
+    if (nIter < 1) nIter = 1;
+
+    memset(&sBench, 0, sizeof(SelectorBench));
+    for (iLayer = 0; pStyle && iLayer <= pStyle->nLayer; iLayer++) {
+        CssStyleSheet *pSheet = styleSheetLayer(pStyle, iLayer);
+        Tcl_HashTable *aTab[3];
+        aTab[0] = &pSheet->aByTag;
+        aTab[1] = &pSheet->aByClass;
+        aTab[2] = &pSheet->aById;
+        benchAddRules(&sBench, pSheet->pUniversalRules);
+        benchAddRules(&sBench, pSheet->pAfterRules);
+        benchAddRules(&sBench, pSheet->pBeforeRules);
+        for (ii = 0; ii < 3; ii++) {
+            Tcl_HashSearch search;
+            Tcl_HashEntry *pEntry = Tcl_FirstHashEntry(aTab[ii], &search);
+            for ( ; pEntry; pEntry = Tcl_NextHashEntry(&search)) {
+                benchAddRules(&sBench, (CssRule *)Tcl_GetHashValue(pEntry));
+            }
+        }
+    }
+    if (pTree->pRoot) {
+        HtmlWalkTree(pTree, pTree->pRoot, benchNodeCb, (ClientData)&sBench);
+    }
+
+    Tcl_GetTime(&t1);
+    for (ii = 0; ii < nIter; ii++) {
+        int iNode;
+        for (iNode = 0; iNode < sBench.nNode; iNode++) {
+            HtmlNode *pNode = sBench.apNode[iNode];
+            int iRule;
+            for (iRule = 0; iRule < sBench.nRule; iRule++) {
+                CssSelector *pSelector = sBench.apRule[iRule]->pSelector;
+                if (HtmlCssSelectorTest(pSelector, pNode, 0)) nMatch++;
+            }
+        }
+    }
+    Tcl_GetTime(&t2);
+
+    nTest = (Tcl_WideInt)nIter * sBench.nNode * sBench.nRule;
+    iUsec = (Tcl_WideInt)(t2.sec - t1.sec) * 1000000 + (t2.usec - t1.usec);
+    if (iUsec > 0) {
+        rate = (double)nTest * 1000000.0 / (double)iUsec;
+    }
+
+    pRet = Tcl_NewObj();
+    Tcl_ListObjAppendElement(0, pRet, Tcl_NewStringObj("rules", -1));
+    Tcl_ListObjAppendElement(0, pRet, Tcl_NewIntObj(sBench.nRule));
+    Tcl_ListObjAppendElement(0, pRet, Tcl_NewStringObj("nodes", -1));
+    Tcl_ListObjAppendElement(0, pRet, Tcl_NewIntObj(sBench.nNode));
+    Tcl_ListObjAppendElement(0, pRet, Tcl_NewStringObj("tests", -1));
+    Tcl_ListObjAppendElement(0, pRet, Tcl_NewWideIntObj(nTest));
+    Tcl_ListObjAppendElement(0, pRet, Tcl_NewStringObj("matches", -1));
+    Tcl_ListObjAppendElement(0, pRet, Tcl_NewIntObj(nMatch / nIter));
+    Tcl_ListObjAppendElement(0, pRet, Tcl_NewStringObj("usec", -1));
+    Tcl_ListObjAppendElement(0, pRet, Tcl_NewWideIntObj(iUsec));
+    Tcl_ListObjAppendElement(0, pRet, Tcl_NewStringObj("rate", -1));
+    Tcl_ListObjAppendElement(0, pRet, Tcl_NewWideIntObj((Tcl_WideInt)rate));
+    Tcl_SetObjResult(interp, pRet);
+
+    HtmlFree(sBench.apNode);
+    HtmlFree(sBench.apRule);
+    return TCL_OK;
+}
+
 /*
  *---------------------------------------------------------------------------
  *
@@ -4258,27 +6274,31 @@ HtmlCssStyleConfigDump(clientData, interp, objc, objv)
     Tcl_Obj *pRet;
     int nRule = 0;
     int jj = 0;
+    int iLayer;
 
-    for (pRule = pStyle->pUniversalRules; pRule; pRule = pRule->pNext) {
-        if (nRule < MAX_RULES) {
-            apRule[nRule++] = pRule;
+    for (iLayer = 0; iLayer <= pStyle->nLayer; iLayer++) {
+        CssStyleSheet *pSheet = styleSheetLayer(pStyle, iLayer);
+        for (pRule = pSheet->pUniversalRules; pRule; pRule = pRule->pNext) {
+            if (nRule < MAX_RULES) {
+                apRule[nRule++] = pRule;
+            }
         }
-    }
 
-    apTable[0] = &pStyle->aByTag;
-    apTable[1] = &pStyle->aById;
-    apTable[2] = &pStyle->aByClass;
-    for (jj = 0; jj < 3; jj++) {
-        Tcl_HashEntry *pEntry;
-        Tcl_HashSearch search;
-        for (pEntry = Tcl_FirstHashEntry(apTable[jj], &search);
-             pEntry;
-             pEntry = Tcl_NextHashEntry(&search)
-        ) {
-            pRule = (CssRule *)Tcl_GetHashValue(pEntry);
-            for ( ; pRule; pRule = pRule->pNext) {
-                if (nRule < MAX_RULES) {
-                    apRule[nRule++] = pRule;
+        apTable[0] = &pSheet->aByTag;
+        apTable[1] = &pSheet->aById;
+        apTable[2] = &pSheet->aByClass;
+        for (jj = 0; jj < 3; jj++) {
+            Tcl_HashEntry *pEntry;
+            Tcl_HashSearch search;
+            for (pEntry = Tcl_FirstHashEntry(apTable[jj], &search);
+                 pEntry;
+                 pEntry = Tcl_NextHashEntry(&search)
+            ) {
+                pRule = (CssRule *)Tcl_GetHashValue(pEntry);
+                for ( ; pRule; pRule = pRule->pNext) {
+                    if (nRule < MAX_RULES) {
+                        apRule[nRule++] = pRule;
+                    }
                 }
             }
         }
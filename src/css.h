@@ -154,6 +154,7 @@ const char *HtmlCssGetNextCommaListItem(const char *z, int n, int *pN);
 int HtmlCssParse(Tcl_Obj *, int, Tcl_Obj *, Tcl_Obj *, CssStyleSheet **);
 int HtmlCssStyleSheetSyntaxErrs(CssStyleSheet *);
 void HtmlCssStyleSheetFree(CssStyleSheet *);
+void HtmlCssSharedStyleSweep(HtmlInterpData *, int);
 
 /* Values to pass as the second argument ("origin") of HtmlCssParse() */
 #define CSS_ORIGIN_AGENT  1
@@ -164,6 +165,12 @@ void HtmlCssStyleSheetFree(CssStyleSheet *);
  * Function to apply a stylesheet to a document node.
  */
 void HtmlCssStyleSheetApply(HtmlTree *, HtmlNode *);
+void HtmlCssStyleShareInit(HtmlTree *);
+void HtmlCssStyleShareFinish(HtmlTree *);
+void HtmlCssAncestorFilterInit(HtmlTree *);
+void HtmlCssAncestorFilterFinish(HtmlTree *);
+void HtmlCssAncestorFilterPush(HtmlTree *, HtmlNode *);
+void HtmlCssAncestorFilterPop(HtmlTree *, HtmlNode *);
 void HtmlCssStyleSheetGenerated(HtmlTree *, HtmlElementNode *);
 void HtmlCssStyleGenerateContent(HtmlTree *, HtmlElementNode *, int);
 
@@ -180,9 +187,12 @@ int HtmlCssInlineQuery(Tcl_Interp *, CssPropertySet *, Tcl_Obj *);
 */
 
 Tcl_ObjCmdProc HtmlCssStyleReport;
+Tcl_ObjCmdProc HtmlCssSelectorBench;
+Tcl_ObjCmdProc HtmlCssSharedStyleStats;
 
 void HtmlCssCheckDynamic(HtmlTree *);
-void HtmlCssFreeDynamics(HtmlElementNode *);
+void HtmlCssFreeDynamics(HtmlTree *, HtmlElementNode *);
+void HtmlCssClassListFree(HtmlElementNode *);
 int  HtmlCssTclNodeDynamics(Tcl_Interp *, HtmlNode *);
 
 /* The interface to the csssearch.c module. This module is responsible
@@ -193,6 +203,10 @@ int HtmlCssSearchShutdown(HtmlTree *);
 int HtmlCssSearchInvalidateCache(HtmlTree *);
 Tcl_ObjCmdProc HtmlCssSearch;
 
+void HtmlCssSearchIndexAdd(HtmlTree *, HtmlNode *);
+void HtmlCssSearchIndexRemove(HtmlTree *, HtmlNode *);
+void HtmlCssSearchIndexReset(HtmlTree *);
+
 #if 0
 
 /* Future interface for :before and :after pseudo-elements. Need this to 
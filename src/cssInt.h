@@ -48,6 +48,8 @@ typedef struct CssParse CssParse;
 typedef struct CssToken CssToken;
 typedef struct CssPriority CssPriority;
 typedef struct CssProperties CssProperties;
+typedef struct CssProgram CssProgram;
+typedef struct CssProgramOp CssProgramOp;
 
 typedef unsigned char u8;
 typedef unsigned int u32;
@@ -110,6 +112,12 @@ typedef unsigned int u32;
 
 #define CSS_SELECTOR_NEVERMATCH 43
 
+/*
+** Opcodes used only in compiled selector programs (see CssProgram).
+*/
+#define CSS_OP_TAG             46     /* Tag name atom (pointer compare) */
+#define CSS_OP_CLASS           47     /* Class name atom (pointer compare) */
+
 
 /*
  * Before they are passed to the lemon-generated parser, the tokenizer
@@ -133,10 +141,30 @@ struct CssToken {
  */
 struct CssSelector {
     u8 isDynamic;     /* True if this selector is dynamic */
+    u8 isNoShare;     /* True if selector prevents style-sharing (css.c) */
     u8 eSelector;     /* CSS_SELECTOR* or CSS_PSEUDO* value */
     char *zAttr;      /* The attribute queried, if any. */
     char *zValue;     /* The value tested for, if any. */
     CssSelector *pNext;  /* Next simple-selector in chain */
+    CssProgram *pProgram;  /* Compiled chain. Head of chain only (css.c) */
+};
+
+/*
+ * When a rule is added to a stylesheet its selector chain is compiled
+ * into an array of CssProgramOp structures, one per simple-selector, in
+ * the same order as the linked list. Tag names and class names are
+ * resolved to atoms at compile time, so that testing them against a
+ * node is a pointer comparison. See selectorCompile() in css.c.
+ */
+struct CssProgramOp {
+    u8 eOp;              /* CSS_SELECTOR*, CSS_PSEUDO* or CSS_OP* value */
+    const char *zValue;  /* Value or atom tested for, if any */
+    const char *zAttr;   /* The attribute queried, if any */
+};
+struct CssProgram {
+    HtmlInterpData *pAtoms;  /* Owner of the atoms (or NULL) */
+    int nOp;             /* Number of entries in aOp[] */
+    CssProgramOp aOp[1]; /* Array of nOp ops (allocated past end) */
 };
 
 /*
@@ -155,11 +183,20 @@ struct CssProperties {
     CssRule **apRule;
 };
 
+#define CSS_MAX_ANCESTOR_HASH 4
 struct CssRule {
     CssPriority *pPriority;  /* Pointer to the priority of source stylesheet */
     int specificity;         /* Specificity of the selector */
     int iRule;               /* Rule-number within source style sheet */
+    int iSeq;                /* CssParse.iSeq of the parse that added it */
     CssSelector *pSelector;  /* The selector-chain for this rule */
+
+    /* Hashes of tags, ids and classes that must be present on an ancestor
+     * of any node that matches pSelector. Zero for unused entries. See
+     * the ancestor filter in css.c.
+     */
+    unsigned int aAncestorHash[CSS_MAX_ANCESTOR_HASH];
+
     int freePropertySets;          /* True to delete pPropertySet */
     int freeSelector;              /* True to delete pSelector */
     CssPropertySet *pPropertySet;  /* Property values for the rule. */
@@ -204,6 +241,12 @@ struct CssPriority {
  *
  * For example, the rule "H1 {text-decoration: bold}" is stored in a linked
  * list accessible by looking up "h1" in the rules hash table.
+ *
+ * The stylesheet configuration of a widget (HtmlTree.pStyle) may also 
+ * have zero or more shared stylesheets layered beneath it, stored in the
+ * CssStyleSheet.apLayer[] array. Shared stylesheets are immutable and
+ * reference counted. The remaining fields are only used by shared 
+ * stylesheets. See "Shared stylesheets" in css.c.
  */
 struct CssStyleSheet {
     int nSyntaxErr;           /* Number of syntax errors during parsing */
@@ -217,6 +260,20 @@ struct CssStyleSheet {
     Tcl_HashTable aByTag;      /* Rule lists by tag (string keys) */
     Tcl_HashTable aByClass;    /* Rule lists by class (string keys) */
     Tcl_HashTable aById;       /* Rule lists by id (string keys) */
+
+    int nLayer;                /* Number of entries in apLayer[] */
+    CssStyleSheet **apLayer;   /* Shared stylesheets layered beneath this */
+    int *aLayerSeq;            /* Sequence number of each apLayer[] entry */
+    int iNextSeq;              /* Next sequence number to assign */
+
+    int nRef;                  /* Number of configurations using this */
+    unsigned int iHash;        /* Hash of pText, pId and eMode */
+    Tcl_Obj *pText;            /* Stylesheet text */
+    Tcl_Obj *pId;              /* Stylesheet id */
+    int eMode;                 /* HTML_MODE_XXX value used to parse pText */
+    HtmlInterpData *pInterpData;  /* Owner of aSharedStyle table */
+    CssStyleSheet *pNextShared;   /* Next sheet with the same iHash */
+    int isRetained;               /* True to keep while nRef==0 */
 };
 
 /*
@@ -238,6 +295,17 @@ struct CssParse {
     CssPriority *pPriority2;
 
     int iNextRule;                  /* iRule value for next rule */
+    int iSeq;                       /* Sequence number of this parse */
+
+    /* Rules are prepended to their lists as they are parsed. The lists
+     * are sorted into priority order when parsing is finished (see 
+     * parseSortRules() in css.c). apDirty[] contains the by-tag, by-class
+     * and by-id hash entries whose lists have been modified.
+     */
+    int nDirty;                     /* Number of entries in apDirty[] */
+    int nDirtyAlloc;                /* Allocated size of apDirty[] */
+    Tcl_HashEntry **apDirty;        /* Modified entries in hash tables */
+    int isDirty;                    /* True if other lists modified */
 
     /* The parser sets the isIgnore flag to true when it enters an @media {}
      * block that does *not* apply, and sets it back to false when it exits the
@@ -270,7 +338,9 @@ void HtmlCssImport(CssParse *pParse, CssToken *);
 /* Test if a selector matches a node */
 int HtmlCssSelectorTest(CssSelector *, HtmlNode *, int);
 
-void HtmlCssAddDynamic(HtmlElementNode *, CssSelector *, int);
+int HtmlCssSelectorSources(CssSelector *, HtmlNode *, HtmlNode ***, int *);
+
+void HtmlCssAddDynamic(HtmlTree *, HtmlElementNode *, CssSelector *, int);
 
 /* Append the string representation of the supplied selector to the object. */
 void HtmlCssSelectorToString(CssSelector *, Tcl_Obj *);
@@ -4,58 +4,254 @@
 
 static const char rcsid[] = "$Id: cssdynamic.c,v 1.12 2007/06/10 07:53:03 danielk1977 Exp $";
 
+#define LOG if (pTree->options.logcmd)
+
 /*
  * How dynamic CSS selectors are implemented:
  *
  *     The implementation of dynamic CSS selectors serves two purposes.
  *     Firstly, they are a feature in and of themselves. Secondly, they
- *     exercise the same dynamic-update code that an external scripting 
+ *     exercise the same dynamic-update code that an external scripting
  *     implementation someday might.
  *
  *     A "dynamic selector", according to Tkhtml, is any selector that
  *     includes an :active, :focus, or :hover pseudo class.
+ *
+ *     When a node is styled, a CssDynamic structure is attached to it for
+ *     each dynamic selector that would match the node if all dynamic
+ *     flags were set. At the same time the condition is added to the
+ *     HtmlTree.aDynamic index once for each node whose dynamic flags the
+ *     selector tests (the "source" nodes, as determined by
+ *     HtmlCssSelectorSources()). For example, the condition for selector
+ *     "div:hover span" attached to a <span> is indexed under each <div>
+ *     ancestor of the <span>.
+ *
+ *     When the dynamic flags of a node are modified, only the conditions
+ *     indexed under that node are retested. If the source set of a
+ *     condition is too expensive to determine, the condition is not
+ *     indexed. While any such conditions exist, HtmlCssCheckDynamic()
+ *     falls back to retesting every condition in the sub-trees that
+ *     might be affected.
  */
 
+typedef struct CssDynamicRef CssDynamicRef;
+
 struct CssDynamic {
     int isSet;                /* True when the condition is set */
+    int isGlobal;             /* True if not indexed in HtmlTree.aDynamic */
     CssSelector *pSelector;   /* The selector for this condition */
+    HtmlElementNode *pElem;   /* The element this condition is attached to */
+    int nSource;              /* Number of entries in apSource[] */
+    HtmlNode **apSource;      /* Nodes the condition is indexed under */
+    CssDynamicRef *aRef;      /* Index entries, one for each apSource[] */
     CssDynamic *pNext;
 };
 
+/*
+ * The value of each entry in the HtmlTree.aDynamic hash table is a
+ * doubly linked list of the following structures, one for each condition
+ * that depends on the dynamic flags of the node the entry is keyed by.
+ * The structures for a condition are allocated as a single array, 
+ * CssDynamic.aRef[]. Each records the hash table entry it is linked into,
+ * so that it can be unlinked in constant time (see dynamicUnindex()).
+ */
+struct CssDynamicRef {
+    CssDynamic *pDynamic;
+    Tcl_HashEntry *pEntry;    /* Entry in HtmlTree.aDynamic */
+    CssDynamicRef *pNext;
+    CssDynamicRef *pPrev;
+};
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * dynamicUnindex --
+ *
+ *     Remove dynamic condition p from the HtmlTree.aDynamic index.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     Frees p->apSource and p->aRef. May decrement HtmlTree.nDynamicGlobal.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+dynamicUnindex(pTree, p)
+    HtmlTree *pTree;
+    CssDynamic *p;
+{
+    int ii;
+    for (ii = 0; ii < p->nSource; ii++) {
+        CssDynamicRef *pRef = &p->aRef[ii];
+        if (pRef->pNext) {
+            pRef->pNext->pPrev = pRef->pPrev;
+        }
+        if (pRef->pPrev) {
+            pRef->pPrev->pNext = pRef->pNext;
+        } else if (pRef->pNext) {
+            Tcl_SetHashValue(pRef->pEntry, pRef->pNext);
+        } else {
+            Tcl_DeleteHashEntry(pRef->pEntry);
+        }
+    }
+    HtmlFree(p->aRef);
+    HtmlFree(p->apSource);
+    p->aRef = 0;
+    p->apSource = 0;
+    p->nSource = 0;
+
+    if (p->isGlobal) {
+        pTree->nDynamicGlobal--;
+        p->isGlobal = 0;
+    }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * dynamicIndex --
+ *
+ *     Add dynamic condition p to the HtmlTree.aDynamic index. The
+ *     condition must not already be indexed.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     Sets p->apSource, p->aRef and p->nSource, or p->isGlobal.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+dynamicIndex(pTree, p)
+    HtmlTree *pTree;
+    CssDynamic *p;
+{
+    HtmlNode *pNode = &p->pElem->node;
+    int ii;
+
+    assert(p->nSource == 0 && !p->isGlobal);
+    if (!HtmlCssSelectorSources(p->pSelector,pNode,&p->apSource,&p->nSource)){
+        p->isGlobal = 1;
+        pTree->nDynamicGlobal++;
+        return;
+    }
+
+    if (p->nSource > 0) {
+        p->aRef = (CssDynamicRef *)HtmlAlloc(
+            "CssDynamic.aRef", p->nSource * sizeof(CssDynamicRef)
+        );
+    }
+    for (ii = 0; ii < p->nSource; ii++) {
+        int isNew;
+        Tcl_HashEntry *pEntry;
+        CssDynamicRef *pRef = &p->aRef[ii];
+        pEntry = Tcl_CreateHashEntry(
+            &pTree->aDynamic, (char *)p->apSource[ii], &isNew
+        );
+        pRef->pDynamic = p;
+        pRef->pEntry = pEntry;
+        pRef->pPrev = 0;
+        pRef->pNext = (isNew ? 0 : (CssDynamicRef *)Tcl_GetHashValue(pEntry));
+        if (pRef->pNext) {
+            pRef->pNext->pPrev = pRef;
+        }
+        Tcl_SetHashValue(pEntry, pRef);
+    }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlCssAddDynamic --
+ *
+ *     Attach a dynamic condition for selector pSelector to element pElem.
+ *     If the condition is already attached, the set of nodes it is
+ *     indexed under is recalculated, as the document structure may have
+ *     changed since it was attached.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     Modifies pElem->pDynamic and the HtmlTree.aDynamic index.
+ *
+ *---------------------------------------------------------------------------
+ */
 void
-HtmlCssAddDynamic(pElem, pSelector, isSet)
+HtmlCssAddDynamic(pTree, pElem, pSelector, isSet)
+    HtmlTree *pTree;
     HtmlElementNode *pElem;
     CssSelector *pSelector;
     int isSet;
 {
     CssDynamic *pNew;
     for (pNew = pElem->pDynamic; pNew ; pNew = pNew->pNext) {
-        if (pNew->pSelector == pSelector) return;
+        if (pNew->pSelector == pSelector) {
+            dynamicUnindex(pTree, pNew);
+            dynamicIndex(pTree, pNew);
+            return;
+        }
     }
     pNew = 0;
 
     pNew = HtmlNew(CssDynamic);
     pNew->isSet = (isSet ? 1 : 0);
     pNew->pSelector = pSelector;
+    pNew->pElem = pElem;
     pNew->pNext = pElem->pDynamic;
     pElem->pDynamic = pNew;
+    dynamicIndex(pTree, pNew);
 }
 
 void
-HtmlCssFreeDynamics(pElem)
+HtmlCssFreeDynamics(pTree, pElem)
+    HtmlTree *pTree;
     HtmlElementNode *pElem;
 {
     CssDynamic *p = pElem->pDynamic;
     while (p) {
         CssDynamic *pTmp = p;
         p = p->pNext;
+        dynamicUnindex(pTree, pTmp);
         HtmlFree(pTmp);
     }
     pElem->pDynamic = 0;
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * checkDynamic --
+ *
+ *     Retest dynamic condition p. If the result has changed since it
+ *     was last tested, schedule a restyle of the element it is attached
+ *     to.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     May call HtmlCallbackRestyle().
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+checkDynamic(pTree, p)
+    HtmlTree *pTree;
+    CssDynamic *p;
+{
+    HtmlNode *pNode = &p->pElem->node;
+    int res = HtmlCssSelectorTest(p->pSelector, pNode, 0) ? 1 : 0;
+    if (res != p->isSet) {
+        HtmlCallbackRestyle(pTree, pNode);
+    }
+    p->isSet = res;
+}
 
-static int 
+static int
 checkDynamicCb(pTree, pNode, clientData)
     HtmlTree *pTree;
     HtmlNode *pNode;
@@ -65,33 +261,82 @@ checkDynamicCb(pTree, pNode, clientData)
         HtmlElementNode *pElem = (HtmlElementNode *)pNode;
         CssDynamic *p;
         for (p = pElem->pDynamic; p; p = p->pNext) {
-            int res = HtmlCssSelectorTest(p->pSelector, pNode, 0) ? 1 : 0; 
-            if (res != p->isSet) {
-                HtmlCallbackRestyle(pTree, pNode);
-            }
-            p->isSet = res;
+            checkDynamic(pTree, p);
+            (*(int *)clientData)++;
         }
     }
     return HTML_WALK_DESCEND;
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlCssCheckDynamic --
+ *
+ *     Retest the dynamic conditions that may have been affected by
+ *     changes to the dynamic flags of the nodes passed to
+ *     HtmlCallbackDynamic() since the last call.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     May call HtmlCallbackRestyle(). Clears HtmlTree.cb.pDynamic and
+ *     HtmlTree.cb.apDynamic.
+ *
+ *---------------------------------------------------------------------------
+ */
 void
 HtmlCssCheckDynamic(pTree)
     HtmlTree *pTree;
 {
     if (pTree->cb.pDynamic) {
-        HtmlNode *pParent = HtmlNodeParent(pTree->cb.pDynamic);
-        if (pParent) {
-            int i;
-            int nChild = HtmlNodeNumChildren(pParent);
-            for (i = 0; HtmlNodeChild(pParent, i) != pTree->cb.pDynamic; i++);
-            for ( ; i < nChild; i++) {
-                HtmlWalkTree(pTree,HtmlNodeChild(pParent,i),checkDynamicCb,0);
+        int nCheck = 0;
+
+        if (pTree->nDynamicGlobal > 0) {
+            /* At least one condition is not indexed. Retest all
+             * conditions attached to nodes in the sub-trees rooted
+             * at cb.pDynamic and its right-hand siblings.
+             */
+            HtmlNode *pParent = HtmlNodeParent(pTree->cb.pDynamic);
+            ClientData cd = (ClientData)&nCheck;
+            if (pParent) {
+                int i;
+                int nChild = HtmlNodeNumChildren(pParent);
+                for (i = 0; HtmlNodeChild(pParent, i) != pTree->cb.pDynamic; i++);
+                for ( ; i < nChild; i++) {
+                    HtmlWalkTree(pTree, HtmlNodeChild(pParent,i), checkDynamicCb, cd);
+                }
+            } else {
+                HtmlWalkTree(pTree, pTree->cb.pDynamic, checkDynamicCb, cd);
             }
         } else {
-            HtmlWalkTree(pTree, pTree->cb.pDynamic, checkDynamicCb, 0);
+            int ii;
+            for (ii = 0; ii < pTree->cb.nDynamic; ii++) {
+                HtmlNode *pNode = pTree->cb.apDynamic[ii];
+                Tcl_HashEntry *pEntry;
+                pEntry = Tcl_FindHashEntry(&pTree->aDynamic, (char *)pNode);
+                if (pEntry) {
+                    CssDynamicRef *pRef;
+                    pRef = (CssDynamicRef *)Tcl_GetHashValue(pEntry);
+                    for ( ; pRef; pRef = pRef->pNext) {
+                        checkDynamic(pTree, pRef->pDynamic);
+                        nCheck++;
+                    }
+                }
+            }
         }
+
+        LOG {
+            HtmlLog(pTree, "STYLEENGINE",
+                "Dynamic: %d modified nodes, retested %d conditions (%s)",
+                pTree->cb.nDynamic, nCheck,
+                (pTree->nDynamicGlobal > 0) ? "full" : "indexed"
+            );
+        }
+
         pTree->cb.pDynamic = 0;
+        pTree->cb.nDynamic = 0;
     }
 }
 
@@ -113,4 +358,3 @@ HtmlCssTclNodeDynamics(interp, pNode)
     Tcl_SetObjResult(interp, pRet);
     return TCL_OK;
 }
-
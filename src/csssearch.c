@@ -21,6 +21,12 @@ static const char rcsid[] = "$Id: csssearch.c,v 1.7 2007/10/27 08:37:50 hkoba Ex
  *
  *         HtmlCssSearchInvalidateCache()
  *
+ *     Maintain the node index (see below):
+ *
+ *         HtmlCssSearchIndexAdd()
+ *         HtmlCssSearchIndexRemove()
+ *         HtmlCssSearchIndexReset()
+ *
  */
 
 #define SEARCH_MODE_ALL     1
@@ -40,6 +46,26 @@ struct HtmlSearchCache {
      * called. 
      */
     Tcl_HashTable aCache;
+
+    /* Index of element nodes by tag name, id, class and "name" attribute.
+     * Each entry in aIndex maps from a key to a hash table (with
+     * TCL_ONE_WORD_KEYS) containing the set of nodes with that property.
+     * Keys are the first character of the key-type followed by the
+     * value, folded to lower-case for all but tag names:
+     *
+     *     "<div"      Nodes with tag name "div".
+     *     "#header"   Nodes with id="header".
+     *     ".menu"     Nodes with "menu" in their class attribute.
+     *     "=submit"   Nodes with name="submit".
+     *
+     * The index is built the first time it is required by a search and
+     * kept up to date by the tree module from then on. Every element
+     * node that exists is in the index, whether it is part of the
+     * document tree or an orphan. Whether or not a node is currently
+     * part of the tree is checked by HtmlCssSearch() at query time.
+     */
+    int isIndexValid;
+    Tcl_HashTable aIndex;
 };
 
 struct CssSearch {
@@ -81,12 +107,667 @@ cssSearchCb(pTree, pNode, clientData)
     return HTML_WALK_DESCEND;
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * searchIndexKey --
+ *
+ *     Initialize the dynamic string pKey with the index key formed from
+ *     character c and the first n bytes of z (all of z if n < 0). If
+ *     isFold is true, ASCII upper-case characters are folded to 
+ *     lower-case, to match the comparisons done by attrTest() in css.c.
+ *
+ *     The caller must call Tcl_DStringFree() on pKey.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+searchIndexKey(pKey, c, z, n, isFold)
+    Tcl_DString *pKey;
+    char c;
+    const char *z;
+    int n;
+    int isFold;
+{
+    int ii;
+    char *zKey;
+
+    if (n < 0) {
+        n = strlen(z);
+    }
+    Tcl_DStringInit(pKey);
+    Tcl_DStringSetLength(pKey, n + 1);
+    zKey = Tcl_DStringValue(pKey);
+    zKey[0] = c;
+    for (ii = 0; ii < n; ii++) {
+        char x = z[ii];
+        if (isFold && x >= 'A' && x <= 'Z') {
+            x += ('a' - 'A');
+        }
+        zKey[ii + 1] = x;
+    }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * searchIndexEntry --
+ *
+ *     Add node pNode to, or remove it from, the set of nodes associated
+ *     with the index key formed from character c and the first n bytes
+ *     of string z (if n is less than 0, all of z). If isFold is true,
+ *     the value is folded to lower-case before it is used.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     May modify HtmlSearchCache.aIndex.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+searchIndexEntry(pSearchCache, c, z, n, isFold, pNode, isAdd)
+    HtmlSearchCache *pSearchCache;
+    char c;
+    const char *z;
+    int n;
+    int isFold;
+    HtmlNode *pNode;
+    int isAdd;
+{
+    Tcl_DString sKey;
+    Tcl_HashEntry *pEntry;
+    Tcl_HashTable *pSet;
+    int isNew;
+
+    searchIndexKey(&sKey, c, z, n, isFold);
+    if (isAdd) {
+        pEntry = Tcl_CreateHashEntry(
+            &pSearchCache->aIndex, Tcl_DStringValue(&sKey), &isNew
+        );
+        if (isNew) {
+            pSet = HtmlNew(Tcl_HashTable);
+            Tcl_InitHashTable(pSet, TCL_ONE_WORD_KEYS);
+            Tcl_SetHashValue(pEntry, pSet);
+        }
+        pSet = (Tcl_HashTable *)Tcl_GetHashValue(pEntry);
+        Tcl_CreateHashEntry(pSet, (char *)pNode, &isNew);
+    } else {
+        pEntry = Tcl_FindHashEntry(
+            &pSearchCache->aIndex, Tcl_DStringValue(&sKey)
+        );
+        if (pEntry) {
+            Tcl_HashEntry *pNodeEntry;
+            pSet = (Tcl_HashTable *)Tcl_GetHashValue(pEntry);
+            pNodeEntry = Tcl_FindHashEntry(pSet, (char *)pNode);
+            if (pNodeEntry) {
+                Tcl_DeleteHashEntry(pNodeEntry);
+            }
+            if (pSet->numEntries == 0) {
+                Tcl_DeleteHashTable(pSet);
+                HtmlFree(pSet);
+                Tcl_DeleteHashEntry(pEntry);
+            }
+        }
+    }
+    Tcl_DStringFree(&sKey);
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * searchIndexNode --
+ *
+ *     Add element node pNode to, or remove it from, all sets in the
+ *     index that it belongs to. The set of keys is derived from the 
+ *     current tag name and attributes of pNode, so a node must be 
+ *     removed before any attribute is modified and added again 
+ *     afterwards.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     May modify HtmlSearchCache.aIndex.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+searchIndexNode(pSearchCache, pNode, isAdd)
+    HtmlSearchCache *pSearchCache;
+    HtmlNode *pNode;
+    int isAdd;
+{
+    const char *zAttr;
+
+    if (HtmlNodeIsText(pNode)) return;
+
+    searchIndexEntry(pSearchCache, '<', pNode->zTag, -1, 0, pNode, isAdd);
+
+    zAttr = HtmlAttrId(((HtmlElementNode *)pNode)->pAttributes);
+    if (zAttr) {
+        searchIndexEntry(pSearchCache, '#', zAttr, -1, 1, pNode, isAdd);
+    }
+
+    zAttr = HtmlNodeAttr(pNode, "name");
+    if (zAttr) {
+        searchIndexEntry(pSearchCache, '=', zAttr, -1, 1, pNode, isAdd);
+    }
+
+    zAttr = HtmlAttrClass(((HtmlElementNode *)pNode)->pAttributes);
+    if (zAttr) {
+        const char *z = zAttr;
+        int n;
+        while ((z = HtmlCssGetNextListItem(z, strlen(z), &n))) {
+            searchIndexEntry(pSearchCache, '.', z, n, 1, pNode, isAdd);
+            z += n;
+        }
+    }
+}
+
+static int 
+searchIndexBuildCb(pTree, pNode, clientData)
+    HtmlTree *pTree; 
+    HtmlNode *pNode;
+    ClientData clientData;
+{
+    searchIndexNode(pTree->pSearchCache, pNode, 1);
+    return HTML_WALK_DESCEND;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * searchIndexBuild --
+ *
+ *     Populate the index with all element nodes in the document tree
+ *     and all orphan trees.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     Sets HtmlSearchCache.isIndexValid.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+searchIndexBuild(pTree)
+    HtmlTree *pTree;
+{
+    Tcl_HashEntry *pEntry;
+    Tcl_HashSearch sSearch;
+
+    assert(!pTree->pSearchCache->isIndexValid);
+    HtmlWalkTree(pTree, 0, searchIndexBuildCb, 0);
+    for (
+        pEntry = Tcl_FirstHashEntry(&pTree->aOrphan, &sSearch);
+        pEntry;
+        pEntry = Tcl_NextHashEntry(&sSearch)
+    ) {
+        HtmlNode *pOrphan = (HtmlNode *)Tcl_GetHashKey(&pTree->aOrphan,pEntry);
+        HtmlWalkTree(pTree, pOrphan, searchIndexBuildCb, 0);
+    }
+    pTree->pSearchCache->isIndexValid = 1;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlCssSearchIndexAdd --
+ * HtmlCssSearchIndexRemove --
+ *
+ *     These are called by the tree module when an element node is 
+ *     created or destroyed, and before (Remove) and after (Add) the 
+ *     attributes of an element node are modified. Text nodes are ignored.
+ *     If the index has not been built yet, these are no-ops.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     May modify HtmlSearchCache.aIndex.
+ *
+ *---------------------------------------------------------------------------
+ */
+void
+HtmlCssSearchIndexAdd(pTree, pNode)
+    HtmlTree *pTree;
+    HtmlNode *pNode;
+{
+    HtmlSearchCache *pSearchCache = pTree->pSearchCache;
+    if (pSearchCache && pSearchCache->isIndexValid) {
+        searchIndexNode(pSearchCache, pNode, 1);
+    }
+}
+void
+HtmlCssSearchIndexRemove(pTree, pNode)
+    HtmlTree *pTree;
+    HtmlNode *pNode;
+{
+    HtmlSearchCache *pSearchCache = pTree->pSearchCache;
+    if (pSearchCache && pSearchCache->isIndexValid) {
+        searchIndexNode(pSearchCache, pNode, 0);
+    }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlCssSearchIndexReset --
+ *
+ *     Discard the index. This is called when the whole document is
+ *     about to be discarded, so that the nodes do not have to be removed
+ *     from the index one at a time. The index is rebuilt the next time 
+ *     it is required.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     Clears HtmlSearchCache.isIndexValid.
+ *
+ *---------------------------------------------------------------------------
+ */
+void
+HtmlCssSearchIndexReset(pTree)
+    HtmlTree *pTree;
+{
+    HtmlSearchCache *pSearchCache = pTree->pSearchCache;
+    Tcl_HashSearch sSearch;
+    Tcl_HashEntry *pEntry;
+
+    if (!pSearchCache || !pSearchCache->isIndexValid) return;
+
+    for (
+        pEntry = Tcl_FirstHashEntry(&pSearchCache->aIndex, &sSearch);
+        pEntry;
+        pEntry = Tcl_NextHashEntry(&sSearch)
+    ) {
+        Tcl_HashTable *pSet = (Tcl_HashTable *)Tcl_GetHashValue(pEntry);
+        Tcl_DeleteHashTable(pSet);
+        HtmlFree(pSet);
+    }
+    Tcl_DeleteHashTable(&pSearchCache->aIndex);
+    Tcl_InitHashTable(&pSearchCache->aIndex, TCL_STRING_KEYS);
+    pSearchCache->isIndexValid = 0;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * searchIndexSet --
+ *
+ *     Find the smallest indexed set of nodes that contains all nodes
+ *     matched by the subject (right-most compound selector) of pSelector.
+ *     The candidate keys are the type, id, class and [name="..."]
+ *     simple selectors of the subject.
+ *
+ * Results:
+ *     Returns 0 if the subject contains no indexable simple selector, 
+ *     in which case the index cannot be used. Otherwise returns 1 and
+ *     sets *ppSet to the set (or to NULL if no nodes match the key).
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int
+searchIndexSet(pSearchCache, pSelector, ppSet)
+    HtmlSearchCache *pSearchCache;
+    CssSelector *pSelector;
+    Tcl_HashTable **ppSet;
+{
+    CssSelector *p;
+    int isFound = 0;
+
+    *ppSet = 0;
+    for (
+        p = pSelector; 
+        p && p->eSelector != CSS_SELECTORCHAIN_DESCENDANT &&
+             p->eSelector != CSS_SELECTORCHAIN_CHILD &&
+             p->eSelector != CSS_SELECTORCHAIN_ADJACENT;
+        p = p->pNext
+    ) {
+        Tcl_DString sKey;
+        Tcl_HashEntry *pEntry;
+        Tcl_HashTable *pSet = 0;
+
+        switch (p->eSelector) {
+            case CSS_SELECTOR_TYPE:
+                searchIndexKey(&sKey, '<', p->zValue, -1, 0);
+                break;
+            case CSS_SELECTOR_ID:
+                searchIndexKey(&sKey, '#', p->zValue, -1, 1);
+                break;
+            case CSS_SELECTOR_CLASS:
+                searchIndexKey(&sKey, '.', p->zValue, -1, 1);
+                break;
+            case CSS_SELECTOR_ATTRVALUE:
+                if (0 == strcmp(p->zAttr, "name")) {
+                    searchIndexKey(&sKey, '=', p->zValue, -1, 1);
+                    break;
+                }
+                /* Fall through */
+            default:
+                continue;
+        }
+
+        pEntry = Tcl_FindHashEntry(
+            &pSearchCache->aIndex, Tcl_DStringValue(&sKey)
+        );
+        Tcl_DStringFree(&sKey);
+        if (pEntry) {
+            pSet = (Tcl_HashTable *)Tcl_GetHashValue(pEntry);
+        }
+
+        if (!pSet) {
+            /* No node at all matches this simple selector. */
+            *ppSet = 0;
+            return 1;
+        }
+        if (!isFound || pSet->numEntries < (*ppSet)->numEntries) {
+            *ppSet = pSet;
+        }
+        isFound = 1;
+    }
+
+    return isFound;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * searchIsInScope --
+ *
+ *     Return true if node pNode should be considered by a search. If
+ *     pSearchRoot is not NULL, pNode must be a descendant of it. 
+ *     Otherwise, pNode must be part of the document tree (not part of 
+ *     an orphan tree).
+ *
+ * Results:
+ *     True or false.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int
+searchIsInScope(pTree, pNode, pSearchRoot)
+    HtmlTree *pTree;
+    HtmlNode *pNode;
+    HtmlNode *pSearchRoot;
+{
+    HtmlNode *pTop = (pSearchRoot ? pSearchRoot : pTree->pRoot);
+    HtmlNode *p;
+
+    if (pNode == pSearchRoot) return 0;
+    for (p = pNode; p; p = HtmlNodeParent(p)) {
+        if (p == pTop) return 1;
+    }
+    return 0;
+}
+
+static int
+searchCompareNodes(pLeft, pRight)
+    const void *pLeft;
+    const void *pRight;
+{
+    HtmlNode *p1 = *(HtmlNode **)pLeft;
+    HtmlNode *p2 = *(HtmlNode **)pRight;
+    return (p1->iNode - p2->iNode);
+}
+
+/*
+ * Used by searchSortByPath() to sort search results into tree order when
+ * the HtmlNode.iNode values are not valid. aiPath[] contains the index 
+ * of each ancestor of pNode (starting with the child of the root node)
+ * and of pNode itself within its parent.
+ */
+typedef struct SearchPath SearchPath;
+struct SearchPath {
+    HtmlNode *pNode;
+    int *aiPath;
+    int nPath;
+};
+
+static int
+searchComparePaths(pLeft, pRight)
+    const void *pLeft;
+    const void *pRight;
+{
+    const SearchPath *p1 = (const SearchPath *)pLeft;
+    const SearchPath *p2 = (const SearchPath *)pRight;
+    int ii;
+    for (ii = 0; ii < p1->nPath && ii < p2->nPath; ii++) {
+        if (p1->aiPath[ii] != p2->aiPath[ii]) {
+            return p1->aiPath[ii] - p2->aiPath[ii];
+        }
+    }
+    return p1->nPath - p2->nPath;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * searchChildIndex --
+ *
+ *     Return the index of pNode within its parent. The first time the
+ *     index of a child of some parent node is requested, the indexes 
+ *     of all children of that parent are added to hash table pPosition,
+ *     so that each parent is scanned at most once per sort.
+ *
+ * Results:
+ *     Index of pNode in HtmlNodeParent(pNode).
+ *
+ * Side effects:
+ *     May add entries to pPosition.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int
+searchChildIndex(pPosition, pNode)
+    Tcl_HashTable *pPosition;
+    HtmlNode *pNode;
+{
+    Tcl_HashEntry *pEntry = Tcl_FindHashEntry(pPosition, (char *)pNode);
+    if (!pEntry) {
+        HtmlNode *pParent = HtmlNodeParent(pNode);
+        int ii;
+        for (ii = 0; ii < HtmlNodeNumChildren(pParent); ii++) {
+            HtmlNode *pChild = HtmlNodeChild(pParent, ii);
+            int isNew;
+            Tcl_HashEntry *p;
+            p = Tcl_CreateHashEntry(pPosition, (char *)pChild, &isNew);
+            Tcl_SetHashValue(p, (ClientData)(size_t)ii);
+        }
+        pEntry = Tcl_FindHashEntry(pPosition, (char *)pNode);
+        assert(pEntry);
+    }
+    return (int)(size_t)Tcl_GetHashValue(pEntry);
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * searchSortByPath --
+ *
+ *     Sort the array of nNode nodes at apNode into tree order without
+ *     using the HtmlNode.iNode values. This is used instead of
+ *     HtmlSequenceNodes() when the node numbers are out of date, as 
+ *     renumbering walks the entire tree. The cost of this function 
+ *     depends only on the result nodes, their ancestors and the 
+ *     siblings of those.
+ *
+ *     All nodes in apNode must be part of the tree at HtmlTree.pRoot.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     Reorders apNode.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+searchSortByPath(apNode, nNode)
+    HtmlNode **apNode;
+    int nNode;
+{
+    Tcl_HashTable aPosition;
+    SearchPath *aPath;
+    int *aiPool;
+    int nPool = 0;
+    int ii;
+
+    aPath = (SearchPath *)HtmlAlloc("temp", nNode * sizeof(SearchPath));
+    for (ii = 0; ii < nNode; ii++) {
+        HtmlNode *p;
+        aPath[ii].pNode = apNode[ii];
+        aPath[ii].nPath = 0;
+        for (p = apNode[ii]; HtmlNodeParent(p); p = HtmlNodeParent(p)) {
+            aPath[ii].nPath++;
+        }
+        nPool += aPath[ii].nPath;
+    }
+
+    Tcl_InitHashTable(&aPosition, TCL_ONE_WORD_KEYS);
+    aiPool = (int *)HtmlAlloc("temp", MAX(nPool, 1) * sizeof(int));
+    nPool = 0;
+    for (ii = 0; ii < nNode; ii++) {
+        HtmlNode *p;
+        int jj = aPath[ii].nPath;
+        aPath[ii].aiPath = &aiPool[nPool];
+        nPool += jj;
+        for (p = apNode[ii]; HtmlNodeParent(p); p = HtmlNodeParent(p)) {
+            aPath[ii].aiPath[--jj] = searchChildIndex(&aPosition, p);
+        }
+    }
+    Tcl_DeleteHashTable(&aPosition);
+
+    qsort(aPath, nNode, sizeof(SearchPath), searchComparePaths);
+    for (ii = 0; ii < nNode; ii++) {
+        apNode[ii] = aPath[ii].pNode;
+    }
+    HtmlFree(aiPool);
+    HtmlFree(aPath);
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * searchIndexQuery --
+ *
+ *     Try to answer a search using the index. For each rule in the
+ *     list pSearch->pRuleList, the smallest candidate set is obtained
+ *     from the index (see searchIndexSet()). Each candidate that is in 
+ *     scope is tested against the full selectors and the matches are 
+ *     sorted into tree order.
+ *
+ * Results:
+ *     Returns 1 if the search was answered and the results stored in
+ *     pSearch->pCache. Returns 0 if the index cannot be used for this
+ *     search (i.e. some selector has no indexable subject), in which
+ *     case the caller must fall back to walking the tree.
+ *
+ * Side effects:
+ *     May build the index.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int
+searchIndexQuery(pSearch)
+    CssSearch *pSearch;
+{
+    HtmlTree *pTree = pSearch->pTree;
+    HtmlSearchCache *pSearchCache = pTree->pSearchCache;
+    CssCachedSearch *pCache = pSearch->pCache;
+    Tcl_HashTable **apSet;
+    Tcl_HashTable aSeen;
+    CssRule *pRule;
+    int nRule = 0;
+    int ii;
+
+    /* Searching the sub-tree of an orphan node is rare. Just walk it. */
+    if (pSearch->pSearchRoot && HtmlNodeIsOrphan(pSearch->pSearchRoot)) {
+        return 0;
+    }
+
+    /* While a fragment is being parsed (see [$widget fragment]), the 
+     * fragment nodes are neither part of the tree nor in the orphan 
+     * table, so the index cannot be built.
+     */
+    if (!pSearchCache->isIndexValid) {
+        if (pTree->pFragment) return 0;
+        searchIndexBuild(pTree);
+    }
+
+    for (pRule = pSearch->pRuleList; pRule; pRule = pRule->pNext) nRule++;
+    apSet = (Tcl_HashTable **)HtmlAlloc("temp", nRule*sizeof(Tcl_HashTable*));
+    for (ii = 0, pRule = pSearch->pRuleList; pRule; pRule = pRule->pNext) {
+        if (!searchIndexSet(pSearchCache, pRule->pSelector, &apSet[ii++])) {
+            HtmlFree(apSet);
+            return 0;
+        }
+    }
+
+    Tcl_InitHashTable(&aSeen, TCL_ONE_WORD_KEYS);
+    for (ii = 0; ii < nRule; ii++) {
+        Tcl_HashEntry *pEntry;
+        Tcl_HashSearch sSearch;
+        if (!apSet[ii]) continue;
+        for (
+            pEntry = Tcl_FirstHashEntry(apSet[ii], &sSearch);
+            pEntry;
+            pEntry = Tcl_NextHashEntry(&sSearch)
+        ) {
+            HtmlNode *pNode = (HtmlNode *)Tcl_GetHashKey(apSet[ii], pEntry);
+            int isNew = 1;
+
+            /* A node may be in the candidate sets of more than one rule */
+            if (nRule > 1) {
+                Tcl_CreateHashEntry(&aSeen, (char *)pNode, &isNew);
+            }
+            if (isNew && searchIsInScope(pTree, pNode, pSearch->pSearchRoot)) {
+                cssSearchCb(pTree, pNode, (ClientData)pSearch);
+            }
+        }
+    }
+    Tcl_DeleteHashTable(&aSeen);
+    HtmlFree(apSet);
+
+    /* Hash tables are not ordered, so sort the results into tree order. 
+     * If nodes have been inserted since the tree was last numbered, do
+     * not renumber the whole tree just to sort a few results.
+     */
+    if (pCache->nNode > 1) {
+        if (pTree->isSequenceOk) {
+            qsort(pCache->apNode, pCache->nNode, sizeof(HtmlNode *), 
+                searchCompareNodes
+            );
+        } else {
+            searchSortByPath(pCache->apNode, pCache->nNode);
+        }
+    }
+    return 1;
+}
+
 int 
 HtmlCssSearchInit(pTree)
     HtmlTree *pTree;
 {
     pTree->pSearchCache = HtmlNew(HtmlSearchCache);
     Tcl_InitHashTable(&pTree->pSearchCache->aCache, TCL_STRING_KEYS);
+    Tcl_InitHashTable(&pTree->pSearchCache->aIndex, TCL_STRING_KEYS);
     return TCL_OK;
 }
 
@@ -115,7 +796,9 @@ HtmlCssSearchShutdown(pTree)
     HtmlTree *pTree;
 {
     HtmlCssSearchInvalidateCache(pTree);
+    HtmlCssSearchIndexReset(pTree);
     Tcl_DeleteHashTable(&pTree->pSearchCache->aCache);
+    Tcl_DeleteHashTable(&pTree->pSearchCache->aIndex);
     HtmlFree(pTree->pSearchCache);
     pTree->pSearchCache = 0;
     return TCL_OK;
@@ -215,6 +898,7 @@ HtmlCssSearch(clientData, interp, objc, objv)
         const char *zArg = Tcl_GetString(aOption[0].pArg);
         if (*zArg) {
             pSearchRoot = HtmlNodeGetPointer(pTree, zArg);
+            if (!pSearchRoot) return TCL_ERROR;
         }
     }
     if (aOption[1].pArg) {      /* Handle -length option */
@@ -250,7 +934,9 @@ HtmlCssSearch(clientData, interp, objc, objv)
         sSearch.pTree = pTree;
         sSearch.pSearchRoot = pSearchRoot;
         sSearch.pCache = HtmlNew(CssCachedSearch);
-        HtmlWalkTree(pTree, pSearchRoot, cssSearchCb, (ClientData)&sSearch);
+        if (!searchIndexQuery(&sSearch)) {
+            HtmlWalkTree(pTree, pSearchRoot, cssSearchCb, (ClientData)&sSearch);
+        }
         pCache = sSearch.pCache;
         HtmlCssStyleSheetFree(pStyle);
         HtmlFree(z);
@@ -267,7 +953,7 @@ HtmlCssSearch(clientData, interp, objc, objv)
             Tcl_Obj *pRet = Tcl_NewObj();
             int ii;
             for(ii = 0; ii < pCache->nNode; ii++){
-                Tcl_Obj *pCmd = HtmlNodeCommand(pTree, pCache->apNode[ii]);
+                Tcl_Obj *pCmd = HtmlNodeHandle(pTree, pCache->apNode[ii]);
                 Tcl_ListObjAppendElement(interp, pRet, pCmd);
             }
             Tcl_SetObjResult(interp, pRet);
@@ -281,7 +967,7 @@ HtmlCssSearch(clientData, interp, objc, objv)
         case SEARCH_MODE_INDEX:
             if (iIndex >= 0 && iIndex < pCache->nNode) {
                 Tcl_SetObjResult(
-                    interp, HtmlNodeCommand(pTree, pCache->apNode[iIndex])
+                    interp, HtmlNodeHandle(pTree, pCache->apNode[iIndex])
                 );
             }
             break;
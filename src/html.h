@@ -110,8 +110,10 @@ typedef int            Html_32;      /* 32-bit signed integer */
 typedef struct HtmlNodeStack HtmlNodeStack;
 typedef struct HtmlOptions HtmlOptions;
 typedef struct HtmlTree HtmlTree;
+typedef struct HtmlInterpData HtmlInterpData;
 typedef struct HtmlTreeState HtmlTreeState;
 typedef struct HtmlAttributes HtmlAttributes;
+typedef struct HtmlArena HtmlArena;
 typedef struct HtmlTokenMap HtmlTokenMap;
 typedef struct HtmlCanvas HtmlCanvas;
 typedef struct HtmlCanvasItem HtmlCanvasItem;
@@ -129,6 +131,7 @@ typedef struct HtmlImage2 HtmlImage2;
 typedef struct HtmlWidgetTag HtmlWidgetTag;
 typedef struct HtmlTaggedRegion HtmlTaggedRegion;
 typedef struct HtmlText HtmlText;
+typedef struct HtmlTextBlock HtmlTextBlock;
 
 typedef struct HtmlNode HtmlNode;
 typedef struct HtmlElementNode HtmlElementNode;
@@ -141,6 +144,7 @@ typedef struct HtmlDamage HtmlDamage;
 
 typedef struct HtmlFragmentContext HtmlFragmentContext;
 typedef struct HtmlSearchCache HtmlSearchCache;
+typedef struct HtmlTileCache HtmlTileCache;
 
 #include "css.h"
 #include "htmlprop.h"
@@ -178,13 +182,25 @@ struct HtmlTokenMap {
 #define TAG_OK       3
 
 struct HtmlAttributes {
-    int nAttr;
+    int nAttr;                  /* Number of attributes in a[] */
+    int nAlloc;                 /* Allocated size of a[] */
+    char *zId;                  /* Value of "id" attribute, or NULL */
+    char *zClass;               /* Value of "class" attribute, or NULL */
+    char *zStyle;               /* Value of "style" attribute, or NULL */
     struct HtmlAttribute {
-        char *zName;
-        char *zValue;
+        char *zName;            /* Atom from HtmlInterpData.aAttrAtom */
+        char *zValue;           /* Attribute value */
+        int isAlloc;            /* True if zValue is a separate allocation */
     } a[1];
 };
 
+/* Values of the "id", "class" and "style" attributes of an attribute 
+ * set that may be NULL. Faster than HtmlMarkupArg().
+ */
+#define HtmlAttrId(p)    ((p) ? (p)->zId : 0)
+#define HtmlAttrClass(p) ((p) ? (p)->zClass : 0)
+#define HtmlAttrStyle(p) ((p) ? (p)->zStyle : 0)
+
 /*
  * For a replaced node, the HtmlNode.pReplacement variable points to an
  * instance of the following structure. The member objects are the name of
@@ -218,12 +234,19 @@ struct HtmlNodeReplacement {
 };
 
 /*
- * When a Tcl command representing a node-handle is created, an instance of the 
- * following structure is allocated.
+ * When a node-handle is first returned to script, an instance of the 
+ * following structure is allocated. It is shared by the node and by each
+ * Tcl_Obj whose internal representation refers to the handle, so that
+ * a handle to a deleted node can be detected (pNode is set to NULL).
+ * The structure is freed when nRef drops to zero.
  */
 struct HtmlNodeCmd {
-    Tcl_Obj *pCommand;
-    HtmlTree *pTree;
+    Tcl_Obj *pCommand;      /* Handle name "::tkhtml::nodeN", or NULL */
+    HtmlTree *pTree;        /* Tree that owns pNode */
+    HtmlNode *pNode;        /* Node, or NULL once the node is deleted */
+    int iHandle;            /* The N in "::tkhtml::nodeN" */
+    int nRef;               /* Node (1) plus Tcl_Obj internal reps */
+    int isCommand;          /* True once the Tcl command has been created */
 };
 
 struct HtmlNodeStack {
@@ -343,13 +366,16 @@ struct HtmlElementNode {
 
     /* Children of this element node */
     int nChild;                    /* Number of child nodes */
+    int nChildAlloc;               /* Allocated size of apChildren[] */
     HtmlNode **apChildren;         /* Array of pointers to children nodes */
 
     CssPropertySet *pStyle;                /* Parsed inline style */
+    const char **apClass;                  /* Class-name atoms (css.c) */
 
     /* Information generated by the style engine */
     HtmlComputedValues *pPropertyValues;   /* Current CSS property values */
     HtmlComputedValues *pPreviousValues;   /* Previous CSS property values */
+    int iStyleShare;                       /* Style-sharing id (css.c) */
     CssDynamic *pDynamic;                  /* CSS dynamic conditions */
     Tcl_Obj *pOverride;                    /* List of property overrides */
     HtmlNodeStack *pStack;                 /* Stacking context */
@@ -362,6 +388,7 @@ struct HtmlElementNode {
     HtmlNodeReplacement *pReplacement;     /* Replaced object, if any */
     HtmlLayoutCache *pLayoutCache;         /* Cached layout, if any */
     HtmlNodeScrollbars *pScrollbar;        /* Internal scrollbars, if any */
+    HtmlTextBlock *pTextBlock;             /* Text-representation block */
 
     HtmlCanvasItem *pBox;
 };
@@ -413,7 +440,11 @@ struct HtmlOptions {
     Tcl_Obj *imagecmd;
     int      imagecache;
     int      imagepixmapify;
+    int      imageasync;                /* Boolean */
+    int      layoutslice;               /* Layout time-slice (ms) or 0 */
+    int      discardparsed;             /* Boolean */
     int      mode;                      /* One of the HTML_MODE_XXX values */
+    int      nodecommands;              /* Boolean */
     int      shrink;                    /* Boolean */
     double   zoom;                      /* Universal scaling factor. */
 
@@ -466,6 +497,9 @@ struct HtmlCallback {
 
     /* HTML_DYNAMIC */
     HtmlNode *pDynamic;         /* Recalculate dynamic CSS for this node */
+    int nDynamic;               /* Number of entries in apDynamic[] */
+    int nDynamicAlloc;          /* Allocated size of apDynamic[] */
+    HtmlNode **apDynamic;       /* Nodes with modified dynamic flags */
 
     /* HTML_DAMAGE */
     HtmlDamage *pDamage;
@@ -493,6 +527,7 @@ struct HtmlCallback {
 void HtmlCallbackForce(HtmlTree *);
 void HtmlCallbackDynamic(HtmlTree *, HtmlNode *);
 void HtmlCallbackDamage(HtmlTree *, int, int, int, int);
+void HtmlCallbackExpose(HtmlTree *, int, int, int, int);
 void HtmlCallbackLayout(HtmlTree *, HtmlNode *);
 void HtmlCallbackRestyle(HtmlTree *, HtmlNode *);
 
@@ -515,6 +550,32 @@ struct HtmlTreeState {
     int isCdataInHead;      /* True if previous token was <title> */
 };
 
+/*
+ * Each Tcl interpreter that contains one or more html widgets has a
+ * single instance of the following structure, shared by all of them. It
+ * is reference counted - one reference is held by the interpreter (as 
+ * assoc-data) and one by each widget (HtmlTree.pInterpData).
+ *
+ * Class and attribute name atoms are interned here instead of in each
+ * HtmlTree, so that compiled stylesheets may be shared between widgets
+ * (see "Shared stylesheets" in css.c). Fonts and colors are cached here
+ * too, one HtmlDisplayCache for each display in use (see htmlprop.h).
+ */
+struct HtmlInterpData {
+    int nRef;                       /* Number of references */
+    Tcl_HashTable aClassAtom;       /* Class-name atoms (css.c) */
+    Tcl_HashTable aAttrAtom;        /* Attribute-name atoms (htmltagdb.c) */
+    Tcl_HashTable aSharedStyle;     /* Shared stylesheets by hash (css.c) */
+    int isStyleSweep;               /* True if aSharedStyle sweep pending */
+    int nRetainedStyle;             /* Retained agent stylesheets (css.c) */
+    int nStyleParse;                /* Shared stylesheets parsed (css.c) */
+    Tcl_HashTable aNodeHandle;      /* Live node-handles (htmltree.c) */
+    int iNodeHandle;                /* Next node-handle number */
+    HtmlDisplayCache *pDisplayCache;  /* Font/color caches (htmlprop.c) */
+};
+HtmlInterpData *HtmlInterpDataGet(Tcl_Interp *);
+void HtmlInterpDataRelease(HtmlInterpData *);
+
 struct HtmlTree {
 
     /*
@@ -557,6 +618,7 @@ struct HtmlTree {
      */
     Tcl_Obj *pDocument;             /* Text of the html document */
     int nParsed;                    /* Bytes of pDocument tokenized */
+    int nDiscard;                   /* Bytes discarded by -discardparsed */
     int nCharParsed;                /* TODO: Characters parsed */
 
     int iWriteInsert;               /* Byte offset in pDocument for [write] */
@@ -568,6 +630,14 @@ struct HtmlTree {
     HtmlNode *pRoot;                /* The root-node of the document. */
 
     Tcl_HashTable aAtom;            /* String atoms for this widget */
+    HtmlInterpData *pInterpData;    /* State shared with other widgets */
+
+    /* Dynamic CSS conditions indexed by the nodes whose dynamic flags
+     * they depend on, and the number of conditions that could not be
+     * indexed. See cssdynamic.c.
+     */
+    Tcl_HashTable aDynamic;
+    int nDynamicGlobal;
 
     HtmlTreeState state;
 
@@ -586,6 +656,8 @@ struct HtmlTree {
     HtmlFragmentContext *pFragment;
 
     int isFixed;                    /* True if any "fixed" graphics */
+    int isFixedBackground;          /* True if any fixed backgrounds */
+    int isFixedOnTop;               /* True if fixed content is painted last */
 
     /*
      * Handler callbacks configured by the [$widget handler] command.
@@ -606,9 +678,18 @@ struct HtmlTree {
 
     CssStyleSheet *pStyle;          /* Style sheet configuration */
 
+    HtmlArena *pArena;              /* Arena for document nodes (htmltree.c) */
+
     /* Used by code in HtmlStyleApply() */
     void *pStyleApply;
 
+    /* Style-sharing cache used by HtmlCssStyleSheetApply() (css.c) */
+    void *pStyleShare;
+    int iStyleShareId;              /* Last style-sharing id assigned */
+
+    /* Ancestor filter used by HtmlCssStyleSheetApply() (css.c) */
+    void *pAncestorFilter;
+
     HtmlOptions options;            /* Configurable options */
     Tk_OptionTable optionTable;     /* Option table */
 
@@ -620,6 +701,8 @@ struct HtmlTree {
      * Internal representation of a completely layed-out document.
      */
     HtmlCanvas canvas;              /* Canvas to render into */
+    HtmlTileCache *pTileCache;      /* Rendered canvas tiles (htmldraw.c) */
+    void *pCanvasIndex;             /* Spatial index of canvas (htmldraw.c) */
     int iCanvasWidth;               /* Width of window for canvas */
     int iCanvasHeight;              /* Height of window for canvas */
 
@@ -631,8 +714,7 @@ struct HtmlTree {
      * HtmlComputedValuesSetupTables(), except for aFontSizeTable[], which is
      * set via the -fonttable option. 
      */
-    Tcl_HashTable aColor;
-    HtmlFontCache fontcache;
+    HtmlDisplayCache *pDisplayCache;   /* Fonts and colors (shared) */
     Tcl_HashTable aValues;
     Tcl_HashTable aFontFamilies;
     Tcl_HashTable aCounterLists;
@@ -658,6 +740,12 @@ struct HtmlTree {
      */
     int isBboxOk;
 
+    /* True if the most recent layout was interrupted before the whole
+     * document was laid out (see the -layoutslice option). The rest of
+     * the document is laid out by subsequent idle callbacks.
+     */
+    int isLayoutPartial;
+
     HtmlCallback cb;                /* See structure definition comments */
     int iLastSnapshotId;            /* Last snapshot id allocated */
     Tcl_TimerToken delayToken;
@@ -703,6 +791,7 @@ Tcl_ObjCmdProc HtmlCssStyleConfigDump;
 Tcl_ObjCmdProc Rt_AllocCommand;
 Tcl_ObjCmdProc HtmlWidgetBboxCmd;
 Tcl_ObjCmdProc HtmlImageServerReport;
+Tcl_ObjCmdProc HtmlImageJobsCmd;
 
 Tcl_ObjCmdProc HtmlDebug;
 Tcl_ObjCmdProc HtmlDecode;
@@ -743,20 +832,35 @@ char CONST *HtmlNodeTagName(HtmlNode *);
 char CONST *HtmlNodeAttr(HtmlNode *, char CONST *);
 char *      HtmlNodeToString(HtmlNode *);
 HtmlNode *  HtmlNodeGetPointer(HtmlTree *, char CONST *);
+HtmlNode *  HtmlNodeFromObj(HtmlTree *, Tcl_Obj *);
 int         HtmlNodeIsOrphan(HtmlNode *);
 
 int HtmlNodeAddChild(HtmlElementNode *, int, const char *, HtmlAttributes *);
 int HtmlNodeAddTextChild(HtmlNode *, HtmlTextNode *);
 
+/*
+ * Per-document arena used to allocate nodes and attributes (htmltree.c).
+ * Memory returned by HtmlArenaAlloc() must be freed with HtmlArenaFree().
+ */
+HtmlArena * HtmlTreeArena(HtmlTree *);
+char *      HtmlArenaAlloc(HtmlArena *, const char *, int);
+void        HtmlArenaFree(void *);
+HtmlArena * HtmlArenaOf(const void *);
+#define HtmlArenaNew(pArena, x) \
+    ((x *)memset(HtmlArenaAlloc((pArena), #x, sizeof(x)), 0, sizeof(x)))
+
 Html_u8     HtmlNodeTagType(HtmlNode *);
 
 Tcl_Obj *HtmlNodeCommand(HtmlTree *, HtmlNode *pNode);
+Tcl_Obj *HtmlNodeHandle(HtmlTree *, HtmlNode *pNode);
+int HtmlNodeDispatchCmd(ClientData, Tcl_Interp *, int, Tcl_Obj *CONST []);
 int HtmlNodeDeleteCommand(HtmlTree *, HtmlNode *pNode);
 
 void HtmlDrawCleanup(HtmlTree *, HtmlCanvas *);
 void HtmlDrawDeleteControls(HtmlTree *, HtmlCanvas *);
 
 void HtmlDrawCanvas(HtmlCanvas*,HtmlCanvas*,int,int,HtmlNode*);
+void HtmlDrawCanvasIndex(HtmlTree *);
 void HtmlDrawText(HtmlCanvas*,const char*,int,int,int,int,int,HtmlNode*,int);
 void HtmlDrawTextExtend(HtmlCanvas*, int, int);
 int HtmlDrawTextLength(HtmlCanvas*);
@@ -810,6 +914,7 @@ void HtmlFloatListNormalize(HtmlFloatList*, int, int);
 void HtmlFloatListMargins(HtmlFloatList*, int, int, int *, int *);
 void HtmlFloatListLog(HtmlTree *, CONST char *, CONST char *, HtmlFloatList *);
 int HtmlFloatListIsConstant(HtmlFloatList*, int, int);
+void HtmlFloatListStats(HtmlFloatList*, int *, int *, int *);
 
 HtmlPropertyCache * HtmlNewPropertyCache();
 void HtmlSetPropertyCache(HtmlPropertyCache *, int, CssProperty *);
@@ -817,6 +922,7 @@ void HtmlAttributesToPropertyCache(HtmlNode *pNode);
 
 Tcl_HashKeyType * HtmlCaseInsenstiveHashType();
 Tcl_HashKeyType * HtmlFontKeyHashType();
+Tcl_HashKeyType * HtmlTextWidthHashType();
 Tcl_HashKeyType * HtmlComputedValuesHashType();
 
 CONST char *HtmlDefaultTcl();
@@ -850,6 +956,8 @@ void HtmlWidgetNodeBox(HtmlTree *, HtmlNode *, int *, int *, int *, int *);
 
 void HtmlWidgetSetViewport(HtmlTree *, int, int, int);
 void HtmlWidgetRepair(HtmlTree *, int, int, int, int, int);
+void HtmlDrawTileInvalidate(HtmlTree *, int, int, int, int);
+void HtmlDrawTileCleanup(HtmlTree *);
 
 int HtmlNodeClearStyle(HtmlTree *, HtmlElementNode *);
 int HtmlNodeClearGenerated(HtmlTree *, HtmlElementNode *);
@@ -873,6 +981,8 @@ Tcl_ObjCmdProc HtmlTextIndexCmd;
 Tcl_ObjCmdProc HtmlTextBboxCmd;
 Tcl_ObjCmdProc HtmlTextOffsetCmd;
 void HtmlTextInvalidate(HtmlTree *);
+void HtmlTextInvalidateNode(HtmlTree *, HtmlNode *);
+void HtmlTextFreeElement(HtmlElementNode *);
 
 void HtmlWidgetBboxText(
 HtmlTree *, HtmlNode *, int, HtmlNode *, int, int *, int *, int *, int*);
@@ -880,7 +990,15 @@ int HtmlNodeScrollbarDoCallback(HtmlTree *, HtmlNode *);
 
 void HtmlDelScrollbars(HtmlTree *, HtmlNode *);
 
-HtmlAttributes * HtmlAttributesNew(int, char const **, int *, int);
+HtmlAttributes * HtmlAttributesNew(
+    HtmlTree *, HtmlArena *, int, char const **, int *, int
+);
+HtmlAttributes * HtmlAttributesSet(
+    HtmlTree *, HtmlArena *, HtmlAttributes *, const char *, const char *
+);
+void HtmlAttributesFree(HtmlAttributes *);
+char *HtmlAttributesFind(HtmlAttributes *, const char *);
+const char *HtmlAttributeAtom(HtmlTree *, const char *);
 
 void HtmlParseFragment(HtmlTree *, const char *);
 void HtmlSequenceNodes(HtmlTree *);
@@ -925,7 +1043,7 @@ HtmlTokenMap * HtmlHashLookup(void *, const char *zType);
 /*
  * Creation, modification and deletion of HtmlTextNode objects.
  */
-HtmlTextNode * HtmlTextNew(int, const char *, int, int);
+HtmlTextNode * HtmlTextNew(HtmlArena *, int, const char *, int, int);
 void           HtmlTextSet(HtmlTextNode *, int, const char *, int, int);
 void           HtmlTextFree(HtmlTextNode *);
 
@@ -34,6 +34,7 @@ static const char rcsid[] = "$Id: htmldraw.c,v 1.208 2008/02/14 08:43:49 danielk
 
 #include "html.h"
 #include <assert.h>
+#include <limits.h>
 #include <X11/Xutil.h>
 
 
@@ -99,6 +100,14 @@ static const char rcsid[] = "$Id: htmldraw.c,v 1.208 2008/02/14 08:43:49 danielk
  *         used to scroll the window. It recalculates the positions of
  *         mapped windows.
  *
+ *     HtmlDrawTileInvalidate
+ *     HtmlDrawTileCleanup
+ *
+ *         Repair() paints from a cache of rendered canvas tiles where
+ *         possible (see "TILE CACHE" below). TileInvalidate() discards
+ *         cached tiles that intersect a region of the canvas that has
+ *         changed. TileCleanup() discards all cached tiles.
+ *
  * Snapshot feature (for figuring out the difference between two layouts):
  *
  *     HtmlDrawSnapshot
@@ -139,6 +148,7 @@ static const char rcsid[] = "$Id: htmldraw.c,v 1.208 2008/02/14 08:43:49 danielk
  *
  * Canvas management:
  *     HtmlDrawCanvas
+ *     HtmlDrawCanvasIndex
  *     HtmlDrawCleanup
  *     HtmlDrawCopyCanvas
  *     HtmlDrawIsEmpty
@@ -372,6 +382,8 @@ static int scrollToNodeCb(HtmlCanvasItem *, int, int, Overflow *, ClientData);
 static int layoutBboxCb(HtmlCanvasItem *, int, int, Overflow *, ClientData);
 static int layoutNodeCb(HtmlCanvasItem *, int, int, Overflow *, ClientData);
 
+static void canvasIndexFree(HtmlTree *);
+
 /*
  * This is like a big expensive assert() statement that checks the
  * internal state of the HtmlCanvas structure passed as an argument
@@ -746,6 +758,11 @@ CHECK_CANVAS(pCanvas);
 
     assert(pTree || !pCanvas->pFirst);
 
+    /* The spatial index refers to the primitives of HtmlTree.canvas. */
+    if (pTree && pCanvas == &pTree->canvas) {
+        canvasIndexFree(pTree);
+    }
+
     pItem = pCanvas->pFirst;
     while (pItem) {
         Tcl_Obj *pObj = 0;
@@ -1795,17 +1812,21 @@ fill_rectangle(win, d, xcolor, x, y, w, h)
 /*
  *---------------------------------------------------------------------------
  *
- * HtmlLayoutPrimitives --
+ * tileimage --
+ *
+ *     Tile image pImage over the block (bg_x, bg_y, bg_w, bg_h) of
+ *     drawable "drawable".
  *
  * Results:
- *     None.
+ *     Zero if the image is not yet available to draw (because it is
+ *     being scaled by a worker thread), otherwise one.
  *
  * Side effects:
  *     None.
  *
  *---------------------------------------------------------------------------
  */
-static void
+static int
 tileimage(
 pQuery, drawable, d_w, d_h, pImage, bg_x, bg_y, bg_w, bg_h, iPosX, iPosY)
     GetPixmapQuery *pQuery;   /* Clipping region */
@@ -1856,7 +1877,8 @@ pQuery, drawable, d_w, d_h, pImage, bg_x, bg_y, bg_w, bg_h, iPosX, iPosY)
             img = HtmlImageImage(pImage);
         }
     }
-    if (i_w <= 0 || i_h <= 0) return;
+    if (!pix && !img) return 0;
+    if (i_w <= 0 || i_h <= 0) return 1;
 
     x1 = iPosX;
     if (iPosX != bg_x) {
@@ -1912,6 +1934,7 @@ pQuery, drawable, d_w, d_h, pImage, bg_x, bg_y, bg_w, bg_h, iPosX, iPosY)
             }
         }
     }
+    return 1;
 }
 
 static void
@@ -2264,13 +2287,31 @@ drawImage(pQuery, pI2, drawable, x, y, w, h)
 
         HtmlImageSize(pI2->pImage, &imW, &imH);
 
-        tileimage(
+        if (!tileimage(
             pQuery, drawable, w, h, 
             pI2->pImage,
             x + pI2->x, y + pI2->y,
             imW, imH,
             x + pI2->x, y + pI2->y
-        );
+        )) {
+            /* The image is being scaled asynchronously. Draw a one pixel
+             * wide silver box as a placeholder.
+             */
+            Tk_Window win = pQuery->pTree->tkwin;
+            Tcl_HashEntry *pEntry;
+            XColor *xcolor;
+            int x1 = x + pI2->x;
+            int y1 = y + pI2->y;
+            pEntry = Tcl_FindHashEntry(
+                &pQuery->pTree->pDisplayCache->aColor, "silver"
+            );
+            assert(pEntry);
+            xcolor = ((HtmlColor *)Tcl_GetHashValue(pEntry))->xcolor;
+            fill_rectangle(win, drawable, xcolor, x1, y1, imW, 1);
+            fill_rectangle(win, drawable, xcolor, x1, y1 + imH - 1, imW, 1);
+            fill_rectangle(win, drawable, xcolor, x1, y1, 1, imH);
+            fill_rectangle(win, drawable, xcolor, x1 + imW - 1, y1, 1, imH);
+        }
     }
 }
 
@@ -2459,236 +2500,937 @@ drawText(pQuery, pItem, drawable, x, y)
 }
 
 
+/*
+ * The following structures are used to build a spatial index of the
+ * display list stored in HtmlTree.canvas. The index is built by
+ * HtmlDrawCanvasIndex() once HtmlLayout() has finished and is used by
+ * searchCanvas() so that the cost of a query depends on the number of 
+ * primitives in the queried region, not on the size of the document.
+ *
+ * Each leaf primitive (anything other than an ORIGIN, MARKER or OVERFLOW
+ * item) is stored in the CanvasIndex.aEntry[] array, in display-list
+ * order. Along with the primitive itself, each entry records the 
+ * accumulated origin, the innermost overflow region (if any) and the
+ * innermost enclosing pair of CANVAS_ORIGIN items (see below) that apply
+ * to the primitive. This is the same context that searchCanvas() used to
+ * build up while walking the linked list.
+ *
+ * The entries are grouped into buckets of CANVAS_INDEX_BUCKET entries.
+ * A complete binary tree (stored implicitly in CanvasIndex.aNode[]) 
+ * records the minimum top and maximum bottom y-coordinate of the
+ * primitives in each subtree of buckets. Because the tree is built over
+ * the display-list order, not sorted by y-coordinate, a query visits the
+ * matching primitives in exactly the same order as a linear scan would.
+ *
+ * Items that follow the MARKER_FIXED marker ("position:fixed" content)
+ * move with the viewport, so they are not part of the tree. They are 
+ * always a suffix of the display list (entries CanvasIndex.iFixed and
+ * greater) and are tested individually by each query.
+ */
+typedef struct CanvasIndex CanvasIndex;
+typedef struct CanvasIndexEntry CanvasIndexEntry;
+typedef struct CanvasIndexOverflow CanvasIndexOverflow;
+typedef struct CanvasIndexOrigin CanvasIndexOrigin;
+typedef struct CanvasIndexNode CanvasIndexNode;
+
+#define CANVAS_INDEX_BUCKET 8
+
+struct CanvasIndexEntry {
+    HtmlCanvasItem *pItem;
+    int x;                   /* Accumulated origin x-coordinate */
+    int y;                   /* Accumulated origin y-coordinate */
+    int iOverflow;           /* Index in CanvasIndex.aOverflow[], or -1 */
+    int iOrigin;             /* Index in CanvasIndex.aOrigin[], or -1 */
+};
+
+/*
+ * One of these is allocated for each CANVAS_OVERFLOW item. The range
+ * (iMinScroll..iMaxScroll) contains every value the vertical scroll
+ * offset of the associated node-scrollbar may take without a relayout.
+ */
+struct CanvasIndexOverflow {
+    HtmlCanvasItem *pItem;   /* The CANVAS_OVERFLOW item */
+    int x;                   /* Accumulated origin x-coordinate */
+    int y;                   /* Accumulated origin y-coordinate */
+    int isFixed;             /* True if after the MARKER_FIXED marker */
+    int iMinScroll;
+    int iMaxScroll;
+};
+
+/*
+ * A searchCanvas() query skips the entire sub-list between a pair of
+ * CANVAS_ORIGIN items if the vertical extent recorded by the pair does
+ * not intersect the queried region. To preserve this behaviour, each
+ * pair of CANVAS_ORIGIN items that encloses at least one primitive has an
+ * entry in CanvasIndex.aOrigin[]. Nested pairs that are tested against
+ * the same overflow scroll offset are merged into a single entry (by
+ * taking the intersection of the two extents), so the length of the
+ * iParent chain is bounded by the depth of nested overflow regions.
+ */
+struct CanvasIndexOrigin {
+    int top;                 /* Absolute y-coordinate of top of region */
+    int bottom;              /* Absolute y-coordinate of bottom of region */
+    int iOverflow;           /* Overflow region the test is scrolled by */
+    int iParent;             /* Enclosing entry in aOrigin[], or -1 */
+};
+
+struct CanvasIndexNode {
+    int top;                 /* Minimum y-coordinate in subtree */
+    int bottom;              /* Maximum y-coordinate in subtree */
+};
+
+struct CanvasIndex {
+    int nEntry;
+    int nEntryAlloc;
+    CanvasIndexEntry *aEntry;
+    int iFixed;              /* Index of first "position:fixed" entry */
+
+    int nOverflow;
+    int nOverflowAlloc;
+    CanvasIndexOverflow *aOverflow;
+
+    int nOrigin;
+    int nOriginAlloc;
+    CanvasIndexOrigin *aOrigin;
+
+    int nLeaf;               /* Number of leaves (buckets) in aNode[] tree */
+    CanvasIndexNode *aNode;  /* Tree nodes. Root is aNode[1] */
+};
+
 /*
  *---------------------------------------------------------------------------
  *
- * searchCanvas --
+ * canvasIndexFree --
  *
- *     Iterate through a subset of the drawing primitives in the
- *     canvas associated with widget pTree. For each primitive, invoke
- *     the callback function provided as argument xFunc.
+ *     Free the spatial index attached to widget pTree, if any.
  *
  * Results:
  *     None.
  *
  * Side effects:
+ *     Sets HtmlTree.pCanvasIndex to NULL.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+canvasIndexFree(pTree)
+    HtmlTree *pTree;
+{
+    CanvasIndex *pIndex = (CanvasIndex *)pTree->pCanvasIndex;
+    if (pIndex) {
+        HtmlFree(pIndex->aEntry);
+        HtmlFree(pIndex->aOverflow);
+        HtmlFree(pIndex->aOrigin);
+        HtmlFree(pIndex->aNode);
+        HtmlFree(pIndex);
+        pTree->pCanvasIndex = 0;
+    }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * canvasIndexScroll --
+ *
+ *     Return the current vertical scroll offset of overflow region iOverflow.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int
+canvasIndexScroll(pIndex, iOverflow)
+    CanvasIndex *pIndex;
+    int iOverflow;
+{
+    if (iOverflow >= 0) {
+        HtmlCanvasItem *pItem = pIndex->aOverflow[iOverflow].pItem;
+        HtmlElementNode *pElem = (HtmlElementNode *)pItem->x.overflow.pNode;
+        if (pElem->pScrollbar) {
+            return pElem->pScrollbar->iVertical;
+        }
+    }
+    return 0;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlDrawCanvasIndex --
+ *
+ *     Build the spatial index used by searchCanvas() for the display list
+ *     currently stored in HtmlTree.canvas. This is called by HtmlLayout()
+ *     each time a complete layout is generated (not after a time-sliced
+ *     pass that was interrupted, so that the cost of a time-sliced layout
+ *     is not quadratic in the size of the document). The index is 
+ *     discarded when the canvas is (see HtmlDrawCleanup()).
+ *
+ * Results:
  *     None.
  *
+ * Side effects:
+ *     Replaces HtmlTree.pCanvasIndex.
+ *
  *---------------------------------------------------------------------------
  */
-static int    
-searchCanvas(pTree, ymin, ymax, xFunc, clientData, requireOverflow)
+void
+HtmlDrawCanvasIndex(pTree)
     HtmlTree *pTree;
-    int ymin;                    /* Minimum y coordinate, or INT_MIN */
-    int ymax;                    /* Maximum y coordinate, or INT_MAX */
-    int (*xFunc)(HtmlCanvasItem *, int, int, Overflow *, ClientData);
-    ClientData clientData;
-    int requireOverflow;         /* Boolean. True to pass Overflow* arg */
 {
+    CanvasIndex *pIndex;
     HtmlCanvasItem *pItem;
-    HtmlCanvasItem *pSkip = 0;
-    HtmlCanvas *pCanvas = &pTree->canvas;
+
     int origin_x = 0;
     int origin_y = 0;
-    int rc = 0;
-    int nTest = 0;
-    int nCallback = 0;
+    int iCurrentOrigin = -1;
 
-    /* The overflow stack. Grown using HtmlRealloc(). */
-    Overflow **apOverflow = 0;
-    int nOverflow = 0;
+    /* Stack of open overflow regions. Grown using HtmlRealloc(). */
+    int *aiOverflow = 0;
+    int nOverflowStack = 0;
     int iOverflow = -1;
 
-    /* Debugging variables to support assert() statements */
-    int nOrigin = 0;
-    int bSeenFixedMarker = 0;
-     
-    for (pItem = pCanvas->pFirst; pItem; pItem = (pSkip?pSkip:pItem->pNext)) {
+    /* Stack of open CANVAS_ORIGIN pairs. Each element is the value of 
+     * iCurrentOrigin before the pair was opened.
+     */
+    int *aiOrigin = 0;
+    int nOriginStack = 0;
+    int iOriginDepth = 0;
 
-        pSkip = 0;
+    int nLeaf;
+    int ii;
+
+    canvasIndexFree(pTree);
+    pIndex = HtmlNew(CanvasIndex);
+    pIndex->iFixed = -1;
+
+    for (pItem = pTree->canvas.pFirst; pItem; pItem = pItem->pNext) {
         switch (pItem->type) {
             case CANVAS_ORIGIN: {
                 CanvasOrigin *pOrigin1 = &pItem->x.o;
-                CanvasOrigin *pOrigin2 = 0;
-                int ymin2 = ymin;
-                int ymax2 = ymax;
-                if (pOrigin1->pSkip) pOrigin2 = &pItem->x.o.pSkip->x.o;
-
-                nOrigin += (pOrigin2?1:-1);
-
-                if (iOverflow >= 0) {
-                    ymin2 += apOverflow[iOverflow]->yscroll;
-                    ymax2 += apOverflow[iOverflow]->yscroll;
-                }
-    
                 origin_x += pOrigin1->x;
                 origin_y += pOrigin1->y;
-                if (pOrigin2 && (
-                    (ymax >= 0 && (origin_y + pOrigin1->vertical) > ymax2) ||
-                    (ymin >= 0 && (origin_y + pOrigin2->vertical) < ymin2))
-                ) {
-                   pSkip = pOrigin1->pSkip;
+                if (pOrigin1->pSkip) {
+                    CanvasOrigin *pOrigin2 = &pOrigin1->pSkip->x.o;
+                    CanvasIndexOrigin *pNew;
+                    CanvasIndexOrigin *pParent = 0;
+                    int iParent = iCurrentOrigin;
+
+                    if (iOriginDepth == nOriginStack) {
+                        nOriginStack += 16;
+                        aiOrigin = (int *)HtmlRealloc(0, aiOrigin, 
+                            nOriginStack * sizeof(int)
+                        );
+                    }
+                    aiOrigin[iOriginDepth++] = iCurrentOrigin;
+
+                    if (pIndex->nOrigin == pIndex->nOriginAlloc) {
+                        pIndex->nOriginAlloc = pIndex->nOriginAlloc*2 + 64;
+                        pIndex->aOrigin = (CanvasIndexOrigin *)HtmlRealloc(0,
+                            pIndex->aOrigin, 
+                            pIndex->nOriginAlloc * sizeof(CanvasIndexOrigin)
+                        );
+                    }
+                    if (iParent >= 0) pParent = &pIndex->aOrigin[iParent];
+                    pNew = &pIndex->aOrigin[pIndex->nOrigin];
+                    pNew->top = origin_y + pOrigin1->vertical;
+                    pNew->bottom = origin_y + pOrigin2->vertical;
+                    pNew->iOverflow = (iOverflow>=0) ? aiOverflow[iOverflow]:-1;
+                    pNew->iParent = iParent;
+                    if (pParent && pParent->iOverflow == pNew->iOverflow) {
+                        pNew->top = MAX(pNew->top, pParent->top);
+                        pNew->bottom = MIN(pNew->bottom, pParent->bottom);
+                        pNew->iParent = pParent->iParent;
+                    }
+                    iCurrentOrigin = pIndex->nOrigin++;
+                } else {
+                    assert(iOriginDepth > 0);
+                    iCurrentOrigin = aiOrigin[--iOriginDepth];
                 }
                 break;
             }
 
-            case CANVAS_MARKER: {
-                if(pItem->x.marker.flags == MARKER_FIXED){
-                    assert(bSeenFixedMarker == 0);
-                    assert(nOrigin == 0);
-                    assert(origin_x == 0);
-                    assert(origin_y == 0);
-                    origin_x = pTree->iScrollX;
-                    origin_y = pTree->iScrollY;
-                    bSeenFixedMarker = 1;
+            case CANVAS_MARKER:
+                if (pItem->x.marker.flags == MARKER_FIXED) {
+                    assert(pIndex->iFixed < 0);
+                    assert(origin_x == 0 && origin_y == 0);
+                    pIndex->iFixed = pIndex->nEntry;
                 }
                 break;
-            }
 
             case CANVAS_OVERFLOW: {
-                if (requireOverflow) {
-                    Overflow *pOverflow = (Overflow *)&pItem[1];
-                    HtmlNode *pNode = pItem->x.overflow.pNode;
-    
-                    HtmlElementNode *pElem = (HtmlElementNode *)pNode;
-                    assert(!HtmlNodeIsText(pNode));
-    
-                    iOverflow++;
-                    assert(iOverflow <= nOverflow);
-                    if (iOverflow == nOverflow) {
-                        int n = sizeof(Overflow *) * (nOverflow + 1);
-                        apOverflow = (Overflow**)HtmlRealloc(0, apOverflow, n);
-                        nOverflow++;
-                    }
-                    apOverflow[iOverflow] = pOverflow;
-                    pOverflow->pItem = &pItem->x.overflow;
-                    pOverflow->x = pItem->x.overflow.x + origin_x;
-                    pOverflow->y = pItem->x.overflow.y + origin_y;
-                    pOverflow->w = pItem->x.overflow.w;
-                    pOverflow->h = pItem->x.overflow.h;
-                    pOverflow->pixmap = 0;
-                    pOverflow->pNext = 0;
-    
-                    /* Adjust the x and y coords for scrollable blocks: */
-                    pOverflow->xscroll = 0;
-                    pOverflow->yscroll = 0;
-                    if (pElem->pScrollbar) {
-                        pOverflow->xscroll = pElem->pScrollbar->iHorizontal;
-                        pOverflow->yscroll = pElem->pScrollbar->iVertical;
-                    }
+                CanvasIndexOverflow *pNew;
+                HtmlElementNode *pElem;
+                if (pIndex->nOverflow == pIndex->nOverflowAlloc) {
+                    pIndex->nOverflowAlloc = pIndex->nOverflowAlloc * 2 + 16;
+                    pIndex->aOverflow = (CanvasIndexOverflow *)HtmlRealloc(0,
+                        pIndex->aOverflow, 
+                        pIndex->nOverflowAlloc * sizeof(CanvasIndexOverflow)
+                    );
                 }
-           
-                break;
-            }
-           
-            default: {
-                Overflow *pOver = 0;
-                nTest++;
-
-                if (ymax >= 0 || ymin >= 0) {
-                    int x, y, w, h;
-                    int ymin2 = ymin;
-                    int ymax2 = ymax;
-                    itemToBox(pItem, origin_x, origin_y, &x, &y, &w, &h);
-                    if (iOverflow >= 0) {
-                        ymin2 += apOverflow[iOverflow]->yscroll;
-                        ymax2 += apOverflow[iOverflow]->yscroll;
-                    }
-                    if ((ymax >= 0 && y >= ymax2) || 
-                        (ymin >= 0 && (y+h) <= ymin2)
-                    ) {
-                       break;
-                    }
+                pNew = &pIndex->aOverflow[pIndex->nOverflow];
+                pNew->pItem = pItem;
+                pNew->x = origin_x;
+                pNew->y = origin_y;
+                pNew->isFixed = (pIndex->iFixed >= 0);
+                pNew->iMinScroll = 0;
+                pNew->iMaxScroll = 0;
+
+                /* The [$node yview] command (see htmltree.c) constrains the
+                 * scroll offset to lie between 0 and (iVerticalMax-iHeight).
+                 * Neither of those change without a new layout. Include the
+                 * current offset too, as it is not clamped until the next
+                 * time it is modified.
+                 */
+                pElem = (HtmlElementNode *)pItem->x.overflow.pNode;
+                if (pElem->pScrollbar) {
+                    HtmlNodeScrollbars *p = pElem->pScrollbar;
+                    int iMax = p->iVerticalMax - p->iHeight;
+                    pNew->iMinScroll = MIN(MIN(0, iMax), p->iVertical);
+                    pNew->iMaxScroll = MAX(MAX(0, iMax), p->iVertical);
                 }
 
-                if (iOverflow >= 0) {
-                    pOver = apOverflow[iOverflow];
+                if (iOverflow+1 == nOverflowStack) {
+                    nOverflowStack += 16;
+                    aiOverflow = (int *)HtmlRealloc(0, aiOverflow, 
+                        nOverflowStack * sizeof(int)
+                    );
                 }
-                rc = xFunc(pItem, origin_x, origin_y, pOver, clientData);
-                if (0 != rc) {
-                    goto search_out;
+                aiOverflow[++iOverflow] = pIndex->nOverflow++;
+                break;
+            }
+
+            default: {
+                CanvasIndexEntry *pEntry;
+                if (pIndex->nEntry == pIndex->nEntryAlloc) {
+                    pIndex->nEntryAlloc = pIndex->nEntryAlloc * 2 + 256;
+                    pIndex->aEntry = (CanvasIndexEntry *)HtmlRealloc(0, 
+                        pIndex->aEntry, 
+                        pIndex->nEntryAlloc * sizeof(CanvasIndexEntry)
+                    );
                 }
-                nCallback++;
+                pEntry = &pIndex->aEntry[pIndex->nEntry++];
+                pEntry->pItem = pItem;
+                pEntry->x = origin_x;
+                pEntry->y = origin_y;
+                pEntry->iOverflow = (iOverflow >= 0) ? aiOverflow[iOverflow]:-1;
+                pEntry->iOrigin = iCurrentOrigin;
                 break;
             }
         }
 
-        /* Check if we are supposed to pop the overflow stack */
-        while (iOverflow >= 0 && pItem == apOverflow[iOverflow]->pItem->pEnd) {
+        /* Pop the overflow stack, as searchCanvasList() does. */
+        while (iOverflow >= 0 && 
+            pItem == pIndex->aOverflow[aiOverflow[iOverflow]].pItem->x.overflow.pEnd
+        ) {
             iOverflow--;
         }
     }
+    HtmlFree(aiOverflow);
+    HtmlFree(aiOrigin);
 
-#if 0
-printf("Search(%d, %d) -> %d tests %d callbacks\n",ymin,ymax,nTest,nCallback);
-#endif
- 
-search_out:
-    HtmlFree(apOverflow);
-    return rc;
-}
+    if (pIndex->iFixed < 0) {
+        pIndex->iFixed = pIndex->nEntry;
+    }
 
-static int
-sorterCb(pItem, x, y, pOverflow, clientData)
-    HtmlCanvasItem *pItem;
-    int x;
-    int y;
-    Overflow *pOverflow;
-    ClientData clientData;
-{
-    CanvasItemSorter *pSorter = (CanvasItemSorter *)clientData;
+    /* Build the tree over the non-fixed entries. Leaf number ii covers 
+     * entries (ii*CANVAS_INDEX_BUCKET) to ((ii+1)*CANVAS_INDEX_BUCKET - 1)
+     * and is stored at aNode[nLeaf+ii]. Unused leaves have an empty 
+     * (top > bottom) extent so that they are never visited.
+     */
+    nLeaf = 1;
+    while (nLeaf * CANVAS_INDEX_BUCKET < pIndex->iFixed) nLeaf = nLeaf * 2;
+    pIndex->nLeaf = nLeaf;
+    pIndex->aNode = (CanvasIndexNode *)HtmlAlloc(0, 
+        2 * nLeaf * sizeof(CanvasIndexNode)
+    );
+    for (ii = 0; ii < nLeaf; ii++) {
+        CanvasIndexNode *pNode = &pIndex->aNode[nLeaf + ii];
+        int iEntry = ii * CANVAS_INDEX_BUCKET;
+        int iEnd = MIN(iEntry + CANVAS_INDEX_BUCKET, pIndex->iFixed);
+        pNode->top = INT_MAX;
+        pNode->bottom = INT_MIN;
+        for ( ; iEntry < iEnd; iEntry++) {
+            CanvasIndexEntry *pEntry = &pIndex->aEntry[iEntry];
+            int x, y, w, h;
+            itemToBox(pEntry->pItem, pEntry->x, pEntry->y, &x, &y, &w, &h);
+
+            /* The entry may be scrolled by the overflow region it is in. */
+            if (pEntry->iOverflow >= 0) {
+                CanvasIndexOverflow *pO = &pIndex->aOverflow[pEntry->iOverflow];
+                y -= pO->iMaxScroll;
+                h += (pO->iMaxScroll - pO->iMinScroll);
+            }
+            pNode->top = MIN(pNode->top, y);
+            pNode->bottom = MAX(pNode->bottom, y + h);
 
-    /* Only visible items are added to the sorter. */
-    if (pItem->type == CANVAS_BOX) {
-        HtmlComputedValues *p = HtmlNodeComputedValues(pItem->x.box.pNode);
-        if (
-            (p->eBorderTopStyle == CSS_CONST_NONE || !p->border.iTop) && 
-            (p->eBorderBottomStyle == CSS_CONST_NONE || !p->border.iBottom) && 
-            (p->eBorderRightStyle == CSS_CONST_NONE || !p->border.iRight) && 
-            (p->eBorderLeftStyle == CSS_CONST_NONE || !p->border.iLeft) &&
-            (p->eOutlineStyle == CSS_CONST_NONE || !p->iOutlineWidth) &&
-            (!p->imBackgroundImage) && 
-            (!p->cBackgroundColor || !p->cBackgroundColor->xcolor)
-        ) {
-            return 0;
+            /* The size of a CANVAS_WINDOW primitive is the requested size
+             * of the window, which may change without a relayout.
+             */
+            if (pEntry->pItem->type == CANVAS_WINDOW) {
+                pNode->bottom = INT_MAX;
+            }
         }
     }
-    if (pItem->type == CANVAS_LINE) {
-        HtmlComputedValues *p = HtmlNodeComputedValues(pItem->x.box.pNode);
-        if (p->eTextDecoration == CSS_CONST_NONE) {
-            return 0;
-        }
+    for (ii = nLeaf - 1; ii > 0; ii--) {
+        CanvasIndexNode *pLeft = &pIndex->aNode[ii * 2];
+        CanvasIndexNode *pRight = &pIndex->aNode[ii * 2 + 1];
+        pIndex->aNode[ii].top = MIN(pLeft->top, pRight->top);
+        pIndex->aNode[ii].bottom = MAX(pLeft->bottom, pRight->bottom);
     }
 
-    if (pSorter->iSnapshot) {
-        /* If CanvasItemSorter.iSnapshot is not zero, then we are creating
-         * a snap-shot for HtmlDrawSnapshot().
-         */
-        pItem->iSnapshot = pSorter->iSnapshot;
-        if (pItem->type == CANVAS_BOX) {
-            x += pItem->x.box.x;
-            y += pItem->x.box.y;
-        }
-        pItem->nRef++;
-        assert(pItem->nRef >= 2);
-    } 
+    pTree->pCanvasIndex = (void *)pIndex;
+    HtmlLog(pTree, "LAYOUTENGINE", "Canvas index: %d primitives "
+        "(%d fixed), %d overflow regions, %d origins",
+        pIndex->nEntry, pIndex->nEntry - pIndex->iFixed, 
+        pIndex->nOverflow, pIndex->nOrigin
+    );
+}
+
+/*
+ * Query state passed between searchCanvasIndex() and the functions it 
+ * calls.
+ */
+typedef struct CanvasIndexQuery CanvasIndexQuery;
+struct CanvasIndexQuery {
+    HtmlTree *pTree;
+    CanvasIndex *pIndex;
+    int ymin;
+    int ymax;
+    int (*xFunc)(HtmlCanvasItem *, int, int, Overflow *, ClientData);
+    ClientData clientData;
+    int requireOverflow;
+    unsigned char *aOverflowInit;   /* True for each initialized Overflow */
+    int nTest;
+    int nCallback;
+};
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * canvasIndexOverflow --
+ *
+ *     Return the Overflow structure (stored immediately after the 
+ *     CANVAS_OVERFLOW item itself) for overflow region iOverflow. It is
+ *     initialized the first time it is requested during each query.
+ *
+ *---------------------------------------------------------------------------
+ */
+static Overflow *
+canvasIndexOverflow(pQuery, iOverflow)
+    CanvasIndexQuery *pQuery;
+    int iOverflow;
+{
+    CanvasIndexOverflow *pO = &pQuery->pIndex->aOverflow[iOverflow];
+    HtmlCanvasItem *pItem = pO->pItem;
+    Overflow *pOverflow = (Overflow *)&pItem[1];
+
+    if (!pQuery->aOverflowInit[iOverflow]) {
+        HtmlElementNode *pElem = (HtmlElementNode *)pItem->x.overflow.pNode;
+        int origin_x = pO->x;
+        int origin_y = pO->y;
+        if (pO->isFixed) {
+            origin_x += pQuery->pTree->iScrollX;
+            origin_y += pQuery->pTree->iScrollY;
+        }
+        pOverflow->pItem = &pItem->x.overflow;
+        pOverflow->x = pItem->x.overflow.x + origin_x;
+        pOverflow->y = pItem->x.overflow.y + origin_y;
+        pOverflow->w = pItem->x.overflow.w;
+        pOverflow->h = pItem->x.overflow.h;
+        pOverflow->pixmap = 0;
+        pOverflow->pNext = 0;
+        pOverflow->xscroll = 0;
+        pOverflow->yscroll = 0;
+        if (pElem->pScrollbar) {
+            pOverflow->xscroll = pElem->pScrollbar->iHorizontal;
+            pOverflow->yscroll = pElem->pScrollbar->iVertical;
+        }
+        pQuery->aOverflowInit[iOverflow] = 1;
+    }
+    return pOverflow;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * canvasIndexVisit --
+ *
+ *     Test entry iEntry of the index against the query region and invoke
+ *     the query callback if it is inside. The tests are identical to
+ *     those applied by searchCanvasList().
+ *
+ * Results:
+ *     Zero, or the non-zero value returned by the callback.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int
+canvasIndexVisit(pQuery, iEntry)
+    CanvasIndexQuery *pQuery;
+    int iEntry;
+{
+    CanvasIndex *pIndex = pQuery->pIndex;
+    CanvasIndexEntry *pEntry = &pIndex->aEntry[iEntry];
+    Overflow *pOver = 0;
+    int ymin = pQuery->ymin;
+    int ymax = pQuery->ymax;
+    int origin_x = pEntry->x;
+    int origin_y = pEntry->y;
+    int yfixed = 0;
+    int rc;
+
+    if (iEntry >= pIndex->iFixed) {
+        origin_x += pQuery->pTree->iScrollX;
+        origin_y += pQuery->pTree->iScrollY;
+        yfixed = pQuery->pTree->iScrollY;
+    }
+    pQuery->nTest++;
+
+    if (ymax >= 0 || ymin >= 0) {
+        int iOrigin;
+        int x, y, w, h;
+        int yscroll = 0;
+
+        /* Enclosing CANVAS_ORIGIN extents. */
+        for (iOrigin = pEntry->iOrigin; iOrigin >= 0; ) {
+            CanvasIndexOrigin *pOrigin = &pIndex->aOrigin[iOrigin];
+            int s = 0;
+            if (pQuery->requireOverflow) {
+                s = canvasIndexScroll(pIndex, pOrigin->iOverflow);
+            }
+            if ((ymax >= 0 && pOrigin->top + yfixed > ymax + s) ||
+                (ymin >= 0 && pOrigin->bottom + yfixed < ymin + s)
+            ) {
+                return 0;
+            }
+            iOrigin = pOrigin->iParent;
+        }
+
+        /* The primitive itself. */
+        itemToBox(pEntry->pItem, origin_x, origin_y, &x, &y, &w, &h);
+        if (pQuery->requireOverflow) {
+            yscroll = canvasIndexScroll(pIndex, pEntry->iOverflow);
+        }
+        if ((ymax >= 0 && y >= ymax + yscroll) || 
+            (ymin >= 0 && (y+h) <= ymin + yscroll)
+        ) {
+            return 0;
+        }
+    }
+
+    if (pQuery->requireOverflow && pEntry->iOverflow >= 0) {
+        pOver = canvasIndexOverflow(pQuery, pEntry->iOverflow);
+    }
+    rc = pQuery->xFunc(pEntry->pItem, origin_x, origin_y, pOver, 
+        pQuery->clientData
+    );
+    if (rc == 0) {
+        pQuery->nCallback++;
+    }
+    return rc;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * canvasIndexSearch --
+ *
+ *     Visit the entries covered by node iNode of the index tree that
+ *     may intersect the query region, in display-list order.
+ *
+ * Results:
+ *     Zero, or the first non-zero value returned by the callback.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int
+canvasIndexSearch(pQuery, iNode)
+    CanvasIndexQuery *pQuery;
+    int iNode;
+{
+    CanvasIndex *pIndex = pQuery->pIndex;
+    CanvasIndexNode *pNode = &pIndex->aNode[iNode];
+    int rc = 0;
+
+    if (pNode->top > pNode->bottom) return 0;
+    if (pQuery->ymax >= 0 && pNode->top >= pQuery->ymax) return 0;
+    if (pQuery->ymin >= 0 && pNode->bottom <= pQuery->ymin) return 0;
+
+    if (iNode >= pIndex->nLeaf) {
+        int iEntry = (iNode - pIndex->nLeaf) * CANVAS_INDEX_BUCKET;
+        int iEnd = MIN(iEntry + CANVAS_INDEX_BUCKET, pIndex->iFixed);
+        for ( ; rc == 0 && iEntry < iEnd; iEntry++) {
+            rc = canvasIndexVisit(pQuery, iEntry);
+        }
+    } else {
+        rc = canvasIndexSearch(pQuery, iNode * 2);
+        if (rc == 0) {
+            rc = canvasIndexSearch(pQuery, iNode * 2 + 1);
+        }
+    }
+    return rc;
+}
+
+/*
+ * Flags for the final argument to searchCanvas(), searchCanvasIndex() and
+ * searchCanvasList(). By default primitives in both the normal and the
+ * "position:fixed" part of the display list (the part that follows the
+ * MARKER_FIXED marker) are visited.
+ */
+#define SEARCH_OVERFLOW   0x01    /* Pass Overflow* argument to callback */
+#define SEARCH_NOFIXED    0x02    /* Skip the "position:fixed" primitives */
+#define SEARCH_FIXEDONLY  0x04    /* Skip all other primitives */
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * searchCanvasIndex --
+ *
+ *     Equivalent to searchCanvasList(), but uses the spatial index 
+ *     HtmlTree.pCanvasIndex to avoid visiting primitives outside of
+ *     the region (ymin..ymax).
+ *
+ * Results:
+ *     Zero, or the first non-zero value returned by the callback.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int
+searchCanvasIndex(pTree, ymin, ymax, xFunc, clientData, flags)
+    HtmlTree *pTree;
+    int ymin;
+    int ymax;
+    int (*xFunc)(HtmlCanvasItem *, int, int, Overflow *, ClientData);
+    ClientData clientData;
+    int flags;                   /* Mask of SEARCH_XXX flags */
+{
+    CanvasIndex *pIndex = (CanvasIndex *)pTree->pCanvasIndex;
+    CanvasIndexQuery sQuery;
+    int iEntry;
+    int rc = 0;
+
+#ifndef NDEBUG
+    for (iEntry = 0; iEntry < pIndex->nOverflow; iEntry++) {
+        CanvasIndexOverflow *pO = &pIndex->aOverflow[iEntry];
+        int s = canvasIndexScroll(pIndex, iEntry);
+        assert(s >= pO->iMinScroll && s <= pO->iMaxScroll);
+    }
+#endif
+
+    memset(&sQuery, 0, sizeof(CanvasIndexQuery));
+    sQuery.pTree = pTree;
+    sQuery.pIndex = pIndex;
+    sQuery.ymin = ymin;
+    sQuery.ymax = ymax;
+    sQuery.xFunc = xFunc;
+    sQuery.clientData = clientData;
+    sQuery.requireOverflow = (flags & SEARCH_OVERFLOW);
+    if (sQuery.requireOverflow && pIndex->nOverflow > 0) {
+        sQuery.aOverflowInit = (unsigned char *)HtmlClearAlloc(0, 
+            pIndex->nOverflow
+        );
+    }
+
+    if (pIndex->iFixed > 0 && !(flags & SEARCH_FIXEDONLY)) {
+        rc = canvasIndexSearch(&sQuery, 1);
+    }
+    if (!(flags & SEARCH_NOFIXED)) {
+        iEntry = pIndex->iFixed;
+        for ( ; rc == 0 && iEntry < pIndex->nEntry; iEntry++) {
+            rc = canvasIndexVisit(&sQuery, iEntry);
+        }
+    }
+
+#if 0
+printf("Search(%d, %d) -> %d tests %d callbacks\n", 
+    ymin, ymax, sQuery.nTest, sQuery.nCallback
+);
+#endif
+
+    HtmlFree(sQuery.aOverflowInit);
+    return rc;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * searchCanvasList --
+ *
+ *     Iterate through a subset of the drawing primitives in the
+ *     canvas associated with widget pTree by walking the linked list
+ *     of primitives from the start. For each primitive, invoke the 
+ *     callback function provided as argument xFunc.
+ *
+ *     This is used by searchCanvas() when there is no spatial index
+ *     available.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int    
+searchCanvasList(pTree, ymin, ymax, xFunc, clientData, flags)
+    HtmlTree *pTree;
+    int ymin;                    /* Minimum y coordinate, or INT_MIN */
+    int ymax;                    /* Maximum y coordinate, or INT_MAX */
+    int (*xFunc)(HtmlCanvasItem *, int, int, Overflow *, ClientData);
+    ClientData clientData;
+    int flags;                   /* Mask of SEARCH_XXX flags */
+{
+    HtmlCanvasItem *pItem;
+    HtmlCanvasItem *pSkip = 0;
+    HtmlCanvas *pCanvas = &pTree->canvas;
+    int origin_x = 0;
+    int origin_y = 0;
+    int rc = 0;
+    int nTest = 0;
+    int nCallback = 0;
+
+    /* The overflow stack. Grown using HtmlRealloc(). */
+    Overflow **apOverflow = 0;
+    int nOverflow = 0;
+    int iOverflow = -1;
+
+    /* True once the MARKER_FIXED marker has been seen */
+    int bSeenFixedMarker = 0;
+
+    /* Debugging variables to support assert() statements */
+    int nOrigin = 0;
+     
+    for (pItem = pCanvas->pFirst; pItem; pItem = (pSkip?pSkip:pItem->pNext)) {
+
+        pSkip = 0;
+        switch (pItem->type) {
+            case CANVAS_ORIGIN: {
+                CanvasOrigin *pOrigin1 = &pItem->x.o;
+                CanvasOrigin *pOrigin2 = 0;
+                int ymin2 = ymin;
+                int ymax2 = ymax;
+                if (pOrigin1->pSkip) pOrigin2 = &pItem->x.o.pSkip->x.o;
+
+                nOrigin += (pOrigin2?1:-1);
+
+                if (iOverflow >= 0) {
+                    ymin2 += apOverflow[iOverflow]->yscroll;
+                    ymax2 += apOverflow[iOverflow]->yscroll;
+                }
+    
+                origin_x += pOrigin1->x;
+                origin_y += pOrigin1->y;
+                if (pOrigin2 && (
+                    (ymax >= 0 && (origin_y + pOrigin1->vertical) > ymax2) ||
+                    (ymin >= 0 && (origin_y + pOrigin2->vertical) < ymin2))
+                ) {
+                   pSkip = pOrigin1->pSkip;
+                }
+                break;
+            }
+
+            case CANVAS_MARKER: {
+                if(pItem->x.marker.flags == MARKER_FIXED){
+                    assert(bSeenFixedMarker == 0);
+                    assert(nOrigin == 0);
+                    assert(origin_x == 0);
+                    assert(origin_y == 0);
+                    origin_x = pTree->iScrollX;
+                    origin_y = pTree->iScrollY;
+                    bSeenFixedMarker = 1;
+                    if (flags & SEARCH_NOFIXED) goto search_out;
+                }
+                break;
+            }
+
+            case CANVAS_OVERFLOW: {
+                if (flags & SEARCH_OVERFLOW) {
+                    Overflow *pOverflow = (Overflow *)&pItem[1];
+                    HtmlNode *pNode = pItem->x.overflow.pNode;
+    
+                    HtmlElementNode *pElem = (HtmlElementNode *)pNode;
+                    assert(!HtmlNodeIsText(pNode));
+    
+                    iOverflow++;
+                    assert(iOverflow <= nOverflow);
+                    if (iOverflow == nOverflow) {
+                        int n = sizeof(Overflow *) * (nOverflow + 1);
+                        apOverflow = (Overflow**)HtmlRealloc(0, apOverflow, n);
+                        nOverflow++;
+                    }
+                    apOverflow[iOverflow] = pOverflow;
+                    pOverflow->pItem = &pItem->x.overflow;
+                    pOverflow->x = pItem->x.overflow.x + origin_x;
+                    pOverflow->y = pItem->x.overflow.y + origin_y;
+                    pOverflow->w = pItem->x.overflow.w;
+                    pOverflow->h = pItem->x.overflow.h;
+                    pOverflow->pixmap = 0;
+                    pOverflow->pNext = 0;
+    
+                    /* Adjust the x and y coords for scrollable blocks: */
+                    pOverflow->xscroll = 0;
+                    pOverflow->yscroll = 0;
+                    if (pElem->pScrollbar) {
+                        pOverflow->xscroll = pElem->pScrollbar->iHorizontal;
+                        pOverflow->yscroll = pElem->pScrollbar->iVertical;
+                    }
+                }
+           
+                break;
+            }
+           
+            default: {
+                Overflow *pOver = 0;
+                if (!bSeenFixedMarker && (flags & SEARCH_FIXEDONLY)) break;
+                nTest++;
+
+                if (ymax >= 0 || ymin >= 0) {
+                    int x, y, w, h;
+                    int ymin2 = ymin;
+                    int ymax2 = ymax;
+                    itemToBox(pItem, origin_x, origin_y, &x, &y, &w, &h);
+                    if (iOverflow >= 0) {
+                        ymin2 += apOverflow[iOverflow]->yscroll;
+                        ymax2 += apOverflow[iOverflow]->yscroll;
+                    }
+                    if ((ymax >= 0 && y >= ymax2) || 
+                        (ymin >= 0 && (y+h) <= ymin2)
+                    ) {
+                       break;
+                    }
+                }
+
+                if (iOverflow >= 0) {
+                    pOver = apOverflow[iOverflow];
+                }
+                rc = xFunc(pItem, origin_x, origin_y, pOver, clientData);
+                if (0 != rc) {
+                    goto search_out;
+                }
+                nCallback++;
+                break;
+            }
+        }
+
+        /* Check if we are supposed to pop the overflow stack */
+        while (iOverflow >= 0 && pItem == apOverflow[iOverflow]->pItem->pEnd) {
+            iOverflow--;
+        }
+    }
+
+#if 0
+printf("Search(%d, %d) -> %d tests %d callbacks\n",ymin,ymax,nTest,nCallback);
+#endif
+ 
+search_out:
+    HtmlFree(apOverflow);
+    return rc;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * searchCanvas --
+ *
+ *     Iterate through a subset of the drawing primitives in the
+ *     canvas associated with widget pTree. For each primitive, invoke
+ *     the callback function provided as argument xFunc.
+ *
+ *     If the spatial index has been built (see HtmlDrawCanvasIndex()), it
+ *     is used to find the primitives. Otherwise the display list is
+ *     scanned from the start.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int    
+searchCanvas(pTree, ymin, ymax, xFunc, clientData, flags)
+    HtmlTree *pTree;
+    int ymin;                    /* Minimum y coordinate, or INT_MIN */
+    int ymax;                    /* Maximum y coordinate, or INT_MAX */
+    int (*xFunc)(HtmlCanvasItem *, int, int, Overflow *, ClientData);
+    ClientData clientData;
+    int flags;                   /* Mask of SEARCH_XXX flags */
+{
+    if (pTree->pCanvasIndex) {
+        return searchCanvasIndex(
+            pTree, ymin, ymax, xFunc, clientData, flags
+        );
+    }
+    return searchCanvasList(
+        pTree, ymin, ymax, xFunc, clientData, flags
+    );
+}
+
+static int
+sorterCb(pItem, x, y, pOverflow, clientData)
+    HtmlCanvasItem *pItem;
+    int x;
+    int y;
+    Overflow *pOverflow;
+    ClientData clientData;
+{
+    CanvasItemSorter *pSorter = (CanvasItemSorter *)clientData;
+
+    /* Only visible items are added to the sorter. */
+    if (pItem->type == CANVAS_BOX) {
+        HtmlComputedValues *p = HtmlNodeComputedValues(pItem->x.box.pNode);
+        if (
+            (p->eBorderTopStyle == CSS_CONST_NONE || !p->border.iTop) && 
+            (p->eBorderBottomStyle == CSS_CONST_NONE || !p->border.iBottom) && 
+            (p->eBorderRightStyle == CSS_CONST_NONE || !p->border.iRight) && 
+            (p->eBorderLeftStyle == CSS_CONST_NONE || !p->border.iLeft) &&
+            (p->eOutlineStyle == CSS_CONST_NONE || !p->iOutlineWidth) &&
+            (!p->imBackgroundImage) && 
+            (!p->cBackgroundColor || !p->cBackgroundColor->xcolor)
+        ) {
+            return 0;
+        }
+    }
+    if (pItem->type == CANVAS_LINE) {
+        HtmlComputedValues *p = HtmlNodeComputedValues(pItem->x.box.pNode);
+        if (p->eTextDecoration == CSS_CONST_NONE) {
+            return 0;
+        }
+    }
+
+    if (pSorter->iSnapshot) {
+        /* If CanvasItemSorter.iSnapshot is not zero, then we are creating
+         * a snap-shot for HtmlDrawSnapshot().
+         */
+        pItem->iSnapshot = pSorter->iSnapshot;
+        if (pItem->type == CANVAS_BOX) {
+            x += pItem->x.box.x;
+            y += pItem->x.box.y;
+        }
+        pItem->nRef++;
+        assert(pItem->nRef >= 2);
+    } 
 
     sorterInsert(pSorter, pItem, x, y, pOverflow);
     return 0;
 }
 static void    
-searchSortedCanvas(pTree, ymin, ymax, pNode, xFunc, clientData)
+searchSortedCanvas(pTree, ymin, ymax, flags, xFunc, clientData)
     HtmlTree *pTree;
     int ymin;                    /* Minimum y coordinate, or INT_MIN */
     int ymax;                    /* Maximum y coordinate, or INT_MAX */
-    HtmlNode *pNode;             /* Node to search subtree of, or NULL */
+    int flags;                   /* SEARCH_NOFIXED or SEARCH_FIXEDONLY */
     int (*xFunc)(HtmlCanvasItem *, int, int, Overflow *, ClientData);
     ClientData clientData;
 {
     CanvasItemSorter sSorter;
     memset(&sSorter, 0, sizeof(CanvasItemSorter));
 
-    searchCanvas(pTree, ymin, ymax, sorterCb, (ClientData)&sSorter, 1);
+    flags |= SEARCH_OVERFLOW;
+    searchCanvas(pTree, ymin, ymax, sorterCb, (ClientData)&sSorter, flags);
     sorterIterate(&sSorter, xFunc, clientData);
     sorterReset(&sSorter);
 }
@@ -2744,13 +3486,26 @@ static CanvasItemSorterSlot *nextItem(pSorter, piLevel, piItem)
     return pRet;
 }
 
-static void damageSlot(pTree, pSlot, pX1, pY1, pX2, pY2, isOld)
+/*
+ *---------------------------------------------------------------------------
+ *
+ * damageSlot --
+ *
+ *     Add the area occupied by the item in snapshot slot pSlot to the
+ *     damaged region of the widget (see HtmlCallbackDamage()). If isOld
+ *     is true, pSlot is from the old snapshot.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     May add a rectangle to HtmlTree.cb.pDamage.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void damageSlot(pTree, pSlot, isOld)
     HtmlTree *pTree;
     CanvasItemSorterSlot *pSlot;
-    int *pX1;
-    int *pY1;
-    int *pX2;
-    int *pY2;
     int isOld;
 {
     int x;
@@ -2767,10 +3522,11 @@ static void damageSlot(pTree, pSlot, pX1, pY1, pX2, pY2, isOld)
         pSlot->pItem->x.w.pElem->pReplacement->iCanvasX = -10000;
         pSlot->pItem->x.w.pElem->pReplacement->iCanvasY = -10000;
     }
-    *pX1 = MIN(*pX1, x);
-    *pY1 = MIN(*pY1, y);
-    *pX2 = MAX(*pX2, x+w);
-    *pY2 = MAX(*pY2, y+h);
+    if (w > 0 && h > 0) {
+        HtmlCallbackDamage(pTree, 
+            x - pTree->iScrollX - 1, y - pTree->iScrollY - 1, w + 1, h + 1
+        );
+    }
 }
 
 static int itemsAreEqual(p1, p2)
@@ -2820,6 +3576,30 @@ HtmlDrawSnapshotZero(pTree)
     return (HtmlCanvasSnapshot *)HtmlNew(CanvasItemSorter);
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlDrawSnapshotDamage --
+ *
+ *     Compare snapshot pSnapshot with the current state of the canvas.
+ *     The area occupied by each item that has been created, deleted,
+ *     moved or marked dirty since the snapshot was taken is added to the
+ *     damaged region of the widget (see HtmlCallbackDamage()), so that
+ *     unrelated changes in distant parts of the viewport are repaired
+ *     as separate rectangles.
+ *
+ *     If ppCurrent is not NULL, *ppCurrent is set to a new snapshot of
+ *     the current canvas. The caller must free it using
+ *     HtmlDrawSnapshotFree().
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     May schedule a repaint.
+ *
+ *---------------------------------------------------------------------------
+ */
 void
 HtmlDrawSnapshotDamage(pTree, pSnapshot, ppCurrent)
     HtmlTree *pTree;
@@ -2844,11 +3624,6 @@ HtmlDrawSnapshotDamage(pTree, pSnapshot, ppCurrent)
     int iMoved = 0;
     int iStuck = 0;
 
-    int x1 = 100000; 
-    int y1 = 100000; 
-    int x2 = 0;
-    int y2 = 0;
-
     CanvasItemSorterSlot *pNewSlot;
     CanvasItemSorterSlot *pOldSlot;
 
@@ -2868,13 +3643,13 @@ HtmlDrawSnapshotDamage(pTree, pSnapshot, ppCurrent)
                 newy += pNewSlot->pItem->x.box.y;
             }
             if (newx != pOldSlot->x || newy != pOldSlot->y) {
-                damageSlot(pTree, pOldSlot, &x1, &y1, &x2, &y2, 1);
-                damageSlot(pTree, pNewSlot, &x1, &y1, &x2, &y2, 0);
+                damageSlot(pTree, pOldSlot, 1);
+                damageSlot(pTree, pNewSlot, 0);
                 iMoved++;
             } else {
                 HtmlNode *pNode = itemToNode(pNewSlot->pItem);
                 if (pNode && pNode->iSnapshot == pOld->iSnapshot) {
-                    damageSlot(pTree, pNewSlot, &x1, &y1, &x2, &y2, 0);
+                    damageSlot(pTree, pNewSlot, 0);
                     iDirty++;
                 } else {
                     iStuck++;
@@ -2883,33 +3658,27 @@ HtmlDrawSnapshotDamage(pTree, pSnapshot, ppCurrent)
             pOldSlot = nextItem(pOld, &iOldLevel, &iOldItem);
             pNewSlot = nextItem(pNew, &iNewLevel, &iNewItem);
         } else if (pNewSlot->pItem->iSnapshot == pOld->iSnapshot) {
-            damageSlot(pTree, pOldSlot, &x1, &y1, &x2, &y2, 1);
+            damageSlot(pTree, pOldSlot, 1);
             iDeleted++;
             pOldSlot = nextItem(pOld, &iOldLevel, &iOldItem);
         } else {
-            damageSlot(pTree, pNewSlot, &x1, &y1, &x2, &y2, 0);
+            damageSlot(pTree, pNewSlot, 0);
             iCreated++;
             pNewSlot = nextItem(pNew, &iNewLevel, &iNewItem);
         }
     }
 
     while (pNewSlot) {
-        damageSlot(pTree, pNewSlot, &x1, &y1, &x2, &y2, 0);
+        damageSlot(pTree, pNewSlot, 0);
         iCreated++;
         pNewSlot = nextItem(pNew, &iNewLevel, &iNewItem);
     }
     while (pOldSlot) {
-        damageSlot(pTree, pOldSlot, &x1, &y1, &x2, &y2, 1);
+        damageSlot(pTree, pOldSlot, 1);
         iDeleted++;
         pOldSlot = nextItem(pOld, &iOldLevel, &iOldItem);
     }
 
-    if (x1<x2 && y1<y2) {
-        int x = x1 - pTree->iScrollX - 1;
-        int y = y1 - pTree->iScrollY - 1;
-        HtmlCallbackDamage(pTree, x, y, 1+x2-x1, 1+y2-y1);
-    }
-
     if (ppCurrent) {
         *ppCurrent = (HtmlCanvasSnapshot *)pNew;
     } else {
@@ -3166,14 +3935,18 @@ pixmapQueryCb(pItem, origin_x, origin_y, pOverflow, clientData)
 /*
  *---------------------------------------------------------------------------
  *
- * getPixmap --
+ * drawPixmap --
  *
- *    Return a Pixmap containing the rendered document. The caller is
- *    responsible for calling Tk_FreePixmap() on the returned value.
+ *    Render the w x h region of the document with top-left corner at
+ *    canvas coordinates (xcanvas, ycanvas) into pixmap pmap.
  *
  *    This is the function that actually does the drawing using X11 
  *    drawing primitives.
  *
+ *    The flags argument may be 0, SEARCH_NOFIXED or SEARCH_FIXEDONLY. 
+ *    If it is SEARCH_FIXEDONLY, then only "position:fixed" content is 
+ *    drawn, over the existing contents of the pixmap.
+ *
  * Results:
  *     None.
  *
@@ -3182,17 +3955,17 @@ pixmapQueryCb(pItem, origin_x, origin_y, pOverflow, clientData)
  *
  *---------------------------------------------------------------------------
  */
-static Pixmap 
-getPixmap(pTree, xcanvas, ycanvas, w, h, getwin)
+static void
+drawPixmap(pTree, pmap, xcanvas, ycanvas, w, h, getwin, flags)
     HtmlTree *pTree;        /* Pointer to html widget */
-    int xcanvas;            /* top-left canvas x-coord of requested pixmap */
-    int ycanvas;            /* top-left canvas y-coord of requested pixmap */
-    int w;                  /* Required width of pixmap */
-    int h;                  /* Required height of pixmap */
+    Pixmap pmap;            /* Pixmap to draw to */
+    int xcanvas;            /* top-left canvas x-coord of pixmap */
+    int ycanvas;            /* top-left canvas y-coord of pixmap */
+    int w;                  /* Width of pixmap */
+    int h;                  /* Height of pixmap */
     int getwin;             /* Boolean. True to add windows to pTree->pMapped */
+    int flags;              /* SEARCH_NOFIXED or SEARCH_FIXEDONLY */
 {
-    Pixmap pmap;
-    Display *pDisplay;
     Tk_Window win = pTree->tkwin;
     XColor *bg_color = 0;
     GetPixmapQuery sQuery;
@@ -3201,10 +3974,6 @@ getPixmap(pTree, xcanvas, ycanvas, w, h, getwin)
     ClientData clientData;
     HtmlNode *pBgRoot;
 
-    Tk_MakeWindowExist(win);
-    pDisplay = Tk_Display(win);
-    pmap = Tk_GetPixmap(pDisplay, Tk_WindowId(win), w, h, Tk_Depth(win));
-
     /* Determine which tree node (if any) determines the background
      * color and image of the entire canvas.
      */
@@ -3220,12 +3989,12 @@ getPixmap(pTree, xcanvas, ycanvas, w, h, getwin)
         }
     }
 
-    if (
+    if ((flags & SEARCH_FIXEDONLY) == 0 && (
         !pBgRoot || 
         !HtmlNodeComputedValues(pBgRoot)->cBackgroundColor->xcolor
-    ) {
+    )) {
         Tcl_HashEntry *pEntry;
-        pEntry = Tcl_FindHashEntry(&pTree->aColor, "white");
+        pEntry = Tcl_FindHashEntry(&pTree->pDisplayCache->aColor, "white");
         assert(pEntry);
         bg_color = ((HtmlColor *)Tcl_GetHashValue(pEntry))->xcolor;
         fill_rectangle(win, pmap, bg_color, 0, 0, w, h);
@@ -3243,7 +4012,7 @@ getPixmap(pTree, xcanvas, ycanvas, w, h, getwin)
     sQuery.pCurrentOverflow = 0;
     sQuery.pOverflowList = 0;
 
-    if (pBgRoot) {
+    if (pBgRoot && (flags & SEARCH_FIXEDONLY) == 0) {
         CanvasBox sBox;
         int xv = xcanvas - pTree->iScrollX;
         int yv = ycanvas - pTree->iScrollY;
@@ -3265,7 +4034,9 @@ getPixmap(pTree, xcanvas, ycanvas, w, h, getwin)
         CanvasItemSorter *pSorter = (CanvasItemSorter *)pTree->cb.pSnapshot;
         sorterIterate(pSorter, pixmapQueryCb, clientData);
     }else{
-        searchSortedCanvas(pTree, ycanvas, ycanvas+h, 0, pixmapQueryCb, clientData);
+        searchSortedCanvas(
+            pTree, ycanvas, ycanvas+h, flags, pixmapQueryCb, clientData
+        );
     }
 #endif
     pixmapQuerySwitchOverflow(&sQuery, 0);
@@ -3295,22 +4066,164 @@ getPixmap(pTree, xcanvas, ycanvas, w, h, getwin)
         pOutline = pOutline->pNext;
         HtmlFree(pPrev);
     }
-  
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * getPixmap --
+ *
+ *    Return a Pixmap containing the rendered document. The caller is
+ *    responsible for calling Tk_FreePixmap() on the returned value.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static Pixmap 
+getPixmap(pTree, xcanvas, ycanvas, w, h, getwin)
+    HtmlTree *pTree;        /* Pointer to html widget */
+    int xcanvas;            /* top-left canvas x-coord of requested pixmap */
+    int ycanvas;            /* top-left canvas y-coord of requested pixmap */
+    int w;                  /* Required width of pixmap */
+    int h;                  /* Required height of pixmap */
+    int getwin;             /* Boolean. True to add windows to pTree->pMapped */
+{
+    Tk_Window win = pTree->tkwin;
+    Pixmap pmap;
+
+    Tk_MakeWindowExist(win);
+    pmap = Tk_GetPixmap(Tk_Display(win), Tk_WindowId(win), w, h, Tk_Depth(win));
+    drawPixmap(pTree, pmap, xcanvas, ycanvas, w, h, getwin, 0);
     return pmap;
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * layoutImageTiles --
+ *
+ *     <widget> image -tilesize SIZE -command SCRIPT
+ * 
+ *     Render the entire document canvas in tiles of at most SIZE x SIZE
+ *     pixels, working from left to right and top to bottom. For each 
+ *     tile, the name of a Tk image containing the tile and the canvas 
+ *     coordinates of the top-left corner of the tile are appended to
+ *     SCRIPT and the result evaluated. The image is deleted when the 
+ *     script returns, so a script that wishes to retain the tile must
+ *     copy it.
+ *
+ *     Only one tile exists at any one time, so the memory required does 
+ *     not depend on the size of the document. If SCRIPT returns
+ *     TCL_BREAK, or destroys the widget, no further tiles are rendered.
+ *
+ * Results:
+ *     Standard Tcl return code.
+ *
+ * Side effects:
+ *     Invokes SCRIPT zero or more times.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int
+layoutImageTiles(pTree, iTile, pScript)
+    HtmlTree *pTree;
+    int iTile;
+    Tcl_Obj *pScript;
+{
+    Tcl_Interp *interp = pTree->interp;
+    Display *pDisplay = Tk_Display(pTree->tkwin);
+    int rc = TCL_OK;
+    int w, h;
+    int x, y;
+
+    Tk_MakeWindowExist(pTree->tkwin);
+    w = MAX(pTree->canvas.right, Tk_Width(pTree->tkwin));
+    h = MAX(pTree->canvas.bottom, Tk_Height(pTree->tkwin));
+
+    /* The script may destroy the widget. If it does, stop rendering 
+     * tiles. The Tcl_Preserve() ensures pTree->isDeleted can still be
+     * read after the widget is deleted.
+     */
+    Tcl_Preserve((ClientData)pTree);
+    for (y = 0; rc == TCL_OK && !pTree->isDeleted && y < h; y += iTile) {
+        for (x = 0; rc == TCL_OK && !pTree->isDeleted && x < w; x += iTile) {
+            int tw = MIN(iTile, w - x);
+            int th = MIN(iTile, h - y);
+            Pixmap pixmap;
+            XImage *pXImage;
+            Tcl_Obj *pImage;
+
+            pixmap = getPixmap(pTree, x, y, tw, th, 0);
+            pXImage = XGetImage(pDisplay, pixmap, 0, 0, tw, th, 
+                AllPlanes, ZPixmap
+            );
+            pImage = HtmlXImageToImage(pTree, pXImage, tw, th);
+            XDestroyImage(pXImage);
+            Tk_FreePixmap(pDisplay, pixmap);
+            if (!pImage) {
+                rc = TCL_ERROR;
+                break;
+            }
+
+            {
+                Tcl_Obj *pEval = Tcl_DuplicateObj(pScript);
+                Tcl_Obj *pDelete = Tcl_NewStringObj("image delete", -1);
+                Tcl_IncrRefCount(pEval);
+                Tcl_IncrRefCount(pDelete);
+                Tcl_ListObjAppendElement(0, pEval, pImage);
+                Tcl_ListObjAppendElement(0, pEval, Tcl_NewIntObj(x));
+                Tcl_ListObjAppendElement(0, pEval, Tcl_NewIntObj(y));
+                Tcl_ListObjAppendElement(0, pDelete, pImage);
+
+                rc = Tcl_EvalObjEx(interp, pEval, TCL_EVAL_GLOBAL);
+                if (rc == TCL_CONTINUE) rc = TCL_OK;
+                if (rc == TCL_ERROR) {
+                    /* Evaluate [image delete] without clobbering the
+                     * error message left by the script.
+                     */
+                    Tcl_Obj *pErr = Tcl_GetObjResult(interp);
+                    Tcl_IncrRefCount(pErr);
+                    Tcl_EvalObjEx(interp, pDelete, TCL_EVAL_GLOBAL);
+                    Tcl_SetObjResult(interp, pErr);
+                    Tcl_DecrRefCount(pErr);
+                } else {
+                    Tcl_EvalObjEx(interp, pDelete, TCL_EVAL_GLOBAL);
+                }
+
+                Tcl_DecrRefCount(pDelete);
+                Tcl_DecrRefCount(pEval);
+                Tcl_DecrRefCount(pImage);
+            }
+        }
+    }
+
+    Tcl_Release((ClientData)pTree);
+
+    if (rc == TCL_BREAK) rc = TCL_OK;
+    if (rc == TCL_OK) Tcl_ResetResult(interp);
+    return rc;
+}
+
 /*
  *---------------------------------------------------------------------------
  *
  * HtmlLayoutImage --
  *
- *     <widget> image
+ *     <widget> image ?-tilesize SIZE -command SCRIPT?
  * 
  *     Render the document to a Tk image and return the name of the image
  *     as the Tcl result. The calling script is responsible for deleting
  *     the image. The image has blank space where controls would be mapped
  *     in a live display.
  *
+ *     If the -tilesize and -command options are specified, the whole
+ *     document is rendered in tiles instead. See layoutImageTiles().
+ *
  * Results:
  *     Standard Tcl return code.
  *
@@ -3333,6 +4246,43 @@ int HtmlLayoutImage(clientData, interp, objc, objv)
     int w;
     int h;
 
+    if (objc > 2) {
+        int iTile = 0;
+        Tcl_Obj *pScript = 0;
+        int ii;
+
+        for (ii = 2; ii < objc; ii += 2) {
+            const char *zOpt = Tcl_GetString(objv[ii]);
+            if (ii + 1 >= objc) {
+                Tcl_AppendResult(interp, "option requires an argument: ",
+                    zOpt, (char *)0
+                );
+                return TCL_ERROR;
+            }
+            if (0 == strcmp(zOpt, "-tilesize")) {
+                if (Tcl_GetIntFromObj(interp, objv[ii + 1], &iTile)) {
+                    return TCL_ERROR;
+                }
+            } else if (0 == strcmp(zOpt, "-command")) {
+                pScript = objv[ii + 1];
+            } else {
+                Tcl_AppendResult(interp, "unknown option \"", zOpt, 
+                    "\": must be -tilesize or -command", (char *)0
+                );
+                return TCL_ERROR;
+            }
+        }
+        if (iTile <= 0 || !pScript) {
+            Tcl_AppendResult(interp, "tiled rendering requires a positive "
+                "-tilesize and a -command script", (char *)0
+            );
+            return TCL_ERROR;
+        }
+
+        HtmlCallbackForce(pTree);
+        return layoutImageTiles(pTree, iTile, pScript);
+    }
+
     /* Force any pending style and/or layout operations to run. */
     HtmlCallbackForce(pTree);
 
@@ -3350,9 +4300,12 @@ int HtmlLayoutImage(clientData, interp, objc, objv)
         pXImage = XGetImage(pDisplay, pixmap, x, y, w, h, AllPlanes, ZPixmap);
         pImage = HtmlXImageToImage(pTree, pXImage, w, h);
         XDestroyImage(pXImage);
+        Tk_FreePixmap(Tk_Display(pTree->tkwin), pixmap);
+        if (!pImage) {
+            return TCL_ERROR;
+        }
         Tcl_SetObjResult(interp, pImage);
         Tcl_DecrRefCount(pImage);
-        Tk_FreePixmap(Tk_Display(pTree->tkwin), pixmap);
     } else {
         /* If the width or height is zero, then the image is empty. So just
 	 * run the following simple script to set the interpreter result to
@@ -3551,7 +4504,7 @@ layoutNodeIndexCmd(pTree, x, y)
         iIndex += sQuery.pClosest->iIndex;
 
         /* Load the result into the Tcl interpreter */
-        pCmd = Tcl_DuplicateObj(HtmlNodeCommand(pTree, pNode));
+        pCmd = Tcl_DuplicateObj(HtmlNodeHandle(pTree, pNode));
         Tcl_ListObjAppendElement(0, pCmd, Tcl_NewIntObj(iIndex));
         Tcl_SetObjResult(pTree->interp, pCmd);
     }
@@ -3722,13 +4675,13 @@ layoutNodeCmd(pTree, x, y)
     searchCanvas(pTree, y-1, y+1, layoutNodeCb, (ClientData)&sQuery, 1);
 
     if (sQuery.nNode == 1) {
-        Tcl_SetObjResult(pTree->interp, HtmlNodeCommand(pTree, *sQuery.apNode));
+        Tcl_SetObjResult(pTree->interp, HtmlNodeHandle(pTree, *sQuery.apNode));
     } else if (sQuery.nNode > 0) {
         int i;
         Tcl_Obj *pRet = Tcl_NewObj();
         qsort(sQuery.apNode, sQuery.nNode, sizeof(HtmlNode*),layoutNodeCompare);
         for (i = 0; i < sQuery.nNode; i++) {
-            Tcl_Obj *pCmd = HtmlNodeCommand(pTree, sQuery.apNode[i]);
+            Tcl_Obj *pCmd = HtmlNodeHandle(pTree, sQuery.apNode[i]);
             Tcl_ListObjAppendElement(0, pRet, pCmd);
         }
         Tcl_SetObjResult(pTree->interp, pRet);
@@ -3774,7 +4727,7 @@ HtmlLayoutNode(clientData, interp, objc, objv)
 
     if (objc == 2){
         if (pTree->pRoot) {
-            Tcl_Obj *pCmd = HtmlNodeCommand(pTree, pTree->pRoot);
+            Tcl_Obj *pCmd = HtmlNodeHandle(pTree, pTree->pRoot);
             Tcl_SetObjResult(interp, pCmd);
         }
     } else if (objc == 4 || objc == 5) {
@@ -3862,7 +4815,7 @@ HtmlWidgetBboxCmd(clientData, interp, objc, objv)
     HtmlCallbackForce(pTree);
 
     if (objc == 3) {
-        HtmlNode *pNode = HtmlNodeGetPointer(pTree, Tcl_GetString(objv[2]));
+        HtmlNode *pNode = HtmlNodeFromObj(pTree, objv[2]);
         if (!pNode) {
             return TCL_ERROR;
         }
@@ -4066,6 +5019,12 @@ HtmlWidgetDamageText(pTree, pNodeStart, iIndexStart, pNodeFin, iIndexFin)
     y = sQuery.top - pTree->iScrollY;
     h = (sQuery.bottom - pTree->iScrollY) - y;
     HtmlCallbackDamage(pTree, x, y, w, h);
+
+    /* Only the part of the text visible in the viewport was examined
+     * above, but the rendering of text outside of the viewport may have 
+     * changed too. So discard all cached tiles.
+     */
+    HtmlDrawTileCleanup(pTree);
 }
 
 void
@@ -4363,6 +5322,344 @@ HtmlWidgetNodeBox(pTree, pNode, pX, pY, pW, pH)
     }
 }
 
+/*
+ * TILE CACHE:
+ *
+ *     To avoid re-rendering the canvas each time part of the window must
+ *     be repainted (i.e. each time the viewport is scrolled and a strip of
+ *     the window is exposed), rendered regions of the canvas are cached
+ *     as HTML_TILE_SIZE x HTML_TILE_SIZE pixmaps. Tiles are identified by
+ *     their position on the canvas (so the cache does not depend on the
+ *     scroll position). A region of the window is repaired by copying
+ *     from cached tiles, rendering only those tiles that are not already
+ *     in the cache.
+ *
+ *     Cached tiles are discarded when the canvas changes, i.e. by 
+ *     HtmlCallbackDamage() (but not HtmlCallbackExpose()) and each time 
+ *     the layout engine is run. To bound the memory used, at most 
+ *     HTML_TILE_MIN tiles, or three viewports worth of tiles if that is 
+ *     greater, are cached. When this limit is reached the least recently
+ *     used tile is discarded.
+ *
+ *     Tiles never contain "position:fixed" content, which depends on the
+ *     scroll position. If the document contains fixed content, it is 
+ *     drawn over the tiles each time part of the window is repaired. 
+ *     This is only possible if the fixed content is painted after all
+ *     other content (HtmlTree.isFixedOnTop), and there are no fixed
+ *     background images (HtmlTree.isFixedBackground), which are painted
+ *     beneath other content. Otherwise the cache is not used.
+ */
+#define HTML_TILE_SIZE 256
+#define HTML_TILE_MIN   64
+
+typedef struct HtmlTile HtmlTile;
+struct HtmlTile {
+    int iTile[2];             /* Tile column and row (hash key) */
+    Pixmap pixmap;            /* Rendered tile */
+    int iLastUse;             /* Value of HtmlTileCache.iClock when used */
+};
+
+struct HtmlTileCache {
+    Tcl_HashTable aTile;      /* Map from iTile[2] to HtmlTile* */
+    int iClock;               /* Incremented each time a tile is used */
+};
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * tileDiv --
+ *
+ *     Return the index of the tile column (or row) containing canvas
+ *     x (or y) coordinate i. Canvas coordinates may be negative.
+ *
+ * Results:
+ *     Tile index.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int
+tileDiv(i)
+    int i;
+{
+    if (i >= 0) return (i / HTML_TILE_SIZE);
+    return -1 - ((-1 - i) / HTML_TILE_SIZE);
+}
+
+static void
+tileFree(pTree, pTile)
+    HtmlTree *pTree;
+    HtmlTile *pTile;
+{
+    Tk_FreePixmap(Tk_Display(pTree->tkwin), pTile->pixmap);
+    HtmlFree(pTile);
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlDrawTileCleanup --
+ *
+ *     Discard all cached tiles. This is called when the whole canvas
+ *     changes (i.e. after the layout engine is run) and when the widget
+ *     is destroyed.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     Frees HtmlTree.pTileCache.
+ *
+ *---------------------------------------------------------------------------
+ */
+void
+HtmlDrawTileCleanup(pTree)
+    HtmlTree *pTree;
+{
+    HtmlTileCache *pCache = pTree->pTileCache;
+    if (pCache) {
+        Tcl_HashEntry *pEntry;
+        Tcl_HashSearch sSearch;
+        for (
+            pEntry = Tcl_FirstHashEntry(&pCache->aTile, &sSearch);
+            pEntry;
+            pEntry = Tcl_NextHashEntry(&sSearch)
+        ) {
+            tileFree(pTree, (HtmlTile *)Tcl_GetHashValue(pEntry));
+        }
+        Tcl_DeleteHashTable(&pCache->aTile);
+        HtmlFree(pCache);
+        pTree->pTileCache = 0;
+    }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlDrawTileInvalidate --
+ *
+ *     Discard any cached tiles that intersect the rectangle of the canvas
+ *     with top-left corner at canvas coordinates (x, y), width w and
+ *     height h.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     May free tiles.
+ *
+ *---------------------------------------------------------------------------
+ */
+void
+HtmlDrawTileInvalidate(pTree, x, y, w, h)
+    HtmlTree *pTree;
+    int x;
+    int y;
+    int w;
+    int h;
+{
+    HtmlTileCache *pCache = pTree->pTileCache;
+    int ix1, iy1, ix2, iy2;
+    int ix, iy;
+
+    if (!pCache || w <= 0 || h <= 0) return;
+
+    ix1 = tileDiv(x);
+    iy1 = tileDiv(y);
+    ix2 = tileDiv(x + w - 1);
+    iy2 = tileDiv(y + h - 1);
+
+    /* If the rectangle covers more tiles than are cached, it is cheaper
+     * to iterate through the cache than through the rectangle. 
+     */
+    if ((ix2 - ix1 + 1) * (iy2 - iy1 + 1) > pCache->aTile.numEntries) {
+        Tcl_HashEntry *pEntry;
+        Tcl_HashSearch sSearch;
+        for (
+            pEntry = Tcl_FirstHashEntry(&pCache->aTile, &sSearch);
+            pEntry;
+            pEntry = Tcl_NextHashEntry(&sSearch)
+        ) {
+            HtmlTile *pTile = (HtmlTile *)Tcl_GetHashValue(pEntry);
+            if (
+                pTile->iTile[0] >= ix1 && pTile->iTile[0] <= ix2 &&
+                pTile->iTile[1] >= iy1 && pTile->iTile[1] <= iy2
+            ) {
+                tileFree(pTree, pTile);
+                Tcl_DeleteHashEntry(pEntry);
+            }
+        }
+        return;
+    }
+
+    for (iy = iy1; iy <= iy2; iy++) {
+        for (ix = ix1; ix <= ix2; ix++) {
+            int aKey[2];
+            Tcl_HashEntry *pEntry;
+            aKey[0] = ix;
+            aKey[1] = iy;
+            pEntry = Tcl_FindHashEntry(&pCache->aTile, (char *)aKey);
+            if (pEntry) {
+                tileFree(pTree, (HtmlTile *)Tcl_GetHashValue(pEntry));
+                Tcl_DeleteHashEntry(pEntry);
+            }
+        }
+    }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * tileGet --
+ *
+ *     Return the tile at column ix, row iy of the canvas, rendering it 
+ *     and adding it to the cache if it is not already cached. If the 
+ *     cache is full, the least recently used tile is discarded first.
+ *
+ * Results:
+ *     Pointer to HtmlTile structure owned by the cache.
+ *
+ * Side effects:
+ *     May render a tile. May discard a tile.
+ *
+ *---------------------------------------------------------------------------
+ */
+static HtmlTile *
+tileGet(pTree, ix, iy, g)
+    HtmlTree *pTree;
+    int ix;
+    int iy;
+    int g;                  /* Passed through to getPixmap() */
+{
+    HtmlTileCache *pCache = pTree->pTileCache;
+    Tcl_HashEntry *pEntry;
+    HtmlTile *pTile;
+    int aKey[2];
+    int isNew;
+
+    aKey[0] = ix;
+    aKey[1] = iy;
+    pEntry = Tcl_FindHashEntry(&pCache->aTile, (char *)aKey);
+
+    if (!pEntry) {
+        int nCol = 2 + Tk_Width(pTree->tkwin) / HTML_TILE_SIZE;
+        int nRow = 2 + Tk_Height(pTree->tkwin) / HTML_TILE_SIZE;
+        int nMax = MAX(HTML_TILE_MIN, 3 * nCol * nRow);
+
+        if (pCache->aTile.numEntries >= nMax) {
+            Tcl_HashEntry *pLru = 0;
+            Tcl_HashSearch sSearch;
+            int iLru = 0;
+            for (
+                pEntry = Tcl_FirstHashEntry(&pCache->aTile, &sSearch);
+                pEntry;
+                pEntry = Tcl_NextHashEntry(&sSearch)
+            ) {
+                HtmlTile *p = (HtmlTile *)Tcl_GetHashValue(pEntry);
+                if (!pLru || p->iLastUse < iLru) {
+                    pLru = pEntry;
+                    iLru = p->iLastUse;
+                }
+            }
+            tileFree(pTree, (HtmlTile *)Tcl_GetHashValue(pLru));
+            Tcl_DeleteHashEntry(pLru);
+        }
+
+        pTile = HtmlNew(HtmlTile);
+        pTile->iTile[0] = ix;
+        pTile->iTile[1] = iy;
+        pTile->pixmap = Tk_GetPixmap(Tk_Display(pTree->tkwin), 
+            Tk_WindowId(pTree->tkwin), HTML_TILE_SIZE, HTML_TILE_SIZE, 
+            Tk_Depth(pTree->tkwin)
+        );
+        drawPixmap(pTree, pTile->pixmap, 
+            ix * HTML_TILE_SIZE, iy * HTML_TILE_SIZE, 
+            HTML_TILE_SIZE, HTML_TILE_SIZE, g, SEARCH_NOFIXED
+        );
+        pEntry = Tcl_CreateHashEntry(&pCache->aTile, (char *)aKey, &isNew);
+        assert(isNew);
+        Tcl_SetHashValue(pEntry, pTile);
+    }
+
+    pTile = (HtmlTile *)Tcl_GetHashValue(pEntry);
+    pTile->iLastUse = pCache->iClock++;
+    return pTile;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * tileRepair --
+ *
+ *     Copy the rectangle of the viewport at viewport coordinates (x, y), 
+ *     width w, height h from cached tiles to drawable d, with the 
+ *     top-left corner of the rectangle at (dx, dy). Tiles not already
+ *     in the cache are rendered.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     May render tiles.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+tileRepair(pTree, x, y, w, h, g, d, dx, dy)
+    HtmlTree *pTree;
+    int x;
+    int y;
+    int w;
+    int h;
+    int g;
+    Drawable d;
+    int dx;
+    int dy;
+{
+    Display *pDisp = Tk_Display(pTree->tkwin);
+    XGCValues gc_values;
+    GC gc;
+
+    /* Region to repair in canvas coordinates */
+    int cx1 = pTree->iScrollX + x;
+    int cy1 = pTree->iScrollY + y;
+    int cx2 = cx1 + w;
+    int cy2 = cy1 + h;
+
+    int ix, iy;
+
+    if (!pTree->pTileCache) {
+        pTree->pTileCache = HtmlNew(HtmlTileCache);
+        Tcl_InitHashTable(&pTree->pTileCache->aTile, 2);
+    }
+
+    memset(&gc_values, 0, sizeof(XGCValues));
+    gc = Tk_GetGC(pTree->tkwin, 0, &gc_values);
+
+    for (iy = tileDiv(cy1); iy <= tileDiv(cy2 - 1); iy++) {
+        for (ix = tileDiv(cx1); ix <= tileDiv(cx2 - 1); ix++) {
+            HtmlTile *pTile = tileGet(pTree, ix, iy, g);
+
+            /* Intersection of the tile and the region, canvas coords */
+            int tx = ix * HTML_TILE_SIZE;
+            int ty = iy * HTML_TILE_SIZE;
+            int sx1 = MAX(cx1, tx);
+            int sy1 = MAX(cy1, ty);
+            int sx2 = MIN(cx2, tx + HTML_TILE_SIZE);
+            int sy2 = MIN(cy2, ty + HTML_TILE_SIZE);
+
+            XCopyArea(pDisp, pTile->pixmap, d, gc, 
+                sx1 - tx, sy1 - ty, sx2 - sx1, sy2 - sy1, 
+                sx1 - cx1 + dx, sy1 - cy1 + dy
+            );
+        }
+    }
+
+    Tk_FreeGC(pDisp, gc);
+}
+
 static void 
 widgetRepair(pTree, x, y, w, h, g)
     HtmlTree *pTree;
@@ -4377,12 +5674,44 @@ widgetRepair(pTree, x, y, w, h, g)
     XGCValues gc_values;
     Tk_Window win = pTree->tkwin;
     Display *pDisp = Tk_Display(win); 
+    int isTile;
 
     if (w <= 0 || h <= 0) {
         return;
     }
 
-    pixmap = getPixmap(pTree, pTree->iScrollX+x, pTree->iScrollY+y, w, h, g);
+    /* Paint from the tile cache, unless a snapshot is active (in which
+     * case getPixmap() only draws the items in the snapshot, which are 
+     * those visible in the viewport when it was taken) or the document
+     * contains "fixed" content that cannot be drawn over the tiles.
+     * The cache is not used while a time-sliced layout is incomplete
+     * either, as any tiles rendered would be discarded by the next pass.
+     */
+    isTile = (!pTree->cb.pSnapshot && !pTree->isLayoutPartial);
+    if (isTile && !pTree->isFixed) {
+        assert(Tk_WindowId(win));
+        tileRepair(pTree, x, y, w, h, g, Tk_WindowId(pTree->docwin),
+            x - Tk_X(pTree->docwin), y - Tk_Y(pTree->docwin)
+        );
+        return;
+    }
+
+    if (isTile && pTree->isFixedOnTop && !pTree->isFixedBackground) {
+        /* Copy the tiles to a pixmap, then draw the fixed content over 
+         * the top. The pixmap avoids flicker when the fixed content is
+         * drawn. 
+         */
+        pixmap = Tk_GetPixmap(pDisp, Tk_WindowId(win), w, h, Tk_Depth(win));
+        tileRepair(pTree, x, y, w, h, g, pixmap, 0, 0);
+        drawPixmap(pTree, pixmap, 
+            pTree->iScrollX + x, pTree->iScrollY + y, w, h, g, 
+            SEARCH_FIXEDONLY
+        );
+    } else {
+        int cx = pTree->iScrollX + x;
+        int cy = pTree->iScrollY + y;
+        pixmap = getPixmap(pTree, cx, cy, w, h, g);
+    }
     memset(&gc_values, 0, sizeof(XGCValues));
     gc = Tk_GetGC(pTree->tkwin, 0, &gc_values);
     assert(Tk_WindowId(win));
@@ -4457,7 +5786,9 @@ HtmlWidgetSetViewport(pTree, scroll_x, scroll_y, force_redraw)
          * fixed background images or boxes. If this is not zero, then we need
          * to redraw the entire viewport each time the user scrolls the window.
          * In other words, we need to do something generate an expose event
-         * that covers the whole viewport.
+         * that covers the whole viewport. Unless there are fixed background
+         * images, the repair copies the rest of the canvas from the tile 
+         * cache and only renders the fixed content (see widgetRepair()).
          *
          * Moving the docwin between coords (0,0) and (-10000,0) each time
          * the window is scrolled seems to achieve this.
@@ -4485,7 +5816,7 @@ HtmlWidgetSetViewport(pTree, scroll_x, scroll_y, force_redraw)
 	     * horizontal or vertical direction, make sure the entire viewport
              * is redrawn.
              */
-            HtmlCallbackDamage(pTree, 0, 0, 100000, 100000);
+            HtmlCallbackExpose(pTree, 0, 0, 100000, 100000);
         }
         Tk_MoveWindow(pTree->docwin, -1*scroll_x, -1*scroll_y);
     }
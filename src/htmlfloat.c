@@ -65,7 +65,9 @@ static const char rcsid[] = "$Id: htmlfloat.c,v 1.21 2006/10/27 15:19:18 danielk
  *         the float list are made
  *
  *     HtmlFloatListLog --
- *         Output the state of the float-list to the debugging log.
+ *     HtmlFloatListStats --
+ *         Output the state of the float-list to the debugging log, or
+ *         retrieve the number of floats added and queries made.
  */
 typedef struct FloatListEntry FloatListEntry;
 
@@ -77,6 +79,12 @@ typedef struct FloatListEntry FloatListEntry;
  * the FloatListEntry.y variable in the next struct in the list, or
  * HtmlFloatList.yend for the last list entry.
  *
+ * So that the entry containing a given y-coordinate can be found in
+ * O(log N) time, the list is a skip-list. FloatListEntry.apNext[0] is the
+ * next entry in the list. Each entry is also linked into between 0 and
+ * FLOAT_MAX_LEVEL-1 sparser lists via apNext[1] and greater. The heads
+ * of each level are stored in HtmlFloatList.apHead.
+ *
  * All coordinates stored in the float-list are stored relative to an
  * origin point set to (0, 0) when the list is created by
  * HtmlFloatListNew(). But the origin point can be shifted using the
@@ -86,6 +94,8 @@ typedef struct FloatListEntry FloatListEntry;
  * HtmlFloatList.yorigin.
  *
  */
+#define FLOAT_MAX_LEVEL 12
+
 struct FloatListEntry {
     int y;                    /* Y-coord for top of this margin */
     int left;                 /* Left floating margin */
@@ -93,16 +103,44 @@ struct FloatListEntry {
     int leftValid;            /* True if the left margin is valid */
     int rightValid;           /* True if the right margin is valid */
     int isTop;                /* True if this is the top of 1 or more f.b. */
-    FloatListEntry *pNext;    /* Next entry in list */
+    int nLevel;               /* Number of elements in apNext[] */
+    FloatListEntry *apNext[1];   /* Next entry at each level (skip-list) */
 };
 struct HtmlFloatList {
     int xorigin;
     int yorigin;
     int yend;
     int endValid;
-    FloatListEntry *pEntry;
+
+    /* The largest y-coordinate of an entry with isTop set (used by
+     * ClearTop()), and the largest bottom coordinate of a left and right 
+     * floating margin (used by Clear()).
+     */
+    int yTop;
+    int topValid;
+    int yLeftEnd;
+    int leftEndValid;
+    int yRightEnd;
+    int rightEndValid;
+
+    int nLevel;                            /* Levels currently in use */
+    unsigned int iRandom;                  /* PRNG state for entry levels */
+    FloatListEntry *apHead[FLOAT_MAX_LEVEL];
+
+    /* Statistics reported by HtmlFloatListStats() */
+    int nFloat;                /* Number of calls to HtmlFloatListAdd() */
+    int nQuery;                /* Number of queries */
+    int nStep;                 /* Entries visited while answering queries */
 };
 
+/* Return the entry following entry p at level i. If p is NULL, return
+ * the first entry at level i.
+ */
+#define NEXT(pList, p, i) ((p) ? (p)->apNext[i] : (pList)->apHead[i])
+
+/* Return the y-coordinate of the bottom of the margin described by p. */
+#define YEND(pList, p) ((p)->apNext[0] ? (p)->apNext[0]->y : (pList)->yend)
+
 static void 
 floatListPrint(pList)
     HtmlFloatList *pList;
@@ -111,7 +149,7 @@ floatListPrint(pList)
     Tcl_Obj *pObj = Tcl_NewObj();
     Tcl_IncrRefCount(pObj);
 
-    for (pEntry = pList->pEntry; pEntry; pEntry = pEntry->pNext) {
+    for (pEntry = pList->apHead[0]; pEntry; pEntry = pEntry->apNext[0]) {
         char zBuf[100];
         sprintf(zBuf, "(y=%d, ", pEntry->y);
         Tcl_AppendToObj(pObj, zBuf, -1);
@@ -153,6 +191,7 @@ floatListPrint(pList)
 HtmlFloatList *HtmlFloatListNew()
 {
     HtmlFloatList *pList = HtmlNew(HtmlFloatList);
+    pList->iRandom = 1;
 #ifdef DEBUG_FLOAT_LIST
     printf("HtmlFloatListNew()  -> %p\n", pList);
 #endif
@@ -181,16 +220,126 @@ HtmlFloatListDelete(pList)
 {
     if (pList) {
         FloatListEntry *pEntry;
-        FloatListEntry *pEntry2 = 0;
-        for (pEntry = pList->pEntry; pEntry; pEntry = pEntry->pNext) {
-            if (pEntry2) HtmlFree(pEntry2);
-            pEntry2 = pEntry;
+        FloatListEntry *pNext;
+        for (pEntry = pList->apHead[0]; pEntry; pEntry = pNext) {
+            pNext = pEntry->apNext[0];
+            HtmlFree(pEntry);
         }
-        if (pEntry2) HtmlFree(pEntry2);
         HtmlFree(pList);
     }
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * floatListSeek --
+ *
+ *     Find the last entry in the list with (FloatListEntry.y <= y). If
+ *     apPrev is not NULL, it is populated with the last entry at each
+ *     level with (FloatListEntry.y <= y), or NULL if there is no such
+ *     entry at that level. This is the information required to link a
+ *     new entry with y-coordinate y into the skip-list.
+ *
+ *     Parameter 'y' is an absolute coordinate (the current origin is not
+ *     considered).
+ *
+ * Results:
+ *     Pointer to list entry, or NULL if there are no entries with
+ *     (FloatListEntry.y <= y).
+ *
+ * Side effects:
+ *     Increments HtmlFloatList.nStep.
+ *
+ *---------------------------------------------------------------------------
+ */
+static FloatListEntry *
+floatListSeek(pList, y, apPrev)
+    HtmlFloatList *pList;
+    int y;
+    FloatListEntry **apPrev;
+{
+    FloatListEntry *p = 0;
+    int ii;
+
+    for (ii = pList->nLevel - 1; ii >= 0; ii--) {
+        FloatListEntry *pNext;
+        while ((pNext = NEXT(pList, p, ii)) && pNext->y <= y) {
+            p = pNext;
+            pList->nStep++;
+        }
+        if (apPrev) apPrev[ii] = p;
+    }
+    return p;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * floatListLink --
+ *
+ *     Allocate a new list entry with y-coordinate y and link it into the
+ *     skip-list. Array apPrev must have been populated by a call to
+ *     floatListSeek() with the same y-coordinate. If pCopy is not NULL,
+ *     the margins of the new entry are copied from it.
+ *
+ * Results:
+ *     Pointer to the new entry.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static FloatListEntry *
+floatListLink(pList, y, apPrev, pCopy)
+    HtmlFloatList *pList;
+    int y;
+    FloatListEntry **apPrev;
+    FloatListEntry *pCopy;
+{
+    FloatListEntry *pNew;
+    int nLevel = 1;
+    int nBytes;
+    int ii;
+
+    /* Choose a level for the new entry. Each level is 4 times sparser than
+     * the one below it. A simple LCG is used so that the layout engine
+     * behaves deterministically.
+     */
+    while (nLevel < FLOAT_MAX_LEVEL) {
+        pList->iRandom = pList->iRandom * 1103515245 + 12345;
+        if ((pList->iRandom >> 16) & 0x03) break;
+        nLevel++;
+    }
+
+    nBytes = sizeof(FloatListEntry) + (nLevel - 1) * sizeof(FloatListEntry *);
+    pNew = (FloatListEntry *)HtmlAlloc("FloatListEntry", nBytes);
+    memset(pNew, 0, nBytes);
+    if (pCopy) {
+        pNew->left = pCopy->left;
+        pNew->right = pCopy->right;
+        pNew->leftValid = pCopy->leftValid;
+        pNew->rightValid = pCopy->rightValid;
+    }
+    pNew->y = y;
+    pNew->nLevel = nLevel;
+
+    for (ii = pList->nLevel; ii < nLevel; ii++) {
+        apPrev[ii] = 0;
+    }
+    pList->nLevel = MAX(pList->nLevel, nLevel);
+
+    for (ii = 0; ii < nLevel; ii++) {
+        pNew->apNext[ii] = NEXT(pList, apPrev[ii], ii);
+        if (apPrev[ii]) {
+            apPrev[ii]->apNext[ii] = pNew;
+        } else {
+            pList->apHead[ii] = pNew;
+        }
+    }
+    return pNew;
+}
+
 /*
  *---------------------------------------------------------------------------
  *
@@ -216,23 +365,24 @@ void insertListEntry(pList, y)
     HtmlFloatList *pList;
     int y;
 {
+    FloatListEntry *apPrev[FLOAT_MAX_LEVEL];
     FloatListEntry *pEntry;
-    FloatListEntry *pNew = 0;
     assert(pList);
 
 #if 1 && defined(DEBUG_FLOAT_LIST)
     printf("insertListEntry(%p, y=%d)\n", pList, y);
 #endif
 
+    pEntry = floatListSeek(pList, y, apPrev);
+
     /* See if a new entry is required at the start of the list. */
-    if (pList->pEntry && pList->pEntry->y > y) {
-        pNew = HtmlNew(FloatListEntry);
-        pNew->pNext = pList->pEntry;
+    if (!pEntry && pList->apHead[0]) {
+        floatListLink(pList, y, apPrev, 0);
         goto insert_out;
     }
 
-    for (pEntry = pList->pEntry; pEntry; pEntry = pEntry->pNext) {
-        int yend = pEntry->pNext ? pEntry->pNext->y : pList->yend;
+    if (pEntry) {
+        int yend = YEND(pList, pEntry);
         if (pEntry->y == y || yend == y) {
             /* The list already has this entry. We need do nothing. */
             goto insert_out;
@@ -243,31 +393,21 @@ void insertListEntry(pList, y)
              * split it into two parts. The margins are the same in each
              * part.
              */
-            int nBytes = sizeof(FloatListEntry);
-            pNew = (FloatListEntry *)HtmlAlloc("FloatListEntry", nBytes);
-            memcpy(pNew, pEntry, nBytes);
-            pEntry->pNext = pNew;
-            pNew->y = y;
-            pNew->isTop = 0;
+            floatListLink(pList, y, apPrev, pEntry);
             goto insert_out;
         }
+        assert(!pEntry->apNext[0]);
     }
 
+    /* Coordinate y is below the end of the list. Append an entry for
+     * the region between the current end of the list and y, which has
+     * no floating margins, if required. Since y is greater than
+     * HtmlFloatList.yend, apPrev is also correct for linking an entry
+     * with y-coordinate HtmlFloatList.yend.
+     */
     assert(pList->yend < y || pList->yend == 0);
-    pEntry = pList->pEntry;
-    while (pEntry && pEntry->pNext) {
-        pEntry = pEntry->pNext;
-    }
-    assert(!pEntry || !pEntry->pNext);
-
     if (pEntry || pList->endValid) {
-        pNew = HtmlNew(FloatListEntry);
-        pNew->y = pList->yend;
-        if (pEntry) {
-            pEntry->pNext = pNew;
-        } else {
-            pList->pEntry = pNew;
-        }
+        floatListLink(pList, pList->yend, apPrev, 0);
     } 
     pList->yend = y;
 
@@ -351,33 +491,47 @@ HtmlFloatListAdd(pList, side, x, y1, y2)
     insertListEntry(pList, y1);
     insertListEntry(pList, y2);
 
-    /* Now make a second pass and set the other variables on the relevant
-     * list entry or entries. We modify a list entry if it "starts" before
-     * y2 and ends after y1.
+    /* Now set the other variables on the relevant list entry or entries.
+     * We modify a list entry if it "starts" before y2 and ends after y1.
+     * The first such entry is the one that starts at y1.
      */
-    for (pEntry = pList->pEntry; pEntry; pEntry = pEntry->pNext) {
-        int yend = pEntry->pNext ? pEntry->pNext->y : pList->yend;
-        if (pEntry->y == y1) {
-            pEntry->isTop = 1;
+    pEntry = floatListSeek(pList, y1, 0);
+    assert(pEntry && pEntry->y == y1);
+    pEntry->isTop = 1;
+    if (!pList->topValid || y1 > pList->yTop) {
+        pList->yTop = y1;
+        pList->topValid = 1;
+    }
+    if (side==FLOAT_LEFT) {
+        if (!pList->leftEndValid || y2 > pList->yLeftEnd) {
+            pList->yLeftEnd = y2;
+            pList->leftEndValid = 1;
         }
-        if (y2 > pEntry->y && y1 < yend) {
-            if (side==FLOAT_LEFT) {
-                if (pEntry->leftValid) {
-                    pEntry->left = MAX(pEntry->left, x);
-                } else {
-                    pEntry->leftValid = 1;
-                    pEntry->left = x;
-                }
-            } else {
-                if (pEntry->rightValid) {
-                    pEntry->right = MIN(pEntry->right, x);
-                } else {
-                    pEntry->rightValid = 1;
-                    pEntry->right = x;
-                }
-            } 
+    } else {
+        if (!pList->rightEndValid || y2 > pList->yRightEnd) {
+            pList->yRightEnd = y2;
+            pList->rightEndValid = 1;
         }
     }
+    pList->nFloat++;
+
+    for ( ; pEntry && pEntry->y < y2; pEntry = pEntry->apNext[0]) {
+        if (side==FLOAT_LEFT) {
+            if (pEntry->leftValid) {
+                pEntry->left = MAX(pEntry->left, x);
+            } else {
+                pEntry->leftValid = 1;
+                pEntry->left = x;
+            }
+        } else {
+            if (pEntry->rightValid) {
+                pEntry->right = MIN(pEntry->right, x);
+            } else {
+                pEntry->rightValid = 1;
+                pEntry->right = x;
+            }
+        } 
+    }
 
 #ifdef DEBUG_FLOAT_LIST
     floatListPrint(pList);
@@ -409,13 +563,11 @@ HtmlFloatListClearTop(pList, y)
     HtmlFloatList *pList;
     int y;
 {
-    FloatListEntry *pEntry;
     int ret = y - pList->yorigin;
 
-    for (pEntry = pList->pEntry; pEntry; pEntry = pEntry->pNext) {
-        if (pEntry->isTop) {
-            ret = MAX(ret, pEntry->y);
-        }
+    pList->nQuery++;
+    if (pList->topValid) {
+        ret = MAX(ret, pList->yTop);
     }
     return ret + pList->yorigin;
 }
@@ -456,7 +608,6 @@ HtmlFloatListClear(pList, clear, y)
     int clear;         /* CLEAR_LEFT, CLEAR_RIGHT, CLEAR_NONE or CLEAR_BOTH */
     int y;
 {
-    FloatListEntry *pEntry;
     int ret = y - pList->yorigin;
 
 #ifdef DEBUG_FLOAT_LIST
@@ -469,33 +620,32 @@ HtmlFloatListClear(pList, clear, y)
     );
 #endif
 
-    if (clear == CLEAR_NONE) {
-        goto clear_out;
-    }
-    if (clear == CLEAR_BOTH) {
-        ret = MAX(ret, pList->yend);
-        goto clear_out;
-    }
+    pList->nQuery++;
+    switch (clear) {
+        case CLEAR_NONE:
+            break;
+        case CLEAR_BOTH:
+            ret = MAX(ret, pList->yend);
+            break;
 
-    for (pEntry = pList->pEntry; pEntry; pEntry = pEntry->pNext) {
-        int yend = pEntry->pNext ? pEntry->pNext->y : pList->yend;
-        switch (clear) {
-            case CLEAR_LEFT:
-                if (pEntry->leftValid) {
-                    ret = MAX(yend, ret);
-                }
-                break;
-            case CLEAR_RIGHT:
-                if (pEntry->rightValid) {
-                    ret = MAX(yend, ret);
-                }
-                break;
-            default:
-                assert(0);
-        }
+        /* The bottom of the lowest left or right floating margin is
+         * recorded by HtmlFloatListAdd(), so there is no need to search
+         * the list for it.
+         */
+        case CLEAR_LEFT:
+            if (pList->leftEndValid) {
+                ret = MAX(ret, pList->yLeftEnd);
+            }
+            break;
+        case CLEAR_RIGHT:
+            if (pList->rightEndValid) {
+                ret = MAX(ret, pList->yRightEnd);
+            }
+            break;
+        default:
+            assert(0);
     }
  
-clear_out:
     ret += pList->yorigin;
 #ifdef DEBUG_FLOAT_LIST
     printf(" -> %d\n", ret);
@@ -525,6 +675,9 @@ HtmlFloatListNormalize(pList, x, y)
     int x;
     int y;
 {
+    /* The coordinates stored in the list are not modified. Instead, the
+     * origin is applied to the arguments and results of each query.
+     */
     pList->xorigin += x;
     pList->yorigin += y;
 #ifdef DEBUG_FLOAT_LIST
@@ -555,7 +708,8 @@ HtmlFloatListNormalize(pList, x, y)
  *
  *---------------------------------------------------------------------------
  */
-void floatListMarginsNormal(pList, y1, y2, pLeft, pRight)
+static void 
+floatListMarginsNormal(pList, y1, y2, pLeft, pRight)
     HtmlFloatList *pList;
     int y1;
     int y2;
@@ -565,24 +719,32 @@ void floatListMarginsNormal(pList, y1, y2, pLeft, pRight)
     FloatListEntry *pEntry;
 
     /* Locate the FloatListEntry that includes y1, if any. This is the
-     * first entry with an end-coordinate greater than y1.
+     * first entry with an end-coordinate greater than y1. If y1 is above
+     * the first entry in the list, start with the first entry.
      */
-    for (pEntry = pList->pEntry; pEntry; pEntry = pEntry->pNext) {
-        int yend = pEntry->pNext ? pEntry->pNext->y : pList->yend;
-        assert(yend > pEntry->y);
-        if (yend > y1) {
-            if (pEntry->leftValid) {
-                *pLeft = MAX(*pLeft, pEntry->left);
-            }
-            if (pEntry->rightValid) {
-                *pRight = MIN(*pRight, pEntry->right);
-            }
+    pEntry = floatListSeek(pList, y1, 0);
+    if (pEntry && YEND(pList, pEntry) <= y1) {
+        pEntry = pEntry->apNext[0];
+    }
+    if (!pEntry) {
+        pEntry = (pList->apHead[0] && y1 < pList->apHead[0]->y) ? 
+            pList->apHead[0] : 0;
+    }
 
-            if (yend < y2) {
-                floatListMarginsNormal(pList, yend, y2, pLeft, pRight);
-            }
-            break;
+    /* Combine the margins of the entry containing y1 and each subsequent
+     * entry that starts above y2.
+     */
+    for ( ; pEntry; pEntry = pEntry->apNext[0]) {
+        int yend = YEND(pList, pEntry);
+        assert(yend > pEntry->y);
+        if (pEntry->leftValid) {
+            *pLeft = MAX(*pLeft, pEntry->left);
         }
+        if (pEntry->rightValid) {
+            *pRight = MIN(*pRight, pEntry->right);
+        }
+        pList->nStep++;
+        if (yend >= y2) break;
     }
 }
 
@@ -637,6 +799,7 @@ HtmlFloatListMargins(pList, y1, y2, pLeft, pRight)
     printf("HtmlFloatListMargins(%p, y1=%d, y2=%d, left=%d, right=%d)", 
             pList, y1, y2, *pLeft, *pRight);
 #endif
+    pList->nQuery++;
     *pLeft -= pList->xorigin;
     *pRight -= pList->xorigin;
 
@@ -692,6 +855,7 @@ HtmlFloatListPlace(pList, parentwidth, width, height, y)
 #endif
 
     parentwidth -= pList->xorigin;
+    pList->nQuery++;
 
     while (1) {
         int left = 0 - pList->xorigin;
@@ -702,16 +866,18 @@ HtmlFloatListPlace(pList, parentwidth, width, height, y)
         if ((right - left) >= width) {
             goto place_out;
         }
-        for (pEntry = pList->pEntry; pEntry; pEntry = pEntry->pNext) {
-            int yend = pEntry->pNext ? pEntry->pNext->y : pList->yend;
-            if (yend > ret) {
-                ret = yend;
-                break;
-            }
+
+        /* Move ret to the bottom of the first entry that ends below ret. */
+        pEntry = floatListSeek(pList, ret, 0);
+        if (!pEntry) {
+            pEntry = pList->apHead[0];
+        } else if (YEND(pList, pEntry) <= ret) {
+            pEntry = pEntry->apNext[0];
         }
         if (!pEntry) {
             goto place_out;
         }
+        ret = YEND(pList, pEntry);
     }
 
 place_out:
@@ -755,8 +921,12 @@ HtmlFloatListLog(pTree, zCaption, zNode, pList)
 
     sprintf(zBuf, "<p>Origin point is (%d, %d).</p>", x, y);
     Tcl_AppendToObj(pLog, zBuf, -1);
+    sprintf(zBuf, "<p>%d floats, %d queries, %d entries visited.</p>", 
+        pList->nFloat, pList->nQuery, pList->nStep
+    );
+    Tcl_AppendToObj(pLog, zBuf, -1);
     Tcl_AppendToObj(pLog,"<table><tr><th>Left<th>Top (y)<th>Right<th>isTop",-1);
-    for (pCsr = pList->pEntry; pCsr; pCsr = pCsr->pNext) {
+    for (pCsr = pList->apHead[0]; pCsr; pCsr = pCsr->apNext[0]) {
         char zLeft[20];
         char zRight[20];
         strcpy(zLeft, "N/A");
@@ -779,6 +949,52 @@ HtmlFloatListLog(pTree, zCaption, zNode, pList)
     Tcl_DecrRefCount(pLog);
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlFloatListStats --
+ *
+ *     Retrieve the number of floating margins added to the list, the
+ *     number of queries made and the total number of list entries 
+ *     visited while answering them. Any of the output pointers may be
+ *     NULL.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+void 
+HtmlFloatListStats(pList, pnFloat, pnQuery, pnStep)
+    HtmlFloatList *pList;
+    int *pnFloat;
+    int *pnQuery;
+    int *pnStep;
+{
+    if (pnFloat) *pnFloat = pList->nFloat;
+    if (pnQuery) *pnQuery = pList->nQuery;
+    if (pnStep) *pnStep = pList->nStep;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlFloatListIsConstant --
+ *
+ *     Return true if no floating margin starts or ends between 
+ *     y-coordinates y and (y+iHeight), inclusive.
+ *
+ * Results:
+ *     See above.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
 int
 HtmlFloatListIsConstant(pList, y, iHeight)
     HtmlFloatList *pList;
@@ -792,11 +1008,13 @@ HtmlFloatListIsConstant(pList, y, iHeight)
     #define BETWEEN(a, b, c) ((a)<=(b) && (b)<=(c))
 
     assert(y2 >= y1);
+    pList->nQuery++;
     if (pList->endValid && BETWEEN(y1, pList->yend, y2)) return 0;
 
-    for (p = pList->pEntry; p; p = p->pNext) {
-        if (BETWEEN(y1, p->y, y2)) return 0;
-    }
+    /* Find the first entry with (FloatListEntry.y >= y1). */
+    p = floatListSeek(pList, y1 - 1, 0);
+    p = p ? p->apNext[0] : pList->apHead[0];
+    if (p && BETWEEN(y1, p->y, y2)) return 0;
 
     return 1;
 }
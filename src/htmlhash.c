@@ -228,6 +228,8 @@ hashFontKey(tablePtr, keyPtr)
     result += (result<<3) + pKey->iFontSize;
     result += (result<<1) + (pKey->isItalic?1:0);
     result += (result<<1) + (pKey->isBold?1:0);
+    result += (result<<1) + (pKey->isForceMetrics?1:0);
+    result += (result<<3) + (int)(pKey->rFontScale * pKey->rZoom * 1000.0);
 
     return result;
 }
@@ -260,6 +262,9 @@ compareFontKey(keyPtr, hPtr)
         p1->iFontSize != p2->iFontSize ||
         p1->isItalic != p2->isItalic ||
         p1->isBold != p2->isBold ||
+        p1->isForceMetrics != p2->isForceMetrics ||
+        p1->rFontScale != p2->rFontScale ||
+        p1->rZoom != p2->rZoom ||
         strcmp(p1->zFontFamily, p2->zFontFamily)
     ) ? 0 : 1);
 }
@@ -303,6 +308,9 @@ allocFontEntry(tablePtr, keyPtr)
     pStoredKey->iFontSize = pKey->iFontSize;
     pStoredKey->isItalic = pKey->isItalic;
     pStoredKey->isBold = pKey->isBold;
+    pStoredKey->isForceMetrics = pKey->isForceMetrics;
+    pStoredKey->rFontScale = pKey->rFontScale;
+    pStoredKey->rZoom = pKey->rZoom;
     pStoredKey->zFontFamily = (char *)(&pStoredKey[1]);
     strcpy((char *)pStoredKey->zFontFamily, pKey->zFontFamily);
 
@@ -348,6 +356,145 @@ HtmlFontKeyHashType()
     return &hash_key_type;
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * hashTextWidthKey --
+ *
+ *     Generate a 4-byte hash of the HtmlTextWidthKey structure pointed to
+ *     by keyPtr. Both the font serial number and the text bytes are used.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static unsigned int 
+hashTextWidthKey(tablePtr, keyPtr)
+    Tcl_HashTable *tablePtr;    /* Hash table. */
+    VOID *keyPtr;               /* Key from which to compute hash value. */
+{
+    HtmlTextWidthKey *pKey = (HtmlTextWidthKey *)keyPtr;
+    const unsigned char *z = (const unsigned char *)pKey->zText;
+    const unsigned char *zEnd = &z[pKey->nText];
+    unsigned int result = pKey->iFont;
+
+    while (z < zEnd) {
+        result += (result << 3) + *z;
+        z++;
+    }
+    return result;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * compareTextWidthKey --
+ *
+ *     The compare function for the text-width hash. Compare a new key to
+ *     the key of an existing hash-entry.
+ *
+ * Results:
+ *     True if the two keys are the same, false if not.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int 
+compareTextWidthKey(keyPtr, hPtr)
+    VOID *keyPtr;               /* New key to compare. */
+    Tcl_HashEntry *hPtr;        /* Existing key to compare. */
+{   
+    HtmlTextWidthKey *p1 = (HtmlTextWidthKey *) keyPtr;
+    HtmlTextWidthKey *p2 = (HtmlTextWidthKey *) hPtr->key.string;
+
+    return ((
+        p1->iFont != p2->iFont ||
+        p1->nText != p2->nText ||
+        memcmp(p1->zText, p2->zText, p1->nText)
+    ) ? 0 : 1);
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * allocTextWidthEntry --
+ *
+ *     Allocate enough space for a Tcl_HashEntry, an HtmlTextWidthKey key
+ *     and a copy of the text the key refers to.
+ *
+ * Results:
+ *     Pointer to allocated TclHashEntry structure.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static Tcl_HashEntry * 
+allocTextWidthEntry(tablePtr, keyPtr)
+    Tcl_HashTable *tablePtr;    /* Hash table. */
+    VOID *keyPtr;               /* Key to store in the hash table entry. */
+{
+    HtmlTextWidthKey *pKey = (HtmlTextWidthKey *)keyPtr;
+    unsigned int size;
+    Tcl_HashEntry *hPtr;
+    HtmlTextWidthKey *pStoredKey;
+
+    size = (
+        sizeof(Tcl_HashEntry) - sizeof(hPtr->key) +
+        sizeof(HtmlTextWidthKey) + pKey->nText
+    );
+    if (size < sizeof(Tcl_HashEntry)) {
+        size = sizeof(Tcl_HashEntry);
+    }
+
+    hPtr = (Tcl_HashEntry *) HtmlAlloc("allocTextWidthEntry()", size);
+    pStoredKey = (HtmlTextWidthKey *)(hPtr->key.string);
+    pStoredKey->iFont = pKey->iFont;
+    pStoredKey->nText = pKey->nText;
+    pStoredKey->zText = (const char *)(&pStoredKey[1]);
+    memcpy((char *)pStoredKey->zText, pKey->zText, pKey->nText);
+
+    return hPtr;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlTextWidthHashType --
+ *
+ *     Return a pointer to the hash key type for the text-width cache
+ *     (HtmlFontCache.aWidth). The key-type for the hash-table is
+ *     HtmlTextWidthKey (see htmlprop.h).
+ *
+ * Results:
+ *     Pointer to hash_key_type (see above).
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+Tcl_HashKeyType * 
+HtmlTextWidthHashType() 
+{
+    static Tcl_HashKeyType hash_key_type = {
+        TCL_HASH_KEY_TYPE_VERSION,          /* version */
+        0,                                  /* flags */
+        hashTextWidthKey,                   /* hashKeyProc */
+        compareTextWidthKey,                /* compareKeysProc */
+        allocTextWidthEntry,                /* allocEntryProc */
+        freeCaseInsensitiveEntry            /* freeEntryProc */
+    };
+    return &hash_key_type;
+}
+
 /*
  *---------------------------------------------------------------------------
  *
@@ -95,8 +95,11 @@ struct HtmlImageServer {
     HtmlTree *pTree;                 /* Pointer to owner HtmlTree object */
     Tcl_HashTable aImage;            /* Hash table of images by URL */
     int isSuspendGC;
+    int isJobDamage;                 /* True if imageJobDamage() scheduled */
 };
 
+typedef struct HtmlImageJob HtmlImageJob;
+
 /*
  * HtmlImage structures are stored in the Htmltree.aImage array. The index
  * to the array is the URI specified for the image. If the URI was loaded
@@ -130,6 +133,9 @@ struct HtmlImage2 {
     Tcl_Obj *pImageName;             /* Image name, if this is unscaled */
     Tcl_Obj *pDelete;                /* Delete script, if this is unscaled */
     HtmlImage2 *pUnscaled;           /* Unscaled image, if this is scaled */
+    HtmlImageJob *pJob;              /* Pending asynchronous scale, or NULL */
+    int isJobDone;                   /* True if job finished since last
+                                      * call to imageJobDamage() */
 
     HtmlImage2 *pNext;               /* Next in list of scaled copies */
 };
@@ -138,6 +144,11 @@ struct HtmlImage2 {
 #define ALPHA_CHANNEL_TRUE    1
 #define ALPHA_CHANNEL_FALSE   2
 
+static void imageJobCancel(HtmlImage2 *);
+#ifdef TCL_THREADS
+static void imageJobDamage(ClientData);
+#endif
+
 
 /*
  *---------------------------------------------------------------------------
@@ -192,6 +203,11 @@ HtmlImageServerShutdown(pTree)
     Tcl_HashSearch search;
     Tcl_HashEntry *pEntry = Tcl_FirstHashEntry(&p->aImage, &search);
     assert(!pEntry);
+#endif
+#ifdef TCL_THREADS
+    if (p->isJobDamage) {
+        Tcl_CancelIdleCall(imageJobDamage, (ClientData)p);
+    }
 #endif
     HtmlFree(p);
     pTree->pImageServer = 0;
@@ -366,6 +382,7 @@ imageChanged(clientData, x, y, width, height, imgWidth, imgHeight)
 
         for (p = pImage->pNext; p; p = p->pNext) {
             p->isValid = 0;
+            imageJobCancel(p);
             assert(!p->pTileName);
         }
         freeTile(pImage);
@@ -662,11 +679,763 @@ HtmlImageScale(pImage, pWidth, pHeight, doScale)
     return pRet;
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * imageCreatePhoto --
+ *
+ *     Create a new, empty, photo image. If argument pName is not NULL,
+ *     it is the name of an existing photo image to recreate (this
+ *     discards the image data). Otherwise Tk picks a unique name.
+ *
+ *     Tk does not export a C API for creating a photo image, so the
+ *     [image create photo] command is invoked directly via Tcl_EvalObjv().
+ *     This avoids parsing and compiling a script each time a scaled copy 
+ *     or tile is created.
+ *
+ * Results:
+ *     A pointer to a Tcl object with a ref-count of 1 containing the
+ *     name of the image, or NULL if an error occurs.
+ *
+ * Side effects:
+ *     Modifies the interpreter result.
+ *
+ *---------------------------------------------------------------------------
+ */
+static Tcl_Obj *
+imageCreatePhoto(interp, pName)
+    Tcl_Interp *interp;
+    Tcl_Obj *pName;
+{
+    Tcl_Obj *apObj[4];
+    Tcl_Obj *pRet = 0;
+    int nObj = (pName ? 4 : 3);
+    int ii;
+
+    apObj[0] = Tcl_NewStringObj("image", 5);
+    apObj[1] = Tcl_NewStringObj("create", 6);
+    apObj[2] = Tcl_NewStringObj("photo", 5);
+    apObj[3] = pName;
+    for (ii = 0; ii < nObj; ii++) {
+        Tcl_IncrRefCount(apObj[ii]);
+    }
+    if (TCL_OK == Tcl_EvalObjv(interp, nObj, apObj, TCL_EVAL_GLOBAL)) {
+        pRet = Tcl_GetObjResult(interp);
+        Tcl_IncrRefCount(pRet);
+    }
+    for (ii = 0; ii < nObj; ii++) {
+        Tcl_DecrRefCount(apObj[ii]);
+    }
+    return pRet;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * imageScaleSpans --
+ *
+ *     Helper for imageScaleBlock(). Map each of the nDst pixels along
+ *     one axis of the scaled image to a span of pixels along the same
+ *     axis of the nSrc pixel source image. The span for destination
+ *     pixel i is (aStart[i] .. aStart[i]+aCount[i]-1).
+ *
+ *     When shrinking, each span covers all source pixels that fall 
+ *     under the destination pixel (a box filter). When enlarging, each
+ *     span is a single source pixel (nearest neighbour).
+ *
+ * Results:
+ *     True if every span is exactly one pixel wide, otherwise false.
+ *
+ * Side effects:
+ *     Populates arrays aStart[] and aCount[].
+ *
+ *---------------------------------------------------------------------------
+ */
+static int
+imageScaleSpans(nSrc, nDst, aStart, aCount)
+    int nSrc;
+    int nDst;
+    int *aStart;
+    int *aCount;
+{
+    int isNearest = 1;
+    int i;
+    for (i = 0; i < nDst; i++) {
+        int iStart = (int)(((Tcl_WideInt)i * nSrc) / nDst);
+        int iEnd = (int)(((Tcl_WideInt)(i + 1) * nSrc) / nDst);
+        if (iEnd <= iStart) iEnd = iStart + 1;
+        if (iEnd > nSrc) iEnd = nSrc;
+        aStart[i] = iStart;
+        aCount[i] = iEnd - iStart;
+        if (aCount[i] != 1) isNearest = 0;
+    }
+    return isNearest;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * imageScaleBlock --
+ *
+ *     Scale the pixels in photo block pSrc into the RGBA buffer zDst,
+ *     which is nDstW pixels wide and nDstH pixels high (pitch 4*nDstW).
+ *     Array aSpan, which must have room for 2*(nDstW+nDstH) integers, 
+ *     is used as scratch space.
+ *
+ *     Both images are walked row by row. Where the image is being 
+ *     enlarged along both axes, the source pixels are sampled (nearest
+ *     neighbour). Otherwise each output pixel is the average of the box 
+ *     of source pixels it covers. Colour channels are weighted by alpha
+ *     so that fully transparent pixels do not darken their neighbours.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     Writes to buffers zDst and aSpan. This function does not use the
+ *     Tcl or Tk APIs, so it may be called from a worker thread.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+imageScaleBlock(pSrc, zDst, nDstW, nDstH, aSpan)
+    Tk_PhotoImageBlock *pSrc;
+    unsigned char *zDst;
+    int nDstW;
+    int nDstH;
+    int *aSpan;
+{
+    const int o0 = pSrc->offset[0];
+    const int o1 = pSrc->offset[1];
+    const int o2 = pSrc->offset[2];
+    const int o3 = pSrc->offset[3];
+    const int nPixel = pSrc->pixelSize;
+    int *aXStart;
+    int *aXCount;
+    int *aYStart;
+    int *aYCount;
+    int isNearest;
+    int x, y;
+
+    aXStart = aSpan;
+    aXCount = &aXStart[nDstW];
+    aYStart = &aXCount[nDstW];
+    aYCount = &aYStart[nDstH];
+
+    isNearest = imageScaleSpans(pSrc->width, nDstW, aXStart, aXCount);
+    isNearest = imageScaleSpans(pSrc->height, nDstH, aYStart, aYCount) && 
+                isNearest;
+
+    /* Convert the column starts to byte offsets within a source row. */
+    for (x = 0; x < nDstW; x++) {
+        aXStart[x] *= nPixel;
+    }
+
+    for (y = 0; y < nDstH; y++) {
+        unsigned char *zOut = &zDst[y * nDstW * 4];
+        unsigned char *zRow = &pSrc->pixelPtr[aYStart[y] * pSrc->pitch];
+
+        if (isNearest) {
+            for (x = 0; x < nDstW; x++) {
+                unsigned char *zIn = &zRow[aXStart[x]];
+                zOut[0] = zIn[o0];
+                zOut[1] = zIn[o1];
+                zOut[2] = zIn[o2];
+                zOut[3] = zIn[o3];
+                zOut += 4;
+            }
+        } else {
+            for (x = 0; x < nDstW; x++) {
+                Tcl_WideUInt r = 0, g = 0, b = 0, a = 0;
+                int nBox = aXCount[x] * aYCount[y];
+                int i, j;
+                for (j = 0; j < aYCount[y]; j++) {
+                    unsigned char *zIn = &zRow[j * pSrc->pitch + aXStart[x]];
+                    for (i = 0; i < aXCount[x]; i++) {
+                        unsigned int alpha = zIn[o3];
+                        r += zIn[o0] * alpha;
+                        g += zIn[o1] * alpha;
+                        b += zIn[o2] * alpha;
+                        a += alpha;
+                        zIn += nPixel;
+                    }
+                }
+                if (a > 0) {
+                    zOut[0] = (unsigned char)(r / a);
+                    zOut[1] = (unsigned char)(g / a);
+                    zOut[2] = (unsigned char)(b / a);
+                } else {
+                    zOut[0] = zOut[1] = zOut[2] = 0;
+                }
+                zOut[3] = (unsigned char)(a / nBox);
+                zOut += 4;
+            }
+        }
+    }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * imageScalePut --
+ *
+ *     Copy the scaled pixels in RGBA buffer zPixels (pImage->width by 
+ *     pImage->height pixels) into the photo image for scaled copy pImage.
+ *     The photo image is created if it does not already exist.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     Sets pImage->isValid.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+imageScalePut(pImage, zPixels)
+    HtmlImage2 *pImage;
+    unsigned char *zPixels;
+{
+    Tcl_Interp *interp = pImage->pImageServer->pTree->interp;
+    Tk_PhotoHandle s_photo;
+    Tk_PhotoImageBlock s_block;
+    int sw = pImage->width;
+    int sh = pImage->height;
+
+    if (!pImage->pImageName) {
+        /* If pImageName is still NULL, then create a new photo
+         * image to write the scaled data to.
+         */
+        Tk_Window win = pImage->pImageServer->pTree->tkwin;
+        pImage->pImageName = imageCreatePhoto(interp, 0);
+        if (!pImage->pImageName) return;
+        assert(0 == pImage->pDelete);
+        assert(0 == pImage->image);
+        pImage->image = Tk_GetImage(
+            interp, win, Tcl_GetString(pImage->pImageName), imageChanged, pImage
+        );
+    }
+    assert(pImage->image);
+
+    s_photo = Tk_FindPhoto(interp, Tcl_GetString(pImage->pImageName));
+    if (!s_photo) return;
+
+    s_block.pixelPtr = zPixels;
+    s_block.width = sw;
+    s_block.height = sh;
+    s_block.pitch = sw * 4;
+    s_block.pixelSize = 4;
+    s_block.offset[0] = 0;
+    s_block.offset[1] = 1;
+    s_block.offset[2] = 2;
+    s_block.offset[3] = 3;
+
+    photoputblock(interp, s_photo, &s_block, 0, 0, sw, sh, 0);
+    pImage->isValid = 1;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * imageScaleCopy --
+ *
+ *     Regenerate the scaled copy pImage from the pixels of the unscaled
+ *     image (block pBlock).
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     Sets pImage->isValid.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+imageScaleCopy(pImage, pBlock)
+    HtmlImage2 *pImage;
+    Tk_PhotoImageBlock *pBlock;
+{
+    unsigned char *zPixels;
+    int *aSpan;
+    int sw = pImage->width;
+    int sh = pImage->height;
+
+    CHECK_INTEGER_PLAUSIBILITY(sw);
+    CHECK_INTEGER_PLAUSIBILITY(sh);
+
+    zPixels = (unsigned char *)HtmlAlloc("temp", sw * sh * 4);
+    aSpan = (int *)HtmlAlloc("temp", sizeof(int) * 2 * (sw + sh));
+    imageScaleBlock(pBlock, zPixels, sw, sh, aSpan);
+    imageScalePut(pImage, zPixels);
+    HtmlFree(aSpan);
+    HtmlFree(zPixels);
+}
+
+/*
+ * Asynchronous scaling:
+ *
+ *     If the -imageasync option is true, scaled copies of large images
+ *     are generated by a pool of N_IMAGE_WORKER worker threads shared by
+ *     all widgets in the process. Only the pixel arithmetic in 
+ *     imageScaleBlock() is done by the workers. Images are still decoded
+ *     (by the -imagecmd script and Tk's photo formats) and written to Tk
+ *     photo images by the thread that owns the widget.
+ *
+ *     When HtmlImageImage() finds that a scaled copy must be regenerated,
+ *     imageJobQueue() copies the pixels of the unscaled image into a new
+ *     HtmlImageJob structure and adds it to the queue. While the job is
+ *     outstanding HtmlImageImage() returns 0 and the drawing code draws
+ *     a placeholder in place of the image. When a worker has finished
+ *     with a job it is passed back to the owner thread using 
+ *     Tcl_ThreadQueueEvent(). imageJobEventProc() then copies the scaled
+ *     pixels to the photo image and schedules a redraw.
+ *
+ *     Jobs are allocated and freed only by the owner thread, as 
+ *     HtmlAlloc() is not thread-safe in debugging builds.
+ */
+#define N_IMAGE_WORKER 2
+#define N_ASYNC_PIXELS 4096
+
+struct HtmlImageJob {
+    HtmlImage2 *pImage;          /* Scaled copy, or NULL if cancelled */
+    Tk_PhotoImageBlock src;      /* Copy of unscaled image pixels */
+    unsigned char *zDst;         /* Buffer for scaled pixels (RGBA) */
+    int *aSpan;                  /* Scratch space for imageScaleBlock() */
+    int w;                       /* Width of scaled copy */
+    int h;                       /* Height of scaled copy */
+    Tcl_ThreadId owner;          /* Thread to deliver the result to */
+    HtmlImageJob *pNext;         /* Next job in queue */
+};
+
+typedef struct HtmlImageEvent HtmlImageEvent;
+struct HtmlImageEvent {
+    Tcl_Event header;            /* Must be first */
+    HtmlImageJob *pJob;          /* Finished job */
+};
+
+/*
+ * The number of jobs allocated by each thread and not yet freed. Since
+ * jobs are allocated and freed only by the owner thread, this is kept
+ * in thread-specific data and needs no locking. See HtmlImageJobsCmd().
+ */
+typedef struct ImageJobThreadData ImageJobThreadData;
+struct ImageJobThreadData {
+    int nJob;                    /* Number of outstanding jobs */
+};
+static Tcl_ThreadDataKey imageJobKey;
+
+static int *
+imageJobCount()
+{
+    ImageJobThreadData *p = (ImageJobThreadData *)Tcl_GetThreadData(
+        &imageJobKey, sizeof(ImageJobThreadData)
+    );
+    return &p->nJob;
+}
+
+#ifdef TCL_THREADS
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * imageJobDamageCb --
+ *
+ *     HtmlWalkTree() callback used by imageJobDamage(). Damage the
+ *     region occupied by each node that displays an image for which an
+ *     asynchronous job has finished (HtmlImage2.isJobDone is set on both
+ *     the scaled copy and the unscaled image it is a copy of).
+ *
+ * Results:
+ *     HTML_WALK_DESCEND.
+ *
+ * Side effects:
+ *     May call HtmlCallbackDamageNode().
+ *
+ *---------------------------------------------------------------------------
+ */
+static int
+imageJobDamageCb(pTree, pNode, clientData)
+    HtmlTree *pTree;
+    HtmlNode *pNode;
+    ClientData clientData;
+{
+    HtmlComputedValues *pV = HtmlNodeComputedValues(pNode);
+    if (pV && !HtmlNodeIsText(pNode) && (
+        (pV->imZoomedBackgroundImage && pV->imZoomedBackgroundImage->isJobDone)
+     || (pV->imBackgroundImage && pV->imBackgroundImage->isJobDone)
+     || (pV->imReplacementImage && pV->imReplacementImage->isJobDone)
+     || (pV->imListStyleImage && pV->imListStyleImage->isJobDone)
+    )) {
+        HtmlCallbackDamageNode(pTree, pNode);
+    }
+    return HTML_WALK_DESCEND;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * imageJobDamage --
+ *
+ *     Idle callback scheduled by imageJobEventProc(). Damage the nodes
+ *     that display the images for which jobs have finished since the
+ *     last call. Batching the jobs that finish in a single pass of the
+ *     event loop means the document tree is walked once per pass, not
+ *     once per job.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     May call HtmlCallbackDamageNode(). Clears HtmlImage2.isJobDone for
+ *     all images of the image-server.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+imageJobDamage(clientData)
+    ClientData clientData;
+{
+    HtmlImageServer *p = (HtmlImageServer *)clientData;
+    Tcl_HashEntry *pEntry;
+    Tcl_HashSearch search;
+
+    assert(p->isJobDamage);
+    p->isJobDamage = 0;
+    HtmlWalkTree(p->pTree, 0, imageJobDamageCb, 0);
+
+    for (
+        pEntry = Tcl_FirstHashEntry(&p->aImage, &search); 
+        pEntry; 
+        pEntry = Tcl_NextHashEntry(&search)
+    ) {
+        HtmlImage2 *pImage = (HtmlImage2 *)Tcl_GetHashValue(pEntry);
+        for ( ; pImage; pImage = pImage->pNext) {
+            pImage->isJobDone = 0;
+        }
+    }
+}
+
+/*
+ * The job queue and worker pool. All of the following variables are 
+ * protected by imageQueueMutex.
+ */
+TCL_DECLARE_MUTEX(imageQueueMutex)
+static Tcl_Condition imageQueueCond = 0;   /* Signalled when queue changes */
+static HtmlImageJob *pImageQueue = 0;      /* Jobs waiting for a worker */
+static int isImageWorkerInit = 0;          /* True once pool is started */
+static int isImageWorkerExit = 0;          /* True to stop workers */
+static int nImageWorker = 0;               /* Number of entries in aImageWorker */
+static Tcl_ThreadId aImageWorker[N_IMAGE_WORKER];
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * imageJobEventProc --
+ *
+ *     Tcl event procedure used to deliver a finished job to the thread
+ *     that queued it. Unless the job has been cancelled, the scaled 
+ *     pixels are copied to the photo image for the scaled copy.
+ *
+ * Results:
+ *     1 if the event was handled, or 0 if it should be deferred.
+ *
+ * Side effects:
+ *     Frees the job. May schedule imageJobDamage() to redraw the nodes
+ *     that display the image.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int
+imageJobEventProc(evPtr, flags)
+    Tcl_Event *evPtr;
+    int flags;
+{
+    HtmlImageJob *pJob = ((HtmlImageEvent *)evPtr)->pJob;
+    HtmlImage2 *pImage = pJob->pImage;
+
+    if (!(flags & TCL_WINDOW_EVENTS)) {
+        return 0;
+    }
+
+    if (pImage) {
+        HtmlImageServer *pServer = pImage->pImageServer;
+        assert(pImage->pJob == pJob && pImage->pUnscaled);
+        pImage->pJob = 0;
+        imageScalePut(pImage, pJob->zDst);
+        pImage->isJobDone = 1;
+        pImage->pUnscaled->isJobDone = 1;
+        if (!pServer->isJobDamage) {
+            pServer->isJobDamage = 1;
+            Tcl_DoWhenIdle(imageJobDamage, (ClientData)pServer);
+        }
+    }
+    HtmlFree(pJob);
+    (*imageJobCount())--;
+    return 1;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * imageWorker --
+ *
+ *     Main routine for worker threads. Take jobs from the queue and
+ *     scale them until isImageWorkerExit is set.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     Queues an event for the owner thread of each job processed.
+ *
+ *---------------------------------------------------------------------------
+ */
+static Tcl_ThreadCreateType
+imageWorker(clientData)
+    ClientData clientData;
+{
+    Tcl_MutexLock(&imageQueueMutex);
+    while (!isImageWorkerExit) {
+        HtmlImageJob *pJob = pImageQueue;
+        HtmlImageEvent *pEvent;
+        if (!pJob) {
+            Tcl_ConditionWait(&imageQueueCond, &imageQueueMutex, 0);
+            continue;
+        }
+        pImageQueue = pJob->pNext;
+        pJob->pNext = 0;
+        Tcl_MutexUnlock(&imageQueueMutex);
+
+        /* The job is no longer in the queue, so it will not be freed
+         * until the owner thread receives the event. The owner may clear
+         * HtmlImageJob.pImage in the meantime, so it is not used here.
+         * Tcl frees event structures using ckfree().
+         */
+        imageScaleBlock(&pJob->src, pJob->zDst, pJob->w, pJob->h, pJob->aSpan);
+        pEvent = (HtmlImageEvent *)ckalloc(sizeof(HtmlImageEvent));
+        pEvent->header.proc = imageJobEventProc;
+        pEvent->pJob = pJob;
+
+        Tcl_MutexLock(&imageQueueMutex);
+        if (!isImageWorkerExit) {
+            Tcl_ThreadQueueEvent(pJob->owner, &pEvent->header, TCL_QUEUE_TAIL);
+            Tcl_ThreadAlert(pJob->owner);
+        } else {
+            ckfree((char *)pEvent);
+        }
+    }
+    Tcl_MutexUnlock(&imageQueueMutex);
+    TCL_THREAD_CREATE_RETURN;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * imageWorkerExit --
+ *
+ *     Exit handler. Stop the worker threads and wait for them to exit.
+ *     Jobs that are still outstanding are leaked.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+imageWorkerExit(clientData)
+    ClientData clientData;
+{
+    int nWorker;
+    int ii;
+
+    Tcl_MutexLock(&imageQueueMutex);
+    isImageWorkerExit = 1;
+    nWorker = nImageWorker;
+    Tcl_ConditionNotify(&imageQueueCond);
+    Tcl_MutexUnlock(&imageQueueMutex);
+
+    for (ii = 0; ii < nWorker; ii++) {
+        int rc;
+        Tcl_JoinThread(aImageWorker[ii], &rc);
+    }
+    Tcl_ConditionFinalize(&imageQueueCond);
+}
+
+#endif /* TCL_THREADS */
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * imageJobQueue --
+ *
+ *     Try to queue an asynchronous job to regenerate scaled copy pImage
+ *     from the pixels of the unscaled image (block pBlock). A job is only
+ *     queued if the -imageasync option is set and the image is large 
+ *     enough to be worth it. The worker pool is started the first time
+ *     this function queues a job.
+ *
+ * Results:
+ *     True if a job was queued, otherwise false. If false is returned
+ *     the caller should scale the image using imageScaleCopy().
+ *
+ * Side effects:
+ *     Sets pImage->pJob.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int
+imageJobQueue(pImage, pBlock)
+    HtmlImage2 *pImage;
+    Tk_PhotoImageBlock *pBlock;
+{
+#ifdef TCL_THREADS
+    HtmlTree *pTree = pImage->pImageServer->pTree;
+    HtmlImageJob *pJob;
+    HtmlImageJob **ppJob;
+    int sw = pImage->width;
+    int sh = pImage->height;
+    int nSpan = sizeof(int) * 2 * (sw + sh);
+    int nDst = sw * sh * 4;
+    int nSrc = pBlock->pitch * pBlock->height;
+    int nWorker;
+
+    assert(!pImage->pJob);
+    if (!pTree->options.imageasync || 
+        (sw * sh + pBlock->width * pBlock->height) < N_ASYNC_PIXELS
+    ) {
+        return 0;
+    }
+
+    Tcl_MutexLock(&imageQueueMutex);
+    if (!isImageWorkerInit) {
+        int ii;
+        isImageWorkerInit = 1;
+        for (ii = 0; ii < N_IMAGE_WORKER; ii++) {
+            int rc = Tcl_CreateThread(&aImageWorker[nImageWorker], 
+                imageWorker, 0, TCL_THREAD_STACK_DEFAULT, TCL_THREAD_JOINABLE
+            );
+            if (rc == TCL_OK) nImageWorker++;
+        }
+        if (nImageWorker > 0) {
+            Tcl_CreateExitHandler(imageWorkerExit, 0);
+        }
+    }
+    nWorker = (isImageWorkerExit ? 0 : nImageWorker);
+    Tcl_MutexUnlock(&imageQueueMutex);
+    if (nWorker == 0) {
+        return 0;
+    }
+
+    /* Allocate the job structure, scratch space, output buffer and a 
+     * copy of the source pixels in a single block. The source pixels 
+     * must be copied, as the unscaled image may be modified or deleted
+     * while the job is outstanding.
+     */
+    pJob = (HtmlImageJob *)HtmlAlloc(
+        "HtmlImageJob", sizeof(HtmlImageJob) + nSpan + nDst + nSrc
+    );
+    memset(pJob, 0, sizeof(HtmlImageJob));
+    pJob->pImage = pImage;
+    pJob->w = sw;
+    pJob->h = sh;
+    pJob->owner = Tcl_GetCurrentThread();
+    pJob->aSpan = (int *)&pJob[1];
+    pJob->zDst = (unsigned char *)&pJob->aSpan[2 * (sw + sh)];
+    pJob->src = *pBlock;
+    pJob->src.pixelPtr = &pJob->zDst[nDst];
+    memcpy(pJob->src.pixelPtr, pBlock->pixelPtr, nSrc);
+    pImage->pJob = pJob;
+    (*imageJobCount())++;
+
+    Tcl_MutexLock(&imageQueueMutex);
+    for (ppJob = &pImageQueue; *ppJob; ppJob = &(*ppJob)->pNext);
+    *ppJob = pJob;
+    Tcl_ConditionNotify(&imageQueueCond);
+    Tcl_MutexUnlock(&imageQueueMutex);
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * imageJobCancel --
+ *
+ *     Cancel the outstanding asynchronous job for scaled copy pImage, 
+ *     if any. If the job is still in the queue it is removed and freed.
+ *     Otherwise a worker thread is already processing it, and it is 
+ *     marked as cancelled so that imageJobEventProc() discards it.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     Clears pImage->pJob.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+imageJobCancel(pImage)
+    HtmlImage2 *pImage;
+{
+    HtmlImageJob *pJob = pImage->pJob;
+    if (pJob) {
+        int isQueued = 0;
+#ifdef TCL_THREADS
+        HtmlImageJob **ppJob;
+        Tcl_MutexLock(&imageQueueMutex);
+        for (ppJob = &pImageQueue; *ppJob; ppJob = &(*ppJob)->pNext) {
+            if (*ppJob == pJob) {
+                *ppJob = pJob->pNext;
+                isQueued = 1;
+                break;
+            }
+        }
+        Tcl_MutexUnlock(&imageQueueMutex);
+#endif
+        if (isQueued) {
+            HtmlFree(pJob);
+            (*imageJobCount())--;
+        } else {
+            pJob->pImage = 0;
+        }
+        pImage->pJob = 0;
+    }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlImageImage --
+ *
+ *     Return the Tk image for image object pImage. If pImage is a scaled
+ *     copy that is out of date, it is regenerated first, either directly
+ *     or by queueing an asynchronous job (see imageJobQueue()).
+ *
+ * Results:
+ *     Tk image handle, or 0 if the scaled copy is being generated by
+ *     a worker thread.
+ *
+ * Side effects:
+ *     May regenerate or queue regeneration of scaled copies.
+ *
+ *---------------------------------------------------------------------------
+ */
 Tk_Image
 HtmlImageImage(pImage)
     HtmlImage2 *pImage;    /* Image object */
 {
     assert(pImage && (pImage->isValid == 1 || pImage->isValid == 0));
+    if (pImage->pJob) {
+        /* A worker thread is still generating this scaled copy. */
+        assert(!pImage->isValid);
+        return 0;
+    }
     if (!pImage->isValid) {
         /* pImage->image is invalid. This happens if the underlying Tk
          * image, or the image that this is a scaled copy of, is changed
@@ -677,13 +1446,20 @@ HtmlImageImage(pImage)
         Tk_PhotoImageBlock block;
         Tcl_Interp *interp = pImage->pImageServer->pTree->interp;
         HtmlImage2 *pUnscaled = pImage->pUnscaled;
+        int isRestored = 0;
+
+        assert(pUnscaled);
+        CHECK_INTEGER_PLAUSIBILITY(pUnscaled->width);
+        CHECK_INTEGER_PLAUSIBILITY(pUnscaled->height);
 
         if (pUnscaled->pixmap) {
+            /* The photo data for the unscaled image was discarded when
+             * it was converted to a pixmap. Decode the compressed data
+             * again so that the scaled copy can be generated.
+             */
             Tcl_Obj *apObj[4];
             int rc;
 
-printf("TODO: BAD. Have to recreate image to make scaled copy.\n");
-
             apObj[0] = pUnscaled->pImageName;
             apObj[1] = Tcl_NewStringObj("configure", -1);
             apObj[2] = Tcl_NewStringObj("-data", -1);
@@ -691,113 +1467,50 @@ printf("TODO: BAD. Have to recreate image to make scaled copy.\n");
 
             Tcl_IncrRefCount(apObj[1]);
             Tcl_IncrRefCount(apObj[2]);
-            Tcl_IncrRefCount(apObj[3]);
             pUnscaled->nIgnoreChange++;
             rc = Tcl_EvalObjv(interp, 4, apObj, TCL_EVAL_GLOBAL);
             pUnscaled->nIgnoreChange--;
             assert(rc==TCL_OK);
-            Tcl_IncrRefCount(apObj[3]);
             Tcl_DecrRefCount(apObj[2]);
             Tcl_DecrRefCount(apObj[1]);
+            isRestored = 1;
         }
 
-        assert(pUnscaled);
-        if (!pImage->pImageName) {
-            /* If pImageName is still NULL, then create a new photo
-             * image to write the scaled data to. Todo: Is it possible
-             * to do this without invoking a script, creating the Tcl
-             * command etc.?
-             */
-            Tk_Window win = pImage->pImageServer->pTree->tkwin;
-            Tcl_Interp *interp = pImage->pImageServer->pTree->interp;
-            const char *z;
-
-            Tcl_Eval(interp, "image create photo");
-            pImage->pImageName = Tcl_GetObjResult(interp);
-            Tcl_IncrRefCount(pImage->pImageName);
-            assert(0 == pImage->pDelete);
-            assert(0 == pImage->image);
-
-            z = Tcl_GetString(pImage->pImageName);
-            pImage->image = Tk_GetImage(interp, win, z, imageChanged, pImage);
-        }
-        assert(pImage->image);
-
-        CHECK_INTEGER_PLAUSIBILITY(pImage->width);
-        CHECK_INTEGER_PLAUSIBILITY(pImage->height);
-        CHECK_INTEGER_PLAUSIBILITY(pUnscaled->width);
-        CHECK_INTEGER_PLAUSIBILITY(pUnscaled->height);
-
-        /* Write the scaled data into image pImage->image */
+        /* Write the scaled data into image pImage->image. If the unscaled
+         * image had to be decoded again, regenerate all of its invalid 
+         * scaled copies while the data is available, not just pImage.
+         */
         photo = Tk_FindPhoto(interp, Tcl_GetString(pUnscaled->pImageName));
         if (photo) {
             Tk_PhotoGetImage(photo, &block);
         }
         if (photo && block.pixelPtr) { 
-            int x, y;                /* Iterator variables */
-            int w, h;                /* Width and height of unscaled image */
-            int sw, sh;              /* Width and height of scaled image */
-            Tk_PhotoHandle s_photo;
-            Tk_PhotoImageBlock s_block;
-
-            sw = pImage->width;
-            sh = pImage->height;
-            w = pUnscaled->width;
-            h = pUnscaled->height;
-            s_photo = Tk_FindPhoto(interp, Tcl_GetString(pImage->pImageName));
-
-            s_block.pixelPtr = (unsigned char *)HtmlAlloc("temp", sw * sh * 4);
-            s_block.width = sw;
-            s_block.height = sh;
-            s_block.pitch = sw * 4;
-            s_block.pixelSize = 4;
-            s_block.offset[0] = 0;
-            s_block.offset[1] = 1;
-            s_block.offset[2] = 2;
-            s_block.offset[3] = 3;
-
-            for (x=0; x<sw; x++) {
-                int orig_x = ((x * w) / sw);
-                for (y=0; y<sh; y++) {
-                    unsigned char *zOrig;
-                    unsigned char *zScale;
-                    int orig_y = ((y * h) / sh);
-
-                    zOrig = &block.pixelPtr[
-                        orig_x * block.pixelSize + orig_y * block.pitch];
-                    zScale = &s_block.pixelPtr[
-                        x * s_block.pixelSize + y * s_block.pitch];
-
-                    zScale[0] = zOrig[block.offset[0]];
-                    zScale[1] = zOrig[block.offset[1]];
-                    zScale[2] = zOrig[block.offset[2]];
-                    zScale[3] = zOrig[block.offset[3]];
+            if (isRestored) {
+                HtmlImage2 *p;
+                for (p = pUnscaled->pNext; p; p = p->pNext) {
+                    if (!p->isValid) {
+                        imageJobCancel(p);
+                        imageScaleCopy(p, &block);
+                    }
                 }
+            } else if (!imageJobQueue(pImage, &block)) {
+                imageScaleCopy(pImage, &block);
             }
-            photoputblock(interp, s_photo, &s_block, 0, 0, sw, sh, 0);
-            HtmlFree(s_block.pixelPtr);
-        } else {
-            return HtmlImageImage(pImage->pUnscaled);
         }
 
-        pImage->isValid = 1;
-        if (pUnscaled->pixmap) {
-            Tcl_Obj *apObj[4];
-
-            apObj[0] = Tcl_NewStringObj("image", -1);
-            apObj[1] = Tcl_NewStringObj("create", -1);
-            apObj[2] = Tcl_NewStringObj("photo", -1);
-            apObj[3] = pUnscaled->pImageName;
-
-            Tcl_IncrRefCount(apObj[0]);
-            Tcl_IncrRefCount(apObj[1]);
-            Tcl_IncrRefCount(apObj[2]);
+        if (isRestored) {
+            Tcl_Obj *pName;
             pUnscaled->nIgnoreChange++;
-            Tcl_EvalObjv(interp, 4, apObj, TCL_EVAL_GLOBAL);
+            pName = imageCreatePhoto(interp, pUnscaled->pImageName);
             pUnscaled->nIgnoreChange--;
-            Tcl_DecrRefCount(apObj[2]);
-            Tcl_DecrRefCount(apObj[1]);
-            Tcl_IncrRefCount(apObj[0]);
+            if (pName) Tcl_DecrRefCount(pName);
+        }
+
+        if (pImage->pJob) {
+            return 0;
+        }
+        if (!pImage->isValid) {
+            return HtmlImageImage(pImage->pUnscaled);
         }
     }
 
@@ -922,6 +1635,7 @@ HtmlImagePixmap(pImage)
     }
     if (!pImage->isValid) {
         HtmlImageImage(pImage);
+        if (!pImage->isValid) return 0;
     }
     if (!pImage->pixmap && !HtmlImageAlphaChannel(pImage)) {
         Tk_Window win = pImage->pImageServer->pTree->tkwin;
@@ -979,6 +1693,7 @@ HtmlImageFree(pImage)
          */
         assert(pImage->pUnscaled || 0 == pImage->pNext);
 
+        imageJobCancel(pImage);
         freeImageCompressed(pImage);
         freeTile(pImage);
         if (pImage->pixmap) {
@@ -1159,6 +1874,17 @@ HtmlImageTile(pImage, pW, pH)
         goto return_tile;
     }
 
+    /* The scaled copy is being generated asynchronously. Return 0 so
+     * that the caller draws a placeholder.
+     */
+    if (!HtmlImageImage(pImage)) {
+        HtmlImageSize(pImage, pW, pH);
+        return 0;
+    }
+    if (!pImage->isValid) {
+        goto return_original;
+    }
+
     /* The image is too big to bother with a tile. Return the original. */
     if (!tilesize(pImage, &iTileWidth, &iTileHeight)) {
         goto return_original;
@@ -1170,12 +1896,9 @@ HtmlImageTile(pImage, pW, pH)
     Tk_PhotoGetImage(origphoto, &origblock);
     if (!origblock.pixelPtr) goto return_original;
 
-    /* Create the tile image. Surely there is a way to do this without
-     * invoking a script, but I haven't found it yet.
-     */
-    Tcl_Eval(interp, "image create photo");
-    pTileName = Tcl_GetObjResult(interp);
-    Tcl_IncrRefCount(pTileName);
+    /* Create the tile image. */
+    pTileName = imageCreatePhoto(interp, 0);
+    if (!pTileName) goto return_original;
     tilephoto = Tk_FindPhoto(interp, Tcl_GetString(pTileName));
     Tk_PhotoGetImage(tilephoto, &tileblock);
     pImage->pTileName = pTileName;
@@ -1331,6 +2054,9 @@ int HtmlImageServerCount(pTree)
  *     calls, where <image-name> is the string contained in the 
  *     returned object.
  *
+ *     If the image cannot be created, NULL is returned and an error
+ *     message left in the interpreter result.
+ *
  * Side effects:
  *     None.
  *
@@ -1356,9 +2082,10 @@ Tcl_Obj *HtmlXImageToImage(pTree, pXImage, w, h)
     unsigned long bluemask, blueshift;
     Visual *pVisual;
 
-    Tcl_Eval(interp, "image create photo");
-    pImage = Tcl_GetObjResult(interp);
-    Tcl_IncrRefCount(pImage);
+    pImage = imageCreatePhoto(interp, 0);
+    if (!pImage) {
+        return 0;
+    }
 
     block.pixelPtr = (unsigned char *)HtmlAlloc("temp", w * h * 4);
     block.width = w;
@@ -1379,8 +2106,8 @@ Tcl_Obj *HtmlXImageToImage(pTree, pXImage, w, h)
     for (greenshift=0; !((greenmask>>greenshift)&0x00000001); greenshift++);
     for (blueshift=0; !((bluemask>>blueshift)&0x00000001); blueshift++);
 
-    for (x=0; x<w; x++) {
-        for (y=0; y<h; y++) {
+    for (y=0; y<h; y++) {
+        for (x=0; x<w; x++) {
             unsigned char *pOut;
             unsigned long pixel = XGetPixel(pXImage, x, y);
 
@@ -1405,6 +2132,7 @@ Tcl_Obj *HtmlXImageToImage(pTree, pXImage, w, h)
     int w;
     int h;
 {
+    Tcl_SetResult(pTree->interp, "not supported on this platform", 0);
     return 0;
 }
 #endif
@@ -1478,3 +2206,35 @@ HtmlImageServerReport(clientData, interp, objc, objv)
     Tcl_SetObjResult(interp, pRet);
     return TCL_OK;
 }
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlImageJobsCmd --
+ *
+ *         ::tkhtml::imagejobs
+ *
+ *     Return the number of asynchronous image scaling jobs (see the
+ *     -imageasync option) queued by the calling thread that have not 
+ *     yet been delivered back to it. This includes the jobs of widgets
+ *     that have been destroyed. Used by the test suite to wait for all
+ *     outstanding jobs to finish.
+ *
+ * Results:
+ *     TCL_OK.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+int 
+HtmlImageJobsCmd(clientData, interp, objc, objv)
+    ClientData clientData;             /* Unused */
+    Tcl_Interp *interp;                /* Current interpreter. */
+    int objc;                          /* Number of arguments. */
+    Tcl_Obj *CONST objv[];             /* Argument strings. */
+{
+    Tcl_SetObjResult(interp, Tcl_NewIntObj(*imageJobCount()));
+    return TCL_OK;
+}
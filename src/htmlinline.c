@@ -1662,7 +1662,6 @@ HtmlInlineContextAddText(pContext, pNode)
 
     XColor *color;                 /* Color to render in */
     HtmlFont *pFont;               /* Font to render in */
-    Tk_Font tkfont;                /* Copy of pFont->tkfont */
     int eWhitespace;               /* Value of 'white-space' property */
 
     int sw;                        /* Space-Width in pFont. */
@@ -1677,7 +1676,6 @@ HtmlInlineContextAddText(pContext, pNode)
     pFont = pValues->fFont;
     eWhitespace = pValues->eWhitespace;
 
-    tkfont = pFont->tkfont;
     color = pValues->cColor->xcolor;
 
     sw = pFont->space_pixels;
@@ -1696,7 +1694,6 @@ HtmlInlineContextAddText(pContext, pNode)
 
         switch (eType) {
             case HTML_TEXT_TOKEN_TEXT: {
-                Tcl_Obj *pText;
                 HtmlCanvas *p; 
                 InlineBox *pBox;
                 int tw;            /* Text width */
@@ -1705,18 +1702,15 @@ HtmlInlineContextAddText(pContext, pNode)
 
                 p = inlineContextAddInlineCanvas(pContext, INLINE_TEXT, pNode);
 
-                tw = Tk_TextWidth(tkfont, zData, nData);
+                tw = HtmlFontTextWidth(pContext->pTree, pFont, zData, nData);
                 pBox = &pContext->aInline[pContext->nInline-1];
                 pBox->nContentPixels = tw;
                 pBox->eWhitespace = eWhitespace;
 
                 y = pContext->pCurrent->metrics.iBaseline;
 
-                pText = Tcl_NewStringObj(zData, nData);
-                Tcl_IncrRefCount(pText);
                 iIndex = zData - ((HtmlTextNode *)pNode)->zText;
                 HtmlDrawText(p, zData, nData, 0, y, tw, szonly, pNode, iIndex);
-                Tcl_DecrRefCount(pText);
 
                 pContext->ignoreLineHeight = 0;
                 break;
@@ -128,6 +128,7 @@ struct HtmlLayoutCache {
     LayoutCache aCache[3];
     int iMinWidth;
     int iMaxWidth;
+    HtmlTableCache *pTableCache;   /* Column widths for "display:table" */
 };
 #define CACHED_MINWIDTH_OK ((int)1<<3)
 #define CACHED_MAXWIDTH_OK ((int)1<<4)
@@ -144,6 +145,7 @@ struct HtmlLayoutCache {
  *     HtmlLayoutNodeContent
  *
  *     blockMinMaxWidth
+ *     HtmlLayoutTableCache
  *     nodeGetMargins
  *     nodeGetBoxProperties
  */
@@ -1569,8 +1571,13 @@ HtmlLayoutNodeContent(pLayout, pBox, pNode)
     if (eDisplay == CSS_CONST_NONE) {
         /* Do nothing */
     } else if (eDisplay == CSS_CONST_TABLE) {
-        /* All the work for tables is done in htmltable.c */
+        /* All the work for tables is done in htmltable.c. A table is
+         * always laid out in one pass, as the height of each row depends
+         * on the content of all cells in the row.
+         */
+        pLayout->nNoInterrupt++;
         HtmlTableLayout(pLayout, pBox, pNode);
+        pLayout->nNoInterrupt--;
     } else {
         /* Set up a new NormalFlow for this flow */
         HtmlFloatList *pFloat;
@@ -2240,9 +2247,11 @@ wrapContent(pLayout, pBox, pContent, pNode)
             sAbsolute.width -= pV->border.iRight;
         }
         sAbsolute.iContaining = sAbsolute.width;
+        pLayout->nNoInterrupt++;
         drawAbsolute(pLayout, &sAbsolute, &pBox->vc,
             iLeftBorder + margin.margin_left, iTopBorder
         );
+        pLayout->nNoInterrupt--;
         DRAW_CANVAS(&pBox->vc, &sAbsolute.vc, 
             iRelLeft + margin.margin_left + iLeftBorder, 
             iRelTop + iTopBorder, pNode
@@ -2619,6 +2628,7 @@ normalFlowLayoutBlock(pLayout, pBox, pNode, pY, pContext, pNormal)
     BoxContext sContent;   /* Box context for content to be drawn into */
     BoxContext sBox;       /* sContent + borders */
     BoxContext sTmp;       /* Used to offset content */
+    int iFlowY;            /* Saved value of pLayout->iFlowY */
 
     NormalFlowCallback sNormalFlowCallback;
 
@@ -2701,7 +2711,10 @@ normalFlowLayoutBlock(pLayout, pBox, pNode, pY, pContext, pNormal)
      * minimum height.
      */
     sContent.iContainingHeight = PIXELVAL(pV, HEIGHT, iContHeight);
+    iFlowY = pLayout->iFlowY;
+    pLayout->iFlowY += y;
     normalFlowLayout(pLayout, &sContent, pNode, pNormal);
+    pLayout->iFlowY = iFlowY;
 
     /* Remove any margin-collapse callback added to the normal flow context. */
     normalFlowCbDelete(pNormal, &sNormalFlowCallback);
@@ -2885,6 +2898,90 @@ normalFlowLayoutInlineReplaced(pLayout, pBox, pNode, pY, pContext, pNormal)
     return 0;
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * layoutIsInterrupted --
+ *
+ *     This is called by layoutChildren() before each child node is laid
+ *     out, to check if a time-sliced layout (see the -layoutslice
+ *     option) should stop. Parameter y is the current y-coordinate
+ *     relative to the origin of the normal flow being laid out.
+ *
+ *     The layout is never interrupted during a min-max width test, 
+ *     inside a table or an absolutely positioned box (while 
+ *     LayoutContext.nNoInterrupt is non-zero), before the content laid
+ *     out reaches the bottom of the viewport, or before at least one
+ *     block has been laid out without using the layout cache (see 
+ *     layoutMarkProgress()).
+ *
+ * Results:
+ *     True if the layout should stop, otherwise false.
+ *
+ * Side effects:
+ *     May set LayoutContext.isInterrupted.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int
+layoutIsInterrupted(pLayout, y)
+    LayoutContext *pLayout;
+    int y;
+{
+    if (pLayout->minmaxTest || !pLayout->iDeadline || pLayout->nNoInterrupt) {
+        return 0;
+    }
+    if (
+        !pLayout->isInterrupted && pLayout->isProgress &&
+        (pLayout->iFlowY + y) >= pLayout->iFillY
+    ) {
+        Tcl_Time t;
+        Tcl_GetTime(&t);
+        if (((Tcl_WideInt)t.sec * 1000000 + t.usec) >= pLayout->iDeadline) {
+            pLayout->isInterrupted = 1;
+        }
+    }
+    return pLayout->isInterrupted;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * layoutMarkProgress --
+ *
+ *     This is called each time a block box is laid out from scratch
+ *     (not copied from the layout cache). The first time it is called
+ *     during a time-sliced layout, the deadline is restarted. So each
+ *     continuation pass spends up to a full slice laying out content
+ *     that is not already cached, no matter how long it took to walk
+ *     the cached part of the document, and always gets at least one
+ *     new block further than the previous pass.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     May set LayoutContext.isProgress and LayoutContext.iDeadline.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+layoutMarkProgress(pLayout)
+    LayoutContext *pLayout;
+{
+    if (
+        pLayout->iDeadline && !pLayout->isProgress && 
+        !pLayout->isInterrupted && !pLayout->minmaxTest
+    ) {
+        Tcl_Time t;
+        Tcl_GetTime(&t);
+        pLayout->iDeadline = (Tcl_WideInt)t.sec * 1000000 + t.usec;
+        pLayout->iDeadline += 
+            (Tcl_WideInt)pLayout->pTree->options.layoutslice * 1000;
+        pLayout->isProgress = 1;
+    }
+}
+
 /*
  *---------------------------------------------------------------------------
  *
@@ -2919,6 +3016,7 @@ layoutChildren(pLayout, pBox, pNode, pY, pContext, pNormal)
     for(ii = 0; ii < HtmlNodeNumChildren(pNode) ; ii++) {
         HtmlNode *p = HtmlNodeChild(pNode, ii);
         int r;
+        if (layoutIsInterrupted(pLayout, *pY)) break;
         r = normalFlowLayoutNode(pLayout, pBox, p, pY, pContext, pNormal);
         assert(r >= 0);
         ii += r;
@@ -3336,7 +3434,7 @@ normalFlowLayoutNode(pLayout, pBox, pNode, pY, pContext, pNormal)
 
 #define LAYOUT_CACHE_N_USE_COND 6
 #ifdef LAYOUT_CACHE_DEBUG
-#define LAYOUT_CACHE_N_STORE_COND 9
+#define LAYOUT_CACHE_N_STORE_COND 10
 static int aDebugUseCacheCond[LAYOUT_CACHE_N_USE_COND + 1];
 static int aDebugStoreCacheCond[LAYOUT_CACHE_N_STORE_COND + 1];
 #endif
@@ -3590,6 +3688,7 @@ normalFlowLayout(pLayout, pBox, pNode, pNormal)
     }
 
     layoutChildren(pLayout, pBox, pNode, &y, pContext, pNormal);
+    layoutMarkProgress(pLayout);
     
     /* Finish the inline-border started by the parent, if any. */
     HtmlInlineContextPopBorder(pContext, pBorder);
@@ -3645,7 +3744,8 @@ normalFlowLayout(pLayout, pBox, pNode, pNormal)
         COND(6, pLayout->pFixed == pFixed) &&
         COND(7, !HtmlNodeBefore(pNode) && !HtmlNodeAfter(pNode)) && 
         COND(8, pNode->pParent) &&
-        COND(9, pNode->iNode >= 0)
+        COND(9, pNode->iNode >= 0) &&
+        COND(10, !pLayout->isInterrupted)
     ) {
         HtmlDrawOrigin(&pBox->vc);
         HtmlDrawCopyCanvas(&pCache->canvas, &pBox->vc);
@@ -3800,6 +3900,39 @@ blockMinMaxWidth(pLayout, pNode, pMin, pMax)
     return TCL_OK;
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlLayoutTableCache --
+ *
+ *     Return a pointer to the slot in the layout-cache of element pNode
+ *     used by htmltable.c to cache the results of the column width 
+ *     analysis. The slot is cleared (and the HtmlTableCache freed using
+ *     HtmlTableCacheFree()) whenever the layout-cache of pNode is 
+ *     invalidated.
+ *
+ * Results:
+ *     Pointer to HtmlTableCache pointer (may point to NULL).
+ *
+ * Side effects:
+ *     May allocate the layout-cache for pNode.
+ *
+ *---------------------------------------------------------------------------
+ */
+HtmlTableCache **
+HtmlLayoutTableCache(pNode)
+    HtmlNode *pNode;
+{
+    HtmlElementNode *pElem = (HtmlElementNode *)pNode;
+    assert(!HtmlNodeIsText(pNode));
+    if (!pElem->pLayoutCache) {
+        pElem->pLayoutCache = (HtmlLayoutCache *)HtmlClearAlloc(
+            "HtmlLayoutCache", sizeof(HtmlLayoutCache)
+        );
+    }
+    return &pElem->pLayoutCache->pTableCache;
+}
+
 
 /*
  *---------------------------------------------------------------------------
@@ -3970,6 +4103,23 @@ HtmlLayout(pTree)
     sLayout.pTree = pTree;
     sLayout.interp = pTree->interp;
 
+    /* If the -layoutslice option is set, and this is not a forced layout
+     * (i.e. one required by a [bbox] or similar command), set a deadline
+     * after which the layout engine stops laying out content below the
+     * viewport. See layoutIsInterrupted(). Each continuation pass relies
+     * on the layout cache to skip the content laid out by earlier passes,
+     * so the layout is never time-sliced if -layoutcache is false.
+     */
+    if (!pTree->cb.isForce && pTree->options.layoutslice > 0 &&
+        pTree->options.layoutcache
+    ) {
+        Tcl_Time t;
+        Tcl_GetTime(&t);
+        sLayout.iDeadline = (Tcl_WideInt)t.sec * 1000000 + t.usec;
+        sLayout.iDeadline += (Tcl_WideInt)pTree->options.layoutslice * 1000;
+        sLayout.iFillY = pTree->iScrollY + Tk_Height(pTree->tkwin);
+    }
+
 #ifdef LAYOUT_CACHE_DEBUG
     memset(aDebugUseCacheCond, 0, sizeof(int) * (LAYOUT_CACHE_N_USE_COND + 1));
     memset(aDebugStoreCacheCond, 0, sizeof(int)*(LAYOUT_CACHE_N_STORE_COND+1));
@@ -4015,6 +4165,11 @@ HtmlLayout(pTree)
          */
         HtmlDrawCanvas(&pTree->canvas, &sBox.vc, 0, 0, pBody);
 
+        /* Fixed elements are always laid out in full, even if the 
+         * layout of the main flow was interrupted.
+         */
+        sLayout.iDeadline = 0;
+
         /* This loop takes care of nested "position:fixed" elements. */
         HtmlDrawAddMarker(&pTree->canvas, 0, 0, 1);
         while (sLayout.pFixed) {
@@ -4044,7 +4199,30 @@ HtmlLayout(pTree)
         pTree->canvas.right = MAX(pTree->canvas.right, sBox.width);
         pTree->canvas.bottom = MAX(pTree->canvas.bottom, sBox.height);
 
+        /* Report the amount of work done by the root float list. */
+        if (pTree->options.logcmd) {
+            int nFloat, nQuery, nStep;
+            HtmlFloatListStats(sNormal.pFloat, &nFloat, &nQuery, &nStep);
+            HtmlLog(pTree, "LAYOUTENGINE", 
+                "Float list: %d floats, %d queries, %d entries visited",
+                nFloat, nQuery, nStep
+            );
+        }
         HtmlFloatListDelete(sNormal.pFloat);
+
+        /* Build the spatial index used to query the new display list.
+         * If this pass was interrupted, the next pass replaces the display
+         * list anyway, so queries scan it linearly until the layout is
+         * complete.
+         */
+        if (!sLayout.isInterrupted) {
+            HtmlDrawCanvasIndex(pTree);
+        }
+    }
+
+    pTree->isLayoutPartial = sLayout.isInterrupted;
+    if (sLayout.isInterrupted) {
+        HtmlLog(pTree, "LAYOUTENGINE", "INTERRUPTED", NULL);
     }
 
 #ifdef LAYOUT_CACHE_DEBUG
@@ -4112,6 +4290,7 @@ HtmlLayoutInvalidateCache(pTree, pNode)
             HtmlDrawCleanup(pTree, &pElem->pLayoutCache->aCache[0].canvas);
             HtmlDrawCleanup(pTree, &pElem->pLayoutCache->aCache[1].canvas);
             HtmlDrawCleanup(pTree, &pElem->pLayoutCache->aCache[2].canvas);
+            HtmlTableCacheFree(pElem->pLayoutCache->pTableCache);
             HtmlFree(pElem->pLayoutCache);
             pElem->pLayoutCache = 0;
         }
@@ -35,6 +35,17 @@ struct LayoutContext {
 
     NodeList *pAbsolute;     /* List of nodes with "absolute" 'position' */
     NodeList *pFixed;        /* List of nodes with "fixed" 'position' */
+
+    /* Variables used by time-sliced layout (see the -layoutslice option
+     * and layoutIsInterrupted() in htmllayout.c). If iDeadline is 0,
+     * the layout is never interrupted.
+     */
+    Tcl_WideInt iDeadline;   /* Stop laying out at this time (microseconds) */
+    int iFillY;              /* Do not stop before this canvas y-coordinate */
+    int iFlowY;              /* Canvas y-coord of current normal-flow origin */
+    int isInterrupted;       /* True once the deadline has been reached */
+    int isProgress;          /* True once a block is laid out from scratch */
+    int nNoInterrupt;        /* If non-zero, do not interrupt the layout */
 };
 
 /* Values for LayoutContext.minmaxTest */
@@ -135,6 +146,12 @@ void nodeGetMargins(LayoutContext *, HtmlNode *, int, MarginProperties *);
 
 int  blockMinMaxWidth(LayoutContext *, HtmlNode *, int *, int *);
 
+/* Column width analysis of a table, cached with the layout of the table
+ * node. See htmltable.c.
+ */
+typedef struct HtmlTableCache HtmlTableCache;
+HtmlTableCache **HtmlLayoutTableCache(HtmlNode *);
+
 int getHeight(HtmlNode *, int, int);
 
 /*--------------------------------------------------------------------------*
@@ -143,6 +160,7 @@ int getHeight(HtmlNode *, int, int);
  *     htmlTableLayout.c contains code to layout HTML/CSS tables.
  */
 int HtmlTableLayout(LayoutContext*, BoxContext*, HtmlNode*);
+void HtmlTableCacheFree(HtmlTableCache *);
 
 /* End of htmlTableLayout.c interface
  *-------------------------------------------------------------------------*/
@@ -766,7 +766,9 @@ HtmlTokenize(pTree, zText, isFinal, xAddText, xAddElement, xAddClosing)
 
             if (c || isFinal) {
                 int ts = isTrimStart;
-                HtmlTextNode *pTextNode = HtmlTextNew(i, &z[n], isTrimEnd, ts);
+                HtmlTextNode *pTextNode = HtmlTextNew(
+                    HtmlTreeArena(pTree), i, &z[n], isTrimEnd, ts
+                );
                 xAddText(pTree, pTextNode, n);
                 n += i;
             } else {
@@ -798,6 +800,7 @@ HtmlTokenize(pTree, zText, isFinal, xAddText, xAddElement, xAddClosing)
         ) {
             const char *zData = &z[n+9];
             int nData;
+            HtmlTextNode *pTextNode;
             for (i = 9; z[n + i]; i++) {
                 if (z[n + i] == ']' && strncmp(&z[n + i], "]]>", 3) == 0) {
                     break;
@@ -809,7 +812,8 @@ HtmlTokenize(pTree, zText, isFinal, xAddText, xAddElement, xAddClosing)
             n += i + 3;
 
             nData = i - 9;
-            xAddText(pTree, HtmlTextNew(nData, zData, 0, 0), 0);
+            pTextNode = HtmlTextNew(HtmlTreeArena(pTree), nData, zData, 0, 0);
+            xAddText(pTree, pTextNode, 0);
 
             isTrimStart = 0;
         }
@@ -1009,7 +1013,9 @@ HtmlTokenize(pTree, zText, isFinal, xAddText, xAddElement, xAddClosing)
                 HtmlAttributes *pAttr;
                 Tcl_Obj *pScript = 0;
                 const char **zArgs = (const char **)(&argv[1]);
-                pAttr = HtmlAttributesNew(argc - 1, zArgs, &arglen[1], 1);
+                pAttr = HtmlAttributesNew(pTree,
+                    HtmlTreeArena(pTree), argc - 1, zArgs, &arglen[1], 1
+                );
 
 
                 /* Unless a fragment is being parsed, search for a 
@@ -1025,7 +1031,7 @@ HtmlTokenize(pTree, zText, isFinal, xAddText, xAddElement, xAddClosing)
                     nScript = findEndOfScript(eType, z, &n);
                     if (nScript < 0) {
                         n = nStartScript;
-                        HtmlFree(pAttr);
+                        HtmlAttributesFree(pAttr);
                         goto incomplete;
                     }
                 }
@@ -1042,7 +1048,9 @@ HtmlTokenize(pTree, zText, isFinal, xAddText, xAddElement, xAddClosing)
                     }
                     if (zScript) {
                         HtmlTextNode *pTextNode;
-                        pTextNode = HtmlTextNew(nScript, zScript, 1, 1);
+                        pTextNode = HtmlTextNew(
+                            HtmlTreeArena(pTree), nScript, zScript, 1, 1
+                        );
                         xAddText(pTree, pTextNode, n);
                         xAddClosing(pTree, eType, zAtom, n);
                     } else {
@@ -1089,7 +1097,7 @@ HtmlTokenize(pTree, zText, isFinal, xAddText, xAddElement, xAddClosing)
                     }
                     z = Tcl_GetString(pTree->pDocument);
 
-                    HtmlFree(pAttr);
+                    HtmlAttributesFree(pAttr);
                     isTrimStart = 0;
 
                     if (pTree->eWriteState == HTML_WRITE_WAIT) {
@@ -1150,6 +1158,53 @@ tokenizeWrapper(pTree, isFin, xAddText, xAddElement, xAddClosing)
     return rc;
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * tokenizerDiscard --
+ *
+ *     This is called after each block of text is tokenized if the
+ *     -discardparsed option is true. The bytes of HtmlTree.pDocument
+ *     that have already been tokenized are discarded, so that only the
+ *     incomplete token (if any) at the end of the document is retained.
+ *     Text and element nodes own copies of their data, so the document 
+ *     text is not required once it has been tokenized.
+ *
+ *     Nothing is discarded while a script handler is running or the 
+ *     tokenizer is waiting for [$html write continue], as in these 
+ *     states HtmlTree.iWriteInsert refers to an offset in pDocument.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     Replaces HtmlTree.pDocument and updates HtmlTree.nParsed and 
+ *     HtmlTree.nDiscard.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+tokenizerDiscard(pTree)
+    HtmlTree *pTree;
+{
+    if (
+        pTree->options.discardparsed && pTree->pDocument &&
+        pTree->nParsed > 0 && pTree->eWriteState == HTML_WRITE_NONE
+    ) {
+        int nDoc;
+        const char *zDoc = Tcl_GetStringFromObj(pTree->pDocument, &nDoc);
+        Tcl_Obj *pTail;
+
+        assert(pTree->nParsed <= nDoc);
+        pTail = Tcl_NewStringObj(&zDoc[pTree->nParsed], nDoc-pTree->nParsed);
+        Tcl_IncrRefCount(pTail);
+        Tcl_DecrRefCount(pTree->pDocument);
+        pTree->pDocument = pTail;
+        pTree->nDiscard += pTree->nParsed;
+        pTree->nParsed = 0;
+    }
+}
+
 /*
  *---------------------------------------------------------------------------
  *
@@ -1194,6 +1249,7 @@ HtmlTokenizerAppend(pTree, zText, nText, isFinal)
             HtmlTreeAddElement,
             HtmlTreeAddClosingTag
         );
+        tokenizerDiscard(pTree);
     }
 }
 
@@ -1339,6 +1395,7 @@ HtmlWriteContinue(pTree)
                 HtmlTreeAddElement,
                 HtmlTreeAddClosingTag
             );
+            tokenizerDiscard(pTree);
             break;
         }
         case HTML_WRITE_INHANDLERWAIT:
@@ -1163,11 +1163,12 @@ decrementColorRef(pTree, pColor)
     HtmlColor *pColor;
 {
     if (pColor) {
+        HtmlDisplayCache *pCache = pTree->pDisplayCache;
         pColor->nRef--;
         assert(pColor->nRef >= 0);
         if (pColor->nRef == 0) {
             Tcl_HashEntry *pEntry;
-            pEntry = Tcl_FindHashEntry(&pTree->aColor, pColor->zColor);
+            pEntry = Tcl_FindHashEntry(&pCache->aColor, pColor->zColor);
             Tcl_DeleteHashEntry(pEntry);
             if (pColor->xcolor) {
                 Tk_FreeColor(pColor->xcolor);
@@ -1179,20 +1180,20 @@ decrementColorRef(pTree, pColor)
 
 #ifndef NDEBUG
 static int 
-dumpColorTable(pTree)
-    HtmlTree *pTree;
+dumpColorTable(pCache)
+    HtmlDisplayCache *pCache;
 {
     Tcl_HashSearch search;
     Tcl_HashEntry *pEntry;
     int iRet = 0;
     for (
-        pEntry = Tcl_FirstHashEntry(&pTree->aColor, &search);
+        pEntry = Tcl_FirstHashEntry(&pCache->aColor, &search);
         pEntry;
         pEntry = Tcl_NextHashEntry(&search)
     ) {
         HtmlColor *pColor = Tcl_GetHashValue(pEntry);
         printf("%s -> {%s (%d) %p}\n", 
-            Tcl_GetHashKey(&pTree->aColor, pEntry), 
+            Tcl_GetHashKey(&pCache->aColor, pEntry), 
             pColor->zColor, pColor->nRef, pColor->xcolor
         );
         iRet++;
@@ -1208,7 +1209,7 @@ dumpColorTable(pTree)
  *
  *     Css property pProp contains a color-name. Set *pCVar (part of an
  *     HtmlComputedValues structure) to point to the corresponding entry in the 
- *     pTree->aColor array. The entry may be created if required.
+ *     HtmlDisplayCache.aColor table. The entry may be created if required.
  *
  * Results: 
  *     0 if *pCVar is set correctly. If pProp cannot be parsed as a color name,
@@ -1253,7 +1254,9 @@ propertyValuesSetColor(p, pCVar, pProp)
     zColor = HtmlCssPropertyGetString(pProp);
     if (!zColor || !zColor[0]) return 1;
 
-    pEntry = Tcl_CreateHashEntry(&pTree->aColor, zColor, &newEntry);
+    pEntry = Tcl_CreateHashEntry(
+        &pTree->pDisplayCache->aColor, zColor, &newEntry
+    );
     if (newEntry) {
         XColor *color;
 
@@ -2033,6 +2036,7 @@ HtmlComputedValuesInit(pTree, pNode, pParent, p)
     p->pTree = pTree;
     p->pParent = pParent;
     p->pNode = pNode;
+    p->isTclScript = 0;
 
     /* Copy property values that are inherited by default from the 
      * properties of the parent node, if there is one.
@@ -2087,6 +2091,7 @@ propertyValuesTclScript(p, eProp, zScript)
     Tcl_Interp *interp = p->pTree->interp;
     Tcl_Obj *pCommand = HtmlNodeCommand(p->pTree, p->pNode);
 
+    p->isTclScript = 1;
     Tcl_SetVar2Ex(interp, "N", 0, pCommand, 0);
     rc = Tcl_Eval(interp, zScript);
     zRes = Tcl_GetStringResult(interp);
@@ -2373,7 +2378,7 @@ allocateNewFont(clientData)
     Tk_Window tkwin = pTree->tkwin;
 
     Tcl_Interp *interp = pTree->interp;
-    int isForceFontMetrics = pTree->options.forcefontmetrics;
+    int isForceFontMetrics = pFontKey->isForceMetrics;
     Tk_Font tkfont = 0;
     const char *DEFAULT_FONT_FAMILY = "Helvetica";
 
@@ -2388,7 +2393,7 @@ allocateNewFont(clientData)
     /* Local variable iFontSize is in points - not thousandths */
     int iFontSize;
     float fontsize = ((float)pFontKey->iFontSize / (float)HTML_IFONTSIZE_SCALE);
-    fontsize = fontsize * pTree->options.fontscale * pTree->options.zoom;
+    fontsize = fontsize * pFontKey->rFontScale * pFontKey->rZoom;
 
 #if 0
     if (isForceFontMetrics) {
@@ -2575,11 +2580,17 @@ HtmlComputedValuesFinish(p)
     };
 #undef OFFSET
 
-    Tcl_HashTable *pFontHash = &p->pTree->fontcache.aHash;
+    HtmlFontCache *pCache = &p->pTree->pDisplayCache->fontcache;
+    Tcl_HashTable *pFontHash = &pCache->aHash;
 
     /* Find the font to use. If there is not a matching font in the font hash
-     * table already, allocate a new one.
+     * table already, allocate a new one. Fonts are shared with other 
+     * widgets, so the options that affect font allocation are part of
+     * the key.
      */
+    p->fontKey.isForceMetrics = (p->pTree->options.forcefontmetrics ? 1 : 0);
+    p->fontKey.rFontScale = p->pTree->options.fontscale;
+    p->fontKey.rZoom = p->pTree->options.zoom;
     pEntry = Tcl_CreateHashEntry(pFontHash, (char *)&p->fontKey, &ne);
     if (ne) {
 #ifndef TKHTML_ENABLE_PROFILE
@@ -2590,12 +2601,12 @@ HtmlComputedValuesFinish(p)
         );
 #endif
         assert(pFont);
+        pFont->iSerial = pCache->iNextSerial++;
         Tcl_SetHashValue(pEntry, pFont);
         pFont->pKey = (HtmlFontKey *)Tcl_GetHashKey(pFontHash, pEntry);
     } else {
         pFont = Tcl_GetHashValue(pEntry);
         if (pFont->nRef == 0) {
-            HtmlFontCache *pCache = &p->pTree->fontcache;
             if (pFont == pCache->pLruHead) {
                 pCache->pLruHead = pCache->pLruHead->pNext;
                 if (!pCache->pLruHead) {
@@ -2833,6 +2844,32 @@ HtmlComputedValuesFinish(p)
     return pValues;
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * fontWidthCacheReset --
+ *
+ *     Remove all entries from the text-width cache at HtmlFontCache.aWidth.
+ *     The hit and miss counters are not modified.
+ *
+ * Results: 
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+fontWidthCacheReset(p)
+    HtmlFontCache *p;
+{
+    Tcl_DeleteHashTable(&p->aWidth);
+    Tcl_InitCustomHashTable(
+        &p->aWidth, TCL_CUSTOM_TYPE_KEYS, HtmlTextWidthHashType()
+    );
+}
+
 /*
  *---------------------------------------------------------------------------
  *
@@ -2859,7 +2896,7 @@ HtmlFontRelease(pTree, pFont)
         pFont->nRef--;
         assert(pFont->nRef >= 0);
         if (pFont->nRef == 0) {
-            HtmlFontCache *p = &pTree->fontcache;
+            HtmlFontCache *p = &pTree->pDisplayCache->fontcache;
             assert(pFont->pNext == 0);
             assert((p->pLruTail&&p->pLruHead) || (!p->pLruTail&&!p->pLruHead));
             if (p->pLruTail) {
@@ -2913,6 +2950,64 @@ HtmlFontReference(pFont)
     pFont->nRef++;
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlFontTextWidth --
+ *
+ *     Return the width in pixels of the nText bytes of UTF-8 text at zText
+ *     when rendered using font pFont. This is equivalent to:
+ *
+ *         Tk_TextWidth(pFont->tkfont, zText, nText);
+ *
+ *     except that the widths of short strings are cached in the 
+ *     HtmlDisplayCache.fontcache.aWidth hash table.
+ *
+ * Results: 
+ *     Width of text in pixels.
+ *
+ * Side effects:
+ *     May add an entry to, or empty, the text-width cache.
+ *
+ *---------------------------------------------------------------------------
+ */
+int 
+HtmlFontTextWidth(pTree, pFont, zText, nText)
+    HtmlTree *pTree;
+    HtmlFont *pFont;
+    const char *zText;
+    int nText;
+{
+    HtmlFontCache *p = &pTree->pDisplayCache->fontcache;
+    HtmlTextWidthKey sKey;
+    Tcl_HashEntry *pEntry;
+    int isNew;
+    int iWidth;
+
+    if (nText > HTML_MAX_TEXTWIDTH_BYTES) {
+        return Tk_TextWidth(pFont->tkfont, zText, nText);
+    }
+
+    sKey.iFont = pFont->iSerial;
+    sKey.nText = nText;
+    sKey.zText = zText;
+    pEntry = Tcl_FindHashEntry(&p->aWidth, (char *)&sKey);
+    if (pEntry) {
+        p->nWidthHit++;
+        return (int)(size_t)Tcl_GetHashValue(pEntry);
+    }
+
+    p->nWidthMiss++;
+    if (p->aWidth.numEntries >= HTML_MAX_TEXTWIDTH_ENTRIES) {
+        fontWidthCacheReset(p);
+    }
+    iWidth = Tk_TextWidth(pFont->tkfont, zText, nText);
+    pEntry = Tcl_CreateHashEntry(&p->aWidth, (char *)&sKey, &isNew);
+    assert(isNew);
+    Tcl_SetHashValue(pEntry, (ClientData)(size_t)iWidth);
+    return iWidth;
+}
+
 void 
 HtmlComputedValuesReference(pValues)
     HtmlComputedValues *pValues;
@@ -2966,33 +3061,32 @@ HtmlComputedValuesRelease(pTree, pValues)
 /*
  *---------------------------------------------------------------------------
  *
- * HtmlComputedValuesSetupTables --
+ * displayCacheNew --
  * 
- *     This function is called during widget initialisation to initialise the
- *     three hash-tables used by code in this file:
- *
- *         HtmlTree.aColor
- *         HtmlTree.fontcache.aHash
- *         HtmlTree.aFontFamilies
- *         HtmlTree.aValues
+ *     Allocate and initialise a new HtmlDisplayCache structure for the
+ *     display, screen and colormap of widget pTree. The new structure has
+ *     a reference count of zero and is not linked into the 
+ *     HtmlInterpData.pDisplayCache list.
  *
- *     The aColor array is pre-loaded with 16 colors - the colors defined by
+ *     The aColor table is pre-loaded with 16 colors - the colors defined by
  *     the CSS standard. This is because the RGB definitions of these colors in
  *     CSS may be different than Tk's definition. If we preload all 16 and
  *     leave them in the color-cache permanently, we can be sure that the CSS
  *     defintions will always be used.
  *
- *     The fontcache.aHash and aValues hash tables are initialised empty.
+ *     The fontcache.aHash and fontcache.aWidth hash tables are 
+ *     initialised empty.
  *
  * Results: 
+ *     Pointer to new structure.
  *
  * Side effects:
  *     None.
  *
  *---------------------------------------------------------------------------
  */
-void 
-HtmlComputedValuesSetupTables(pTree)
+static HtmlDisplayCache *
+displayCacheNew(pTree)
     HtmlTree *pTree;
 {
     static struct CssColor {
@@ -3016,83 +3110,61 @@ HtmlComputedValuesSetupTables(pTree)
         {"aqua",    "#00FFFF"}
     };
     int ii;
+    int n;
     Tcl_HashEntry *pEntry;
-    Tcl_Interp *interp = pTree->interp;
-    Tcl_HashKeyType *pType;
     HtmlColor *pColor;
-    int n;
-
-    Tcl_Obj **apFamily;
-    int nFamily;
-    int dummy;
-
-    pType = HtmlCaseInsenstiveHashType();
-    Tcl_InitCustomHashTable(&pTree->aColor, TCL_CUSTOM_TYPE_KEYS, pType);
-
-    pType = HtmlFontKeyHashType();
-    Tcl_InitCustomHashTable(&pTree->fontcache.aHash,TCL_CUSTOM_TYPE_KEYS,pType);
+    HtmlDisplayCache *p;
 
-    pType = HtmlComputedValuesHashType();
-    Tcl_InitCustomHashTable(&pTree->aValues, TCL_CUSTOM_TYPE_KEYS, pType);
+    p = HtmlNew(HtmlDisplayCache);
+    p->display = Tk_Display(pTree->tkwin);
+    p->iScreen = Tk_ScreenNumber(pTree->tkwin);
+    p->colormap = Tk_Colormap(pTree->tkwin);
 
-    /* Initialise the aFontFamilies hash table. */
-    pType = HtmlCaseInsenstiveHashType();
-    Tcl_InitCustomHashTable(&pTree->aFontFamilies, TCL_CUSTOM_TYPE_KEYS, pType);
-    Tcl_Eval(interp, "font families");
-    Tcl_ListObjGetElements(NULL, Tcl_GetObjResult(interp), &nFamily, &apFamily);
-    for (ii = 0; ii < nFamily; ii++) {
-        Tcl_HashEntry *pEntry = Tcl_CreateHashEntry(
-            &pTree->aFontFamilies, Tcl_GetString(apFamily[ii]), &dummy
-        );
-        Tcl_SetHashValue(pEntry, 0);
-       
-        /* Note that sometimes the [font families] command returns a list
-         * containing duplicate elements. Therefore we cannot "assert(dummy)".
-         */
-    }
-    pEntry = Tcl_CreateHashEntry(&pTree->aFontFamilies, "serif", &dummy);
-    Tcl_SetHashValue(pEntry, "Times");
-    pEntry = Tcl_CreateHashEntry(&pTree->aFontFamilies, "sans-serif", &dummy);
-    Tcl_SetHashValue(pEntry, "Helvetica");
-    pEntry = Tcl_CreateHashEntry(&pTree->aFontFamilies, "monospace", &dummy);
-    Tcl_SetHashValue(pEntry, "Courier");
+    Tcl_InitCustomHashTable(
+        &p->aColor, TCL_CUSTOM_TYPE_KEYS, HtmlCaseInsenstiveHashType()
+    );
+    Tcl_InitCustomHashTable(
+        &p->fontcache.aHash, TCL_CUSTOM_TYPE_KEYS, HtmlFontKeyHashType()
+    );
+    Tcl_InitCustomHashTable(
+        &p->fontcache.aWidth, TCL_CUSTOM_TYPE_KEYS, HtmlTextWidthHashType()
+    );
 
     /* Initialise the color table */
     for (ii = 0; ii < sizeof(color_map)/sizeof(struct CssColor); ii++) {
         pColor = (HtmlColor *)HtmlAlloc("HtmlColor", sizeof(HtmlColor));
         pColor->zColor = color_map[ii].css;
         pColor->nRef = 1;
-        pColor->xcolor = Tk_GetColor(interp, pTree->tkwin, color_map[ii].tk);
+        pColor->xcolor = Tk_GetColor(
+            pTree->interp, pTree->tkwin, color_map[ii].tk
+        );
         assert(pColor->xcolor);
-        pEntry = Tcl_CreateHashEntry(&pTree->aColor, pColor->zColor, &n);
+        pEntry = Tcl_CreateHashEntry(&p->aColor, pColor->zColor, &n);
         assert(pEntry && n);
         Tcl_SetHashValue(pEntry, pColor);
     }
 
     /* Add the "transparent" color */
-    pEntry = Tcl_CreateHashEntry(&pTree->aColor, "transparent", &n);
+    pEntry = Tcl_CreateHashEntry(&p->aColor, "transparent", &n);
     assert(pEntry && n);
     pColor = (HtmlColor *)HtmlAlloc("HtmlColor", sizeof(HtmlColor));
     pColor->zColor = "transparent";
     pColor->nRef = 1;
     pColor->xcolor = 0;
     Tcl_SetHashValue(pEntry, pColor);
+
+    return p;
 }
 
 /*
  *---------------------------------------------------------------------------
  *
- * HtmlFontClearCache --
+ * fontCacheClear --
  * 
  *     Assuming there are no valid references to any fonts in the 
- *     font-cache, clean up all fonts at the Tk level. This happens:
- *
- *       (a) when the widget is being destroyed, and
- *       (b) when font-related options change.
- *
- *     If the isReinit argument is non-zero, the hash-table at
- *     HtmlTree.fontcache.aHash is left in a usable (but empty) state.
- *     If isReinit is zero, it is not safe to use the hash table after
+ *     font-cache, clean up all fonts at the Tk level. This happens when
+ *     the last widget using the display cache that contains the font 
+ *     cache is destroyed. It is not safe to use the hash tables after 
  *     this function returns.
  *
  * Results: 
@@ -3103,10 +3175,9 @@ HtmlComputedValuesSetupTables(pTree)
  *
  *---------------------------------------------------------------------------
  */
-void
-HtmlFontCacheClear(pTree, isReinit)
-    HtmlTree *pTree;
-    int isReinit;
+static void
+fontCacheClear(p)
+    HtmlFontCache *p;
 {
     HtmlFont *pFont;
     HtmlFont *pNext;
@@ -3116,7 +3187,7 @@ HtmlFontCacheClear(pTree, isReinit)
     Tcl_HashSearch search;
     Tcl_HashEntry *pEntry;
     for (
-        pEntry = Tcl_FirstHashEntry(&pTree->fontcache.aHash, &search);
+        pEntry = Tcl_FirstHashEntry(&p->aHash, &search);
         pEntry;
         pEntry = Tcl_NextHashEntry(&search)
     ) {
@@ -3125,59 +3196,36 @@ HtmlFontCacheClear(pTree, isReinit)
     }
 #endif
 
-    Tcl_DeleteHashTable(&pTree->fontcache.aHash);
-    for (pFont = pTree->fontcache.pLruHead; pFont; pFont = pNext) {
+    Tcl_DeleteHashTable(&p->aHash);
+    Tcl_DeleteHashTable(&p->aWidth);
+    for (pFont = p->pLruHead; pFont; pFont = pNext) {
         Tk_FreeFont(pFont->tkfont);
         pNext = pFont->pNext;
         HtmlFree(pFont);
     }
-    if (isReinit) {
-        memset(&pTree->fontcache, 0, sizeof(HtmlFontCache));
-        Tcl_InitCustomHashTable(
-            &pTree->fontcache.aHash, TCL_CUSTOM_TYPE_KEYS, HtmlFontKeyHashType()
-        );
-    }
-}
-
-
-void HtmlComputedValuesFreePrototype(pTree)
-    HtmlTree *pTree;
-{
-    if (pTree->pPrototypeCreator) {
-        pTree->pPrototypeCreator->values.nRef = 1;
-        HtmlComputedValuesRelease(pTree, &pTree->pPrototypeCreator->values);
-        HtmlFree(pTree->pPrototypeCreator);
-        pTree->pPrototypeCreator = 0;
-    }
 }
 
 /*
  *---------------------------------------------------------------------------
  *
- * HtmlComputedValuesCleanupTables --
+ * displayCacheFree --
  * 
- *     This function is called during widget destruction to deallocate
- *     resources allocated by HtmlComputedValuesSetupTables(). This should be
- *     called after HtmlComputedValues references have been released (otherwise
- *     an assertion will fail).
- *
- *     Resources are currently:
- *
- *         - The entries in aColor for the 15 CSS defined colors.
- *         - The entry in aColor for "transparent".
- *         - The entries in the font-family table.
+ *     Free the HtmlDisplayCache structure p, which has a reference count 
+ *     of zero and has been removed from the HtmlInterpData.pDisplayCache 
+ *     list. All fonts and colors must have been released (except for the
+ *     colors pre-loaded by displayCacheNew()).
  *
  * Results: 
  *     None.
  *
  * Side effects:
- *     Cleans up resources allocated by HtmlComputedValuesSetupTables().
+ *     Frees fonts and colors at the Tk level.
  *
  *---------------------------------------------------------------------------
  */
-void 
-HtmlComputedValuesCleanupTables(pTree)
-    HtmlTree *pTree;
+static void
+displayCacheFree(p)
+    HtmlDisplayCache *p;
 {
     CONST char **pzCursor;
    
@@ -3201,28 +3249,177 @@ HtmlComputedValuesCleanupTables(pTree)
         0
     };
 
-    HtmlComputedValuesFreePrototype(pTree);
+    assert(p->nRef == 0);
 
     for (pzCursor = azColor; *pzCursor; pzCursor++) {
         HtmlColor *pColor;
-        Tcl_HashEntry *pEntry = Tcl_FindHashEntry(&pTree->aColor, *pzCursor);
+        Tcl_HashEntry *pEntry = Tcl_FindHashEntry(&p->aColor, *pzCursor);
         assert(pEntry);
         pColor = (HtmlColor *)Tcl_GetHashValue(pEntry);
-        decrementColorRef(pTree, pColor);
+        assert(pColor->nRef == 1);
+        Tcl_DeleteHashEntry(pEntry);
+        if (pColor->xcolor) {
+            Tk_FreeColor(pColor->xcolor);
+        }
+        HtmlFree(pColor);
     }
 
-    HtmlFontCacheClear(pTree, 0);
-
-    Tcl_DeleteHashTable(&pTree->aFontFamilies);
-
 #ifndef NDEBUG
     /* This code is to assert() that there are no stray entries left in
      * the colors table. If there is, the restrack.c code would catch it
      * eventually, but it's better to dump core here. Memory leaks make
      * me look like a clown!
      */
-    assert(dumpColorTable(pTree) == 0);
+    assert(dumpColorTable(p) == 0);
 #endif
+    Tcl_DeleteHashTable(&p->aColor);
+
+    fontCacheClear(&p->fontcache);
+    HtmlFree(p);
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlComputedValuesSetupTables --
+ * 
+ *     This function is called during widget initialisation to initialise the
+ *     tables used by code in this file:
+ *
+ *         HtmlTree.pDisplayCache
+ *         HtmlTree.aFontFamilies
+ *         HtmlTree.aValues
+ *
+ *     HtmlTree.pDisplayCache is set to point to the HtmlDisplayCache in
+ *     the HtmlInterpData.pDisplayCache list that matches the display,
+ *     screen and colormap of the widget window. If there is no such 
+ *     structure, a new one is allocated and added to the list. The aValues
+ *     hash table is initialised empty.
+ *
+ * Results: 
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+void 
+HtmlComputedValuesSetupTables(pTree)
+    HtmlTree *pTree;
+{
+    int ii;
+    Tcl_HashEntry *pEntry;
+    Tcl_Interp *interp = pTree->interp;
+    Tcl_HashKeyType *pType;
+
+    HtmlInterpData *pInterpData = pTree->pInterpData;
+    HtmlDisplayCache *pCache;
+
+    Tcl_Obj **apFamily;
+    int nFamily;
+    int dummy;
+
+    /* Find or create the display cache */
+    for (
+        pCache = pInterpData->pDisplayCache; 
+        pCache && (
+            pCache->display != Tk_Display(pTree->tkwin) ||
+            pCache->iScreen != Tk_ScreenNumber(pTree->tkwin) ||
+            pCache->colormap != Tk_Colormap(pTree->tkwin)
+        ); 
+        pCache = pCache->pNext
+    );
+    if (!pCache) {
+        pCache = displayCacheNew(pTree);
+        pCache->pInterpData = pInterpData;
+        pCache->pNext = pInterpData->pDisplayCache;
+        pInterpData->pDisplayCache = pCache;
+    }
+    pCache->nRef++;
+    pTree->pDisplayCache = pCache;
+
+    pType = HtmlComputedValuesHashType();
+    Tcl_InitCustomHashTable(&pTree->aValues, TCL_CUSTOM_TYPE_KEYS, pType);
+
+    /* Initialise the aFontFamilies hash table. */
+    pType = HtmlCaseInsenstiveHashType();
+    Tcl_InitCustomHashTable(&pTree->aFontFamilies, TCL_CUSTOM_TYPE_KEYS, pType);
+    Tcl_Eval(interp, "font families");
+    Tcl_ListObjGetElements(NULL, Tcl_GetObjResult(interp), &nFamily, &apFamily);
+    for (ii = 0; ii < nFamily; ii++) {
+        Tcl_HashEntry *pEntry = Tcl_CreateHashEntry(
+            &pTree->aFontFamilies, Tcl_GetString(apFamily[ii]), &dummy
+        );
+        Tcl_SetHashValue(pEntry, 0);
+       
+        /* Note that sometimes the [font families] command returns a list
+         * containing duplicate elements. Therefore we cannot "assert(dummy)".
+         */
+    }
+    pEntry = Tcl_CreateHashEntry(&pTree->aFontFamilies, "serif", &dummy);
+    Tcl_SetHashValue(pEntry, "Times");
+    pEntry = Tcl_CreateHashEntry(&pTree->aFontFamilies, "sans-serif", &dummy);
+    Tcl_SetHashValue(pEntry, "Helvetica");
+    pEntry = Tcl_CreateHashEntry(&pTree->aFontFamilies, "monospace", &dummy);
+    Tcl_SetHashValue(pEntry, "Courier");
+}
+
+void HtmlComputedValuesFreePrototype(pTree)
+    HtmlTree *pTree;
+{
+    if (pTree->pPrototypeCreator) {
+        pTree->pPrototypeCreator->values.nRef = 1;
+        HtmlComputedValuesRelease(pTree, &pTree->pPrototypeCreator->values);
+        HtmlFree(pTree->pPrototypeCreator);
+        pTree->pPrototypeCreator = 0;
+    }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlComputedValuesCleanupTables --
+ * 
+ *     This function is called during widget destruction to deallocate
+ *     resources allocated by HtmlComputedValuesSetupTables(). This should be
+ *     called after HtmlComputedValues references have been released (otherwise
+ *     an assertion will fail).
+ *
+ *     Resources are currently:
+ *
+ *         - The reference to the shared HtmlDisplayCache. If this is the
+ *           last widget using it, it is freed.
+ *         - The entries in the font-family table.
+ *
+ * Results: 
+ *     None.
+ *
+ * Side effects:
+ *     Cleans up resources allocated by HtmlComputedValuesSetupTables().
+ *
+ *---------------------------------------------------------------------------
+ */
+void 
+HtmlComputedValuesCleanupTables(pTree)
+    HtmlTree *pTree;
+{
+    HtmlDisplayCache *pCache = pTree->pDisplayCache;
+
+    HtmlComputedValuesFreePrototype(pTree);
+
+    pCache->nRef--;
+    assert(pCache->nRef >= 0);
+    if (pCache->nRef == 0) {
+        HtmlDisplayCache **pp = &pCache->pInterpData->pDisplayCache;
+        while (*pp != pCache) {
+            pp = &(*pp)->pNext;
+        }
+        *pp = pCache->pNext;
+        displayCacheFree(pCache);
+    }
+    pTree->pDisplayCache = 0;
+
+    Tcl_DeleteHashTable(&pTree->aFontFamilies);
 }
 
 static Tcl_Obj *
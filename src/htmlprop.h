@@ -28,6 +28,8 @@ typedef struct HtmlCounterList HtmlCounterList;
 typedef struct HtmlFont HtmlFont;
 typedef struct HtmlFontKey HtmlFontKey;
 typedef struct HtmlFontCache HtmlFontCache;
+typedef struct HtmlDisplayCache HtmlDisplayCache;
+typedef struct HtmlTextWidthKey HtmlTextWidthKey;
 
 /* 
  * This structure is used to group four padding, margin or border-width
@@ -51,8 +53,16 @@ struct HtmlFourSides {
  *     'font-style'
  *     'font-weight'
  *
- * HtmlFont structures are stored in the HtmlTree.aFonts hash table. The hash
- * table uses a custom key type (struct HtmlFontKey) implemented in htmlhash.c. 
+ * HtmlFont structures are stored in the HtmlDisplayCache.fontcache.aHash
+ * hash table, which is shared by all widgets in an interpreter that use
+ * the same display. The hash table uses a custom key type (struct 
+ * HtmlFontKey) implemented in htmlhash.c. 
+ *
+ * Since fonts are shared between widgets, the key includes the values
+ * of the widget options that affect the Tk font loaded or its metrics:
+ * -fontscale, -zoom and -forcefontmetrics. So changing the -zoom option
+ * of a widget and then changing it back finds the original fonts in the
+ * cache (unless they have been evicted by then).
  */
 #define HTML_IFONTSIZE_SCALE 1000
 struct HtmlFontKey {
@@ -63,6 +73,10 @@ struct HtmlFontKey {
     const char *zFontFamily; /* Name of font family (i.e. "Serif") */
     unsigned char isItalic;  /* True if the font is italic */
     unsigned char isBold;    /* True if the font is bold */
+
+    unsigned char isForceMetrics; /* Value of -forcefontmetrics option */
+    double rFontScale;       /* Value of -fontscale option */
+    double rZoom;            /* Value of -zoom option */
 };
 struct HtmlFont {
     int nRef;              /* Number of pointers to this structure */
@@ -75,25 +89,60 @@ struct HtmlFont {
     int space_pixels;      /* Pixels per space (' ') in this font */
     Tk_FontMetrics metrics;
 
+    unsigned int iSerial;  /* Unique id of font within the HtmlFontCache */
     HtmlFont *pNext;       /* Next entry in the Html.FontCache LRU list */
 };
 
 /*
  * In Tk, allocating new fonts is very expensive. So we try hard to 
- * avoid doing it more than is required.
+ * avoid doing it more than is required. Up to HTML_MAX_ZEROREF_FONTS
+ * fonts that are not used by any widget are retained in the cache, the
+ * least recently used of which is freed when the limit is exceeded.
+ */
+#define HTML_MAX_ZEROREF_FONTS 200
+
+/*
+ * Measuring text with Tk_TextWidth() is also expensive, and the same words
+ * tend to be measured in the same fonts over and over again (once for each
+ * min/max width pass and again for each relayout). So the widths of short
+ * text tokens are stored in the HtmlFontCache.aWidth hash table. The key
+ * type (struct HtmlTextWidthKey) is implemented in htmlhash.c. The hash
+ * value is the width in pixels, cast to a ClientData.
+ *
+ * Tokens longer than HTML_MAX_TEXTWIDTH_BYTES bytes are never cached. If
+ * the table grows to HTML_MAX_TEXTWIDTH_ENTRIES entries, it is emptied.
+ *
+ * Entries are keyed by HtmlFont.iSerial, not the HtmlFont pointer. Serial
+ * numbers are never reused, so when a font is freed its entries can no
+ * longer be found and there is no need to touch the table (which is 
+ * shared by all widgets on the display). They are discarded the next
+ * time the table is emptied.
  */
-#define HTML_MAX_ZEROREF_FONTS 50
+#define HTML_MAX_TEXTWIDTH_BYTES 64
+#define HTML_MAX_TEXTWIDTH_ENTRIES 8192
+struct HtmlTextWidthKey {
+    unsigned int iFont;      /* HtmlFont.iSerial of font text is measured in */
+    int nText;               /* Number of bytes at zText */
+    const char *zText;       /* UTF-8 text (not nul-terminated) */
+};
+
 struct HtmlFontCache {
     Tcl_HashTable aHash;
     HtmlFont *pLruHead;
     HtmlFont *pLruTail;
     int nZeroRef;
+    unsigned int iNextSerial;  /* Serial number for next font allocated */
+
+    Tcl_HashTable aWidth;    /* Text-width cache (HtmlTextWidthKey keys) */
+    int nWidthHit;           /* Number of aWidth lookups that hit */
+    int nWidthMiss;          /* Number of aWidth lookups that missed */
 };
 
 /*
  * An HtmlColor structure is used to store each color in use by the current
- * document. HtmlColor structures are stored in the HtmlTree.aColors hash
- * table. The hash table uses string keys (the name of the color).
+ * document. HtmlColor structures are stored in the HtmlDisplayCache.aColor
+ * hash table. The hash table uses case-insensitive string keys (the name
+ * of the color).
  */
 struct HtmlColor {
     int nRef;              /* Number of pointers to this structure */
@@ -101,6 +150,28 @@ struct HtmlColor {
     XColor *xcolor;        /* The XColor* */
 };
 
+/*
+ * Fonts and colors are allocated by Tk for a specific display, screen
+ * and colormap. Since allocating them is expensive, all widgets in an
+ * interpreter that use the same combination share a single 
+ * HtmlDisplayCache, stored in the HtmlInterpData.pDisplayCache list.
+ * HtmlTree.pDisplayCache points to the cache used by a widget. 
+ *
+ * The cache is freed when the last widget using it is destroyed.
+ */
+struct HtmlDisplayCache {
+    int nRef;                  /* Number of widgets using this cache */
+    Display *display;          /* Display fonts and colors belong to */
+    int iScreen;               /* Screen number */
+    Colormap colormap;         /* Colormap colors are allocated from */
+
+    HtmlFontCache fontcache;   /* Fonts (and text widths) */
+    Tcl_HashTable aColor;      /* Colors (HtmlColor structures) */
+
+    HtmlInterpData *pInterpData;  /* Interpreter data that owns the cache */
+    HtmlDisplayCache *pNext;      /* Next in HtmlInterpData.pDisplayCache */
+};
+
 /*
  * An HtmlCounterList is used to store the computed value of the 
  * 'counter-increment' and 'counter-reset' properties.
@@ -330,6 +401,8 @@ struct HtmlComputedValuesCreator {
 
     CssProperty *pContent;
     char **pzContent;
+
+    int isTclScript;                 /* True if a tcl() value was evaluated */
 };
 
 /*
@@ -448,10 +521,9 @@ void HtmlComputedValuesReference(HtmlComputedValues *);
  * tables used by code in htmlprop.c. They are called as part of the
  * initialisation and destruction of the widget.
  *
- *     HtmlTree.aColor
- *     HtmlTree.aFont
+ *     HtmlTree.pDisplayCache
  *     HtmlTree.aValues
- *     HtmlTree.aFontSizeTable
+ *     HtmlTree.aFontFamilies
  */
 void HtmlComputedValuesSetupTables(HtmlTree *);
 void HtmlComputedValuesCleanupTables(HtmlTree *);
@@ -459,9 +531,10 @@ void HtmlComputedValuesCleanupTables(HtmlTree *);
 void HtmlComputedValuesFreePrototype(HtmlTree *);
 
 /*
- * Empty the font cache (i.e. because font config options have changed).
+ * Return the width in pixels of a string of text rendered in a font. 
+ * Results are cached in HtmlDisplayCache.fontcache.aWidth.
  */
-void HtmlFontCacheClear(HtmlTree *, int);
+int HtmlFontTextWidth(HtmlTree *, HtmlFont *, const char *, int);
 
 /* 
  * This function formats the HtmlComputedValues structure as a Tcl list and
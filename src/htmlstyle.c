@@ -459,6 +459,32 @@ printf("Stack %d: %s %s\n", iTmp,
     }
     checkStackSort(pTree, apTmp, pTree->nStack * 3);
 
+    /* Set HtmlTree.isFixedOnTop if everything generated by "position:fixed"
+     * elements and their descendants is painted after all other content.
+     * If so, the drawing module can paint the fixed content over cached 
+     * tiles of the rest of the canvas (see htmldraw.c).
+     */
+    {
+        int iMinFixed = pTree->nStack * 3;
+        int iMaxOther = -1;
+        for (pStack = pTree->pStack; pStack; pStack = pStack->pNext) {
+            HtmlElementNode *p;
+            for (p = pStack->pElem; p; p = HtmlElemParent(p)) {
+                if (p->pPropertyValues->ePosition == CSS_CONST_FIXED) break;
+            }
+            if (p) {
+                iMinFixed = MIN(iMinFixed, pStack->iStackingZ);
+                iMinFixed = MIN(iMinFixed, pStack->iBlockZ);
+                iMinFixed = MIN(iMinFixed, pStack->iInlineZ);
+            } else {
+                iMaxOther = MAX(iMaxOther, pStack->iStackingZ);
+                iMaxOther = MAX(iMaxOther, pStack->iBlockZ);
+                iMaxOther = MAX(iMaxOther, pStack->iInlineZ);
+            }
+        }
+        pTree->isFixedOnTop = (iMinFixed > iMaxOther);
+    }
+
     pTree->cb.flags &= (~HTML_STACK);
     HtmlFree(apTmp);
 }
@@ -495,7 +521,7 @@ styleNode(pTree, pNode, clientData)
      * recalculate the nodes list of dynamic conditions.
      */
     if (trashDynamics) {
-        HtmlCssFreeDynamics(pElem);
+        HtmlCssFreeDynamics(pTree, pElem);
     }
 
     /* If there is a "style" attribute on this node, parse the attribute
@@ -512,7 +538,7 @@ styleNode(pTree, pNode, clientData)
      * pElem->pStyle structure is invalidated/recalculated as required.
      */
     if (!pElem->pStyle) {
-        zStyle = HtmlNodeAttr(pNode, "style");
+        zStyle = HtmlAttrStyle(pElem->pAttributes);
         if (zStyle) {
             HtmlCssInlineParse(pTree, -1, zStyle, &pElem->pStyle);
         }
@@ -563,6 +589,7 @@ struct StyleApply {
 
   /* True if we have seen one or more "fixed" items */
   int isFixed;
+  int isFixedBackground;        /* True if any are fixed backgrounds */
 };
 typedef struct StyleApply StyleApply;
 
@@ -623,9 +650,11 @@ styleApply(pTree, pNode, p)
     }
 
     doStyle = p->doStyle;
+    HtmlCssAncestorFilterPush(pTree, pNode);
     for (i = 0; i < HtmlNodeNumChildren(pNode); i++) {
         styleApply(pTree, HtmlNodeChild(pNode, i), p);
     }
+    HtmlCssAncestorFilterPop(pTree, pNode);
     p->doStyle = doStyle;
 
     if (p->doStyle || p->doContent) {
@@ -681,6 +710,9 @@ styleApply(pTree, pNode, p)
         pElem->pPropertyValues->eBackgroundAttachment == CSS_CONST_FIXED
     )) {
         p->isFixed = 1;
+        if (pElem->pPropertyValues->eBackgroundAttachment == CSS_CONST_FIXED) {
+            p->isFixedBackground = 1;
+        }
     }
 }
 
@@ -838,9 +870,14 @@ HtmlStyleApply(pTree, pNode)
 
     assert(pTree->pStyleApply == 0);
     pTree->pStyleApply = (void *)&sApply;
+    HtmlCssStyleShareInit(pTree);
+    HtmlCssAncestorFilterInit(pTree);
     styleApply(pTree, pTree->pRoot, &sApply);
+    HtmlCssAncestorFilterFinish(pTree);
+    HtmlCssStyleShareFinish(pTree);
     pTree->pStyleApply = 0;
     pTree->isFixed = sApply.isFixed;
+    pTree->isFixedBackground = sApply.isFixedBackground;
     HtmlFree(sApply.apCounter);
     return TCL_OK;
 }
@@ -70,6 +70,7 @@ struct TableData {
     LayoutContext *pLayout;
     int border_spacing;      /* Pixel value of 'border-spacing' property */
     int availablewidth;      /* Width available between margins for table */
+    int iContaining;         /* Width of table content (pBox->iContaining) */
 
     /* 
      * Determined by:
@@ -90,6 +91,7 @@ struct TableData {
     int *aMinWidth;          /* Minimum content width of each column */
     CellReqWidth *aReqWidth;       /* Widths requested via CSS */
     CellReqWidth *aSingleReqWidth; /* Widths requested by single span cells */
+    int iFixedRow;           /* Row used by tableColWidthFixed(), or -1 */
 
     /* 
      * Determined by:
@@ -109,6 +111,28 @@ struct TableData {
 };
 typedef struct TableData TableData;
 
+/*
+ * The results of the column width analysis for a table - the number of
+ * rows and columns and the contents of the TableData.aMinWidth, aMaxWidth
+ * and aReqWidth arrays. These depend only on the content and style of the
+ * table and its descendants, not on the width available to the table. So
+ * they are stored in the layout-cache of the table node (see
+ * HtmlLayoutTableCache()) and reused until the layout-cache is
+ * invalidated, which happens whenever the content or style of a cell
+ * changes. The exception is a 'table-layout:fixed' table, for which the
+ * arrays are recalculated if the width of the table content changes (see
+ * tableAnalyzeFixed()).
+ */
+struct HtmlTableCache {
+    int nCol;                  /* Number of columns in table */
+    int nRow;                  /* Number of rows in table */
+    int isFixed;               /* True for the 'table-layout:fixed' algorithm */
+    int iContaining;           /* TableData.iContaining used, if isFixed */
+    int *aMinWidth;            /* Copied to TableData.aMinWidth */
+    int *aMaxWidth;            /* Copied to TableData.aMaxWidth */
+    CellReqWidth *aReqWidth;   /* Copied to TableData.aReqWidth */
+};
+
 /* The two types of callbacks made by tableIterate(). */
 typedef int (CellCallback)(HtmlNode *, int, int, int, int, void *);
 typedef int (RowCallback)(HtmlNode *, int, void *);
@@ -125,8 +149,12 @@ static CellCallback tableCountCells;
 static CellCallback tableColWidthSingleSpan;
 static CellCallback tableColWidthMultiSpan;
 
+/* Populate the same arrays for a table with 'table-layout:fixed'. */
+static CellCallback tableColWidthFixed;
+
 /* Figure out the actual column widths (TableData.aWidth[]). */
 static void tableCalculateCellWidths(TableData *, int, int);
+static void tableCalculateFixedWidths(TableData *, int);
 
 /* A row and cell callback (used together in a single iteration) to draw
  * the table content. All the actual drawing is done here. Everything
@@ -669,6 +697,196 @@ tableColWidthMultiSpan(pNode, col, colspan, row, rowspan, pContext)
     return TCL_OK;
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * tableSetFixedWidth --
+ *
+ *     Set the requested width of columns iCol to (iCol+nSpan-1) of a
+ *     table with 'table-layout:fixed' to *pReq, unless a width has 
+ *     already been set for the column. If nSpan is greater than 1, the
+ *     requested width is divided equally between the columns.
+ *
+ *     For a fixed layout table, the min and max content widths of each
+ *     column are both equal to its requested pixel width (or 0).
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     May modify TableData.aReqWidth, aMinWidth and aMaxWidth.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+tableSetFixedWidth(pData, iCol, nSpan, pReq)
+    TableData *pData;
+    int iCol;
+    int nSpan;
+    CellReqWidth *pReq;
+{
+    int iRem = pReq->x.iVal;
+    int ii;
+
+    if (pReq->eType == CELL_WIDTH_AUTO) return;
+    for (ii = iCol; ii < (iCol + nSpan) && ii < pData->nCol; ii++) {
+        CellReqWidth *p = &pData->aReqWidth[ii];
+        if (pReq->eType == CELL_WIDTH_PIXELS) {
+            int w = iRem / (iCol + nSpan - ii);
+            iRem -= w;
+            if (p->eType == CELL_WIDTH_AUTO) {
+                p->eType = CELL_WIDTH_PIXELS;
+                p->x.iVal = w;
+                pData->aMinWidth[ii] = w;
+                pData->aMaxWidth[ii] = w;
+            }
+        } else if (p->eType == CELL_WIDTH_AUTO) {
+            p->eType = CELL_WIDTH_PERCENT;
+            p->x.fVal = pReq->x.fVal / nSpan;
+        }
+    }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * tableColWidthFixed --
+ *
+ *     A tableIterate() callback used instead of tableColWidthSingleSpan()
+ *     and tableColWidthMultiSpan() for tables with 'table-layout:fixed'.
+ *     Only the cells in the first row of the table are considered. The
+ *     requested widths of columns that were not set by column elements 
+ *     (see tableColumnWidths()) are set to the 'width' of the cell in 
+ *     the first row. The content of the cells is not examined.
+ *
+ *     Percentage padding and border widths of the cells are resolved
+ *     against the width of the table content (TableData.iContaining).
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     Populates the following arrays:
+ *
+ *         TableData.aMinWidth[]
+ *         TableData.aMaxWidth[]
+ *         TableData.aReqWidth[]
+ *
+ *---------------------------------------------------------------------------
+ */
+static int 
+tableColWidthFixed(pNode, col, colspan, row, rowspan, pContext)
+    HtmlNode *pNode;
+    int col;
+    int colspan;
+    int row;
+    int rowspan;
+    void *pContext;
+{
+    TableData *pData = (TableData *)pContext;
+
+    /* Transient cells (see tableIterate()) are ignored. So the "first row"
+     * is the first row that contains a real table cell.
+     */
+    if (HtmlNodeParent(pNode) && pData->iFixedRow < 0) {
+        pData->iFixedRow = row;
+    }
+
+    if (row == pData->iFixedRow && HtmlNodeParent(pNode)) {
+        CellReqWidth req;
+        getReqWidth(pNode, &req);
+        if (req.eType == CELL_WIDTH_PIXELS) {
+            BoxProperties box;
+            nodeGetBoxProperties(
+                pData->pLayout, pNode, pData->iContaining, &box
+            );
+            req.x.iVal += box.iLeft + box.iRight;
+        }
+        tableSetFixedWidth(pData, col, colspan, &req);
+    }
+    return TCL_OK;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * tableColumnWidths --
+ *
+ *     Set the requested widths of the columns of a 'table-layout:fixed'
+ *     table from the 'width' properties of any "display:table-column"
+ *     elements (i.e. <col>) that are children of the table, or children
+ *     of "display:table-column-group" children of the table. A column
+ *     group with no column children is treated as a single column 
+ *     element. The number of columns spanned by each is read from the
+ *     "span" attribute.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     May modify TableData.aReqWidth, aMinWidth and aMaxWidth.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+tableColumnWidths(pData)
+    TableData *pData;
+{
+    HtmlNode *pNode = pData->pNode;
+    int iCol = 0;
+    int ii;
+
+    for (ii = 0; ii < HtmlNodeNumChildren(pNode); ii++) {
+        HtmlNode *pChild = HtmlNodeChild(pNode, ii);
+        HtmlNode *apCol[1];
+        HtmlNode **apList = apCol;
+        int nList = 1;
+        int jj;
+
+        switch (DISPLAY(HtmlNodeComputedValues(pChild))) {
+            case CSS_CONST_TABLE_COLUMN:
+                apCol[0] = pChild;
+                break;
+            case CSS_CONST_TABLE_COLUMN_GROUP: {
+                HtmlElementNode *pElem = (HtmlElementNode *)pChild;
+                apCol[0] = pChild;
+                for (jj = 0; jj < pElem->nChild; jj++) {
+                    HtmlComputedValues *pV = 
+                        HtmlNodeComputedValues(pElem->apChildren[jj]);
+                    if (DISPLAY(pV) == CSS_CONST_TABLE_COLUMN) {
+                        apList = pElem->apChildren;
+                        nList = pElem->nChild;
+                        break;
+                    }
+                }
+                break;
+            }
+            default:
+                continue;
+        }
+
+        for (jj = 0; jj < nList; jj++) {
+            HtmlNode *pCol = apList[jj];
+            CellReqWidth req;
+            CONST char *zSpan;
+            int nSpan;
+
+            if (apList != apCol && 
+                DISPLAY(HtmlNodeComputedValues(pCol)) != CSS_CONST_TABLE_COLUMN
+            ) {
+                continue;
+            }
+            zSpan = HtmlNodeAttr(pCol, "span");
+            nSpan = zSpan ? atoi(zSpan) : 1;
+            if (nSpan <= 0) nSpan = 1;
+
+            getReqWidth(pCol, &req);
+            tableSetFixedWidth(pData, iCol, nSpan, &req);
+            iCol += nSpan;
+        }
+    }
+}
+
 /*
  *---------------------------------------------------------------------------
  *
@@ -1709,6 +1927,247 @@ tableCalculateMaxWidth(pData)
     return ret;
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * tableCalculateFixedWidths --
+ *
+ *     This function is used instead of tableCalculateCellWidths() for
+ *     tables with 'table-layout:fixed' (CSS 2.1 section 17.5.2.1). Each 
+ *     column with a pixel or percentage width request is allocated that
+ *     width. Any remaining space is divided equally between the columns
+ *     with no width request, or between all columns if there are none.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     Populates TableData.aWidth[].
+ *
+ *---------------------------------------------------------------------------
+ */
+static void 
+tableCalculateFixedWidths(pData, availablewidth)
+    TableData *pData;
+    int availablewidth;    /* Total width available for cells */
+{
+    CellReqWidth *aReqWidth = pData->aReqWidth;
+    int *aWidth = pData->aWidth;
+    int iRemaining = availablewidth;
+    int nAuto = 0;
+    int nShare;
+    int ii;
+
+    for (ii = 0; ii < pData->nCol; ii++) {
+        switch (aReqWidth[ii].eType) {
+            case CELL_WIDTH_PIXELS:
+                aWidth[ii] = aReqWidth[ii].x.iVal;
+                break;
+            case CELL_WIDTH_PERCENT:
+                aWidth[ii] = (50 + aReqWidth[ii].x.fVal * availablewidth) / 100;
+                break;
+            default:
+                aWidth[ii] = 0;
+                nAuto++;
+                break;
+        }
+        iRemaining -= aWidth[ii];
+    }
+
+    nShare = (nAuto > 0) ? nAuto : pData->nCol;
+    for (ii = 0; iRemaining > 0 && ii < pData->nCol; ii++) {
+        if (nAuto == 0 || aReqWidth[ii].eType == CELL_WIDTH_AUTO) {
+            int w = iRemaining / nShare;
+            aWidth[ii] += w;
+            iRemaining -= w;
+            nShare--;
+        }
+    }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlTableCacheFree --
+ *
+ *     Free an HtmlTableCache structure allocated by tableAnalyzeColumns().
+ *     This is called by HtmlLayoutInvalidateCache(). It is a no-op if
+ *     the argument is NULL.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+void
+HtmlTableCacheFree(pCache)
+    HtmlTableCache *pCache;
+{
+    if (pCache) {
+        HtmlFree(pCache->aMinWidth);
+        HtmlFree(pCache->aMaxWidth);
+        HtmlFree(pCache->aReqWidth);
+        HtmlFree(pCache);
+    }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * tableAnalyzeFixed --
+ *
+ *     Calculate the requested widths of the columns of a table that uses
+ *     the 'table-layout:fixed' algorithm. Column widths are set by column
+ *     elements and the cells of the first row only. Cell content is not
+ *     considered.
+ *
+ *     Unlike the results of the automatic algorithm, the results depend 
+ *     on the width of the table content, which percentage padding and 
+ *     borders on the cells of the first row refer to. So the width used
+ *     is recorded in HtmlTableCache.iContaining.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     Overwrites the aMinWidth, aMaxWidth and aReqWidth arrays of pCache.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+tableAnalyzeFixed(pData, pCache)
+    TableData *pData;
+    HtmlTableCache *pCache;
+{
+    int nCol = pCache->nCol;
+
+    assert(pCache->isFixed);
+    memset(pCache->aMinWidth, 0, nCol * sizeof(int));
+    memset(pCache->aMaxWidth, 0, nCol * sizeof(int));
+    memset(pCache->aReqWidth, 0, nCol * sizeof(CellReqWidth));
+
+    pData->nCol = nCol;
+    pData->aMinWidth = pCache->aMinWidth;
+    pData->aMaxWidth = pCache->aMaxWidth;
+    pData->aReqWidth = pCache->aReqWidth;
+    pData->iFixedRow = -1;
+
+    tableColumnWidths(pData);
+    tableIterate(
+        pData->pLayout->pTree, pData->pNode, tableColWidthFixed, 0, pData
+    );
+    pCache->iContaining = pData->iContaining;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * tableAnalyzeColumns --
+ *
+ *     Determine the number of rows and columns in the table and the
+ *     minimum, maximum and requested widths of each column. The results
+ *     are stored in the TableData structure. 
+ *
+ *     If the table node has a valid HtmlTableCache, the results are 
+ *     read from it. Otherwise they are calculated and a new 
+ *     HtmlTableCache is stored in the layout-cache of the table node.
+ *     For a 'table-layout:fixed' table, the results are recalculated 
+ *     (see tableAnalyzeFixed()) if the width of the table content has
+ *     changed.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     Sets the nCol, nRow, aMinWidth, aMaxWidth and aReqWidth members of
+ *     pData. The arrays are owned by the HtmlTableCache.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+tableAnalyzeColumns(pData)
+    TableData *pData;
+{
+    HtmlTree *pTree = pData->pLayout->pTree;
+    HtmlNode *pNode = pData->pNode;
+    HtmlComputedValues *pV = HtmlNodeComputedValues(pNode);
+    HtmlTableCache **ppCache = HtmlLayoutTableCache(pNode);
+    HtmlTableCache *pCache = *ppCache;
+
+    if (!pCache) {
+        int nCol;
+
+        /* First step is to figure out how many columns this table has.
+         * There are two ways to do this - by looking at COL or COLGROUP
+         * children of the table, or by counting the cells in each rows.
+         * Technically, we should use the first method if one or more COL 
+         * or COLGROUP elements exist. For now though, always use the 
+         * second method.
+         */
+        tableIterate(pTree, pNode, tableCountCells, tableCountRows, pData);
+        nCol = pData->nCol;
+
+        pCache = HtmlNew(HtmlTableCache);
+        pCache->nCol = nCol;
+        pCache->nRow = pData->nRow;
+        pCache->aMinWidth = (int *)HtmlClearAlloc(0, nCol*sizeof(int));
+        pCache->aMaxWidth = (int *)HtmlClearAlloc(0, nCol*sizeof(int));
+        pCache->aReqWidth = 
+            (CellReqWidth *)HtmlClearAlloc(0, nCol*sizeof(CellReqWidth));
+
+        pData->aMinWidth = pCache->aMinWidth;
+        pData->aMaxWidth = pCache->aMaxWidth;
+        pData->aReqWidth = pCache->aReqWidth;
+
+        /* The 'table-layout:fixed' algorithm is only used if the 'width'
+         * of the table is not "auto" (this is permitted by CSS 2.1).
+         */
+        pCache->isFixed = (
+            pV->eTableLayout == CSS_CONST_FIXED && 
+            PIXELVAL(pV, WIDTH, 100) != PIXELVAL_AUTO
+        );
+
+        if (pCache->isFixed) {
+            tableAnalyzeFixed(pData, pCache);
+        } else {
+            /* Calculate the minimum, maximum, and requested percentage 
+             * widths of each column.  The first pass only considers cells
+             * that span a single column.  In this case the min/max width
+             * of each column is the maximum of the min/max widths for all
+             * cells in the column.
+             * 
+             * If the table contains one or more cells that span more than
+             * one column, we make a second pass. The min/max widths are
+             * increased, if necessary, to account for the multi-column
+             * cell. In this case, the width of each column that the cell
+             * spans is increased by the same amount (plus or minus a pixel
+             * to account for integer rounding).
+             */
+            pData->aSingleReqWidth = 
+                (CellReqWidth *)HtmlClearAlloc(0, nCol*sizeof(CellReqWidth));
+            tableIterate(pTree, pNode, tableColWidthSingleSpan, 0, pData);
+            memcpy(pData->aReqWidth, pData->aSingleReqWidth, 
+                nCol*sizeof(CellReqWidth)
+            );
+            tableIterate(pTree, pNode, tableColWidthMultiSpan, 0, pData);
+            HtmlFree(pData->aSingleReqWidth);
+            pData->aSingleReqWidth = 0;
+        }
+        *ppCache = pCache;
+    } else if (pCache->isFixed && pCache->iContaining != pData->iContaining) {
+        tableAnalyzeFixed(pData, pCache);
+    }
+
+    pData->nCol = pCache->nCol;
+    pData->nRow = pCache->nRow;
+    pData->aMinWidth = pCache->aMinWidth;
+    pData->aMaxWidth = pCache->aMaxWidth;
+    pData->aReqWidth = pCache->aReqWidth;
+}
+
 /*
  *---------------------------------------------------------------------------
  *
@@ -1727,7 +2186,14 @@ tableCalculateMaxWidth(pData)
  *     but <col> and <colspan> are fairly important.
  *
  *     The table layout algorithm used is described in section 17.5.2.2 of 
- *     the CSS 2.1 spec.
+ *     the CSS 2.1 spec. If the table has 'table-layout:fixed' and a 
+ *     'width' other than "auto", the algorithm described in section 
+ *     17.5.2.1 is used instead.
+ *
+ *     The column width analysis (see tableAnalyzeColumns()) does not
+ *     depend on the width available to the table, so it is cached and
+ *     only repeated when the content or style of the table changes (or,
+ *     for a 'table-layout:fixed' table, when the width changes).
  *
  *     When this function is called, pBox->iContaining contains the width
  *     available to the table content - not including any margin, border or
@@ -1759,21 +2225,18 @@ HtmlTableLayout(pLayout, pBox, pNode)
     int availwidth;           /* Total width available for cells */
 
     int *aMinWidth = 0;       /* Minimum width for each column */
-    int *aMaxWidth = 0;       /* Minimum width for each column */
     int *aWidth = 0;          /* Actual width for each column */
     int *aY = 0;              /* Top y-coord for each row */
     TableCell *aCell = 0;     /* Array of nCol cells used during drawing */
     TableData data;
 
-    CellReqWidth *aReqWidth = 0;
-    CellReqWidth *aSingleReqWidth = 0;
-
     memset(&data, 0, sizeof(struct TableData));
     data.pLayout = pLayout;
     data.pNode = pNode;
 
     pBox->iContaining = MAX(pBox->iContaining, 0);  /* ??? */
     assert(pBox->iContaining>=0);
+    data.iContaining = pBox->iContaining;
 
     assert(pV->eDisplay==CSS_CONST_TABLE);
 
@@ -1782,15 +2245,12 @@ HtmlTableLayout(pLayout, pBox, pNode)
      */
     data.border_spacing = pV->iBorderSpacing;
 
-    /* First step is to figure out how many columns this table has.
-     * There are two ways to do this - by looking at COL or COLGROUP
-     * children of the table, or by counting the cells in each rows.
-     * Technically, we should use the first method if one or more COL or
-     * COLGROUP elements exist. For now though, always use the second 
-     * method.
+    /* Figure out the number of rows and columns in the table, and the
+     * minimum, maximum and requested widths of each column.
      */
-    tableIterate(pTree, pNode, tableCountCells, tableCountRows, &data);
+    tableAnalyzeColumns(&data);
     nCol = data.nCol;
+    aMinWidth = data.aMinWidth;
 
     LOG {
         Tcl_Obj *pCmd = HtmlNodeCommand(pTree, pNode);
@@ -1803,45 +2263,23 @@ HtmlTableLayout(pLayout, pBox, pNode)
         }
     }
 
-    /* Allocate arrays for the minimum and maximum widths of each column */
-    aMinWidth      = (int *)HtmlClearAlloc(0, nCol*sizeof(int));
-    aMaxWidth      = (int *)HtmlClearAlloc(0, nCol*sizeof(int));
-    aWidth         = (int *)HtmlClearAlloc(0, nCol*sizeof(int));
-
-    aReqWidth = (CellReqWidth *)HtmlClearAlloc(0, nCol*sizeof(CellReqWidth));
-    aSingleReqWidth = 
-        (CellReqWidth *)HtmlClearAlloc(0, nCol*sizeof(CellReqWidth));
-
+    /* Allocate arrays for the calculated widths of each column and the
+     * drawing pass.
+     */
+    aWidth = (int *)HtmlClearAlloc(0, nCol*sizeof(int));
     aY = (int *)HtmlClearAlloc(0, (data.nRow+1)*sizeof(int));
     aCell = (TableCell *)HtmlClearAlloc(0, data.nCol*sizeof(TableCell));
-
-    data.aMaxWidth = aMaxWidth;
-    data.aMinWidth = aMinWidth;
     data.aWidth = aWidth;
-    data.aReqWidth = aReqWidth;
-    data.aSingleReqWidth = aSingleReqWidth;
-
-    /* Calculate the minimum, maximum, and requested percentage widths of
-     * each column.  The first pass only considers cells that span a single
-     * column.  In this case the min/max width of each column is the maximum of
-     * the min/max widths for all cells in the column.
-     * 
-     * If the table contains one or more cells that span more than one
-     * column, we make a second pass. The min/max widths are increased,
-     * if necessary, to account for the multi-column cell. In this case,
-     * the width of each column that the cell spans is increased by 
-     * the same amount (plus or minus a pixel to account for integer
-     * rounding).
-     */
-    tableIterate(pTree, pNode, tableColWidthSingleSpan, 0, &data);
-    memcpy(aReqWidth, aSingleReqWidth, nCol*sizeof(CellReqWidth));
-    tableIterate(pTree, pNode, tableColWidthMultiSpan, 0, &data);
 
     pBox->width = 0;
     availwidth = (pBox->iContaining - (nCol+1) * data.border_spacing);
     switch (pLayout->minmaxTest) {
         case 0:
-            tableCalculateCellWidths(&data, availwidth, 0);
+            if ((*HtmlLayoutTableCache(pNode))->isFixed) {
+                tableCalculateFixedWidths(&data, availwidth);
+            } else {
+                tableCalculateCellWidths(&data, availwidth, 0);
+            }
             for (i = 0; i < nCol; i++) {
                 pBox->width += aWidth[i];
             }
@@ -1873,13 +2311,9 @@ HtmlTableLayout(pLayout, pBox, pNode)
     }
     pBox->width += (data.border_spacing * (nCol+1));
 
-    HtmlFree(aMinWidth);
-    HtmlFree(aMaxWidth);
     HtmlFree(aWidth);
     HtmlFree(aY);
     HtmlFree(aCell);
-    HtmlFree(aReqWidth);
-    HtmlFree(aSingleReqWidth);
 
     HtmlComputedValuesRelease(pTree, data.pDefaultProperties);
 
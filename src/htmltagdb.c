@@ -279,8 +279,174 @@ HtmlHashInit(htmlPtr, start)
 }
 
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlAttributeAtom --
+ *
+ *     Return the attribute-name atom for nul-terminated string zName.
+ *     Attribute names are compared case-sensitively, so two names are
+ *     the same if and only if their atoms are the same pointer.
+ *
+ * Results:
+ *     Pointer to the atom.
+ *
+ * Side effects:
+ *     May add an entry to HtmlInterpData.aAttrAtom.
+ *
+ *---------------------------------------------------------------------------
+ */
+const char *
+HtmlAttributeAtom(pTree, zName)
+    HtmlTree *pTree;
+    const char *zName;
+{
+    Tcl_HashTable *pAtoms = &pTree->pInterpData->aAttrAtom;
+    int isNew;
+    Tcl_HashEntry *pEntry;
+    pEntry = Tcl_CreateHashEntry(pAtoms, zName, &isNew);
+    return (const char *)Tcl_GetHashKey(pAtoms, pEntry);
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * attributesSlots --
+ *
+ *     Set the HtmlAttributes.zId, zClass and zStyle slots of pAttr to the
+ *     values of the "id", "class" and "style" attributes (or NULL).
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+attributesSlots(pAttr)
+    HtmlAttributes *pAttr;
+{
+    int ii;
+    pAttr->zId = 0;
+    pAttr->zClass = 0;
+    pAttr->zStyle = 0;
+    for (ii = 0; ii < pAttr->nAttr; ii++) {
+        const char *zName = pAttr->a[ii].zName;
+        if (0 == strcmp(zName, "id")) {
+            pAttr->zId = pAttr->a[ii].zValue;
+        } else if (0 == strcmp(zName, "class")) {
+            pAttr->zClass = pAttr->a[ii].zValue;
+        } else if (0 == strcmp(zName, HTML_INLINE_STYLE_ATTR)) {
+            pAttr->zStyle = pAttr->a[ii].zValue;
+        }
+    }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * attributesBuild --
+ *
+ *     Allocate a new HtmlAttributes structure with space for nAlloc
+ *     attributes and populate it with the nAttr name/value pairs in
+ *     argv[]. The values are copied into the same allocation as the
+ *     structure itself. The names are replaced by atoms.
+ *
+ *     If doEscape is true, escape sequences in names and values are
+ *     translated and names are folded to lower case.
+ *
+ * Results:
+ *     Pointer to the new structure.
+ *
+ * Side effects:
+ *     May add entries to HtmlInterpData.aAttrAtom.
+ *
+ *---------------------------------------------------------------------------
+ */
+static HtmlAttributes *
+attributesBuild(pTree, pArena, nAlloc, nAttr, argv, arglen, doEscape)
+    HtmlTree *pTree;
+    HtmlArena *pArena;
+    int nAlloc;
+    int nAttr;
+    char const **argv;
+    int *arglen;
+    int doEscape;
+{
+    HtmlAttributes *pMarkup;
+    int nByte;
+    int j;
+    char *zBuf;
+
+    assert(nAlloc >= nAttr && nAlloc > 0);
+
+    nByte = sizeof(HtmlAttributes);
+    nByte += sizeof(struct HtmlAttribute) * (nAlloc - 1);
+    for (j = 0; j < nAttr; j++) {
+        nByte += arglen[j*2+1] + 1;
+    }
+
+    pMarkup = (HtmlAttributes *)HtmlArenaAlloc(
+        pArena, "HtmlAttributes", nByte
+    );
+    pMarkup->nAttr = nAttr;
+    pMarkup->nAlloc = nAlloc;
+    zBuf = (char *)(&pMarkup->a[nAlloc]);
+
+    for (j=0; j < nAttr; j++) {
+        int idx = (j * 2);
+        char zName[64];
+        char *zFree = 0;
+        char *z = zName;
+
+        if (arglen[idx] >= sizeof(zName)) {
+            z = zFree = HtmlAlloc("temp", arglen[idx] + 1);
+        }
+        memcpy(z, argv[idx], arglen[idx]);
+        z[arglen[idx]] = '\0';
+        if (doEscape) {
+            HtmlTranslateEscapes(z);
+            ToLower(z);
+        }
+        pMarkup->a[j].zName = (char *)HtmlAttributeAtom(pTree, z);
+        HtmlFree(zFree);
+
+        pMarkup->a[j].zValue = zBuf;
+        pMarkup->a[j].isAlloc = 0;
+        memcpy(zBuf, argv[idx+1], arglen[idx+1]);
+        zBuf[arglen[idx+1]] = '\0';
+        if (doEscape) HtmlTranslateEscapes(zBuf);
+        zBuf += (arglen[idx+1] + 1);
+    }
+
+    attributesSlots(pMarkup);
+    return pMarkup;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlAttributesNew --
+ *
+ *     Create a new HtmlAttributes structure from the argc/2 name/value
+ *     pairs in argv[]. Attribute names are interned as atoms in
+ *     HtmlInterpData.aAttrAtom. If doEscape is true, escape sequences are
+ *     translated and names are folded to lower case.
+ *
+ * Results:
+ *     Pointer to the new structure, or NULL if there are no attributes.
+ *
+ * Side effects:
+ *     May add entries to HtmlInterpData.aAttrAtom.
+ *
+ *---------------------------------------------------------------------------
+ */
 HtmlAttributes *
-HtmlAttributesNew(argc, argv, arglen, doEscape)
+HtmlAttributesNew(pTree, pArena, argc, argv, arglen, doEscape)
+    HtmlTree *pTree;
+    HtmlArena *pArena;          /* Arena to allocate from (may be NULL) */
     int argc;
     char const **argv;
     int *arglen;
@@ -289,43 +455,156 @@ HtmlAttributesNew(argc, argv, arglen, doEscape)
     HtmlAttributes *pMarkup = 0;
 
     if (argc > 1) {
-        int nByte;
-        int j;
-        char *zBuf;
-
         int nAttr = argc / 2;
+        pMarkup = attributesBuild(
+            pTree, pArena, nAttr, nAttr, argv, arglen, doEscape
+        );
+    }
+
+    return pMarkup;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlAttributesSet --
+ *
+ *     Set the value of attribute zName in attribute set pAttr to zValue.
+ *     pAttr may be NULL. If the attribute already exists, its value is
+ *     replaced in place. Otherwise it is appended to the set, which is
+ *     only reallocated if it is already full (in which case space for
+ *     twice as many attributes is allocated).
+ *
+ * Results:
+ *     Pointer to the modified attribute set. This may or may not be
+ *     the same as pAttr. If it is not, pAttr has been freed.
+ *
+ * Side effects:
+ *     May add an entry to HtmlInterpData.aAttrAtom.
+ *
+ *---------------------------------------------------------------------------
+ */
+HtmlAttributes *
+HtmlAttributesSet(pTree, pArena, pAttr, zName, zValue)
+    HtmlTree *pTree;
+    HtmlArena *pArena;
+    HtmlAttributes *pAttr;
+    const char *zName;
+    const char *zValue;
+{
+    const char *zAtom = HtmlAttributeAtom(pTree, zName);
+    struct HtmlAttribute *p;
+    int nValue = strlen(zValue);
+    int ii;
+
+    for (ii = 0; pAttr && ii < pAttr->nAttr; ii++) {
+        if (pAttr->a[ii].zName == zAtom) break;
+    }
 
-        nByte = sizeof(HtmlAttributes);
-        for (j = 0; j < argc; j++) {
-            nByte += arglen[j] + 1;
+    if (!pAttr || (ii == pAttr->nAttr && pAttr->nAttr == pAttr->nAlloc)) {
+        /* The attribute set is full (or does not exist). Build a new
+         * one with room to grow, containing a copy of the existing
+         * attributes. The new attribute is appended below. 
+         */
+        int nAttr = (pAttr ? pAttr->nAttr : 0);
+        char const **azPtr;
+        int *aLen;
+        HtmlAttributes *pNew;
+
+        azPtr = (char const **)HtmlAlloc("temp", 
+            (nAttr * 2 + 1) * (sizeof(char *) + sizeof(int))
+        );
+        aLen = (int *)&azPtr[nAttr * 2 + 1];
+        for (ii = 0; ii < nAttr; ii++) {
+            azPtr[ii*2] = pAttr->a[ii].zName;
+            azPtr[ii*2+1] = pAttr->a[ii].zValue;
+            aLen[ii*2] = strlen(azPtr[ii*2]);
+            aLen[ii*2+1] = strlen(azPtr[ii*2+1]);
         }
-        nByte += sizeof(struct HtmlAttribute) * (argc - 1);
+        pNew = attributesBuild(
+            pTree, pArena, nAttr * 2 + 2, nAttr, azPtr, aLen, 0
+        );
+        HtmlFree(azPtr);
+        HtmlAttributesFree(pAttr);
+        pAttr = pNew;
+        ii = nAttr;
+    }
 
-        pMarkup = (HtmlAttributes *)HtmlAlloc("HtmlAttributes", nByte);
-        pMarkup->nAttr = nAttr;
-        zBuf = (char *)(&pMarkup->a[nAttr]);
+    p = &pAttr->a[ii];
+    if (ii == pAttr->nAttr) {
+        assert(pAttr->nAttr < pAttr->nAlloc);
+        pAttr->nAttr++;
+        p->zName = (char *)zAtom;
+    } else if (p->isAlloc) {
+        HtmlArenaFree(p->zValue);
+    }
+    p->zValue = HtmlArenaAlloc(pArena, "HtmlAttributes.zValue", nValue + 1);
+    p->isAlloc = 1;
+    memcpy(p->zValue, zValue, nValue + 1);
 
-        for (j=0; j < nAttr; j++) {
-            int idx = (j * 2);
+    attributesSlots(pAttr);
+    return pAttr;
+}
 
-            pMarkup->a[j].zName = zBuf;
-            memcpy(zBuf, argv[idx], arglen[idx]);
-            zBuf[arglen[idx]] = '\0';
-            if (doEscape) {
-                HtmlTranslateEscapes(zBuf);
-                ToLower(zBuf);
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlAttributesFree --
+ *
+ *     Free an attribute set allocated by HtmlAttributesNew() or 
+ *     HtmlAttributesSet(). This is a no-op if pAttr is NULL.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+void
+HtmlAttributesFree(pAttr)
+    HtmlAttributes *pAttr;
+{
+    if (pAttr) {
+        int ii;
+        for (ii = 0; ii < pAttr->nAttr; ii++) {
+            if (pAttr->a[ii].isAlloc) {
+                HtmlArenaFree(pAttr->a[ii].zValue);
             }
-            zBuf += (arglen[idx] + 1);
-
-            pMarkup->a[j].zValue = zBuf;
-            memcpy(zBuf, argv[idx+1], arglen[idx+1]);
-            zBuf[arglen[idx+1]] = '\0';
-            if (doEscape) HtmlTranslateEscapes(zBuf);
-            zBuf += (arglen[idx+1] + 1);
         }
+        HtmlArenaFree(pAttr);
     }
+}
 
-    return pMarkup;
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlAttributesFind --
+ *
+ *     Return the value of the attribute named by atom zAtom (as returned
+ *     by HtmlAttributeAtom()), or NULL if there is no such attribute.
+ *
+ * Results:
+ *     Pointer to attribute value, or NULL.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+char *
+HtmlAttributesFind(pAttr, zAtom)
+    HtmlAttributes *pAttr;
+    const char *zAtom;
+{
+    int ii;
+    for (ii = 0; pAttr && ii < pAttr->nAttr; ii++) {
+        if (pAttr->a[ii].zName == zAtom) {
+            return pAttr->a[ii].zValue;
+        }
+    }
+    return 0;
 }
 
 /*
@@ -113,7 +113,11 @@ hashstatsCmd(clientData, interp, objc, objv)
         nRef += pV->nRef;
     }
 
-    sprintf(zRes, "%d %d", nObj, nRef);
+    sprintf(zRes, "%d %d %d %d %d", nObj, nRef, 
+        pTree->pDisplayCache->fontcache.aWidth.numEntries,
+        pTree->pDisplayCache->fontcache.nWidthHit, 
+        pTree->pDisplayCache->fontcache.nWidthMiss
+    );
     Tcl_SetResult(interp, zRes, TCL_VOLATILE);
     return TCL_OK;
 }
@@ -451,6 +455,7 @@ INSTRUMENTED(runLayoutEngine, HTML_INSTRUMENT_LAYOUT_ENGINE)
 
     pD = pTree->cb.pDamage;
     HtmlLayout(pTree);
+    HtmlDrawTileCleanup(pTree);
     if (0 && pTree->cb.isForce) {
         pTree->cb.flags |= HTML_SCROLL;
     }
@@ -461,6 +466,39 @@ INSTRUMENTED(runLayoutEngine, HTML_INSTRUMENT_LAYOUT_ENGINE)
     doScrollCallback(pTree);
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * timerPhase --
+ *
+ *     If the -timercmd option is set, report the number of microseconds
+ *     elapsed since *pStart as the cost of phase zPhase of the callback
+ *     handler (one of "DYNAMIC", "STYLE", "LAYOUT" or "PAINT").
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     May invoke the -timercmd script.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+timerPhase(pTree, zPhase, pStart)
+    HtmlTree *pTree;
+    const char *zPhase;
+    Tcl_Time *pStart;
+{
+    if (pTree->options.timercmd) {
+        Tcl_Time now;
+        Tcl_WideInt iMicro;
+        Tcl_GetTime(&now);
+        iMicro = (Tcl_WideInt)(now.sec - pStart->sec) * 1000000 + 
+                 (now.usec - pStart->usec);
+        HtmlTimer(pTree, zPhase, "%ld", (long)iMicro);
+    }
+}
+
 /*
  *---------------------------------------------------------------------------
  *
@@ -477,6 +515,10 @@ INSTRUMENTED(runLayoutEngine, HTML_INSTRUMENT_LAYOUT_ENGINE)
  *         4. Repair,
  *         5. Scroll
  *
+ *     If the -timercmd option is set, the time spent in the dynamic, 
+ *     style and layout steps and in steps 4 and 5 combined ("PAINT") is
+ *     reported to the -timercmd script.
+ *
  * Results:
  *     None.
  *
@@ -492,6 +534,7 @@ INSTRUMENTED(callbackHandler, HTML_INSTRUMENT_CALLBACK)
 
     int offscreen;
     int force_redraw = 0;
+    Tcl_Time sStart;
 
     assert(
         !pTree->pRoot ||
@@ -527,7 +570,9 @@ INSTRUMENTED(callbackHandler, HTML_INSTRUMENT_CALLBACK)
      * modified (setting the HTML_RESTYLE flag). 
      */
     if (pTree->cb.flags & HTML_DYNAMIC) {
+        Tcl_GetTime(&sStart);
         runDynamicStyleEngine(clientData);
+        timerPhase(pTree, "DYNAMIC", &sStart);
     }
     HtmlCheckRestylePoint(pTree);
     pTree->cb.flags &= ~HTML_DYNAMIC;
@@ -541,7 +586,9 @@ INSTRUMENTED(callbackHandler, HTML_INSTRUMENT_CALLBACK)
      * [.html parse] or something?
      */
     if (pTree->cb.flags & HTML_RESTYLE) {
+        Tcl_GetTime(&sStart);
         runStyleEngine(clientData);
+        timerPhase(pTree, "STYLE", &sStart);
     }
     pTree->cb.flags &= ~HTML_RESTYLE;
 
@@ -553,7 +600,9 @@ INSTRUMENTED(callbackHandler, HTML_INSTRUMENT_CALLBACK)
      */
     assert(pTree->cb.pDamage == 0 || pTree->cb.flags & HTML_DAMAGE);
     if (pTree->cb.flags & HTML_LAYOUT) {
+        Tcl_GetTime(&sStart);
         runLayoutEngine(clientData);
+        timerPhase(pTree, "LAYOUT", &sStart);
     }
     pTree->cb.flags &= ~HTML_LAYOUT;
 
@@ -571,7 +620,16 @@ INSTRUMENTED(callbackHandler, HTML_INSTRUMENT_CALLBACK)
         return;
     }
 
-    /* If the HTML_DAMAGE flag is set, repaint one or more window regions. */
+    /* If the HTML_DAMAGE flag is set, repaint one or more window regions.
+     * The rectangles in the damaged region are disjoint, so if one of
+     * them covers the whole viewport it is the only one. In that case, if
+     * the HTML_SCROLL flag is also set, the viewport will be redrawn by
+     * HtmlWidgetSetViewport() below anyway.
+     *
+     * The number of rectangles and pixels repainted are passed to
+     * the -timercmd script as "REPAIR".
+     */
+    Tcl_GetTime(&sStart);
     assert(pTree->cb.pDamage == 0 || pTree->cb.flags & HTML_DAMAGE);
     if (pTree->cb.flags & HTML_DAMAGE) {
         HtmlDamage *pD = pTree->cb.pDamage;
@@ -581,6 +639,8 @@ INSTRUMENTED(callbackHandler, HTML_INSTRUMENT_CALLBACK)
             pD->w < Tk_Width(pTree->tkwin) ||
             pD->h < Tk_Height(pTree->tkwin)
         )) {
+            int nRect = 0;
+            int nPixel = 0;
             pTree->cb.pDamage = 0;
             while (pD) {
                 HtmlDamage *pNext = pD->pNext;
@@ -589,9 +649,14 @@ INSTRUMENTED(callbackHandler, HTML_INSTRUMENT_CALLBACK)
                     pD->w, pD->h, pD->x, pD->y
                 );
                 HtmlWidgetRepair(pTree, pD->x, pD->y, pD->w, pD->h, 1);
+                nRect++;
+                nPixel += (pD->w * pD->h);
                 HtmlFree(pD);
                 pD = pNext;
             }
+            if (pTree->options.timercmd) {
+                HtmlTimer(pTree, "REPAIR", "%d %d", nRect, nPixel);
+            }
         }
     }
 
@@ -610,6 +675,9 @@ INSTRUMENTED(callbackHandler, HTML_INSTRUMENT_CALLBACK)
     if (pTree->cb.flags & (HTML_SCROLL)) {
         doScrollCallback(pTree);
     }
+    if (pTree->cb.flags & (HTML_DAMAGE|HTML_SCROLL)) {
+        timerPhase(pTree, "PAINT", &sStart);
+    }
 
     pTree->cb.flags = 0;
     assert(pTree->cb.inProgress);
@@ -620,7 +688,18 @@ INSTRUMENTED(callbackHandler, HTML_INSTRUMENT_CALLBACK)
         Tcl_DoWhenIdle(callbackHandler, (ClientData)pTree);
     }
 
-    offscreen = MAX(0, 
+    /* If the layout engine was interrupted (because the -layoutslice
+     * option is set), schedule another layout to continue from where
+     * it left off. Subtrees that were completely laid out by this pass
+     * are copied from the layout cache, and each pass lays out at least
+     * one block from scratch (see layoutMarkProgress() in htmllayout.c),
+     * so the layout always completes.
+     */
+    if (pTree->isLayoutPartial) {
+        HtmlCallbackLayout(pTree, pTree->pRoot);
+    }
+
+    offscreen = MAX(0,
         MIN(pTree->canvas.bottom - Tk_Height(pTree->tkwin), pTree->iScrollY)
     );
     if (offscreen != pTree->iScrollY) {
@@ -800,10 +879,10 @@ HtmlCallbackRestyle(pTree, pNode)
 
     /* This is also where the text-representation of the document is
      * invalidated. If the style of a node is to change, or a new node
-     * that has no style is added, then the current text-representation
-     * is clearly suspect.
+     * that has no style is added, then the block of the current 
+     * text-representation that contains it is clearly suspect.
      */
-    HtmlTextInvalidate(pTree);
+    HtmlTextInvalidateNode(pTree, pNode);
     HtmlCssSearchInvalidateCache(pTree);
 }
 
@@ -813,9 +892,9 @@ HtmlCallbackRestyle(pTree, pNode)
  * HtmlCallbackDynamic --
  *
  *     Next widget idle-callback, check if any dynamic CSS conditions
- *     attached to nodes that are part of the sub-tree rooted at pNode
- *     have changed. If so, restyle the affected nodes.  This function
- *     is a no-op if (pNode==0).
+ *     that depend on the dynamic flags of node pNode have changed. If 
+ *     so, restyle the affected nodes.  This function is a no-op if 
+ *     (pNode==0).
  *
  * Results:
  *     None.
@@ -832,6 +911,20 @@ HtmlCallbackDynamic(pTree, pNode)
     HtmlNode *pNode;
 {
     if (pNode) {
+        /* Record pNode in the HtmlCallback.apDynamic array. Duplicates
+         * only cause extra work in HtmlCssCheckDynamic(), so only the
+         * most recent entry is checked for.
+         */
+        HtmlCallback *p = &pTree->cb;
+        if (p->nDynamic == 0 || p->apDynamic[p->nDynamic - 1] != pNode) {
+            if (p->nDynamic == p->nDynamicAlloc) {
+                p->nDynamicAlloc = p->nDynamicAlloc * 2 + 8;
+                p->apDynamic = (HtmlNode **)HtmlRealloc("HtmlCallback.apDynamic",
+                    p->apDynamic, p->nDynamicAlloc * sizeof(HtmlNode *)
+                );
+            }
+            p->apDynamic[p->nDynamic++] = pNode;
+        }
         if (upgradeRestylePoint(&pTree->cb.pDynamic, pNode)) {
             if (!pTree->cb.flags) {
                 Tcl_DoWhenIdle(callbackHandler, (ClientData)pTree);
@@ -904,15 +997,121 @@ HtmlCallbackDamageNode(pTree, pNode)
     }
 }
 
+/*
+ * The damaged region of the widget (HtmlCallback.pDamage) is a list of
+ * disjoint rectangles. To bound the cost of both maintaining the list and
+ * repainting it, no more than HTML_DAMAGE_MAX rectangles are stored. When
+ * this limit is exceeded, the two rectangles that may be merged into a
+ * single bounding box while adding the least area that is not actually
+ * damaged are merged (see damageCost()).
+ */
+#define HTML_DAMAGE_MAX 8
+
 /*
  *---------------------------------------------------------------------------
  *
- * HtmlCallbackDamage --
+ * damageCost --
+ *
+ *     Calculate the cost of replacing rectangles p1 and p2 with their
+ *     bounding box. The cost is the number of pixels in the bounding
+ *     box that are not part of either p1 or p2.
+ *
+ *     If pIsOverlap is not NULL, *pIsOverlap is set to true if p1 and
+ *     p2 intersect (in which case they must be merged regardless of 
+ *     cost to keep the rectangles of the region disjoint).
+ *
+ * Results:
+ *     Number of pixels.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int
+damageCost(p1, p2, pIsOverlap)
+    HtmlDamage *p1;
+    HtmlDamage *p2;
+    int *pIsOverlap;
+{
+    int x1 = MIN(p1->x, p2->x);
+    int y1 = MIN(p1->y, p2->y);
+    int x2 = MAX(p1->x + p1->w, p2->x + p2->w);
+    int y2 = MAX(p1->y + p1->h, p2->y + p2->h);
+
+    int ix = MIN(p1->x + p1->w, p2->x + p2->w) - MAX(p1->x, p2->x);
+    int iy = MIN(p1->y + p1->h, p2->y + p2->h) - MAX(p1->y, p2->y);
+    int iOverlap = ((ix > 0 && iy > 0) ? (ix * iy) : 0);
+
+    if (pIsOverlap) {
+        *pIsOverlap = (iOverlap > 0);
+    }
+    return (x2 - x1) * (y2 - y1) - (p1->w * p1->h) - (p2->w * p2->h) + iOverlap;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * damageInsert --
+ *
+ *     Add rectangle pNew to the damaged region. Any existing rectangle 
+ *     that intersects pNew, or that can be merged with it at no cost, is 
+ *     removed from the region and merged into pNew before it is linked 
+ *     in. This is repeated until pNew is disjoint from all other 
+ *     rectangles in the region.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     Takes ownership of pNew. May free other HtmlDamage structures.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+damageInsert(pTree, pNew)
+    HtmlTree *pTree;
+    HtmlDamage *pNew;
+{
+    HtmlDamage **pp = &pTree->cb.pDamage;
+    while (*pp) {
+        HtmlDamage *p = *pp;
+        int isOverlap;
+        if (damageCost(p, pNew, &isOverlap) == 0 || isOverlap) {
+            int x2 = MAX(p->x + p->w, pNew->x + pNew->w);
+            int y2 = MAX(p->y + p->h, pNew->y + pNew->h);
+            pNew->x = MIN(p->x, pNew->x);
+            pNew->y = MIN(p->y, pNew->y);
+            pNew->w = x2 - pNew->x;
+            pNew->h = y2 - pNew->y;
+            *pp = p->pNext;
+            HtmlFree(p);
+
+            /* The enlarged pNew may now intersect a rectangle already 
+             * checked. Start again from the start of the list. 
+             */
+            pp = &pTree->cb.pDamage;
+        } else {
+            pp = &p->pNext;
+        }
+    }
+    pNew->pNext = pTree->cb.pDamage;
+    pTree->cb.pDamage = pNew;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlCallbackExpose --
  *
  *     Schedule a region to be repainted during the next callback.
  *     The x and y arguments are relative to the viewport, not the
  *     document origin.
  *
+ *     This is used when the contents of the window have been lost, but 
+ *     the canvas has not changed (i.e. in response to an Expose event).
+ *     Use HtmlCallbackDamage() when the canvas itself has changed.
+ *
  * Results:
  *     None.
  *
@@ -922,7 +1121,7 @@ HtmlCallbackDamageNode(pTree, pNode)
  *---------------------------------------------------------------------------
  */
 void 
-HtmlCallbackDamage(pTree, x, y, w, h)
+HtmlCallbackExpose(pTree, x, y, w, h)
     HtmlTree *pTree;
     int x; 
     int y;
@@ -931,6 +1130,7 @@ HtmlCallbackDamage(pTree, x, y, w, h)
 {
     HtmlDamage *pNew;
     HtmlDamage *p;
+    int nDamage = 0;
 
     /* Clip the values to the viewport */
     if (x < 0) {w += x; x = 0;}
@@ -943,14 +1143,10 @@ HtmlCallbackDamage(pTree, x, y, w, h)
         return;
     }
 
-    /* Loop through the current list of damaged rectangles. If possible
-     * clip the new damaged region so that the same part of the display
-     * is not painted more than once.
+    /* Check if some region p completely encapsulates the new region. If 
+     * so, we need do nothing. 
      */
     for (p = pTree->cb.pDamage; p; p = p->pNext) {
-        /* Check if region p completely encapsulates the new region. If so,
-         * we need do nothing. 
-         */
         assert(pTree->cb.flags & HTML_DAMAGE);
         if (
             p->x <= x && p->y <= y && 
@@ -960,34 +1156,54 @@ HtmlCallbackDamage(pTree, x, y, w, h)
         }
     }
 
-#if 0
-    if (pTree->cb.flags & HTML_DAMAGE) {
-        int x2 = MAX(x + w, pTree->cb.x + pTree->cb.w);
-        int y2 = MAX(y + h, pTree->cb.y + pTree->cb.h);
-        pTree->cb.x = MIN(pTree->cb.x, x);
-        pTree->cb.y = MIN(pTree->cb.y, y);
-        pTree->cb.w = x2 - pTree->cb.x;
-        pTree->cb.h = y2 - pTree->cb.y;
-    } else {
-        pTree->cb.x = x;
-        pTree->cb.y = y;
-        pTree->cb.w = w;
-        pTree->cb.h = h;
-    }
-
-    assert(pTree->cb.x >= 0);
-    assert(pTree->cb.y >= 0);
-    assert(pTree->cb.w > 0);
-    assert(pTree->cb.h > 0);
-#endif
- 
     pNew = HtmlNew(HtmlDamage);
     pNew->x = x;
     pNew->y = y;
     pNew->w = w;
     pNew->h = h;
-    pNew->pNext = pTree->cb.pDamage;
-    pTree->cb.pDamage = pNew;
+    damageInsert(pTree, pNew);
+
+    /* If there are now too many rectangles in the region, merge the 
+     * cheapest pair until there are not.
+     */
+    for (p = pTree->cb.pDamage; p; p = p->pNext) nDamage++;
+    while (nDamage > HTML_DAMAGE_MAX) {
+        HtmlDamage **pp1 = 0;
+        HtmlDamage **pp2 = 0;
+        HtmlDamage **ppA;
+        HtmlDamage **ppB;
+        HtmlDamage *p1;
+        HtmlDamage *p2;
+        int iBest = 0;
+
+        for (ppA = &pTree->cb.pDamage; *ppA; ppA = &(*ppA)->pNext) {
+            for (ppB = &(*ppA)->pNext; *ppB; ppB = &(*ppB)->pNext) {
+                int iCost = damageCost(*ppA, *ppB, 0);
+                if (!pp1 || iCost < iBest) {
+                    pp1 = ppA;
+                    pp2 = ppB;
+                    iBest = iCost;
+                }
+            }
+        }
+
+        /* Unlink the pair (p2 first, as pp2 may point into p1). Then 
+         * insert their bounding box in place of p1. 
+         */
+        p1 = *pp1;
+        p2 = *pp2;
+        *pp2 = p2->pNext;
+        *pp1 = p1->pNext;
+        p1->w = MAX(p1->x + p1->w, p2->x + p2->w) - MIN(p1->x, p2->x);
+        p1->h = MAX(p1->y + p1->h, p2->y + p2->h) - MIN(p1->y, p2->y);
+        p1->x = MIN(p1->x, p2->x);
+        p1->y = MIN(p1->y, p2->y);
+        HtmlFree(p2);
+        damageInsert(pTree, p1);
+
+        nDamage = 0;
+        for (p = pTree->cb.pDamage; p; p = p->pNext) nDamage++;
+    }
 
     if (!pTree->cb.flags) {
         Tcl_DoWhenIdle(callbackHandler, (ClientData)pTree);
@@ -995,6 +1211,50 @@ HtmlCallbackDamage(pTree, x, y, w, h)
     pTree->cb.flags |= HTML_DAMAGE;
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlCallbackDamage --
+ *
+ *     Schedule a region to be repainted during the next callback because
+ *     the canvas has changed. The x and y arguments are relative to the 
+ *     viewport, not the document origin.
+ *
+ *     As well as scheduling the repaint, any cached tiles that intersect
+ *     the region are discarded (see HtmlDrawTileInvalidate()). Callers
+ *     pass a region that covers the whole viewport (i.e. 0, 0, 1000000,
+ *     1000000) to indicate that the entire document may have changed,
+ *     so in this case all cached tiles are discarded.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+void 
+HtmlCallbackDamage(pTree, x, y, w, h)
+    HtmlTree *pTree;
+    int x; 
+    int y;
+    int w; 
+    int h;
+{
+    if (
+        x <= 0 && y <= 0 && 
+        (x + w) >= Tk_Width(pTree->tkwin) && (y + h) >= Tk_Height(pTree->tkwin)
+    ) {
+        HtmlDrawTileCleanup(pTree);
+    } else {
+        HtmlDrawTileInvalidate(pTree, 
+            x + pTree->iScrollX, y + pTree->iScrollY, w, h
+        );
+    }
+    HtmlCallbackExpose(pTree, x, y, w, h);
+}
+
 void 
 HtmlCallbackScrollY(pTree, y)
     HtmlTree *pTree;
@@ -1053,6 +1313,29 @@ cleanupHandlerTable(pHash)
     Tcl_DeleteHashTable(pHash);
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * freeTree --
+ *
+ *     Tcl_FreeProc used to free the HtmlTree structure once deleteWidget()
+ *     has run and there are no outstanding Tcl_Preserve() calls.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void 
+freeTree(p)
+    char *p;
+{
+    HtmlFree(p);
+}
+
 /*
  *---------------------------------------------------------------------------
  *
@@ -1106,11 +1389,25 @@ deleteWidget(clientData)
         HtmlFree(pDamage);
     }
 
+    /* Free the cached canvas tiles */
+    HtmlDrawTileCleanup(pTree);
+
     /* Atoms table */
     Tcl_DeleteHashTable(&pTree->aAtom);
 
-    /* Delete the structure itself */
-    HtmlFree(pTree);
+    /* Release the shared per-interpreter state. This must be done after
+     * HtmlTreeClear() has released any shared stylesheets. 
+     */
+    HtmlInterpDataRelease(pTree->pInterpData);
+
+    /* Dynamic CSS condition index (emptied by HtmlTreeClear()) */
+    Tcl_DeleteHashTable(&pTree->aDynamic);
+    HtmlFree(pTree->cb.apDynamic);
+
+    /* Delete the structure itself. This is deferred if a script 
+     * evaluated by the widget has called Tcl_Preserve() on it. 
+     */
+    Tcl_EventuallyFree((ClientData)pTree, freeTree);
 }
 
 /*
@@ -1213,7 +1510,7 @@ docwinEventHandler(clientData, pEvent)
                 p->x, p->y, p->width, p->height
             );
     
-            HtmlCallbackDamage(pTree, 
+            HtmlCallbackExpose(pTree, 
                 p->x + Tk_X(pTree->docwin), p->y + Tk_Y(pTree->docwin),
                 p->width, p->height
             );
@@ -1343,6 +1640,9 @@ configureCmd(clientData, interp, objc, objv)
     #define DOUBLE(v, s1, s2, s3, f) \
         {TK_OPTION_DOUBLE, "-" #v, s1, s2, s3, -1, \
          Tk_Offset(HtmlOptions, v), 0, 0, f}
+    #define INT(v, s1, s2, s3, f) \
+        {TK_OPTION_INT, "-" #v, s1, s2, s3, -1, \
+         Tk_Offset(HtmlOptions, v), 0, 0, f}
     
     /* Option table definition for the html widget. */
     static Tk_OptionSpec htmlOptionSpec[] = {
@@ -1357,14 +1657,18 @@ STRING  (yscrollcommand, "yScrollCommand", "ScrollCommand", ""),
 
 /* Non-debugging, non-standard options in alphabetical order. */
 OBJ     (defaultstyle, "defaultStyle", "DefaultStyle", HTML_DEFAULT_CSS, 0),
+BOOLEAN (discardparsed, "discardParsed", "DiscardParsed", "0", 0),
 DOUBLE  (fontscale, "fontScale", "FontScale", "1.0", F_MASK),
 OBJ     (fonttable, "fontTable", "FontTable", "8 9 10 11 13 15 17", FT_MASK),
 BOOLEAN (forcefontmetrics, "forceFontMetrics", "ForceFontMetrics", "1", F_MASK),
 BOOLEAN (forcewidth, "forceWidth", "ForceWidth", "0", L_MASK),
+BOOLEAN (imageasync, "imageAsync", "ImageAsync", "0", 0),
 BOOLEAN (imagecache, "imageCache", "ImageCache", "1", S_MASK),
 BOOLEAN (imagepixmapify, "imagePixmapify", "ImagePixmapify", "0", 0),
 STRING  (imagecmd, "imageCmd", "ImageCmd", ""),
+INT     (layoutslice, "layoutSlice", "LayoutSlice", "0", 0),
 STRINGT (mode, "mode", "Mode", "standards", azModes),
+BOOLEAN (nodecommands, "nodeCommands", "NodeCommands", "1", 0),
 STRINGT (parsemode, "parsemode", "Parsemode", "html", azParseModes),
 BOOLEAN (shrink, "shrink", "Shrink", "0", S_MASK),
 DOUBLE  (zoom, "zoom", "Zoom", "1.0", F_MASK),
@@ -1380,6 +1684,7 @@ STRING  (timercmd, "timerCmd", "TimerCmd", ""),
     #undef PIXELS
     #undef STRING
     #undef BOOLEAN
+    #undef INT
 
     HtmlTree *pTree = (HtmlTree *)clientData;
     char *pOptions = (char *)&pTree->options;
@@ -1401,6 +1706,20 @@ STRING  (timercmd, "timerCmd", "TimerCmd", ""),
     rc = Tk_SetOptions(
         interp, pOptions, otab, objc-2, &objv[2], win, (init?0:&saved), &mask
     );
+
+    /* The -layoutslice option must not be set to a negative value. */
+    if (TCL_OK == rc && pTree->options.layoutslice < 0) {
+        char zBuf[32];
+        sprintf(zBuf, "%d", pTree->options.layoutslice);
+        Tcl_ResetResult(interp);
+        Tcl_AppendResult(interp, 
+            "expected non-negative integer but got \"", zBuf, "\"", NULL);
+        if (!init) {
+            Tk_RestoreSavedOptions(&saved);
+        }
+        return TCL_ERROR;
+    }
+
     if (TCL_OK == rc) {
         /* Hard-coded minimum values for width and height */
         pTree->options.height = MAX(pTree->options.height, 0);
@@ -1456,15 +1775,6 @@ STRING  (timercmd, "timerCmd", "TimerCmd", ""),
             }
 #endif
         }
-        if (mask & F_MASK) {
-            /* This happens when one of the font related options changes.
-             * The key here is that the font cache (HtmlTree.aFont) must
-             * be completely empty before we rerun the styler. Otherwise
-             * fonts returned by the cache will match the old -fontscale
-             * and -fonttable options.
-             */
-            HtmlFontCacheClear(pTree, 1);
-        }
         if (mask & L_MASK) {
             /* This happens when the -forcewidth option is set. In this
              * case we need to rebuild the layout.
@@ -1863,8 +2173,7 @@ viewCommon(pTree, isXview, objc, objv)
 
         /* The [widget yview] command also supports "scroll-to-node" */
         if (!isXview && objc == 3) {
-            const char *zCmd = Tcl_GetString(objv[2]);
-            HtmlNode *pNode = HtmlNodeGetPointer(pTree, zCmd);
+            HtmlNode *pNode = HtmlNodeFromObj(pTree, objv[2]);
             if (!pNode) {
                 return TCL_ERROR;
             }
@@ -2483,6 +2792,24 @@ stylereportCmd(clientData, interp, objc, objv)
 {
     return HtmlCssStyleReport(clientData, interp, objc, objv);
 }
+static int 
+stylestatsCmd(clientData, interp, objc, objv)
+    ClientData clientData;             /* The HTML widget data structure */
+    Tcl_Interp *interp;                /* Current interpreter. */
+    int objc;                          /* Number of arguments. */
+    Tcl_Obj *CONST objv[];             /* Argument strings. */
+{
+    return HtmlCssSharedStyleStats(clientData, interp, objc, objv);
+}
+static int 
+selectorbenchCmd(clientData, interp, objc, objv)
+    ClientData clientData;             /* The HTML widget data structure */
+    Tcl_Interp *interp;                /* Current interpreter. */
+    int objc;                          /* Number of arguments. */
+    Tcl_Obj *CONST objv[];             /* Argument strings. */
+{
+    return HtmlCssSelectorBench(clientData, interp, objc, objv);
+}
 
 /*
  *---------------------------------------------------------------------------
@@ -2518,7 +2845,7 @@ bboxCmd(clientData, interp, objc, objv)
     }
 
     if (objc == 3) {
-        pNode = HtmlNodeGetPointer(pTree, Tcl_GetString(objv[2]));
+        pNode = HtmlNodeFromObj(pTree, objv[2]);
         if (!pNode) return TCL_ERROR;
     } else {
         pNode = pTree->pRoot;
@@ -2589,8 +2916,10 @@ int widgetCmd(clientData, interp, objc, objv)
         {"_images",      imagesCmd},
         {"_primitives",  primitivesCmd},
         {"_relayout",    relayoutCmd},
+        {"_selectorbench", selectorbenchCmd},
         {"_styleconfig", styleconfigCmd},
         {"_stylereport", stylereportCmd},
+        {"_stylestats",  stylestatsCmd},
 #ifndef NDEBUG
         {"_hashstats",  hashstatsCmd},
 #endif
@@ -2599,7 +2928,84 @@ int widgetCmd(clientData, interp, objc, objv)
     return callSubCmd(aSub, 1, clientData, interp, objc, objv);
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlInterpDataRelease --
+ *
+ *     Decrement the reference count of the HtmlInterpData structure p.
+ *     If it drops to zero, free the structure.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     May free p.
+ *
+ *---------------------------------------------------------------------------
+ */
+void
+HtmlInterpDataRelease(p)
+    HtmlInterpData *p;
+{
+    p->nRef--;
+    assert(p->nRef >= 0);
+    if (p->nRef == 0) {
+        HtmlCssSharedStyleSweep(p, 1);
+        assert(p->aSharedStyle.numEntries == 0);
+        assert(p->pDisplayCache == 0);
+        assert(p->aNodeHandle.numEntries == 0);
+        Tcl_DeleteHashTable(&p->aClassAtom);
+        Tcl_DeleteHashTable(&p->aAttrAtom);
+        Tcl_DeleteHashTable(&p->aSharedStyle);
+        Tcl_DeleteHashTable(&p->aNodeHandle);
+        HtmlFree(p);
+    }
+}
+
+static void
+interpDataDelete(clientData, interp)
+    ClientData clientData;
+    Tcl_Interp *interp;
+{
+    HtmlInterpDataRelease((HtmlInterpData *)clientData);
+}
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlInterpDataGet --
+ *
+ *     Return the HtmlInterpData structure for interpreter interp, 
+ *     creating it if it does not already exist. The caller must 
+ *     increment HtmlInterpData.nRef if it retains the pointer.
+ *
+ * Results:
+ *     Pointer to HtmlInterpData structure.
+ *
+ * Side effects:
+ *     May allocate a new structure and attach it to interp.
+ *
+ *---------------------------------------------------------------------------
+ */
+HtmlInterpData *
+HtmlInterpDataGet(interp)
+    Tcl_Interp *interp;
+{
+    HtmlInterpData *p;
+    p = (HtmlInterpData *)Tcl_GetAssocData(interp, "tkhtml", 0);
+    if (!p) {
+        Tcl_HashKeyType *pType = HtmlCaseInsenstiveHashType();
+        p = HtmlNew(HtmlInterpData);
+        Tcl_InitCustomHashTable(&p->aClassAtom, TCL_CUSTOM_TYPE_KEYS, pType);
+        Tcl_InitHashTable(&p->aAttrAtom, TCL_STRING_KEYS);
+        Tcl_InitHashTable(&p->aSharedStyle, TCL_ONE_WORD_KEYS);
+        Tcl_InitHashTable(&p->aNodeHandle, TCL_ONE_WORD_KEYS);
+        p->nRef = 1;
+        Tcl_SetAssocData(interp, "tkhtml", interpDataDelete, (ClientData)p);
+    }
+    return p;
+}
 
 /*
  *---------------------------------------------------------------------------
@@ -2665,11 +3071,14 @@ newWidget(clientData, interp, objc, objv)
     Tcl_InitHashTable(&pTree->aNodeHandler, TCL_ONE_WORD_KEYS);
     Tcl_InitHashTable(&pTree->aAttributeHandler, TCL_ONE_WORD_KEYS);
     Tcl_InitHashTable(&pTree->aOrphan, TCL_ONE_WORD_KEYS);
+    Tcl_InitHashTable(&pTree->aDynamic, TCL_ONE_WORD_KEYS);
     Tcl_InitHashTable(&pTree->aTag, TCL_STRING_KEYS);
     pTree->cmd = Tcl_CreateObjCommand(interp,zCmd,widgetCmd,pTree,widgetCmdDel);
 
     pType = HtmlCaseInsenstiveHashType();
     Tcl_InitCustomHashTable(&pTree->aAtom, TCL_CUSTOM_TYPE_KEYS, pType);
+    pTree->pInterpData = HtmlInterpDataGet(interp);
+    pTree->pInterpData->nRef++;
 
     HtmlCssSearchInit(pTree);
 
@@ -2952,6 +3361,9 @@ DLL_EXPORT int Tkhtml_Init(interp)
 
     Tcl_CreateObjCommand(interp, "::tkhtml::uri", htmlUriCmd, 0, 0);
 
+    Tcl_CreateObjCommand(interp, "::tkhtml::node", HtmlNodeDispatchCmd, 0, 0);
+    Tcl_CreateObjCommand(interp, "::tkhtml::imagejobs", HtmlImageJobsCmd,0,0);
+
     Tcl_CreateObjCommand(interp, "::tkhtml::byteoffset", htmlByteOffsetCmd,0,0);
     Tcl_CreateObjCommand(interp, "::tkhtml::charoffset", htmlCharOffsetCmd,0,0);
 
@@ -1098,9 +1098,9 @@ HtmlTagAddRemoveCmd(clientData, interp, objc, objv, isAdd)
         return TCL_ERROR;
     }
     if (
-        0 == (sData.pFrom=HtmlNodeGetPointer(pTree, Tcl_GetString(objv[4]))) ||
+        0 == (sData.pFrom=HtmlNodeFromObj(pTree, objv[4])) ||
         TCL_OK != Tcl_GetIntFromObj(interp, objv[5], &sData.iFrom) ||
-        0 == (sData.pTo=HtmlNodeGetPointer(pTree, Tcl_GetString(objv[6]))) ||
+        0 == (sData.pTo=HtmlNodeFromObj(pTree, objv[6])) ||
         TCL_OK != Tcl_GetIntFromObj(interp, objv[7], &sData.iTo)
     ) {
         return TCL_ERROR;
@@ -1255,20 +1255,63 @@ HtmlTagCleanupTree(pTree)
 
 
 /*
- * The following two structs are used together to create a data-structure 
+ * The following structs are used together to create a data-structure 
  * to store the text-representation of the document.
  *
+ * There is one HtmlTextMapping entry for each text token in the text
+ * representation. Array HtmlText.aMapping contains the entries in document 
+ * order, which is also sorted by iStrIndex. Array HtmlText.aiByNode 
+ * contains the indexes of the same entries sorted by pTextNode and then 
+ * iNodeIndex. Both are searched using binary search.
+ *
+ * There is also one HtmlTextBlock for each element that is neither
+ * "display:inline" nor "display:none". A block always begins and ends 
+ * in state SEEN_BLOCK, so the text generated for it depends only on the
+ * subtree rooted at the block element. When a node is restyled, 
+ * HtmlTextInvalidateNode() marks the nearest enclosing block as dirty,
+ * and the next call to initHtmlText() regenerates just the dirty blocks
+ * and splices them into the existing representation. Array 
+ * HtmlText.apBlock stores the blocks in document order, each block 
+ * followed by the nDesc blocks nested inside it.
  */
 typedef struct HtmlTextMapping HtmlTextMapping;
 struct HtmlTextMapping {
     HtmlTextNode *pTextNode;
     int iStrIndex;             /* Character offset in HtmlText.pObj */
     int iNodeIndex;            /* Byte offset in HtmlTextNode.zText */
-    HtmlTextMapping *pNext;
 };
+struct HtmlTextBlock {
+    HtmlElementNode *pElem;    /* Block element (NULL after it is freed) */
+    int iByte;                 /* Byte offset in HtmlText.pObj */
+    int nByte;                 /* Number of bytes generated by block */
+    int iStr;                  /* Character offset in HtmlText.pObj */
+    int nStr;                  /* Number of characters generated by block */
+    int iMap;                  /* Index of first entry in aMapping */
+    int nMap;                  /* Number of aMapping entries in block */
+    int nDesc;                 /* Number of blocks nested inside this one */
+    int iBlock;                /* Index in apBlock (set by updateHtmlText) */
+    int isDirty;               /* True if this block is in apDirty[] */
+};
+
+/*
+ * Maximum number of dirty blocks regenerated individually. If more 
+ * blocks than this are invalidated between two queries, the text
+ * representation is rebuilt from scratch instead.
+ */
+#define HTML_TEXT_MAX_DIRTY 8
+
 struct HtmlText {
     Tcl_Obj *pObj;
-    HtmlTextMapping *pMapping;
+    HtmlTextMapping *aMapping;      /* Mappings sorted by iStrIndex */
+    int nMapping;                   /* Number of entries in aMapping */
+    int nMappingAlloc;              /* Allocated size of aMapping */
+    int *aiByNode;                  /* aMapping indexes sorted by node */
+
+    HtmlTextBlock **apBlock;        /* Blocks in document order */
+    int nBlock;                     /* Number of entries in apBlock */
+    int nBlockAlloc;                /* Allocated size of apBlock */
+    HtmlTextBlock *apDirty[HTML_TEXT_MAX_DIRTY];  /* Blocks to regenerate */
+    int nDirty;                     /* Number of entries in apDirty */
 };
 
 typedef struct HtmlTextInit HtmlTextInit;
@@ -1290,12 +1333,187 @@ addTextMapping(pText, pTextNode, iNodeIndex, iStrIndex)
     int iStrIndex;
 {
     HtmlTextMapping *p;
-    p = (HtmlTextMapping *)HtmlAlloc("HtmlTextMapping",sizeof(HtmlTextMapping));
+    if (pText->nMapping == pText->nMappingAlloc) {
+        int nNew = MAX(pText->nMappingAlloc * 2, 64);
+        pText->aMapping = (HtmlTextMapping *)HtmlRealloc("HtmlTextMapping", 
+            pText->aMapping, nNew * sizeof(HtmlTextMapping)
+        );
+        pText->nMappingAlloc = nNew;
+    }
+    assert(
+        pText->nMapping == 0 || 
+        pText->aMapping[pText->nMapping - 1].iStrIndex < iStrIndex
+    );
+    p = &pText->aMapping[pText->nMapping++];
     p->iStrIndex = iStrIndex;
     p->iNodeIndex = iNodeIndex;
     p->pTextNode = pTextNode;
-    p->pNext = pText->pMapping;
-    pText->pMapping = p;
+}
+
+static void
+addTextBlock(pText, pBlock)
+    HtmlText *pText;
+    HtmlTextBlock *pBlock;
+{
+    if (pText->nBlock == pText->nBlockAlloc) {
+        int nNew = MAX(pText->nBlockAlloc * 2, 16);
+        pText->apBlock = (HtmlTextBlock **)HtmlRealloc("HtmlTextBlock", 
+            pText->apBlock, nNew * sizeof(HtmlTextBlock *)
+        );
+        pText->nBlockAlloc = nNew;
+    }
+    pText->apBlock[pText->nBlock++] = pBlock;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * compareMappingByNode --
+ *
+ *     qsort() comparison function used to sort HtmlText.aiByNode.
+ *     Entries are sorted by text node, then by byte offset within
+ *     the text node.
+ *
+ * Results:
+ *     Negative, zero or positive.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int
+compareMappingByNode(pLeft, pRight)
+    const void *pLeft;
+    const void *pRight;
+{
+    const HtmlTextMapping *p1 = *(const HtmlTextMapping **)pLeft;
+    const HtmlTextMapping *p2 = *(const HtmlTextMapping **)pRight;
+    if (p1->pTextNode != p2->pTextNode) {
+        return ((size_t)p1->pTextNode < (size_t)p2->pTextNode) ? -1 : 1;
+    }
+    return p1->iNodeIndex - p2->iNodeIndex;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * sortMappingByNode --
+ *
+ *     Return an array of the nMapping indexes into aMapping, sorted
+ *     using compareMappingByNode(). It is the responsibility of the 
+ *     caller to free the returned array using HtmlFree().
+ *
+ * Results:
+ *     Pointer to allocated array, or NULL if nMapping is 0.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int *
+sortMappingByNode(aMapping, nMapping)
+    HtmlTextMapping *aMapping;
+    int nMapping;
+{
+    HtmlTextMapping **apSort;
+    int *aiRet;
+    int ii;
+
+    if (nMapping == 0) return 0;
+    apSort = (HtmlTextMapping **)HtmlAlloc(
+        "temp", nMapping * sizeof(HtmlTextMapping *)
+    );
+    for (ii = 0; ii < nMapping; ii++) {
+        apSort[ii] = &aMapping[ii];
+    }
+    qsort(apSort, nMapping, sizeof(HtmlTextMapping *), compareMappingByNode);
+    aiRet = (int *)HtmlAlloc("HtmlTextMapping", nMapping * sizeof(int));
+    for (ii = 0; ii < nMapping; ii++) {
+        aiRet[ii] = apSort[ii] - aMapping;
+    }
+    HtmlFree(apSort);
+    return aiRet;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * findMappingByStr --
+ *
+ *     Search HtmlText.aMapping for the last entry with an iStrIndex 
+ *     value less than or equal to iIndex. If there is no such entry,
+ *     the first entry in the array is returned.
+ *
+ * Results:
+ *     Pointer to mapping, or NULL if the array is empty.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static HtmlTextMapping *
+findMappingByStr(pText, iIndex)
+    HtmlText *pText;
+    int iIndex;
+{
+    int iLo = 0;
+    int iHi = pText->nMapping;
+
+    if (pText->nMapping == 0) return 0;
+    while (iHi - iLo > 1) {
+        int iMid = (iLo + iHi) / 2;
+        if (pText->aMapping[iMid].iStrIndex <= iIndex) {
+            iLo = iMid;
+        } else {
+            iHi = iMid;
+        }
+    }
+    return &pText->aMapping[iLo];
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * findMappingByNode --
+ *
+ *     Search HtmlText.aiByNode for the last entry for text node 
+ *     pTextNode with an iNodeIndex value less than or equal to iIndex.
+ *
+ * Results:
+ *     Pointer to mapping, or NULL if there is no such entry.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static HtmlTextMapping *
+findMappingByNode(pText, pTextNode, iIndex)
+    HtmlText *pText;
+    HtmlTextNode *pTextNode;
+    int iIndex;
+{
+    HtmlTextMapping *pRet = 0;
+    int iLo = 0;
+    int iHi = pText->nMapping - 1;
+
+    while (iLo <= iHi) {
+        int iMid = (iLo + iHi) / 2;
+        HtmlTextMapping *p = &pText->aMapping[pText->aiByNode[iMid]];
+        if (
+            (size_t)p->pTextNode < (size_t)pTextNode || 
+            (p->pTextNode == pTextNode && p->iNodeIndex <= iIndex)
+        ) {
+            if (p->pTextNode == pTextNode) pRet = p;
+            iLo = iMid + 1;
+        } else {
+            iHi = iMid - 1;
+        }
+    }
+    return pRet;
 }
 
 static void
@@ -1345,7 +1563,7 @@ initHtmlText_TextNode(pTree, pTextNode, pInit)
                     pInit->iIdx++;
                 }
 
-                addTextMapping(pTree->pText, 
+                addTextMapping(pInit->pText, 
                     pTextNode, (zData - pTextNode->zText), pInit->iIdx
                 );
                 Tcl_AppendToObj(pInit->pText->pObj, zData, nData);
@@ -1368,6 +1586,10 @@ initHtmlText_Elem(pTree, pElem, pInit)
 {
     HtmlNode *pNode = &pElem->node;
     int eDisplay = HtmlNodeComputedValues(pNode)->eDisplay; 
+    HtmlText *pText = pInit->pText;
+    HtmlTextBlock *pBlock = 0;
+    int iBlock = 0;
+    int nByte;
     int ii;
 
     /* If the element has "display:none" or a replacement window, do
@@ -1383,6 +1605,15 @@ initHtmlText_Elem(pTree, pElem, pInit)
 
     if (eDisplay != CSS_CONST_INLINE) {
         pInit->eState = SEEN_BLOCK;
+        pBlock = HtmlNew(HtmlTextBlock);
+        pBlock->pElem = pElem;
+        Tcl_GetStringFromObj(pText->pObj, &nByte);
+        pBlock->iByte = nByte;
+        pBlock->iStr = pInit->iIdx;
+        pBlock->iMap = pText->nMapping;
+        iBlock = pText->nBlock;
+        addTextBlock(pText, pBlock);
+        pElem->pTextBlock = pBlock;
     }
 
     for (ii = 0; ii < HtmlNodeNumChildren(pNode); ii++) {
@@ -1396,7 +1627,295 @@ initHtmlText_Elem(pTree, pElem, pInit)
 
     if (eDisplay != CSS_CONST_INLINE) {
         pInit->eState = SEEN_BLOCK;
+        Tcl_GetStringFromObj(pText->pObj, &nByte);
+        pBlock->nByte = nByte - pBlock->iByte;
+        pBlock->nStr = pInit->iIdx - pBlock->iStr;
+        pBlock->nMap = pText->nMapping - pBlock->iMap;
+        pBlock->nDesc = pText->nBlock - iBlock - 1;
+    }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * freeTextBlock --
+ *
+ *     Free a block structure, clearing the back-pointer from the
+ *     element node if it still points to this block.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+freeTextBlock(pBlock)
+    HtmlTextBlock *pBlock;
+{
+    if (pBlock->pElem && pBlock->pElem->pTextBlock == pBlock) {
+        pBlock->pElem->pTextBlock = 0;
     }
+    HtmlFree(pBlock);
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * regenerateBlock --
+ *
+ *     Regenerate the text for block pBlock, and its nested blocks, and 
+ *     splice it into the text representation at HtmlTree.pText. 
+ *     HtmlTextBlock.iBlock must be set for pBlock and all blocks that 
+ *     precede it.
+ *
+ * Results:
+ *     1 if successful, or 0 if the element is no longer a block (in 
+ *     which case the caller must rebuild the representation from 
+ *     scratch).
+ *
+ * Side effects:
+ *     pBlock and all blocks nested inside it are freed.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int
+regenerateBlock(pTree, pBlock)
+    HtmlTree *pTree;
+    HtmlTextBlock *pBlock;
+{
+    HtmlText *pText = pTree->pText;
+    HtmlElementNode *pElem = pBlock->pElem;
+
+    /* Copy of the extents of pBlock before it is freed */
+    int iFirst = pBlock->iBlock;
+    int nOld = pBlock->nDesc + 1;
+    int iByte = pBlock->iByte;
+    int nByte = pBlock->nByte;
+    int iStr = pBlock->iStr;
+    int nStr = pBlock->nStr;
+    int iMap = pBlock->iMap;
+    int nMap = pBlock->nMap;
+
+    HtmlText sSub;
+    HtmlTextInit sInit;
+    int *aiSub;
+    int *aiNew;
+    int dByte, dStr, dMap, dBlock;
+    int nTotal;
+    int nSub;
+    const char *zOld;
+    const char *zSub;
+    Tcl_Obj *pObj;
+    int ii, i1, i2, nKeep;
+
+    for (ii = iFirst; ii < iFirst + nOld; ii++) {
+        freeTextBlock(pText->apBlock[ii]);
+        pText->apBlock[ii] = 0;
+    }
+
+    memset(&sSub, 0, sizeof(HtmlText));
+    memset(&sInit, 0, sizeof(HtmlTextInit));
+    sInit.pText = &sSub;
+    sSub.pObj = Tcl_NewObj();
+    Tcl_IncrRefCount(sSub.pObj);
+    initHtmlText_Elem(pTree, pElem, &sInit);
+
+    if (sSub.nBlock == 0 || sSub.apBlock[0]->pElem != pElem) {
+        for (ii = 0; ii < sSub.nBlock; ii++) {
+            freeTextBlock(sSub.apBlock[ii]);
+        }
+        if (sSub.apBlock) HtmlFree(sSub.apBlock);
+        if (sSub.aMapping) HtmlFree(sSub.aMapping);
+        Tcl_DecrRefCount(sSub.pObj);
+        return 0;
+    }
+
+    /* Splice the new text into HtmlText.pObj. A new object is created
+     * as the old one may be shared with the Tcl interpreter.
+     */
+    zOld = Tcl_GetStringFromObj(pText->pObj, &nTotal);
+    zSub = Tcl_GetStringFromObj(sSub.pObj, &nSub);
+    pObj = Tcl_NewStringObj(zOld, iByte);
+    Tcl_AppendToObj(pObj, zSub, nSub);
+    Tcl_AppendToObj(pObj, &zOld[iByte + nByte], nTotal - iByte - nByte);
+    Tcl_IncrRefCount(pObj);
+    Tcl_DecrRefCount(pText->pObj);
+    pText->pObj = pObj;
+    Tcl_DecrRefCount(sSub.pObj);
+
+    dByte = nSub - nByte;
+    dStr = sInit.iIdx - nStr;
+    dMap = sSub.nMapping - nMap;
+    dBlock = sSub.nBlock - nOld;
+
+    /* Splice the new mappings into HtmlText.aMapping. */
+    if (pText->nMapping + dMap > pText->nMappingAlloc) {
+        pText->nMappingAlloc = pText->nMapping + dMap;
+        pText->aMapping = (HtmlTextMapping *)HtmlRealloc("HtmlTextMapping", 
+            pText->aMapping, pText->nMappingAlloc * sizeof(HtmlTextMapping)
+        );
+    }
+    if (dMap != 0) {
+        memmove(&pText->aMapping[iMap + sSub.nMapping],
+            &pText->aMapping[iMap + nMap],
+            (pText->nMapping - iMap - nMap) * sizeof(HtmlTextMapping)
+        );
+    }
+    for (ii = iMap + sSub.nMapping; ii < pText->nMapping + dMap; ii++) {
+        pText->aMapping[ii].iStrIndex += dStr;
+    }
+    for (ii = 0; ii < sSub.nMapping; ii++) {
+        pText->aMapping[iMap + ii] = sSub.aMapping[ii];
+        pText->aMapping[iMap + ii].iStrIndex += iStr;
+    }
+
+    /* Update the by-node index. Entries for the replaced mappings are 
+     * removed and the others adjusted for their new position. Then the 
+     * sorted entries for the new mappings are merged in.
+     */
+    aiSub = sortMappingByNode(sSub.aMapping, sSub.nMapping);
+    nKeep = 0;
+    for (ii = 0; ii < pText->nMapping; ii++) {
+        int iEntry = pText->aiByNode[ii];
+        if (iEntry < iMap) {
+            pText->aiByNode[nKeep++] = iEntry;
+        } else if (iEntry >= iMap + nMap) {
+            pText->aiByNode[nKeep++] = iEntry + dMap;
+        }
+    }
+    pText->nMapping += dMap;
+    aiNew = 0;
+    if (pText->nMapping > 0) {
+        aiNew = (int *)HtmlAlloc(
+            "HtmlTextMapping", pText->nMapping * sizeof(int)
+        );
+    }
+    i1 = 0;
+    i2 = 0;
+    for (ii = 0; ii < pText->nMapping; ii++) {
+        int isSub = (i1 == nKeep);
+        if (!isSub && i2 < sSub.nMapping) {
+            HtmlTextMapping *p1 = &pText->aMapping[pText->aiByNode[i1]];
+            HtmlTextMapping *p2 = &pText->aMapping[aiSub[i2] + iMap];
+            isSub = (compareMappingByNode(&p2, &p1) < 0);
+        }
+        if (isSub) {
+            aiNew[ii] = aiSub[i2++] + iMap;
+        } else {
+            aiNew[ii] = pText->aiByNode[i1++];
+        }
+    }
+    if (pText->aiByNode) HtmlFree(pText->aiByNode);
+    if (aiSub) HtmlFree(aiSub);
+    if (sSub.aMapping) HtmlFree(sSub.aMapping);
+    pText->aiByNode = aiNew;
+
+    /* Splice the new blocks into HtmlText.apBlock, then adjust the 
+     * offsets of the blocks that follow and the extents of the blocks 
+     * that enclose them.
+     */
+    if (pText->nBlock + dBlock > pText->nBlockAlloc) {
+        pText->nBlockAlloc = pText->nBlock + dBlock;
+        pText->apBlock = (HtmlTextBlock **)HtmlRealloc("HtmlTextBlock", 
+            pText->apBlock, pText->nBlockAlloc * sizeof(HtmlTextBlock *)
+        );
+    }
+    memmove(&pText->apBlock[iFirst + sSub.nBlock], 
+        &pText->apBlock[iFirst + nOld],
+        (pText->nBlock - iFirst - nOld) * sizeof(HtmlTextBlock *)
+    );
+    for (ii = 0; ii < sSub.nBlock; ii++) {
+        HtmlTextBlock *p = sSub.apBlock[ii];
+        p->iByte += iByte;
+        p->iStr += iStr;
+        p->iMap += iMap;
+        pText->apBlock[iFirst + ii] = p;
+    }
+    HtmlFree(sSub.apBlock);
+    pText->nBlock += dBlock;
+    for (ii = iFirst + sSub.nBlock; ii < pText->nBlock; ii++) {
+        HtmlTextBlock *p = pText->apBlock[ii];
+        p->iByte += dByte;
+        p->iStr += dStr;
+        p->iMap += dMap;
+    }
+    for (ii = 0; ii < iFirst; ii++) {
+        HtmlTextBlock *p = pText->apBlock[ii];
+        if (ii + p->nDesc >= iFirst) {
+            p->nByte += dByte;
+            p->nStr += dStr;
+            p->nMap += dMap;
+            p->nDesc += dBlock;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * updateHtmlText --
+ *
+ *     Regenerate the dirty blocks of the text representation at 
+ *     HtmlTree.pText. Dirty blocks nested inside other dirty blocks 
+ *     are regenerated as part of the enclosing block. The others are
+ *     processed in reverse document order, so that splicing one does 
+ *     not change the offsets of those still to be processed.
+ *
+ * Results:
+ *     1 if successful, or 0 if the text representation must be 
+ *     rebuilt from scratch.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int
+updateHtmlText(pTree)
+    HtmlTree *pTree;
+{
+    HtmlText *pText = pTree->pText;
+    HtmlTextBlock *apTodo[HTML_TEXT_MAX_DIRTY];
+    int nTodo = 0;
+    int ii, jj;
+
+    for (ii = 0; ii < pText->nBlock; ii++) {
+        pText->apBlock[ii]->iBlock = ii;
+    }
+
+    for (ii = 0; ii < pText->nDirty; ii++) {
+        HtmlTextBlock *p = pText->apDirty[ii];
+        int isNested = 0;
+        for (jj = 0; jj < pText->nDirty; jj++) {
+            HtmlTextBlock *pOuter = pText->apDirty[jj];
+            if (
+                pOuter->iBlock < p->iBlock && 
+                p->iBlock <= pOuter->iBlock + pOuter->nDesc
+            ) {
+                isNested = 1;
+            }
+        }
+        p->isDirty = 0;
+        if (!isNested) {
+            if (!p->pElem) return 0;
+            for (jj = nTodo; jj > 0 && apTodo[jj-1]->iBlock < p->iBlock; jj--) {
+                apTodo[jj] = apTodo[jj-1];
+            }
+            apTodo[jj] = p;
+            nTodo++;
+        }
+    }
+    pText->nDirty = 0;
+
+    for (ii = 0; ii < nTodo; ii++) {
+        if (!regenerateBlock(pTree, apTodo[ii])) return 0;
+    }
+    return 1;
 }
 
 /*
@@ -1406,7 +1925,8 @@ initHtmlText_Elem(pTree, pElem, pInit)
  * 
  *     This function is called to initialise the HtmlText data structure 
  *     at HtmlTree.pText. If the data structure is already initialised
- *     this function is a no-op.
+ *     any dirty blocks are regenerated. Otherwise, if there are no dirty
+ *     blocks, this function is a no-op.
  *
  * Results:
  *     None.
@@ -1420,6 +1940,13 @@ static void
 initHtmlText(pTree)
     HtmlTree *pTree;
 {
+    if (pTree->pText && pTree->pText->nDirty > 0) {
+        HtmlCallbackForce(pTree);
+        if (pTree->pText && !updateHtmlText(pTree)) {
+            HtmlTextInvalidate(pTree);
+        }
+    }
+
     if (!pTree->pText) {
         HtmlTextInit sInit;
         HtmlCallbackForce(pTree);
@@ -1430,6 +1957,11 @@ initHtmlText(pTree)
         Tcl_IncrRefCount(sInit.pText->pObj);
         initHtmlText_Elem(pTree, HtmlNodeAsElement(pTree->pRoot), &sInit);
         Tcl_AppendToObj(sInit.pText->pObj, "\n", 1);
+
+        /* Build the by-node index once all mappings have been added. */
+        sInit.pText->aiByNode = sortMappingByNode(
+            sInit.pText->aMapping, sInit.pText->nMapping
+        );
     }
 }
 
@@ -1439,19 +1971,89 @@ HtmlTextInvalidate(pTree)
 {
     if (pTree->pText) {
         HtmlText *pText = pTree->pText;
-        HtmlTextMapping *pMapping = pText->pMapping;
-
-        Tcl_DecrRefCount(pTree->pText->pObj);
-        while (pMapping) {
-            HtmlTextMapping *pNext = pMapping->pNext;
-            HtmlFree(pMapping);
-            pMapping = pNext;
+        int ii;
+        for (ii = 0; ii < pText->nBlock; ii++) {
+            if (pText->apBlock[ii]) freeTextBlock(pText->apBlock[ii]);
         }
+        Tcl_DecrRefCount(pText->pObj);
+        if (pText->aMapping) HtmlFree(pText->aMapping);
+        if (pText->aiByNode) HtmlFree(pText->aiByNode);
+        if (pText->apBlock) HtmlFree(pText->apBlock);
         HtmlFree(pTree->pText);
         pTree->pText = 0;
     }
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlTextInvalidateNode --
+ * 
+ *     This is called when node pNode is restyled, inserted or has its 
+ *     text modified. The nearest block that encloses pNode (not counting 
+ *     pNode itself, as its display type may have changed) is marked as 
+ *     dirty. If there is no such block, or pNode is NULL, or too many 
+ *     blocks are already dirty, the whole text representation is
+ *     discarded.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     See above.
+ *
+ *---------------------------------------------------------------------------
+ */
+void 
+HtmlTextInvalidateNode(pTree, pNode)
+    HtmlTree *pTree;
+    HtmlNode *pNode;
+{
+    HtmlText *pText = pTree->pText;
+    HtmlNode *p;
+
+    if (!pText) return;
+    for (p = (pNode ? HtmlNodeParent(pNode) : 0); p; p = HtmlNodeParent(p)) {
+        HtmlTextBlock *pBlock = HtmlNodeAsElement(p)->pTextBlock;
+        if (pBlock) {
+            if (pBlock->isDirty) return;
+            if (pText->nDirty < HTML_TEXT_MAX_DIRTY) {
+                pBlock->isDirty = 1;
+                pText->apDirty[pText->nDirty++] = pBlock;
+                return;
+            }
+            break;
+        }
+    }
+    HtmlTextInvalidate(pTree);
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlTextFreeElement --
+ * 
+ *     Called by the tree module when element pElem is about to be freed.
+ *     Detach the element from its text representation block, if any.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+void 
+HtmlTextFreeElement(pElem)
+    HtmlElementNode *pElem;
+{
+    if (pElem->pTextBlock) {
+        pElem->pTextBlock->pElem = 0;
+        pElem->pTextBlock = 0;
+    }
+}
+
 int
 HtmlTextTextCmd(clientData, interp, objc, objv)
     ClientData clientData;             /* The HTML widget */
@@ -1498,42 +2100,34 @@ HtmlTextIndexCmd(clientData, interp, objc, objv)
 {
     HtmlTree *pTree = (HtmlTree *)clientData;
     int ii;
-    Tcl_Obj *p = Tcl_NewObj();
+    Tcl_Obj *p;
 
-    HtmlTextMapping *pMap = 0;
-    int iPrev = 0;
- 
     if (objc < 4) {
         Tcl_WrongNumArgs(interp, 3, objv, "OFFSET ?OFFSET? ...");
         return TCL_ERROR;
     }
 
     initHtmlText(pTree);
-    for (ii = objc-1; ii >= 3; ii--) {
+    p = Tcl_NewObj();
+    for (ii = 3; ii < objc; ii++) {
+        HtmlTextMapping *pMap;
         int iIndex;
         if (Tcl_GetIntFromObj(interp, objv[ii], &iIndex)) {
+            Tcl_DecrRefCount(p);
             return TCL_ERROR;
         }
-        if (pMap == 0 || iIndex > iPrev) {
-            pMap = pTree->pText->pMapping;
-        }
-        for ( ; pMap; pMap = pMap->pNext) {
-            assert(!pMap->pNext || pMap->iStrIndex >= pMap->pNext->iStrIndex);
-            if (pMap->iStrIndex <= iIndex || !pMap->pNext) {
-                int iNodeIdx = pMap->iNodeIndex; 
-                Tcl_Obj *apObj[2];
-
-                int nExtra = iIndex - pMap->iStrIndex;
-                char *zExtra = &(pMap->pTextNode->zText[iNodeIdx]);
-                iNodeIdx += (Tcl_UtfAtIndex(zExtra, nExtra) - zExtra);
-
-                apObj[0] = HtmlNodeCommand(pTree, &pMap->pTextNode->node);
-                apObj[1] = Tcl_NewIntObj(iNodeIdx);
-                Tcl_ListObjReplace(0, p, 0, 0, 2, apObj);
-                break;
-            }
+        pMap = findMappingByStr(pTree->pText, iIndex);
+        if (pMap) {
+            int iNodeIdx = pMap->iNodeIndex; 
+            int nExtra = iIndex - pMap->iStrIndex;
+            char *zExtra = &(pMap->pTextNode->zText[iNodeIdx]);
+            iNodeIdx += (Tcl_UtfAtIndex(zExtra, nExtra) - zExtra);
+
+            Tcl_ListObjAppendElement(0, p, 
+                HtmlNodeCommand(pTree, &pMap->pTextNode->node)
+            );
+            Tcl_ListObjAppendElement(0, p, Tcl_NewIntObj(iNodeIdx));
         }
-        iPrev = iIndex;
     }
 
     Tcl_SetObjResult(interp, p);
@@ -1585,7 +2179,7 @@ HtmlTextOffsetCmd(clientData, interp, objc, objv)
         return TCL_ERROR;
     }
     if (
-        0 == (pNode = HtmlNodeGetPointer(pTree, Tcl_GetString(objv[3]))) ||
+        0 == (pNode = HtmlNodeFromObj(pTree, objv[3])) ||
         TCL_OK != Tcl_GetIntFromObj(interp, objv[4], &iIndex)
     ) {
         return TCL_ERROR;
@@ -1597,13 +2191,11 @@ HtmlTextOffsetCmd(clientData, interp, objc, objv)
     }
 
     initHtmlText(pTree);
-    for (pMap = pTree->pText->pMapping; pMap; pMap = pMap->pNext) {
-        if (pMap->pTextNode == pTextNode && pMap->iNodeIndex <= iIndex) {
-            char *zExtra = &pTextNode->zText[pMap->iNodeIndex];
-            int nExtra = iIndex - pMap->iNodeIndex;
-            iRet = pMap->iStrIndex + Tcl_NumUtfChars(zExtra, nExtra);
-            break;
-        }
+    pMap = findMappingByNode(pTree->pText, pTextNode, iIndex);
+    if (pMap) {
+        char *zExtra = &pTextNode->zText[pMap->iNodeIndex];
+        int nExtra = iIndex - pMap->iNodeIndex;
+        iRet = pMap->iStrIndex + Tcl_NumUtfChars(zExtra, nExtra);
     }
 
     if (iRet >= 0) {
@@ -1649,9 +2241,9 @@ HtmlTextBboxCmd(clientData, interp, objc, objv)
         return TCL_ERROR;
     }
     if (
-        0 == (pFrom=HtmlNodeGetPointer(pTree, Tcl_GetString(objv[3]))) ||
+        0 == (pFrom=HtmlNodeFromObj(pTree, objv[3])) ||
         TCL_OK != Tcl_GetIntFromObj(interp, objv[4], &iFrom) ||
-        0 == (pTo=HtmlNodeGetPointer(pTree, Tcl_GetString(objv[5]))) ||
+        0 == (pTo=HtmlNodeFromObj(pTree, objv[5])) ||
         TCL_OK != Tcl_GetIntFromObj(interp, objv[6], &iTo)
     ) {
         return TCL_ERROR;
@@ -2020,7 +2612,7 @@ HtmlTextSet(pText, n, z, isTrimEnd, isTrimStart)
     int nAlloc;                /* Number of bytes allocated */
 
     if (pText->aToken) {
-        HtmlFree(pText->aToken);
+        HtmlArenaFree(pText->aToken);
     }
 
     /* Make a temporary copy of the text and translate any embedded html 
@@ -2038,7 +2630,10 @@ HtmlTextSet(pText, n, z, isTrimEnd, isTrimStart)
 
     /* Allocate space for HtmlTextNode.aToken and HtmlTextNode.zText */
     nAlloc = nText + (nToken * sizeof(HtmlTextToken));
-    pText->aToken = (HtmlTextToken *)HtmlClearAlloc("TextNode.aToken", nAlloc);
+    pText->aToken = (HtmlTextToken *)HtmlArenaAlloc(
+        HtmlArenaOf(pText), "TextNode.aToken", nAlloc
+    );
+    memset(pText->aToken, 0, nAlloc);
     if (nText > 0) {
         pText->zText = (char *)&pText->aToken[nToken];
     } else {
@@ -2093,7 +2688,8 @@ HtmlTextSet(pText, n, z, isTrimEnd, isTrimStart)
 }
 
 HtmlTextNode *
-HtmlTextNew(n, z, isTrimEnd, isTrimStart)
+HtmlTextNew(pArena, n, z, isTrimEnd, isTrimStart)
+    HtmlArena *pArena;          /* Arena to allocate from (may be NULL) */
     int n;
     const char *z;
     int isTrimEnd;
@@ -2102,7 +2698,7 @@ HtmlTextNew(n, z, isTrimEnd, isTrimStart)
     HtmlTextNode *pText;
 
     /* Allocate space for the HtmlTextNode. */ 
-    pText = HtmlNew(HtmlTextNode);
+    pText = HtmlArenaNew(pArena, HtmlTextNode);
 
     HtmlTextSet(pText, n, z, isTrimEnd, isTrimStart);
     return pText;
@@ -2149,7 +2745,8 @@ void
 HtmlTextFree(p)
     HtmlTextNode *p;
 {
-    HtmlFree(p);
+    HtmlArenaFree(p->aToken);
+    HtmlArenaFree(p);
 }
 
 void
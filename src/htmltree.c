@@ -232,7 +232,7 @@ HtmlNodeClearStyle(pTree, pElem)
         HtmlComputedValuesRelease(pTree, pElem->pPropertyValues);
         HtmlComputedValuesRelease(pTree, pElem->pPreviousValues);
         HtmlCssInlineFree(pElem->pStyle);
-        HtmlCssFreeDynamics(pElem);
+        HtmlCssFreeDynamics(pTree, pElem);
         pElem->pStyle = 0;
         pElem->pPropertyValues = 0;
         pElem->pPreviousValues = 0;
@@ -242,21 +242,285 @@ HtmlNodeClearStyle(pTree, pElem)
     return 0;
 }
 
-int 
-HtmlNodeDeleteCommand(pTree, pNode)
+
+/*
+ * Document arena.
+ *
+ * HtmlElementNode, HtmlTextNode and HtmlAttributes structures (and the
+ * token arrays of text nodes) are allocated from a per-document arena
+ * (HtmlTree.pArena) instead of directly from the heap. The arena carves
+ * small allocations out of large blocks, using one free-list per size
+ * class so that memory released by DOM manipulation is reused. 
+ * Allocations larger than HTML_ARENA_MAX_CHUNK bytes are passed through to
+ * HtmlAlloc().
+ *
+ * Every allocation is preceded by an HtmlArenaChunk header that records
+ * the owner arena and size class, so HtmlArenaFree() does not need to be
+ * passed the arena. An allocation made with a NULL arena is a heap
+ * allocation with a header, and may also be passed to HtmlArenaFree().
+ *
+ * HtmlTreeClear() releases all arena blocks in a single step once the
+ * document has been freed. At that point HtmlArena.nLive must be zero.
+ *
+ * In HTML_DEBUG builds, arena blocks are accounted to the "HtmlArena" 
+ * topic reported by [::tkhtml::heapdebug]. The HtmlArena.nLive counter
+ * gives the number of allocations currently outstanding.
+ */
+#define HTML_ARENA_QUANTUM   16
+#define HTML_ARENA_MAX_CHUNK 512
+#define HTML_ARENA_NCLASS    (HTML_ARENA_MAX_CHUNK / HTML_ARENA_QUANTUM)
+#define HTML_ARENA_BLOCK     (32 * 1024)
+
+typedef union HtmlArenaChunk HtmlArenaChunk;
+typedef struct HtmlArenaBlock HtmlArenaBlock;
+
+union HtmlArenaChunk {
+    struct {
+        HtmlArena *pArena;      /* Owner arena, or NULL */
+        int iClass;             /* Size class, or -1 for heap allocations */
+    } hdr;
+    double align;               /* Force 8-byte alignment */
+    void *pAlign;
+};
+
+struct HtmlArenaBlock {
+    HtmlArenaBlock *pNext;      /* Next block in HtmlArena.pBlock list */
+    double align;               /* Chunks start after this field */
+};
+
+struct HtmlArena {
+    HtmlArenaBlock *pBlock;     /* List of allocated blocks */
+    char *zFree;                /* Unused space in pBlock */
+    int nFree;                  /* Bytes of unused space at zFree */
+    HtmlArenaChunk *apFree[HTML_ARENA_NCLASS];     /* Free-lists */
+
+    int nBlock;                 /* Number of blocks in pBlock list */
+    int nLive;                  /* Number of outstanding allocations */
+};
+
+/* Pointer to the link field of a chunk on a free-list */
+#define ARENA_NEXTFREE(pChunk) (*(HtmlArenaChunk **)(&(pChunk)[1]))
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlTreeArena --
+ *
+ *     Return the arena used to allocate nodes for the current document,
+ *     creating it if required.
+ *
+ * Results:
+ *     Pointer to arena.
+ *
+ * Side effects:
+ *     May set HtmlTree.pArena.
+ *
+ *---------------------------------------------------------------------------
+ */
+HtmlArena *
+HtmlTreeArena(pTree)
     HtmlTree *pTree;
-    HtmlNode *pNode;
 {
-    if (pNode->pNodeCmd) {
-        Tcl_Obj *pCommand = pNode->pNodeCmd->pCommand;
-        Tcl_DeleteCommand(pTree->interp, Tcl_GetString(pCommand));
-        Tcl_DecrRefCount(pCommand);
-        HtmlFree(pNode->pNodeCmd);
-        pNode->pNodeCmd = 0;
+    if (!pTree->pArena) {
+        pTree->pArena = HtmlNew(HtmlArena);
     }
-    return 0;
+    return pTree->pArena;
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlArenaAlloc --
+ *
+ *     Allocate nByte bytes of memory from arena pArena. If pArena is NULL,
+ *     the memory is allocated from the heap. Either way, the returned
+ *     pointer must be freed using HtmlArenaFree(), not HtmlFree().
+ *
+ *     The contents of the allocated memory are undefined. Use the
+ *     HtmlArenaNew() macro to allocate a zeroed structure.
+ *
+ * Results:
+ *     Pointer to allocated memory.
+ *
+ * Side effects:
+ *     May allocate a new arena block.
+ *
+ *---------------------------------------------------------------------------
+ */
+char *
+HtmlArenaAlloc(pArena, zTopic, nByte)
+    HtmlArena *pArena;
+    const char *zTopic;
+    int nByte;
+{
+    HtmlArenaChunk *pChunk;
+    int iClass;
+
+    if (!pArena || nByte > HTML_ARENA_MAX_CHUNK) {
+        int n = sizeof(HtmlArenaChunk) + nByte;
+        pChunk = (HtmlArenaChunk *)HtmlAlloc(zTopic, n);
+        iClass = -1;
+    } else {
+        iClass = (nByte > 0) ? ((nByte - 1) / HTML_ARENA_QUANTUM) : 0;
+        pChunk = pArena->apFree[iClass];
+        if (pChunk) {
+            pArena->apFree[iClass] = ARENA_NEXTFREE(pChunk);
+        } else {
+            int n = sizeof(HtmlArenaChunk) + (iClass+1) * HTML_ARENA_QUANTUM;
+            if (n > pArena->nFree) {
+                int nBlock = HTML_ARENA_BLOCK;
+                HtmlArenaBlock *pBlock = (HtmlArenaBlock *)HtmlAlloc(
+                    "HtmlArena", nBlock
+                );
+                pBlock->pNext = pArena->pBlock;
+                pArena->pBlock = pBlock;
+                pArena->zFree = (char *)&pBlock->align;
+                pArena->nFree = nBlock - (pArena->zFree - (char *)pBlock);
+                pArena->nBlock++;
+            }
+            pChunk = (HtmlArenaChunk *)pArena->zFree;
+            pArena->zFree += n;
+            pArena->nFree -= n;
+        }
+    }
+
+    pChunk->hdr.pArena = pArena;
+    pChunk->hdr.iClass = iClass;
+    if (pArena) {
+        pArena->nLive++;
+    }
+    return (char *)&pChunk[1];
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlArenaFree --
+ *
+ *     Free an allocation returned by HtmlArenaAlloc(). It is a no-op to
+ *     pass a NULL pointer to this function.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+void
+HtmlArenaFree(p)
+    void *p;
+{
+    if (p) {
+        HtmlArenaChunk *pChunk = &((HtmlArenaChunk *)p)[-1];
+        HtmlArena *pArena = pChunk->hdr.pArena;
+        int iClass = pChunk->hdr.iClass;
+
+        if (pArena) {
+            assert(pArena->nLive > 0);
+            pArena->nLive--;
+        }
+        if (iClass < 0) {
+            HtmlFree(pChunk);
+        } else {
+            assert(pArena && iClass < HTML_ARENA_NCLASS);
+            ARENA_NEXTFREE(pChunk) = pArena->apFree[iClass];
+            pArena->apFree[iClass] = pChunk;
+        }
+    }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlArenaOf --
+ *
+ *     Return the arena that allocation p (returned by HtmlArenaAlloc()) 
+ *     was allocated from. New structures related to p (i.e. the children 
+ *     of a node) may be allocated from the same arena.
+ *
+ * Results:
+ *     Pointer to arena, or NULL.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+HtmlArena *
+HtmlArenaOf(p)
+    const void *p;
+{
+    return p ? ((HtmlArenaChunk *)p)[-1].hdr.pArena : 0;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * treeArenaRelease --
+ *
+ *     Free all blocks of the document arena and the arena itself. This
+ *     is called once all nodes of the document have been freed, so there
+ *     should be no outstanding allocations from the arena.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     Clears HtmlTree.pArena.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+treeArenaRelease(pTree)
+    HtmlTree *pTree;
+{
+    HtmlArena *pArena = pTree->pArena;
+    if (pArena) {
+        HtmlArenaBlock *pBlock;
+        HtmlArenaBlock *pNext;
+        assert(pArena->nLive == 0);
+        for (pBlock = pArena->pBlock; pBlock; pBlock = pNext) {
+            pNext = pBlock->pNext;
+            HtmlFree(pBlock);
+        }
+        HtmlFree(pArena);
+        pTree->pArena = 0;
+    }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * nodeReserveChild --
+ *
+ *     Make sure there is space in the HtmlElementNode.apChildren[] array
+ *     of pElem for at least one more child. The array grows geometrically,
+ *     so that appending N children requires O(log N) reallocations.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     May reallocate pElem->apChildren.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+nodeReserveChild(pElem)
+    HtmlElementNode *pElem;
+{
+    assert(pElem->nChild <= pElem->nChildAlloc);
+    if (pElem->nChild == pElem->nChildAlloc) {
+        int nNew = pElem->nChildAlloc ? pElem->nChildAlloc * 2 : 4;
+        pElem->apChildren = (HtmlNode **)HtmlRealloc(
+            "HtmlNode.apChildren", (char *)pElem->apChildren, 
+            nNew * sizeof(HtmlNode *)
+        );
+        pElem->nChildAlloc = nNew;
+    }
+}
 
 /*
  *---------------------------------------------------------------------------
@@ -293,11 +557,14 @@ freeNode(pTree, pNode)
         if (!HtmlNodeIsText(pNode)) {
             /* Do HtmlElementNode specific destruction */
             HtmlElementNode *pElem = (HtmlElementNode *)pNode;
-            HtmlFree(pElem->pAttributes);
+            HtmlCssSearchIndexRemove(pTree, pNode);
+            HtmlTextFreeElement(pElem);
+            HtmlAttributesFree(pElem->pAttributes);
+            HtmlCssClassListFree(pElem);
 
             /* Delete the computed values caches. */
             HtmlNodeClearStyle(pTree, pElem);
-            HtmlCssFreeDynamics(pElem);
+            HtmlCssFreeDynamics(pTree, pElem);
 
             if (pElem->pOverride) {
                 Tcl_DecrRefCount(pElem->pOverride);
@@ -318,7 +585,7 @@ freeNode(pTree, pNode)
             HtmlTextNode *pTextNode = HtmlNodeAsText(pNode);
             assert(pTextNode);
             HtmlTagCleanupNode(pTextNode);
-            HtmlFree(pTextNode->aToken);
+            HtmlArenaFree(pTextNode->aToken);
         }
 
         /* Delete the computed values caches. */
@@ -326,7 +593,7 @@ freeNode(pTree, pNode)
 
         HtmlNodeDeleteCommand(pTree, pNode);
 
-        HtmlFree(pNode);
+        HtmlArenaFree(pNode);
     }
 }
 
@@ -650,7 +917,6 @@ nodeInsertChild(pTree, pElem, pBefore, pAfter, pChild)
     HtmlNode *pAfter;
     HtmlNode *pChild;
 {
-    int n;                  /* Number of bytes to alloc for pNode->apChildren */
     int ii;
     int iBefore;
 
@@ -690,11 +956,8 @@ nodeInsertChild(pTree, pElem, pBefore, pAfter, pChild)
 
     /* Extend the size of the HtmlElementNode.apChildren[] array */
     assert(pElem);
+    nodeReserveChild(pElem);
     pElem->nChild++;
-    n = (pElem->nChild) * sizeof(HtmlNode*);
-    pElem->apChildren = (HtmlNode **)HtmlRealloc(
-        "HtmlNode.apChildren", (char *)pElem->apChildren, n
-    );
 
     for (ii = (pElem->nChild - 1); ii > iBefore; ii--) {
         pElem->apChildren[ii] = pElem->apChildren[ii - 1];
@@ -734,24 +997,20 @@ HtmlNodeAddChild(pElem, eTag, zTag, pAttributes)
     const char *zTag;               /* Atom for tag name */
     HtmlAttributes *pAttributes;
 {
-    int n;                  /* Number of bytes to alloc for pNode->apChildren */
     int r;                  /* Return value */
     HtmlElementNode *pNew;  /* New child node */
 
     assert(pElem);
     
+    nodeReserveChild(pElem);
     r = pElem->nChild++;
-    n = (r+1) * sizeof(HtmlNode*);
-    pElem->apChildren = (HtmlNode **)HtmlRealloc(
-        "HtmlNode.apChildren", (char *)pElem->apChildren, n
-    );
 
     if (!zTag) {
         zTag = HtmlTypeToName(0, eTag);
     }
     assert(zTag);
 
-    pNew = HtmlNew(HtmlElementNode);
+    pNew = HtmlArenaNew(HtmlArenaOf(pElem), HtmlElementNode);
     pNew->pAttributes = pAttributes;
     pNew->node.pParent = (HtmlNode *)pElem;
     pNew->node.eTag = eTag;
@@ -767,7 +1026,6 @@ HtmlNodeAddTextChild(pNode, pTextNode)
     HtmlNode *pNode;
     HtmlTextNode *pTextNode;
 {
-    int n;             /* Number of bytes to alloc for pNode->apChildren */
     int r;             /* Return value */
     HtmlNode *pNew;    /* New child node */
 
@@ -776,11 +1034,8 @@ HtmlNodeAddTextChild(pNode, pTextNode)
     assert(pElem);
     assert(pTextNode);
     
+    nodeReserveChild(pElem);
     r = pElem->nChild++;
-    n = (r+1) * sizeof(HtmlNode*);
-    pElem->apChildren = (HtmlNode **)HtmlRealloc(
-        "HtmlNode.apChildren", (char *)pElem->apChildren, n
-    );
 
     pNew = (HtmlNode *)pTextNode;
     memset(pNew, 0, sizeof(HtmlNode));
@@ -797,61 +1052,39 @@ HtmlNodeAddTextChild(pNode, pTextNode)
  *
  * setNodeAttribute --
  *
- *     Set the value of an attribute on a node. This function is currently
- *     a bit inefficient, due to the way the HtmlToken structure is 
- *     allocated.
+ *     Set the value of an attribute on a node. If the attribute already
+ *     exists its value is replaced in place (see HtmlAttributesSet()).
  *
  * Results:
  *     None
  *
  * Side effects:
- *     Modifies the HtmlToken structure associated with the specified node.
+ *     Modifies the HtmlAttributes structure associated with the node.
  *
  *---------------------------------------------------------------------------
  */
 static void
-setNodeAttribute(pNode, zAttrName, zAttrVal)
+setNodeAttribute(pTree, pNode, zAttrName, zAttrVal)
+    HtmlTree *pTree;
     HtmlNode *pNode;
     const char *zAttrName;
     const char *zAttrVal;
 {
-    #define MAX_NUM_ATTRIBUTES 100
-    char const *azPtr[MAX_NUM_ATTRIBUTES * 2];
-    int aLen[MAX_NUM_ATTRIBUTES * 2];
-
-    int i;
-    int isDone = 0;
-    int nArgs;
     HtmlElementNode *pElem;
-    HtmlAttributes *pAttr;
 
     pElem = HtmlNodeAsElement(pNode);
     if (!pElem) return;
-    pAttr = pElem->pAttributes;
-
-    for (i = 0; pAttr && i < pAttr->nAttr && i < MAX_NUM_ATTRIBUTES; i++) {
-        azPtr[i*2] = pAttr->a[i].zName;
-        if (0 != strcmp(pAttr->a[i].zName, zAttrName)) {
-            azPtr[i*2+1] = pAttr->a[i].zValue;
-        } else {
-            azPtr[i*2+1] = zAttrVal;
-            isDone = 1;
-        }
-    }
-
-    if (!isDone && i < MAX_NUM_ATTRIBUTES) {
-        azPtr[i*2] = zAttrName;
-        azPtr[i*2+1] = zAttrVal;
-        i++;
-    }
 
-    nArgs = i * 2;
-    for (i = 0; i < nArgs; i++) {
-        aLen[i] = strlen(azPtr[i]);
-    }
+    /* The search index is keyed on attribute values, so remove the node
+     * from it while the attributes are being modified. 
+     */
+    HtmlCssSearchIndexRemove(pTree, pNode);
 
-    pElem->pAttributes = HtmlAttributesNew(nArgs, azPtr, aLen, 0);
-    HtmlFree(pAttr);
+    pElem->pAttributes = HtmlAttributesSet(pTree, 
+        HtmlArenaOf(pElem), pElem->pAttributes, zAttrName, zAttrVal
+    );
+    HtmlCssClassListFree(pElem);
+    HtmlCssSearchIndexAdd(pTree, pNode);
 
     /* If this was a call to set the "style" attribute, discard the
      * compiled version at version HtmlElementNode.pStyle.
@@ -863,15 +1096,16 @@ setNodeAttribute(pNode, zAttrName, zAttrVal)
 }
 
 static void
-mergeAttributes(pNode, pAttr)
+mergeAttributes(pTree, pNode, pAttr)
+    HtmlTree *pTree;
     HtmlNode *pNode;
     HtmlAttributes *pAttr;
 {
     int ii;
     for (ii = 0; pAttr && ii < pAttr->nAttr; ii++) {
-        setNodeAttribute(pNode, pAttr->a[ii].zName, pAttr->a[ii].zValue);
+        setNodeAttribute(pTree, pNode, pAttr->a[ii].zName, pAttr->a[ii].zValue);
     }
-    HtmlFree(pAttr);
+    HtmlAttributesFree(pAttr);
 }
 
 static int
@@ -929,9 +1163,14 @@ doParseHandler(pTree, eType, pNode, iOffset)
         } else {
             Tcl_ListObjAppendElement(0, pScript, Tcl_NewStringObj("", -1));
         }
-        Tcl_ListObjAppendElement(
-            0, pScript, Tcl_NewIntObj(iOffset + pTree->nParsed)
-        );
+        /* Both iOffset and HtmlTree.nParsed are relative to the start of
+         * HtmlTree.pDocument. If the -discardparsed option has removed
+         * text from the start of the document, add it back to each so
+         * that the reported offset does not depend on the option.
+         */
+        Tcl_ListObjAppendElement(0, pScript, Tcl_NewIntObj(
+            iOffset + pTree->nParsed + 2 * pTree->nDiscard
+        ));
 
         rc = Tcl_EvalObjEx(pTree->interp, pScript, TCL_EVAL_GLOBAL);
         Tcl_DecrRefCount(pScript);
@@ -981,7 +1220,7 @@ HtmlInitTree(pTree)
          */
         HtmlElementNode *pRoot;
 
-        pRoot = HtmlNew(HtmlElementNode);
+        pRoot = HtmlArenaNew(HtmlTreeArena(pTree), HtmlElementNode);
         pRoot->node.eTag = Html_HTML;
         pRoot->node.zTag = HtmlTypeToName(pTree, Html_HTML);
         pTree->pRoot = (HtmlNode *)pRoot;
@@ -989,6 +1228,9 @@ HtmlInitTree(pTree)
 
         HtmlNodeAddChild(pRoot, Html_HEAD, HtmlTypeToName(pTree, Html_HEAD), 0);
         HtmlNodeAddChild(pRoot, Html_BODY, HtmlTypeToName(pTree, Html_BODY), 0);
+        HtmlCssSearchIndexAdd(pTree, (HtmlNode *)pRoot);
+        HtmlCssSearchIndexAdd(pTree, HtmlNodeChild(pTree->pRoot, 0));
+        HtmlCssSearchIndexAdd(pTree, HtmlNodeChild(pTree->pRoot, 1));
         HtmlCallbackRestyle(pTree, (HtmlNode *)pRoot);
     }
 
@@ -1106,7 +1348,7 @@ treeAddFosterElement(pTree, eTag, zTag, pAttr)
         int n = HtmlNodeAddChild((HtmlElementNode *)pFoster, eTag, zTag, pAttr);
         pNew = HtmlNodeChild(pFoster, n);
     } else {
-        pNew = (HtmlNode *)HtmlNew(HtmlElementNode);
+        pNew = (HtmlNode *)HtmlArenaNew(HtmlTreeArena(pTree), HtmlElementNode);
         ((HtmlElementNode *)pNew)->pAttributes = pAttr;
         pNew->eTag = eTag;
         if (!zTag) {
@@ -1114,9 +1356,13 @@ treeAddFosterElement(pTree, eTag, zTag, pAttr)
         }
         pNew->zTag = zTag;
         nodeInsertChild(pTree, (HtmlElementNode *)pFosterParent,pBefore,0,pNew);
+
+        /* The new node precedes the table in tree order. */
+        pTree->isSequenceOk = 0;
     }
 
     pNew->iNode = pTree->iNextNode++;
+    HtmlCssSearchIndexAdd(pTree, pNew);
     if (HtmlMarkupFlags(eTag) & HTMLTAG_EMPTY) {
         nodeHandlerCallbacks(pTree, pNew);
         pTree->state.pFoster = HtmlNodeParent(pNew);
@@ -1183,7 +1429,7 @@ treeAddTableComponent(pTree, eTag, pAttr)
         ) break;
     }
     if (!pParent) {
-        HtmlFree(pAttr);
+        HtmlAttributesFree(pAttr);
         return pParent;
     }
     eParentTag = HtmlNodeTagType(pParent);
@@ -1208,6 +1454,7 @@ treeAddTableComponent(pTree, eTag, pAttr)
         int n2 = HtmlNodeAddChild((HtmlElementNode *)pParent, Html_TBODY, 0, 0);
         pParent = HtmlNodeChild(pParent, n2);
         pParent->iNode = pTree->iNextNode++;
+        HtmlCssSearchIndexAdd(pTree, pParent);
         eParentTag = Html_TBODY;
     }
 
@@ -1216,6 +1463,7 @@ treeAddTableComponent(pTree, eTag, pAttr)
         int n2 = HtmlNodeAddChild((HtmlElementNode *)pParent, Html_TR, 0, 0);
         pParent = HtmlNodeChild(pParent, n2);
         pParent->iNode = pTree->iNextNode++;
+        HtmlCssSearchIndexAdd(pTree, pParent);
         eParentTag = Html_TR;
     }
     
@@ -1223,6 +1471,7 @@ treeAddTableComponent(pTree, eTag, pAttr)
     n = HtmlNodeAddChild((HtmlElementNode *)pParent, eTag, 0, pAttr);
     pNew = HtmlNodeChild(pParent, n);
     pNew->iNode = pTree->iNextNode++;
+    HtmlCssSearchIndexAdd(pTree, pNew);
     pTree->state.pCurrent = pNew;
 
     /* Return a pointer to the node just added */
@@ -1294,17 +1543,17 @@ HtmlTreeAddElement(pTree, eType, zType, pAttr, iOffset)
     switch (eType) {
         case Html_HTML:
             pParsed = pTree->pRoot;
-            mergeAttributes(pParsed, pAttr);
+            mergeAttributes(pTree, pParsed, pAttr);
             HtmlCallbackRestyle(pTree, pParsed);
             break;
         case Html_HEAD:
             pParsed = pHeadNode;
-            mergeAttributes(pParsed, pAttr);
+            mergeAttributes(pTree, pParsed, pAttr);
             HtmlCallbackRestyle(pTree, pParsed);
             break;
         case Html_BODY:
             pParsed = pBodyNode;
-            mergeAttributes(pParsed, pAttr);
+            mergeAttributes(pTree, pParsed, pAttr);
             HtmlCallbackRestyle(pTree, pParsed);
             break;
 
@@ -1321,6 +1570,8 @@ HtmlTreeAddElement(pTree, eType, zType, pAttr, iOffset)
             HtmlNode *p = HtmlNodeChild(pHeadNode, n);
             pTree->state.isCdataInHead = 1;
             p->iNode = pTree->iNextNode++;
+            pTree->isSequenceOk = 0;
+            HtmlCssSearchIndexAdd(pTree, p);
             pParsed = p;
             HtmlCallbackRestyle(pTree, pParsed);
             break;
@@ -1333,6 +1584,8 @@ HtmlTreeAddElement(pTree, eType, zType, pAttr, iOffset)
             int n = HtmlNodeAddChild(pHeadElem, eType, 0, pAttr);
             HtmlNode *p = HtmlNodeChild(pHeadNode, n);
             p->iNode = pTree->iNextNode++;
+            pTree->isSequenceOk = 0;
+            HtmlCssSearchIndexAdd(pTree, p);
             nodeHandlerCallbacks(pTree, p);
             if (pTree->eWriteState != HTML_WRITE_INHANDLERRESET) {
                 pParsed = p;
@@ -1383,6 +1636,7 @@ HtmlTreeAddElement(pTree, eType, zType, pAttr, iOffset)
                 N = HtmlNodeAddChild(pC, eType, zType, pAttr);
                 pCurrent = HtmlNodeChild(pCurrent, N);
                 pCurrent->iNode = pTree->iNextNode++;
+                HtmlCssSearchIndexAdd(pTree, pCurrent);
                 pParsed = pCurrent;
 
                 assert(!isTableType || eType == Html_FORM);
@@ -1984,7 +2238,7 @@ nodeRemoveCmd(pNode, objc, objv)
         for (jj = 0; jj < nNode; jj++) {
             int e;
             Tcl_Obj *pObj = apNode[jj];
-            HtmlNode *pChild = HtmlNodeGetPointer(pTree, Tcl_GetString(pObj));
+            HtmlNode *pChild = HtmlNodeFromObj(pTree, pObj);
             e = nodeRemoveChild((HtmlElementNode *)pNode, pChild);
             if (e) {
                 nodeOrphanize(pTree, pChild);
@@ -2081,7 +2335,7 @@ nodeInsertCmd(pNode, objc, objv)
             0 == strcmp(Tcl_GetString(objv[2]), "-after")
     )) {
         int iBefore;
-        pBefore = HtmlNodeGetPointer(pTree, Tcl_GetString(objv[3]));
+        pBefore = HtmlNodeFromObj(pTree, objv[3]);
         iBefore = HtmlNodeIndexOfChild(pNode, pBefore);
         if (iBefore < 0) {
             Tcl_ResetResult(pTree->interp);
@@ -2114,7 +2368,7 @@ nodeInsertCmd(pNode, objc, objv)
 
         for (jj = 0; jj < nNode; jj++) {
             Tcl_Obj *pObj = apNode[jj];
-            HtmlNode *pChild = HtmlNodeGetPointer(pTree, Tcl_GetString(pObj));
+            HtmlNode *pChild = HtmlNodeFromObj(pTree, pObj);
             if (pChild) {
                 HtmlElementNode *pElem = HtmlNodeAsElement(pNode);
                 if (pChild->iNode == HTML_NODE_ORPHAN) {
@@ -2138,7 +2392,7 @@ nodeGetStyle(pTree, p)
 {
     HtmlElementNode *pElem = HtmlNodeAsElement(p);
     const char *zStyle;
-    if (!pElem->pStyle && (zStyle = HtmlNodeAttr(p, "style"))) { 
+    if (!pElem->pStyle && (zStyle = HtmlAttrStyle(pElem->pAttributes))) { 
         HtmlCssInlineParse(pTree, -1, zStyle, &pElem->pStyle);
     }
     return pElem->pStyle;
@@ -2240,6 +2494,7 @@ nodeTextCommand(interp, pNode, objc, objv)
         /* Set the node to contain the new text */
         zNew = Tcl_GetStringFromObj(objv[3], &nNew);
         HtmlTextSet(pOrig, nNew, zNew, 0, 0);
+        HtmlTextInvalidateNode(pTree, pNode);
 
     } else if (eChoice == NODE_TEXT_PRE) {
         pRet = nodeGetPreText(HtmlNodeAsText(pNode));
@@ -2447,7 +2702,7 @@ nodeCommand(clientData, interp, objc, objv)
                 if (rc != TCL_OK) {
                     return rc;
                 }
-                setNodeAttribute(pNode, zAttrName, zAttrVal);
+                setNodeAttribute(pTree, pNode, zAttrName, zAttrVal);
                 HtmlCallbackRestyle(pTree, pNode);
             }
 
@@ -2498,7 +2753,7 @@ node_attr_usage:
                 Tcl_Obj *pRes = Tcl_NewObj();
                 for (i = 0; i < HtmlNodeNumChildren(pNode); i++) {
                     HtmlNode *pChild = HtmlNodeChild(pNode, i);
-                    Tcl_Obj *pCmd = HtmlNodeCommand(pTree, pChild);
+                    Tcl_Obj *pCmd = HtmlNodeHandle(pTree, pChild);
                     Tcl_ListObjAppendElement(0, pRes, pCmd);
                 }
                 Tcl_SetObjResult(interp, pRes);
@@ -2552,7 +2807,7 @@ node_attr_usage:
             HtmlNode *pParent;
             pParent = HtmlNodeParent(pNode);
             if (pParent) {
-                Tcl_SetObjResult(interp, HtmlNodeCommand(pTree, pParent));
+                Tcl_SetObjResult(interp, HtmlNodeHandle(pTree, pParent));
             } 
             break;
         }
@@ -2888,6 +3143,242 @@ node_attr_usage:
     return TCL_OK;
 }
 
+/*
+ * Node handles.
+ *
+ * Each node that is returned to script is assigned a handle of the form
+ * "::tkhtml::nodeN", where N is a per-interpreter counter. The handle is
+ * described by an HtmlNodeCmd structure, and the HtmlNodeCmd structures
+ * of all live nodes are stored in the HtmlInterpData.aNodeHandle hash 
+ * table, keyed by N. Since this table is per-interpreter (and so 
+ * per-thread), no locking is required, and a handle can never resolve
+ * to a node belonging to another interpreter. HtmlNodeGetPointer() and
+ * HtmlNodeFromObj() also reject handles that belong to another widget.
+ *
+ * A Tcl_Obj that has been used as a node handle caches a pointer to the
+ * HtmlNodeCmd in its internal representation (type "tkhtml-node"), so
+ * that subsequent lookups do not need to parse the handle or search any
+ * table. The HtmlNodeCmd is reference counted, and its pNode field set
+ * to NULL when the node is deleted, so a stale Tcl_Obj is detected
+ * instead of dereferencing freed memory.
+ *
+ * Unless the -nodecommands option is set to false, a Tcl command with
+ * the same name as the handle is also created, so that the handle may
+ * be invoked as "$node attribute" etc. Otherwise, the [search], [node]
+ * and [children] commands return handles without creating commands,
+ * and the handle is used via "::tkhtml::node $node attribute". Both
+ * forms invoke the same nodeCommand() implementation.
+ */
+#define NODE_HANDLE_PREFIX "::tkhtml::node"
+
+static void nodeHandleFreeIntRep(Tcl_Obj *);
+static void nodeHandleDupIntRep(Tcl_Obj *, Tcl_Obj *);
+
+static Tcl_ObjType nodeHandleType = {
+    "tkhtml-node",              /* name */
+    nodeHandleFreeIntRep,       /* freeIntRepProc */
+    nodeHandleDupIntRep,        /* dupIntRepProc */
+    0,                          /* updateStringProc */
+    0                           /* setFromAnyProc */
+};
+
+static void
+nodeHandleRelease(p)
+    HtmlNodeCmd *p;
+{
+    p->nRef--;
+    assert(p->nRef >= 0);
+    if (p->nRef == 0) {
+        assert(!p->pNode && !p->pCommand);
+        HtmlFree(p);
+    }
+}
+
+static void
+nodeHandleFreeIntRep(pObj)
+    Tcl_Obj *pObj;
+{
+    nodeHandleRelease((HtmlNodeCmd *)pObj->internalRep.otherValuePtr);
+    pObj->typePtr = 0;
+}
+
+static void
+nodeHandleDupIntRep(pSrc, pCopy)
+    Tcl_Obj *pSrc;
+    Tcl_Obj *pCopy;
+{
+    HtmlNodeCmd *p = (HtmlNodeCmd *)pSrc->internalRep.otherValuePtr;
+    p->nRef++;
+    pCopy->internalRep.otherValuePtr = (void *)p;
+    pCopy->typePtr = &nodeHandleType;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * nodeHandleSetObj --
+ *
+ *     Set the internal representation of pObj to refer to handle p. The
+ *     string representation of pObj must already be the handle name.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     Frees any previous internal representation of pObj. Increments
+ *     the reference count of p.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+nodeHandleSetObj(pObj, p)
+    Tcl_Obj *pObj;
+    HtmlNodeCmd *p;
+{
+    if (pObj->typePtr && pObj->typePtr->freeIntRepProc) {
+        pObj->typePtr->freeIntRepProc(pObj);
+    }
+    p->nRef++;
+    pObj->internalRep.otherValuePtr = (void *)p;
+    pObj->typePtr = &nodeHandleType;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * nodeHandleLookup --
+ *
+ *     Return the HtmlNodeCmd structure for the node-handle named by zName,
+ *     or NULL if zName is not the handle of a live node of interpreter
+ *     pInterpData.
+ *
+ * Results:
+ *     Pointer to HtmlNodeCmd or NULL.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static HtmlNodeCmd *
+nodeHandleLookup(pInterpData, zName)
+    HtmlInterpData *pInterpData;
+    const char *zName;
+{
+    const char *z = zName;
+    int iHandle = 0;
+    Tcl_HashEntry *pEntry;
+
+    const char *zPrefix = NODE_HANDLE_PREFIX;
+
+    if (z[0] != ':') zPrefix += 2;            /* Allow "tkhtml::nodeN" */
+    if (strncmp(z, zPrefix, strlen(zPrefix))) return 0;
+    z += strlen(zPrefix);
+    if (*z < '0' || *z > '9') return 0;
+    for ( ; *z >= '0' && *z <= '9'; z++) {
+        iHandle = iHandle * 10 + (*z - '0');
+    }
+    if (*z) return 0;
+
+    pEntry = Tcl_FindHashEntry(
+        &pInterpData->aNodeHandle, (char *)((size_t) iHandle)
+    );
+    return pEntry ? (HtmlNodeCmd *)Tcl_GetHashValue(pEntry) : 0;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * nodeHandleFromObj --
+ *
+ *     Return the HtmlNodeCmd structure for the node-handle pObj, or NULL
+ *     if pObj is not the handle of a live node of interpreter pInterpData.
+ *     An internal representation cached by another interpreter, or for
+ *     a node that has since been deleted, is not trusted.
+ *
+ * Results:
+ *     Pointer to HtmlNodeCmd or NULL.
+ *
+ * Side effects:
+ *     May change the internal representation of pObj.
+ *
+ *---------------------------------------------------------------------------
+ */
+static HtmlNodeCmd *
+nodeHandleFromObj(pInterpData, pObj)
+    HtmlInterpData *pInterpData;
+    Tcl_Obj *pObj;
+{
+    HtmlNodeCmd *p;
+    if (pObj->typePtr == &nodeHandleType) {
+        p = (HtmlNodeCmd *)pObj->internalRep.otherValuePtr;
+        if (p->pNode && p->pTree->pInterpData == pInterpData) {
+            return p;
+        }
+    }
+    p = nodeHandleLookup(pInterpData, Tcl_GetString(pObj));
+    if (p) {
+        nodeHandleSetObj(pObj, p);
+    }
+    return p;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * nodeHandleGet --
+ *
+ *     Return the HtmlNodeCmd structure for node pNode, allocating it
+ *     if required. The Tcl command is not created by this function.
+ *
+ * Results:
+ *     Pointer to HtmlNodeCmd, or NULL for a generated node.
+ *
+ * Side effects:
+ *     May allocate a new handle and add it to the 
+ *     HtmlInterpData.aNodeHandle table.
+ *
+ *---------------------------------------------------------------------------
+ */
+static HtmlNodeCmd *
+nodeHandleGet(pTree, pNode)
+    HtmlTree *pTree;
+    HtmlNode *pNode;
+{
+    HtmlNodeCmd *p = pNode->pNodeCmd;
+
+    if (pNode->iNode == HTML_NODE_GENERATED) {
+        return 0;
+    }
+
+    if (!p) {
+        HtmlInterpData *pInterpData = pTree->pInterpData;
+        char zBuf[100];
+        int isNew;
+        Tcl_HashEntry *pEntry;
+
+        p = HtmlNew(HtmlNodeCmd);
+        p->pTree = pTree;
+        p->pNode = pNode;
+        p->iHandle = pInterpData->iNodeHandle++;
+        p->nRef = 1;
+
+        sprintf(zBuf, "%s%d", NODE_HANDLE_PREFIX, p->iHandle);
+        p->pCommand = Tcl_NewStringObj(zBuf, -1);
+        Tcl_IncrRefCount(p->pCommand);
+        nodeHandleSetObj(p->pCommand, p);
+
+        pEntry = Tcl_CreateHashEntry(
+            &pInterpData->aNodeHandle, (char *)((size_t) p->iHandle), &isNew
+        );
+        assert(isNew);
+        Tcl_SetHashValue(pEntry, p);
+        pNode->pNodeCmd = p;
+    }
+
+    return p;
+}
+
 /*
  *---------------------------------------------------------------------------
  *
@@ -2896,7 +3387,8 @@ node_attr_usage:
  *     Return a Tcl object containing the name of the Tcl command used to
  *     access pNode. If the command does not already exist it is created.
  *
- *     The Tcl_Obj * returned is always a pointer to pNode->pCommand.
+ *     The Tcl_Obj * returned is always a pointer to 
+ *     pNode->pNodeCmd->pCommand.
  *
  * Results:
  *     None.
@@ -2911,28 +3403,131 @@ HtmlNodeCommand(pTree, pNode)
     HtmlTree *pTree;
     HtmlNode *pNode;
 {
-    static int nodeNumber = 0;
-    HtmlNodeCmd *pNodeCmd = pNode->pNodeCmd;
-
-    if (pNode->iNode == HTML_NODE_GENERATED) {
+    HtmlNodeCmd *p = nodeHandleGet(pTree, pNode);
+    if (!p) {
         return 0;
     }
+    if (!p->isCommand) {
+        const char *zCmd = Tcl_GetString(p->pCommand);
+        Tcl_CreateObjCommand(pTree->interp, zCmd, nodeCommand, pNode, 0);
+        p->isCommand = 1;
+    }
+    return p->pCommand;
+}
 
-    if (!pNodeCmd) {
-        char zBuf[100];
-        Tcl_Obj *pCmd;
-        sprintf(zBuf, "::tkhtml::node%d", nodeNumber++);
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlNodeHandle --
+ *
+ *     Return a Tcl object containing the node-handle for pNode. This is
+ *     the same as HtmlNodeCommand(), except that if the -nodecommands
+ *     option is false the Tcl command is not created.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+Tcl_Obj *
+HtmlNodeHandle(pTree, pNode)
+    HtmlTree *pTree;
+    HtmlNode *pNode;
+{
+    HtmlNodeCmd *p;
+    if (pTree->options.nodecommands) {
+        return HtmlNodeCommand(pTree, pNode);
+    }
+    p = nodeHandleGet(pTree, pNode);
+    return p ? p->pCommand : 0;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlNodeDeleteCommand --
+ *
+ *     Called when node pNode is about to be deleted. Delete the Tcl
+ *     command for the node (if any) and invalidate its handle.
+ *
+ * Results:
+ *     Always returns 0.
+ *
+ * Side effects:
+ *     Any Tcl_Obj that refers to the handle is left referring to a
+ *     deleted node. HtmlNodeFromObj() returns NULL for such objects.
+ *
+ *---------------------------------------------------------------------------
+ */
+int 
+HtmlNodeDeleteCommand(pTree, pNode)
+    HtmlTree *pTree;
+    HtmlNode *pNode;
+{
+    HtmlNodeCmd *p = pNode->pNodeCmd;
+    if (p) {
+        Tcl_Obj *pCommand = p->pCommand;
+        Tcl_HashEntry *pEntry;
+
+        if (p->isCommand) {
+            Tcl_DeleteCommand(pTree->interp, Tcl_GetString(pCommand));
+            p->isCommand = 0;
+        }
+        pEntry = Tcl_FindHashEntry(
+            &pTree->pInterpData->aNodeHandle, (char *)((size_t) p->iHandle)
+        );
+        assert(pEntry && Tcl_GetHashValue(pEntry) == (ClientData)p);
+        Tcl_DeleteHashEntry(pEntry);
 
-        pCmd = Tcl_NewStringObj(zBuf, -1);
-        Tcl_IncrRefCount(pCmd);
-        Tcl_CreateObjCommand(pTree->interp, zBuf, nodeCommand, pNode, 0);
-        pNodeCmd = HtmlNew(HtmlNodeCmd);
-        pNodeCmd->pCommand = pCmd;
-        pNodeCmd->pTree = pTree;
-        pNode->pNodeCmd = pNodeCmd;
+        pNode->pNodeCmd = 0;
+        p->pNode = 0;
+        p->pCommand = 0;
+        nodeHandleRelease(p);
+        Tcl_DecrRefCount(pCommand);
     }
+    return 0;
+}
 
-    return pNodeCmd->pCommand;
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlNodeDispatchCmd --
+ *
+ *     ::tkhtml::node NODE-HANDLE SUBCOMMAND ?ARGS?
+ *
+ *     Invoke a node-handle subcommand on the node identified by
+ *     NODE-HANDLE. This works whether or not a Tcl command exists for
+ *     the handle (see the -nodecommands option).
+ *
+ * Results:
+ *     Standard Tcl result.
+ *
+ * Side effects:
+ *     Whatever the node-handle subcommand does.
+ *
+ *---------------------------------------------------------------------------
+ */
+int
+HtmlNodeDispatchCmd(clientData, interp, objc, objv)
+    ClientData clientData;
+    Tcl_Interp *interp;
+    int objc;
+    Tcl_Obj *CONST objv[];
+{
+    HtmlNodeCmd *p;
+    if (objc < 3) {
+        Tcl_WrongNumArgs(interp, 1, objv, "NODE-HANDLE SUBCOMMAND ...");
+        return TCL_ERROR;
+    }
+    p = nodeHandleFromObj(HtmlInterpDataGet(interp), objv[1]);
+    if (!p || p->pTree->interp != interp) {
+        Tcl_AppendResult(interp, "no such node: ", Tcl_GetString(objv[1]), 0);
+        return TCL_ERROR;
+    }
+    return nodeCommand((ClientData)p->pNode, interp, objc - 1, &objv[1]);
 }
 
 /*
@@ -3014,8 +3609,9 @@ int HtmlTreeClear(pTree)
     HtmlDrawSnapshotFree(pTree, pTree->cb.pSnapshot);
     pTree->cb.pSnapshot = 0;
 
-    /* Free the contents of the search-cache */
+    /* Free the contents of the search-cache and the search index */
     HtmlCssSearchInvalidateCache(pTree);
+    HtmlCssSearchIndexReset(pTree);
 
     /* Free the tree representation - pTree->pRoot */
     freeNode(pTree, pTree->pRoot);
@@ -3036,6 +3632,9 @@ int HtmlTreeClear(pTree)
     Tcl_DeleteHashTable(&pTree->aOrphan);
     Tcl_InitHashTable(&pTree->aOrphan, TCL_ONE_WORD_KEYS);
 
+    /* Now that all nodes have been freed, release the document arena */
+    treeArenaRelease(pTree);
+
     /* Free the formatted text, if any (HtmlTree.pText) */
     HtmlTextInvalidate(pTree);
 
@@ -3044,6 +3643,7 @@ int HtmlTreeClear(pTree)
         Tcl_DecrRefCount(pTree->pDocument);
     }
     pTree->nParsed = 0;
+    pTree->nDiscard = 0;
     pTree->pDocument = 0;
 
     /* Free the stylesheets */
@@ -3056,6 +3656,7 @@ int HtmlTreeClear(pTree)
 
     /* Deschedule any dynamic, style or layout callback. */
     pTree->cb.pDynamic = 0;
+    pTree->cb.nDynamic = 0;
     pTree->cb.pRestyle = 0;
     pTree->cb.flags &= ~(HTML_DYNAMIC|HTML_RESTYLE|HTML_LAYOUT);
 
@@ -3068,13 +3669,13 @@ int HtmlTreeClear(pTree)
  *
  * HtmlNodeGetPointer --
  *
- *     String argument zCmd is the name of a node command created for
- *     some node of tree pTree. Find the corresponding HtmlNode pointer
- *     and return it. If zCmd is not the name of a node command, leave
- *     an error in pTree->interp and return NULL.
+ *     String argument zCmd is the node-handle of some node of tree pTree.
+ *     Find the corresponding HtmlNode pointer and return it. If zCmd is
+ *     not the handle of a live node of pTree, leave an error in 
+ *     pTree->interp and return NULL.
  *
  * Results:
- *     Pointer to node object associated with Tcl command zCmd, or NULL.
+ *     Pointer to node object associated with handle zCmd, or NULL.
  *
  * Side effects:
  *     None.
@@ -3086,16 +3687,44 @@ HtmlNodeGetPointer(pTree, zCmd)
     HtmlTree *pTree;
     char CONST *zCmd;
 {
-    Tcl_Interp *interp = pTree->interp;
-    Tcl_CmdInfo info;
-    int rc;
+    HtmlNodeCmd *p = nodeHandleLookup(pTree->pInterpData, zCmd);
+    if (!p || p->pTree != pTree) {
+        Tcl_AppendResult(pTree->interp, "no such node: ", zCmd, NULL);
+        return 0;
+    }
+    return p->pNode;
+}
 
-    rc = Tcl_GetCommandInfo(interp, zCmd, &info);
-    if (rc == 0 || info.objProc != nodeCommand){ 
-        Tcl_AppendResult(interp, "no such node: ", zCmd, NULL);
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlNodeFromObj --
+ *
+ *     Same as HtmlNodeGetPointer(), except that the node-handle is
+ *     passed as a Tcl object. The handle is cached in the internal 
+ *     representation of pObj, so that repeated lookups are O(1).
+ *
+ * Results:
+ *     Pointer to node object associated with handle pObj, or NULL.
+ *
+ * Side effects:
+ *     May change the internal representation of pObj.
+ *
+ *---------------------------------------------------------------------------
+ */
+HtmlNode *
+HtmlNodeFromObj(pTree, pObj)
+    HtmlTree *pTree;
+    Tcl_Obj *pObj;
+{
+    HtmlNodeCmd *p = nodeHandleFromObj(pTree->pInterpData, pObj);
+    if (!p || p->pTree != pTree) {
+        Tcl_AppendResult(pTree->interp, 
+            "no such node: ", Tcl_GetString(pObj), NULL
+        );
         return 0;
     }
-    return (HtmlNode *)info.objClientData;
+    return p->pNode;
 }
 
 /************************************************************************
@@ -3181,7 +3810,7 @@ fragmentAddElement(pTree, eType, zType, pAttributes, iOffset)
         fragmentOrphan(pTree);
     }
 
-    pElem = HtmlNew(HtmlElementNode);
+    pElem = HtmlArenaNew(HtmlTreeArena(pTree), HtmlElementNode);
     pElem->pAttributes = pAttributes;
     pElem->node.eTag = eType;
     if (!zType) {
@@ -3197,6 +3826,7 @@ fragmentAddElement(pTree, eType, zType, pAttributes, iOffset)
         pElem->node.iNode = HTML_NODE_ORPHAN;
     }
     pFragment->pCurrent = pElem;
+    HtmlCssSearchIndexAdd(pTree, (HtmlNode *)pElem);
 
     if (HtmlMarkup(eType)->flags & HTMLTAG_EMPTY) {
         nodeHandlerCallbacks(pTree, pFragment->pCurrent);
@@ -349,6 +349,14 @@ ResDump()
 static Tcl_HashTable aMalloc;
 static Tcl_HashTable aAllocationType;
 
+/*
+ * Total number of bytes currently allocated via Rt_Alloc() and 
+ * Rt_Realloc(), and the high-water mark of the same quantity since the
+ * last [::tkhtml::heapdebug -peak] command.
+ */
+static Tcl_WideInt nHeapByte = 0;
+static Tcl_WideInt nHeapPeak = 0;
+
 /*
  *---------------------------------------------------------------------------
  *
@@ -418,6 +426,9 @@ insertMallocHash(zTopic, p, nBytes)
 
     pEntry2 = Tcl_CreateHashEntry(&aAllocationType, p, &isNewEntry);
     Tcl_SetHashValue(pEntry2, pEntry);
+
+    nHeapByte += nBytes;
+    nHeapPeak = (nHeapByte > nHeapPeak) ? nHeapByte : nHeapPeak;
 }
 
 /*
@@ -463,6 +474,8 @@ freeMallocHash(p, nBytes)
         ckfree((char *)aData);
     }
     Tcl_DeleteHashEntry(pEntryAllocationType);
+
+    nHeapByte -= nBytes;
 }
 
 /*
@@ -470,7 +483,7 @@ freeMallocHash(p, nBytes)
  *
  * HtmlHeapDebug --
  *
- *         ::tkhtml::heapdebug
+ *         ::tkhtml::heapdebug ?-peak?
  *
  *     This Tcl command reports on the currently outstanding heap memory
  *     allocations made by the Html widget code. A Tcl list is returned
@@ -487,6 +500,12 @@ freeMallocHash(p, nBytes)
  *     indicates that 4 HtmlComputedValues structures are allocated for
  *     a total of 544 bytes.
  *
+ *     If the -peak option is specified, a list of two integers is returned
+ *     instead - the total number of bytes currently allocated and the 
+ *     largest total allocated at any one time since the previous -peak
+ *     command (or since the process started). The high-water mark is then
+ *     reset to the current total. This is used by the benchmark script.
+ *
  * Results:
  *     Always TCL_OK.
  *
@@ -505,6 +524,16 @@ HtmlHeapDebug(clientData, interp, objc, objv)
     Tcl_Obj *pRet = Tcl_NewObj();
     Tcl_HashEntry *pEntry;
     Tcl_HashSearch search;
+
+    if (objc == 2 && 0 == strcmp(Tcl_GetString(objv[1]), "-peak")) {
+        Tcl_ListObjAppendElement(interp, pRet, Tcl_NewWideIntObj(nHeapByte));
+        Tcl_ListObjAppendElement(interp, pRet, Tcl_NewWideIntObj(nHeapPeak));
+        nHeapPeak = nHeapByte;
+        Tcl_SetObjResult(interp, pRet);
+        return TCL_OK;
+    }
+
+    initMallocHash();
     for (
         pEntry = Tcl_FirstHashEntry(&aMalloc, &search);
         pEntry;
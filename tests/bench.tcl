@@ -0,0 +1,332 @@
+#
+# Performance benchmark script for Tkhtml3.
+#
+# Usage:
+#
+#     hwish bench.tcl ?-iterations N? ?-output FILE? ?-cases PATTERN?
+#     tclsh bench.tcl -compare OLD.json NEW.json
+#
+# The first form runs each page in the benchmark corpus through a
+# widget and writes a JSON report to FILE (default stdout). For each
+# case the report contains the median time in microseconds spent in
+# each of the following phases:
+#
+#     create     - The [html] command that creates the widget. This
+#                  includes loading the default stylesheet, which is
+#                  only parsed by the first widget created in the
+#                  interpreter (see "Shared stylesheets" in css.c).
+#     parse      - The [$html parse -final] command.
+#     style      - The style engine (reported via the -timercmd option).
+#     dynamic    - The dynamic style engine, after setting the :hover
+#                  flag on a number of document nodes.
+#     layout     - The layout engine.
+#     paint      - Repainting damaged regions and scrolling the viewport.
+#
+# the total number of pixels repainted during the paint phase, and the
+# peak number of bytes allocated by the widget while the case was being
+# run. The peak allocation is only available if the package
+# was compiled with HTML_DEBUG defined (so that HtmlAlloc() is
+# Rt_Alloc()). Otherwise it is reported as null.
+#
+# The second form compares two reports produced by the first and prints
+# the relative change in each measurement.
+#
+# This script is run by the "bench" target of the makefile. It requires
+# a display, so if DISPLAY is not set the makefile runs it under
+# xvfb-run.
+#
+
+set ::bench_phases {create parse style dynamic layout paint}
+
+#--------------------------------------------------------------------------
+# Report comparison (-compare). This part does not require Tk.
+#
+proc bench_readreport {zFile} {
+  set fd [open $zFile]
+  set zJson [read $fd]
+  close $fd
+
+  # The report format is fixed (see bench_writereport), so a couple of
+  # regular expressions are enough to parse it.
+  set aRes [dict create]
+  set re {"([A-Za-z0-9_]+)": \{([^\{\}]*)\}}
+  foreach {all zCase zBody} [regexp -all -inline $re $zJson] {
+    foreach {all zKey zVal} [regexp -all -inline {"([a-z_]+)": ([0-9a-z]+)} $zBody] {
+      dict set aRes $zCase $zKey $zVal
+    }
+  }
+  return $aRes
+}
+
+proc bench_compare {zOld zNew} {
+  set aOld [bench_readreport $zOld]
+  set aNew [bench_readreport $zNew]
+  set lKey [list]
+  foreach p $::bench_phases { lappend lKey ${p}_us }
+  lappend lKey paint_pixels peak_bytes
+
+  puts [format "%-20s %-12s %12s %12s %8s" case measure old new change]
+  foreach zCase [dict keys $aNew] {
+    if {![dict exists $aOld $zCase]} continue
+    foreach zKey $lKey {
+      if {![dict exists $aOld $zCase $zKey]} continue
+      if {![dict exists $aNew $zCase $zKey]} continue
+      set iOld [dict get $aOld $zCase $zKey]
+      set iNew [dict get $aNew $zCase $zKey]
+      if {$iOld eq "null" || $iNew eq "null"} continue
+      if {$iOld == 0} {
+        set zChange "-"
+      } else {
+        set zChange [format "%+.1f%%" [expr {100.0*($iNew-$iOld)/$iOld}]]
+      }
+      puts [format "%-20s %-12s %12s %12s %8s" \
+          $zCase $zKey $iOld $iNew $zChange
+      ]
+    }
+  }
+}
+
+if {[lindex $argv 0] eq "-compare"} {
+  if {[llength $argv] != 3} {
+    puts stderr "Usage: $argv0 -compare OLD.json NEW.json"
+    exit 1
+  }
+  bench_compare [lindex $argv 1] [lindex $argv 2]
+  exit 0
+}
+
+#--------------------------------------------------------------------------
+# The benchmark corpus. Each case is a proc that returns an HTML document.
+# Real-world pages are read from the tests/page* directories.
+#
+set ::bench_dir [file dirname [file normalize [info script]]]
+
+proc bench_deep_nesting {} {
+  set n 400
+  set zDoc "<html><body>"
+  for {set ii 0} {$ii < $n} {incr ii} {
+    append zDoc "<div style=\"margin-left:1px\"><span>level $ii</span>"
+  }
+  append zDoc [string repeat "</div>" $n]
+  append zDoc "</body></html>"
+}
+
+proc bench_huge_table {} {
+  set zDoc "<html><body><table border=1>"
+  for {set ii 0} {$ii < 400} {incr ii} {
+    append zDoc "<tr>"
+    for {set jj 0} {$jj < 15} {incr jj} {
+      append zDoc "<td>Cell $ii.$jj with some text</td>"
+    }
+    append zDoc "</tr>"
+  }
+  append zDoc "</table></body></html>"
+}
+
+proc bench_floats {} {
+  set zDoc "<html><body>"
+  for {set ii 0} {$ii < 600} {incr ii} {
+    set zSide [expr {$ii % 2 ? "left" : "right"}]
+    set w [expr {20 + ($ii * 7) % 80}]
+    append zDoc "<div style=\"float:$zSide;width:${w}px;height:20px\"></div>"
+    append zDoc "<p>Paragraph $ii flowing around floating boxes.</p>"
+  }
+  append zDoc "</body></html>"
+}
+
+# A 10000 rule stylesheet. The parse phase of this case measures the
+# cost of building the stylesheet's rule lists, and the style phase the
+# per-node cost of merging them.
+#
+proc bench_large_stylesheet {} {
+  set zDoc "<html><head><style>"
+  for {set ii 0} {$ii < 2500} {incr ii} {
+    append zDoc ".c$ii { color: #[format %06x [expr {$ii * 997}]] }\n"
+    append zDoc "div.c$ii p span { margin-left: [expr {$ii % 7}]px }\n"
+    append zDoc "#id$ii > p:first-child { font-weight: bold }\n"
+    append zDoc "div.c$ii:hover span { text-decoration: underline }\n"
+  }
+  append zDoc "</style></head><body>"
+  for {set ii 0} {$ii < 1000} {incr ii} {
+    append zDoc "<div class=\"c$ii\" id=\"id$ii\"><p><span>Text $ii</span></p></div>"
+  }
+  append zDoc "</body></html>"
+}
+
+proc bench_many_images {} {
+  set zDoc "<html><body>"
+  for {set ii 0} {$ii < 400} {incr ii} {
+    set w [expr {10 + $ii % 50}]
+    append zDoc "<img src=\"synthetic$ii\" width=$w height=20> "
+  }
+  append zDoc "</body></html>"
+}
+
+proc bench_readfile {zFile} {
+  set fd [open $zFile]
+  set zDoc [read $fd]
+  close $fd
+  return $zDoc
+}
+
+proc bench_cases {} {
+  set lCase [list]
+  foreach c {deep_nesting huge_table floats large_stylesheet many_images} {
+    lappend lCase $c [list bench_$c] $::bench_dir
+  }
+  foreach zDir [lsort [glob -nocomplain -directory $::bench_dir page*]] {
+    set zFile [file join $zDir index.html]
+    if {[file exists $zFile]} {
+      lappend lCase [file tail $zDir] [list bench_readfile $zFile] $zDir
+    }
+  }
+  return $lCase
+}
+
+#--------------------------------------------------------------------------
+# Running the benchmark.
+#
+package require Tkhtml
+
+proc bench_timer {zPhase zMicro} {
+  set zPhase [string tolower $zPhase]
+  if {$zPhase eq "repair"} {
+    # Arguments are the number of rectangles and pixels repainted.
+    incr ::bench_pixels [lindex $zMicro 1]
+  } elseif {[info exists ::bench_times($zPhase)]} {
+    incr ::bench_times($zPhase) $zMicro
+  }
+}
+
+# -imagecmd callback. Images that exist in the directory of the current
+# page are loaded from disk. Otherwise a small synthetic image is created.
+#
+proc bench_imagecmd {zUri} {
+  set zFile [file join $::bench_pagedir $zUri]
+  if {[file isfile $zFile] && ![catch {image create photo -file $zFile} img]} {
+    return $img
+  }
+  set img [image create photo -width 16 -height 16]
+  $img put #4060a0 -to 0 0 16 16
+  return $img
+}
+
+proc bench_peak {} {
+  if {[catch {::tkhtml::heapdebug -peak} res] || [lindex $res 1] == 0} {
+    return null
+  }
+  return [lindex $res 1]
+}
+
+proc bench_median {lVal} {
+  set lVal [lsort -integer $lVal]
+  return [lindex $lVal [expr {[llength $lVal] / 2}]]
+}
+
+proc bench_runone {zDoc} {
+  foreach p $::bench_phases { set ::bench_times($p) 0 }
+  set ::bench_pixels 0
+
+  set t [clock microseconds]
+  html .bench -timercmd bench_timer -imagecmd bench_imagecmd \
+      -width 800 -height 600
+  set ::bench_times(create) [expr {[clock microseconds] - $t}]
+  pack .bench -fill both -expand true
+  update
+
+  catch {::tkhtml::heapdebug -peak}
+
+  set t [clock microseconds]
+  .bench parse -final $zDoc
+  set ::bench_times(parse) [expr {[clock microseconds] - $t}]
+  update
+
+  # Set the :hover flag on up to 50 nodes to exercise the dynamic
+  # style engine. Time spent restyling, relayout and repainting as
+  # a result is attributed to the style, layout and paint phases.
+  set lNode [lrange [.bench search *] 0 49]
+  foreach node $lNode {
+    $node dynamic set hover
+  }
+  update
+
+  set peak [bench_peak]
+  destroy .bench
+
+  set ret [list]
+  foreach p $::bench_phases { lappend ret $::bench_times($p) }
+  lappend ret $::bench_pixels $peak
+}
+
+proc bench_writereport {fd aResult nIter} {
+  puts $fd "{"
+  puts $fd "  \"tkhtml\": \"[package provide Tkhtml]\","
+  puts $fd "  \"iterations\": $nIter,"
+  puts $fd "  \"cases\": \{"
+  set lCase [dict keys $aResult]
+  foreach zCase $lCase {
+    set lField [list]
+    dict for {k v} [dict get $aResult $zCase] {
+      lappend lField "\"$k\": $v"
+    }
+    set zSep [expr {$zCase eq [lindex $lCase end] ? "" : ","}]
+    puts $fd "    \"$zCase\": \{[join $lField {, }]\}$zSep"
+  }
+  puts $fd "  \}"
+  puts $fd "}"
+}
+
+proc bench_main {argv} {
+  set nIter 5
+  set zOutput ""
+  set zPattern *
+  foreach {zOpt zArg} $argv {
+    switch -- $zOpt {
+      -iterations { set nIter $zArg }
+      -output     { set zOutput $zArg }
+      -cases      { set zPattern $zArg }
+      default {
+        puts stderr "Usage: $::argv0 ?-iterations N? ?-output FILE? ?-cases PATTERN?"
+        exit 1
+      }
+    }
+  }
+
+  set aResult [dict create]
+  foreach {zCase zScript zDir} [bench_cases] {
+    if {![string match $zPattern $zCase]} continue
+    set ::bench_pagedir $zDir
+    set zDoc [eval $zScript]
+
+    foreach p $::bench_phases { set aTime($p) [list] }
+    set lPixel [list]
+    set lPeak [list]
+    for {set ii 0} {$ii < $nIter} {incr ii} {
+      set res [bench_runone $zDoc]
+      foreach p $::bench_phases v [lrange $res 0 end-2] {
+        lappend aTime($p) $v
+      }
+      lappend lPixel [lindex $res end-1]
+      lappend lPeak [lindex $res end]
+    }
+
+    foreach p $::bench_phases {
+      dict set aResult $zCase ${p}_us [bench_median $aTime($p)]
+    }
+    dict set aResult $zCase paint_pixels [bench_median $lPixel]
+    set peak [lindex $lPeak 0]
+    if {$peak ne "null"} { set peak [bench_median $lPeak] }
+    dict set aResult $zCase peak_bytes $peak
+  }
+
+  if {$zOutput eq ""} {
+    bench_writereport stdout $aResult $nIter
+  } else {
+    set fd [open $zOutput w]
+    bench_writereport $fd $aResult $nIter
+    close $fd
+  }
+}
+
+bench_main $argv
+exit 0